@@ -28,6 +28,7 @@
 #include "xenia/base/profiling.h"
 #include "xenia/base/system.h"
 #include "xenia/base/threading.h"
+#include "xenia/cpu/compiler/compiler_statistics.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/emulator.h"
 #include "xenia/gpu/command_processor.h"
@@ -609,6 +610,9 @@ bool EmulatorWindow::Initialize() {
     cpu_menu->AddChild(MenuItem::Create(MenuItem::Type::kString,
                                         "&Pause/Resume Profiler", "`",
                                         []() { Profiler::TogglePause(); }));
+    cpu_menu->AddChild(MenuItem::Create(
+        MenuItem::Type::kString, "Dump &Compiler Statistics", "Ctrl+F3",
+        std::bind(&EmulatorWindow::CpuDumpCompilerStatistics, this)));
   }
   cpu_menu->AddChild(MenuItem::Create(MenuItem::Type::kSeparator));
   {
@@ -817,7 +821,11 @@ void EmulatorWindow::OnKeyDown(ui::KeyEvent& e) {
     } break;
 
     case ui::VirtualKey::kF3: {
-      Profiler::ToggleDisplay();
+      if (e.is_ctrl_pressed()) {
+        CpuDumpCompilerStatistics();
+      } else {
+        Profiler::ToggleDisplay();
+      }
     } break;
 
     case ui::VirtualKey::kF4: {
@@ -1179,6 +1187,14 @@ void EmulatorWindow::CpuBreakIntoDebugger() {
 
 void EmulatorWindow::CpuBreakIntoHostDebugger() { xe::debugging::Break(); }
 
+void EmulatorWindow::CpuDumpCompilerStatistics() {
+  if (!cpu::compiler::CompilerStatistics::is_enabled()) {
+    XELOGW("Compiler statistics aren't gathered without --compiler_statistics");
+    return;
+  }
+  cpu::compiler::CompilerStatistics::DumpIfEnabled();
+}
+
 void EmulatorWindow::GpuTraceFrame() {
   emulator()->graphics_system()->RequestFrameTrace();
 }
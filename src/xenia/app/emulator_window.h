@@ -214,6 +214,7 @@ class EmulatorWindow {
   void CpuTimeScalarSetDouble();
   void CpuBreakIntoDebugger();
   void CpuBreakIntoHostDebugger();
+  void CpuDumpCompilerStatistics();
   void GpuTraceFrame();
   void GpuClearCaches();
   void ToggleDisplayConfigDialog();
@@ -66,6 +66,7 @@ void* Arena::Alloc(size_t size, size_t align) {
         assert_true(size + get_padding() < chunk_size_,
                     "need to support larger chunks");
         next = new Chunk(chunk_size_);
+        ++chunk_allocation_count_;
         active_chunk_->next = next;
       }
       next->offset = 0;
@@ -73,6 +74,7 @@ void* Arena::Alloc(size_t size, size_t align) {
     }
   } else {
     head_chunk_ = active_chunk_ = new Chunk(chunk_size_);
+    ++chunk_allocation_count_;
   }
 
   active_chunk_->offset += get_padding();
@@ -37,6 +37,10 @@ class Arena {
   // allocation will be leaked
   void Rewind(size_t size);
 
+  // Chunks allocated from the heap so far, which stops growing once the arena
+  // is large enough for its largest use between resets.
+  size_t chunk_allocation_count() const { return chunk_allocation_count_; }
+
   void* CloneContents();
   template <typename T>
   void CloneContents(std::vector<T>* buffer) {
@@ -63,6 +67,7 @@ class Arena {
   size_t chunk_size_;
   Chunk* head_chunk_;
   Chunk* active_chunk_;
+  size_t chunk_allocation_count_ = 0;
 };
 
 }  // namespace xe
@@ -11,10 +11,12 @@
 #define XENIA_CPU_BACKEND_ASSEMBLER_H_
 
 #include <memory>
+#include <vector>
+
+#include "xenia/cpu/function_debug_info.h"
 
 namespace xe {
 namespace cpu {
-class FunctionDebugInfo;
 class GuestFunction;
 namespace hir {
 class HIRBuilder;
@@ -37,9 +39,15 @@ class Assembler {
 
   virtual void Reset();
 
-  virtual bool Assemble(GuestFunction* function, hir::HIRBuilder* builder,
-                        uint32_t debug_info_flags,
-                        std::unique_ptr<FunctionDebugInfo> debug_info) = 0;
+  // Fails without publishing anything if the guest code was written to after
+  // code_generation was read (see GuestFunction::code_generation).
+  // inlined_calls are published with the code, see
+  // GuestFunction::inlined_calls.
+  virtual bool Assemble(
+      GuestFunction* function, hir::HIRBuilder* builder,
+      uint32_t debug_info_flags, std::unique_ptr<FunctionDebugInfo> debug_info,
+      const std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls,
+      uint32_t code_generation) = 0;
 
  protected:
   Backend* backend_;
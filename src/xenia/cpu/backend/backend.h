@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_BACKEND_BACKEND_H_
 #define XENIA_CPU_BACKEND_BACKEND_H_
 
+#include <filesystem>
 #include <memory>
 
 #include "xenia/cpu/backend/machine_info.h"
@@ -83,6 +84,10 @@ class Backend {
   */
   virtual void DeinitializeBackendContext(void* ctx) {}
   virtual void SetGuestRoundingMode(void* ctx, unsigned int mode){};
+  // VSCR[NJ], whether vector float math flushes denormals to zero, for code
+  // that runs outside of the backend's own machine code.
+  virtual void SetGuestNonJavaMode(void* ctx, bool enabled) {}
+  virtual bool GetGuestNonJavaMode(void* ctx) { return true; }
   /*
         called by KeSetCurrentStackPointers in xboxkrnl_threading.cc just prior
   to calling XThread::Reenter this is an opportunity for a backend to clear any
@@ -93,6 +98,9 @@ class Backend {
 
   * */
   virtual void PrepareForReentry(void* ctx) {}
+  // Called when the guest thread exits, possibly without returning from the
+  // guest code it's running.
+  virtual void OnThreadExit(void* ctx) {}
 
   // returns true if populated st
   virtual bool PopulatePseudoStacktrace(GuestPseudoStackTrace* st) {
@@ -119,6 +127,29 @@ class Backend {
   }
   virtual void FreeGuestTrampoline(uint32_t trampoline_addr) {}
 
+  // Opens storage for code translated from [guest_low, guest_high) of a
+  // module, so that later sessions can reuse it instead of translating again.
+  // storage_root is a directory unique to the module image.
+  virtual bool InitializeCodeStorage(const std::filesystem::path& storage_root,
+                                     uint64_t module_hash, uint32_t guest_low,
+                                     uint32_t guest_high) {
+    return false;
+  }
+  // Sets up the function from code stored by a previous session, if any and
+  // the guest code wasn't written to since code_generation.
+  virtual bool RestoreGuestFunction(GuestFunction* function,
+                                    uint32_t code_generation) {
+    return false;
+  }
+  // Drops everything that refers to the code of a removed function, so calls
+  // to it resolve it again.
+  virtual void InvalidateGuestFunction(uint32_t guest_address) {}
+  // Called after InvalidateGuestFunction when the guest code of the function
+  // was modified, before it's translated again: nothing derived from the old
+  // guest code may be reused for the new translation. The old machine code may
+  // still be running.
+  virtual void DiscardGuestFunction(GuestFunction* function) {}
+
  protected:
   Processor* processor_ = nullptr;
   MachineInfo machine_info_;
@@ -0,0 +1,1793 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/backend/interpreter/interpreter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfenv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/debugging.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/threading.h"
+#include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/hir/opcodes.h"
+#include "xenia/cpu/hir/value.h"
+#include "xenia/cpu/mmio_handler.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/thread_state.h"
+#include "xenia/memory.h"
+
+#if XE_ARCH_AMD64
+#include <xmmintrin.h>
+#endif  // XE_ARCH_AMD64
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace interpreter {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+namespace {
+
+// Registers of all interpreted frames on a thread, in chunks so that frames
+// never move while deeper calls grow the stack.
+class RegisterStack {
+ public:
+  static constexpr uint32_t kChunkRegisterCount = 16384;
+
+  vec128_t* Push(uint32_t count, size_t* chunk_index_out,
+                 size_t* previous_chunk_index_out) {
+    size_t chunk_index = current_chunk_;
+    while (chunk_index < chunks_.size() &&
+           chunks_[chunk_index].capacity - chunks_[chunk_index].used < count) {
+      ++chunk_index;
+    }
+    if (chunk_index == chunks_.size()) {
+      Chunk chunk;
+      chunk.capacity = std::max(kChunkRegisterCount, count);
+      chunk.used = 0;
+      chunk.registers.reset(new vec128_t[chunk.capacity]);
+      chunks_.push_back(std::move(chunk));
+    }
+    auto& chunk = chunks_[chunk_index];
+    vec128_t* registers = chunk.registers.get() + chunk.used;
+    chunk.used += count;
+    *chunk_index_out = chunk_index;
+    *previous_chunk_index_out = current_chunk_;
+    current_chunk_ = chunk_index;
+    return registers;
+  }
+
+  void Pop(size_t chunk_index, size_t previous_chunk_index, uint32_t count) {
+    chunks_[chunk_index].used -= count;
+    current_chunk_ = previous_chunk_index;
+  }
+
+ private:
+  struct Chunk {
+    std::unique_ptr<vec128_t[]> registers;
+    uint32_t capacity;
+    uint32_t used;
+  };
+  std::vector<Chunk> chunks_;
+  size_t current_chunk_ = 0;
+};
+
+thread_local RegisterStack register_stack_;
+
+class RegisterFrame {
+ public:
+  explicit RegisterFrame(uint32_t count) : count_(count) {
+    registers_ = register_stack_.Push(count, &chunk_index_,
+                                      &previous_chunk_index_);
+  }
+  ~RegisterFrame() {
+    register_stack_.Pop(chunk_index_, previous_chunk_index_, count_);
+  }
+
+  vec128_t* registers() const { return registers_; }
+
+ private:
+  vec128_t* registers_;
+  uint32_t count_;
+  size_t chunk_index_;
+  size_t previous_chunk_index_;
+};
+
+// lwarx/ldarx reservation of the thread, checked by stwcx/stdcx.
+struct Reservation {
+  uint32_t address;
+  uint64_t value;
+  bool valid;
+};
+thread_local Reservation reservation_ = {};
+
+// Vector float math always rounds to the nearest, whatever the FPSCR says,
+// and denormals are flushed in software when VSCR[NJ] is set, so the host
+// flush modes are turned off meanwhile.
+class VmxScope {
+ public:
+  VmxScope() {
+#if XE_ARCH_AMD64
+    saved_mode_ = _mm_getcsr();
+    _mm_setcsr(_MM_MASK_MASK);
+#else
+    saved_mode_ = std::fegetround();
+    std::fesetround(FE_TONEAREST);
+#endif  // XE_ARCH_AMD64
+  }
+  ~VmxScope() {
+#if XE_ARCH_AMD64
+    _mm_setcsr(saved_mode_);
+#else
+    std::fesetround(saved_mode_);
+#endif  // XE_ARCH_AMD64
+  }
+
+ private:
+#if XE_ARCH_AMD64
+  uint32_t saved_mode_;
+#else
+  int saved_mode_;
+#endif  // XE_ARCH_AMD64
+};
+
+template <typename T>
+T Get(const vec128_t* registers, uint32_t reg) {
+  T value;
+  std::memcpy(&value, &registers[reg], sizeof(T));
+  return value;
+}
+
+template <typename T>
+void Set(vec128_t* registers, uint32_t reg, T value) {
+  std::memcpy(&registers[reg], &value, sizeof(T));
+}
+
+uint64_t GetInt(const vec128_t* registers, uint32_t reg, uint8_t type) {
+  switch (type) {
+    case INT8_TYPE:
+      return Get<uint8_t>(registers, reg);
+    case INT16_TYPE:
+      return Get<uint16_t>(registers, reg);
+    case INT32_TYPE:
+    case FLOAT32_TYPE:
+      return Get<uint32_t>(registers, reg);
+    default:
+      return Get<uint64_t>(registers, reg);
+  }
+}
+
+int64_t GetSignedInt(const vec128_t* registers, uint32_t reg, uint8_t type) {
+  switch (type) {
+    case INT8_TYPE:
+      return Get<int8_t>(registers, reg);
+    case INT16_TYPE:
+      return Get<int16_t>(registers, reg);
+    case INT32_TYPE:
+      return Get<int32_t>(registers, reg);
+    default:
+      return Get<int64_t>(registers, reg);
+  }
+}
+
+void SetInt(vec128_t* registers, uint32_t reg, uint8_t type, uint64_t value) {
+  switch (type) {
+    case INT8_TYPE:
+      Set(registers, reg, uint8_t(value));
+      break;
+    case INT16_TYPE:
+      Set(registers, reg, uint16_t(value));
+      break;
+    case INT32_TYPE:
+      Set(registers, reg, uint32_t(value));
+      break;
+    default:
+      Set(registers, reg, value);
+      break;
+  }
+}
+
+double GetFloat(const vec128_t* registers, uint32_t reg, uint8_t type) {
+  return type == FLOAT32_TYPE ? double(Get<float>(registers, reg))
+                              : Get<double>(registers, reg);
+}
+
+void SetFloat(vec128_t* registers, uint32_t reg, uint8_t type, double value) {
+  if (type == FLOAT32_TYPE) {
+    Set(registers, reg, float(value));
+  } else {
+    Set(registers, reg, value);
+  }
+}
+
+uint32_t TypeBits(uint8_t type) {
+  return uint32_t(GetTypeSize(TypeName(type))) * 8;
+}
+
+bool IsTrue(const vec128_t* registers, uint32_t reg, uint8_t type) {
+  if (type == VEC128_TYPE) {
+    const vec128_t& value = registers[reg];
+    return (value.u64[0] | value.u64[1]) != 0;
+  }
+  return GetInt(registers, reg, type) != 0;
+}
+
+float AsFloat(uint32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+uint32_t AsBits(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+float FlushDenormal(bool njm, float value) {
+  if (!njm) {
+    return value;
+  }
+  uint32_t bits = AsBits(value);
+  if (!(bits & 0x7F800000)) {
+    bits &= 0x80000000;
+  }
+  return AsFloat(bits);
+}
+
+template <typename F>
+vec128_t MapF32(bool njm, const vec128_t& a, F f) {
+  VmxScope vmx_scope;
+  vec128_t result;
+  for (int i = 0; i < 4; ++i) {
+    result.f32[i] = FlushDenormal(njm, f(FlushDenormal(njm, a.f32[i])));
+  }
+  return result;
+}
+
+template <typename F>
+vec128_t MapF32(bool njm, const vec128_t& a, const vec128_t& b, F f) {
+  VmxScope vmx_scope;
+  vec128_t result;
+  for (int i = 0; i < 4; ++i) {
+    result.f32[i] = FlushDenormal(
+        njm, f(FlushDenormal(njm, a.f32[i]), FlushDenormal(njm, b.f32[i])));
+  }
+  return result;
+}
+
+template <typename F>
+vec128_t MapF32(bool njm, const vec128_t& a, const vec128_t& b,
+                const vec128_t& c, F f) {
+  VmxScope vmx_scope;
+  vec128_t result;
+  for (int i = 0; i < 4; ++i) {
+    result.f32[i] = FlushDenormal(
+        njm, f(FlushDenormal(njm, a.f32[i]), FlushDenormal(njm, b.f32[i]),
+               FlushDenormal(njm, c.f32[i])));
+  }
+  return result;
+}
+
+// Runs f on each element of a part type, with the elements zero-extended.
+template <typename F>
+vec128_t MapInt(uint32_t part_type, const vec128_t& a, const vec128_t& b,
+                F f) {
+  vec128_t result;
+  switch (part_type) {
+    case INT8_TYPE:
+      for (int i = 0; i < 16; ++i) {
+        result.u8[i] = uint8_t(f(a.u8[i], b.u8[i], 8));
+      }
+      break;
+    case INT16_TYPE:
+      for (int i = 0; i < 8; ++i) {
+        result.u16[i] = uint16_t(f(a.u16[i], b.u16[i], 16));
+      }
+      break;
+    case INT32_TYPE:
+      for (int i = 0; i < 4; ++i) {
+        result.u32[i] = uint32_t(f(a.u32[i], b.u32[i], 32));
+      }
+      break;
+    default:
+      assert_unhandled_case(part_type);
+      result = a;
+      break;
+  }
+  return result;
+}
+
+int64_t SignExtend(uint64_t value, uint32_t bits) {
+  return int64_t(value << (64 - bits)) >> (64 - bits);
+}
+
+uint64_t Saturate(int64_t value, uint32_t bits, bool is_unsigned) {
+  int64_t min_value = is_unsigned ? 0 : -(int64_t(1) << (bits - 1));
+  int64_t max_value =
+      is_unsigned ? (int64_t(1) << bits) - 1 : (int64_t(1) << (bits - 1)) - 1;
+  return uint64_t(std::min(std::max(value, min_value), max_value));
+}
+
+uint64_t MultiplyHigh(uint64_t a, uint64_t b) {
+  uint64_t a_lo = uint32_t(a), a_hi = a >> 32;
+  uint64_t b_lo = uint32_t(b), b_hi = b >> 32;
+  uint64_t lo_lo = a_lo * b_lo;
+  uint64_t hi_lo = a_hi * b_lo;
+  uint64_t lo_hi = a_lo * b_hi;
+  uint64_t hi_hi = a_hi * b_hi;
+  uint64_t cross = (lo_lo >> 32) + uint32_t(hi_lo) + lo_hi;
+  return hi_hi + (hi_lo >> 32) + (cross >> 32);
+}
+
+int64_t SignedMultiplyHigh(int64_t a, int64_t b) {
+  uint64_t high = MultiplyHigh(uint64_t(a), uint64_t(b));
+  if (a < 0) {
+    high -= uint64_t(b);
+  }
+  if (b < 0) {
+    high -= uint64_t(a);
+  }
+  return int64_t(high);
+}
+
+template <typename T>
+T RoundToNearestEven(T value) {
+  // Values this large are integers already.
+  T integer_threshold = T(std::numeric_limits<T>::digits > 24
+                              ? 4503599627370496.0
+                              : 8388608.0);
+  if (!std::isfinite(value) || std::abs(value) >= integer_threshold) {
+    return value;
+  }
+  return std::copysign(value - std::remainder(value, T(1)), value);
+}
+
+template <typename T>
+T Round(T value, uint32_t round_mode) {
+  switch (round_mode) {
+    case ROUND_TO_ZERO:
+      return std::trunc(value);
+    case ROUND_TO_NEAREST:
+      return RoundToNearestEven(value);
+    case ROUND_TO_MINUS_INFINITY:
+      return std::floor(value);
+    case ROUND_TO_POSITIVE_INFINITY:
+      return std::ceil(value);
+    default:
+      return std::nearbyint(value);
+  }
+}
+
+// Same as cvt(t)sd2si, returning the integer indefinite value for NaN and
+// values out of range.
+int64_t ConvertToInt(double value, uint32_t bits, uint32_t round_mode) {
+  double rounded =
+      round_mode == ROUND_TO_ZERO ? std::trunc(value) : std::nearbyint(value);
+  double limit = bits == 64 ? 9223372036854775808.0 : 2147483648.0;
+  if (!(rounded >= -limit && rounded < limit)) {
+    return bits == 64 ? INT64_MIN : INT32_MIN;
+  }
+  return int64_t(rounded);
+}
+
+// Bitwise maxps(a, b) & maxps(b, a) and minps(a, b) | minps(b, a), as the JIT
+// does, so NaN and signed zero results match it.
+vec128_t MaxV128(const vec128_t& a, const vec128_t& b) {
+  vec128_t result;
+  for (int i = 0; i < 4; ++i) {
+    uint32_t ab = a.f32[i] > b.f32[i] ? a.u32[i] : b.u32[i];
+    uint32_t ba = b.f32[i] > a.f32[i] ? b.u32[i] : a.u32[i];
+    result.u32[i] = ab & ba;
+  }
+  return result;
+}
+
+vec128_t MinV128(const vec128_t& a, const vec128_t& b) {
+  vec128_t result;
+  for (int i = 0; i < 4; ++i) {
+    uint32_t ab = a.f32[i] < b.f32[i] ? a.u32[i] : b.u32[i];
+    uint32_t ba = b.f32[i] < a.f32[i] ? b.u32[i] : a.u32[i];
+    result.u32[i] = ab | ba;
+  }
+  return result;
+}
+
+// maxps and minps, returning the second source for NaN.
+vec128_t MaxPs(const vec128_t& a, const vec128_t& b) {
+  vec128_t result;
+  for (int i = 0; i < 4; ++i) {
+    result.u32[i] = a.f32[i] > b.f32[i] ? a.u32[i] : b.u32[i];
+  }
+  return result;
+}
+
+vec128_t MinPs(const vec128_t& a, const vec128_t& b) {
+  vec128_t result;
+  for (int i = 0; i < 4; ++i) {
+    result.u32[i] = a.f32[i] < b.f32[i] ? a.u32[i] : b.u32[i];
+  }
+  return result;
+}
+
+vec128_t Pshufb(const vec128_t& src, const vec128_t& control) {
+  vec128_t result;
+  for (int i = 0; i < 16; ++i) {
+    result.u8[i] = control.u8[i] & 0x80 ? 0 : src.u8[control.u8[i] & 0xF];
+  }
+  return result;
+}
+
+vec128_t ByteSwapV128(const vec128_t& value) {
+  vec128_t result;
+  for (int i = 0; i < 4; ++i) {
+    result.u32[i] = xe::byte_swap(value.u32[i]);
+  }
+  return result;
+}
+
+uint64_t ByteSwap(uint64_t value, uint8_t type) {
+  switch (type) {
+    case INT16_TYPE:
+      return xe::byte_swap(uint16_t(value));
+    case INT32_TYPE:
+    case FLOAT32_TYPE:
+      return xe::byte_swap(uint32_t(value));
+    case INT64_TYPE:
+    case FLOAT64_TYPE:
+      return xe::byte_swap(value);
+    default:
+      return value;
+  }
+}
+
+float DotProduct(bool njm, const vec128_t& a, const vec128_t& b,
+                 bool four_elements) {
+  VmxScope vmx_scope;
+  double products[4];
+  for (int i = 0; i < 4; ++i) {
+    products[i] = double(FlushDenormal(njm, a.f32[i])) *
+                  double(FlushDenormal(njm, b.f32[i]));
+  }
+  double sum = four_elements
+                   ? (products[0] + products[2]) + (products[1] + products[3])
+                   : (products[0] + products[2]) + products[1];
+  float result = float(sum);
+  // Overflow produces QNaN instead of infinity, as vmsum3fp128 does.
+  if (std::isinf(result) && std::isfinite(sum)) {
+    return AsFloat(0x7FC00000);
+  }
+  return FlushDenormal(njm, result);
+}
+
+vec128_t Pack(uint32_t flags, const vec128_t& src1, const vec128_t& src2) {
+  vec128_t result = vec128i(0);
+  switch (flags & PACK_TYPE_MODE) {
+    case PACK_TYPE_D3DCOLOR: {
+      vec128_t clamped = MinPs(MaxPs(src1, vec128f(3.0f)),
+                               vec128i(0x404000FF));
+      result = Pshufb(clamped,
+                      vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x0C000408));
+    } break;
+    case PACK_TYPE_FLOAT16_2:
+      for (int i = 0; i < 2; ++i) {
+        result.u16[7 - i] = xe::float_to_xenos_half(src1.f32[i]);
+      }
+      break;
+    case PACK_TYPE_FLOAT16_4:
+      for (int i = 0; i < 4; ++i) {
+        result.u16[7 - (i ^ 2)] = xe::float_to_xenos_half(src1.f32[i]);
+      }
+      break;
+    case PACK_TYPE_SHORT_2:
+    case PACK_TYPE_SHORT_4: {
+      vec128_t clamped = MinPs(MaxPs(src1, vec128i(0x403F8001)),
+                               vec128i(0x40407FFF));
+      result = Pshufb(clamped,
+                      (flags & PACK_TYPE_MODE) == PACK_TYPE_SHORT_2
+                          ? vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+                                    0x01000504)
+                          : vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0x01000504,
+                                    0x09080D0C));
+    } break;
+    case PACK_TYPE_UINT_2101010: {
+      vec128_t clamped = MinPs(
+          MaxPs(src1,
+                vec128i(0x403FFE01, 0x403FFE01, 0x403FFE01, 0x40400000)),
+          vec128i(0x404001FF, 0x404001FF, 0x404001FF, 0x40400003));
+      static const uint32_t masks[] = {0x3FF, 0x3FF, 0x3FF, 0x3};
+      uint32_t packed = 0;
+      for (int i = 0; i < 4; ++i) {
+        packed |= (clamped.u32[i] & masks[i]) << (i * 10);
+      }
+      result = vec128i(packed);
+    } break;
+    case PACK_TYPE_ULONG_4202020: {
+      vec128_t clamped = MinPs(
+          MaxPs(src1,
+                vec128i(0x40380001, 0x40380001, 0x40380001, 0x40400000)),
+          vec128i(0x4047FFFF, 0x4047FFFF, 0x4047FFFF, 0x4040000F));
+      static const uint32_t masks[] = {0xFFFFF, 0xFFFFF, 0xFFFFF, 0xF};
+      vec128_t shifted;
+      for (int i = 0; i < 4; ++i) {
+        clamped.u32[i] &= masks[i];
+        shifted.u32[i] = clamped.u32[i] << 4;
+      }
+      vec128_t low = Pshufb(
+          clamped, vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0x0A0908FF, 0xFF020100));
+      vec128_t high = Pshufb(
+          shifted, vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0x0CFFFF06, 0x0504FFFF));
+      result.u64[0] = low.u64[0] | high.u64[0];
+      result.u64[1] = low.u64[1] | high.u64[1];
+    } break;
+    case PACK_TYPE_8_IN_16:
+    case PACK_TYPE_16_IN_32: {
+      bool in_unsigned = IsPackInUnsigned(flags);
+      bool out_unsigned = IsPackOutUnsigned(flags);
+      bool saturate = IsPackOutSaturate(flags);
+      assert_true(saturate || (in_unsigned && out_unsigned));
+      bool eight_in_16 = (flags & PACK_TYPE_MODE) == PACK_TYPE_8_IN_16;
+      uint32_t in_bits = eight_in_16 ? 16 : 32;
+      uint32_t count = eight_in_16 ? 16 : 8;
+      for (uint32_t k = 0; k < count; ++k) {
+        const vec128_t& src = k < count / 2 ? src1 : src2;
+        uint64_t value = eight_in_16 ? src.u16[k & 7] : src.u32[k & 3];
+        int64_t element;
+        if (in_unsigned) {
+          element = int64_t(value);
+          if (!saturate) {
+            element = int64_t(value & ((uint64_t(1) << (in_bits / 2)) - 1));
+          }
+        } else {
+          element = SignExtend(value, in_bits);
+        }
+        if (saturate) {
+          element = int64_t(Saturate(element, in_bits / 2, out_unsigned));
+        }
+        if (eight_in_16) {
+          result.u8[k ^ 2] = uint8_t(element);
+        } else {
+          result.u16[k ^ 1] = uint16_t(element);
+        }
+      }
+    } break;
+    default:
+      assert_unhandled_case(flags & PACK_TYPE_MODE);
+      break;
+  }
+  return result;
+}
+
+// Adds 3.0 (or 1.0) as an integer, so the value ends up in the mantissa, and
+// replaces the smallest value, which the guest treats as invalid, with QNaN.
+vec128_t UnpackNormalized(vec128_t value, const uint32_t (&bias)[4],
+                          uint32_t overflow) {
+  for (int i = 0; i < 4; ++i) {
+    value.u32[i] += bias[i];
+    if (value.u32[i] == overflow) {
+      value.u32[i] = 0x7FC00000;
+    }
+  }
+  return value;
+}
+
+vec128_t Unpack(uint32_t flags, const vec128_t& src) {
+  vec128_t result = vec128i(0);
+  switch (flags & PACK_TYPE_MODE) {
+    case PACK_TYPE_D3DCOLOR: {
+      static const int bytes[] = {14, 13, 12, 15};
+      for (int i = 0; i < 4; ++i) {
+        result.u32[i] = 0x3F800000 | src.u8[bytes[i]];
+      }
+    } break;
+    case PACK_TYPE_FLOAT16_2:
+      for (int i = 0; i < 2; ++i) {
+        result.f32[i] = xe::xenos_half_to_float(src.u16[(6 + i) ^ 1]);
+      }
+      result.f32[2] = 0.0f;
+      result.f32[3] = 1.0f;
+      break;
+    case PACK_TYPE_FLOAT16_4:
+      for (int i = 0; i < 4; ++i) {
+        result.f32[i] = xe::xenos_half_to_float(src.u16[(4 + i) ^ 1]);
+      }
+      break;
+    case PACK_TYPE_SHORT_2: {
+      result.i32[0] = src.i16[7];
+      result.i32[1] = src.i16[6];
+      static const uint32_t bias[] = {0x40400000, 0x40400000, 0, 0x3F800000};
+      result = UnpackNormalized(result, bias, 0x403F8000);
+    } break;
+    case PACK_TYPE_SHORT_4: {
+      static const int words[] = {5, 4, 7, 6};
+      for (int i = 0; i < 4; ++i) {
+        result.i32[i] = src.i16[words[i]];
+      }
+      static const uint32_t bias[] = {0x40400000, 0x40400000, 0x40400000,
+                                      0x40400000};
+      result = UnpackNormalized(result, bias, 0x403F8000);
+    } break;
+    case PACK_TYPE_UINT_2101010: {
+      static const uint32_t masks[] = {0x3FF, 0x3FF, 0x3FF, 0x3};
+      for (int i = 0; i < 4; ++i) {
+        uint32_t element = (src.u32[3] >> (i * 10)) & masks[i];
+        result.i32[i] = int32_t(element << 22) >> 22;
+      }
+      static const uint32_t bias[] = {0x40400000, 0x40400000, 0x40400000,
+                                      0x3F800000};
+      result = UnpackNormalized(result, bias, 0x403FFE00);
+    } break;
+    case PACK_TYPE_ULONG_4202020: {
+      uint32_t lanes[4] = {
+          uint32_t(src.u8[12]) | (uint32_t(src.u8[13]) << 8) |
+              (uint32_t(src.u8[14]) << 16),
+          uint32_t(src.u8[9]) | (uint32_t(src.u8[10]) << 8) |
+              (uint32_t(src.u8[11]) << 16),
+          uint32_t(src.u8[14]) | (uint32_t(src.u8[15]) << 8) |
+              (uint32_t(src.u8[8]) << 16),
+          uint32_t(src.u8[11]),
+      };
+      uint32_t elements[] = {lanes[0], lanes[2] >> 4, lanes[1],
+                             lanes[3] >> 4};
+      for (int i = 0; i < 4; ++i) {
+        result.i32[i] = int32_t(elements[i] << 12) >> 12;
+      }
+      static const uint32_t bias[] = {0x40400000, 0x40400000, 0x40400000,
+                                      0x3F800000};
+      result = UnpackNormalized(result, bias, 0x40380000);
+    } break;
+    case PACK_TYPE_8_IN_16:
+      assert_false(IsPackInUnsigned(flags) || IsPackOutUnsigned(flags));
+      for (int k = 0; k < 8; ++k) {
+        result.i16[k] = int8_t(
+            src.u8[IsPackToHi(flags) ? (k ^ 2) : ((8 + k) ^ 2)]);
+      }
+      break;
+    case PACK_TYPE_16_IN_32:
+      assert_false(IsPackInUnsigned(flags) || IsPackOutUnsigned(flags));
+      for (int k = 0; k < 4; ++k) {
+        result.i32[k] =
+            int16_t(src.u16[IsPackToHi(flags) ? (k ^ 1) : (4 + (k ^ 1))]);
+      }
+      break;
+    default:
+      assert_unhandled_case(flags & PACK_TYPE_MODE);
+      break;
+  }
+  return result;
+}
+
+// Guest memory accesses, going through the MMIO handlers for the ranges the
+// JIT reaches through access violations.
+MMIORange* LookupMMIO(ppc::PPCContext* context, uint32_t address,
+                      uint8_t type) {
+  if ((address & 0xFF000000) != 0x7F000000 || TypeBits(type) != 32) {
+    return nullptr;
+  }
+  return context->processor->memory()->LookupVirtualMappedRange(address);
+}
+
+void LoadGuest(ppc::PPCContext* context, uint32_t address, uint8_t type,
+               void* value) {
+  if (auto range = LookupMMIO(context, address, type)) {
+    uint32_t data =
+        range->read(context, range->callback_context, address);
+    std::memcpy(value, &data, sizeof(data));
+    return;
+  }
+  std::memcpy(value, context->TranslateVirtual<uint8_t*>(address),
+              GetTypeSize(TypeName(type)));
+}
+
+void StoreGuest(ppc::PPCContext* context, uint32_t address, uint8_t type,
+                const void* value) {
+  if (auto range = LookupMMIO(context, address, type)) {
+    uint32_t data;
+    std::memcpy(&data, value, sizeof(data));
+    range->write(context, range->callback_context, address, data);
+    return;
+  }
+  std::memcpy(context->TranslateVirtual<uint8_t*>(address), value,
+              GetTypeSize(TypeName(type)));
+}
+
+void Trap(ppc::PPCContext* context, uint16_t trap_type) {
+  switch (trap_type) {
+    case 20:
+    case 26: {
+      // 0x0FE00014 is a 'debug print' where r3 = buffer r4 = length
+      auto str =
+          context->TranslateVirtual<const char*>(uint32_t(context->r[3]));
+      XELOGD("(DebugPrint) {}", str);
+      if (cvars::debugprint_trap_log) {
+        debugging::DebugPrint("(DebugPrint) {}", str);
+      }
+    } break;
+    case 0:
+    case 22:
+      XELOGE("tw/td forced trap hit! This should be a crash!");
+      if (cvars::break_on_debugbreak) {
+        xe::debugging::Break();
+      }
+      break;
+    case 25:
+      // ?
+      break;
+    default:
+      XELOGW("Unknown trap type {}", trap_type);
+      xe::debugging::Break();
+      break;
+  }
+}
+
+void CallExtern(ppc::PPCContext* context, Function* function) {
+  if (function->behavior() == Function::Behavior::kBuiltin) {
+    auto builtin_function = static_cast<BuiltinFunction*>(function);
+    if (builtin_function->handler()) {
+      builtin_function->handler()(context, builtin_function->arg0(),
+                                  builtin_function->arg1());
+      return;
+    }
+  } else if (function->behavior() == Function::Behavior::kExtern) {
+    auto extern_function = static_cast<GuestFunction*>(function);
+    if (extern_function->extern_handler()) {
+      extern_function->extern_handler()(context, context->kernel_state);
+      return;
+    }
+  }
+  if (!cvars::ignore_undefined_externs) {
+    xe::FatalError(fmt::format("undefined extern call to {:08X} {}",
+                               function->address(), function->name().c_str()));
+  } else {
+    XELOGE("undefined extern call to {:08X} {}", function->address(),
+           function->name());
+  }
+}
+
+void CallGuest(ThreadState* thread_state, uint32_t target_address,
+               uint32_t return_address) {
+  Function* function =
+      thread_state->processor()->ResolveFunction(target_address);
+  if (!function) {
+    XELOGE("Interpreter failed to resolve function {:08X}", target_address);
+    assert_always();
+    return;
+  }
+  function->Call(thread_state, return_address);
+}
+
+}  // namespace
+
+void Interpreter::Execute(const InterpreterProgram& program,
+                          ThreadState* thread_state, uint32_t return_address) {
+  ppc::PPCContext* context = thread_state->context();
+  auto context_bytes = reinterpret_cast<uint8_t*>(context);
+  Backend* backend = thread_state->processor()->backend();
+  bool njm = backend->GetGuestNonJavaMode(context);
+
+  RegisterFrame frame(program.register_count());
+  vec128_t* registers = frame.registers();
+  if (!program.constants.empty()) {
+    std::memcpy(registers + program.value_register_count,
+                program.constants.data(),
+                program.constants.size() * sizeof(vec128_t));
+  }
+  uint32_t call_return_address = 0;
+
+  const InterpreterInstr* instrs = program.instrs.data();
+  size_t pc = 0;
+  while (pc < program.instrs.size()) {
+    const InterpreterInstr& i = instrs[pc++];
+    const uint32_t dest = i.dest;
+    const uint32_t src1 = i.src[0].reg;
+    const uint32_t src2 = i.src[1].reg;
+    const uint32_t src3 = i.src[2].reg;
+    const uint8_t type = i.dest_type;
+    switch (Opcode(i.opcode)) {
+      case OPCODE_COMMENT:
+      case OPCODE_NOP:
+      case OPCODE_SOURCE_OFFSET:
+      case OPCODE_CONTEXT_BARRIER:
+      case OPCODE_CACHE_CONTROL:
+        break;
+
+      case OPCODE_DEBUG_BREAK:
+        xe::debugging::Break();
+        break;
+      case OPCODE_DEBUG_BREAK_TRUE:
+        if (IsTrue(registers, src1, i.src_types[0])) {
+          xe::debugging::Break();
+        }
+        break;
+      case OPCODE_TRAP:
+        Trap(context, i.flags);
+        break;
+      case OPCODE_TRAP_TRUE:
+        if (IsTrue(registers, src1, i.src_types[0])) {
+          Trap(context, i.flags);
+        }
+        break;
+
+      case OPCODE_CALL:
+      case OPCODE_CALL_TRUE:
+      case OPCODE_CALL_INDIRECT:
+      case OPCODE_CALL_INDIRECT_TRUE: {
+        bool is_conditional = i.opcode == OPCODE_CALL_TRUE ||
+                              i.opcode == OPCODE_CALL_INDIRECT_TRUE;
+        if (is_conditional && !IsTrue(registers, src1, i.src_types[0])) {
+          break;
+        }
+        const auto& target = i.src[is_conditional ? 1 : 0];
+        uint32_t target_address;
+        if (i.opcode == OPCODE_CALL || i.opcode == OPCODE_CALL_TRUE) {
+          target_address = target.symbol->address();
+        } else {
+          target_address = Get<uint32_t>(registers, target.reg);
+          // Returning through bctr.
+          if (i.flags & CALL_POSSIBLE_RETURN &&
+              target_address == return_address) {
+            return;
+          }
+        }
+        bool is_tail = (i.flags & CALL_TAIL) != 0;
+        CallGuest(thread_state, target_address,
+                  is_tail ? return_address : call_return_address);
+        if (is_tail) {
+          return;
+        }
+        njm = backend->GetGuestNonJavaMode(context);
+      } break;
+      case OPCODE_CALL_EXTERN:
+        CallExtern(context, i.src[0].symbol);
+        njm = backend->GetGuestNonJavaMode(context);
+        break;
+      case OPCODE_RETURN:
+        return;
+      case OPCODE_RETURN_TRUE:
+        if (IsTrue(registers, src1, i.src_types[0])) {
+          return;
+        }
+        break;
+      case OPCODE_SET_RETURN_ADDRESS:
+        call_return_address = uint32_t(i.src[0].offset);
+        break;
+
+      case OPCODE_BRANCH:
+        pc = i.src[0].target;
+        break;
+      case OPCODE_BRANCH_TRUE:
+        if (IsTrue(registers, src1, i.src_types[0])) {
+          pc = i.src[1].target;
+        }
+        break;
+      case OPCODE_BRANCH_FALSE:
+        if (!IsTrue(registers, src1, i.src_types[0])) {
+          pc = i.src[1].target;
+        }
+        break;
+
+      case OPCODE_ASSIGN:
+      case OPCODE_CAST:
+        registers[dest] = registers[src1];
+        break;
+      case OPCODE_ZERO_EXTEND:
+      case OPCODE_TRUNCATE:
+        SetInt(registers, dest, type,
+               GetInt(registers, src1, i.src_types[0]));
+        break;
+      case OPCODE_SIGN_EXTEND:
+        SetInt(registers, dest, type,
+               uint64_t(GetSignedInt(registers, src1, i.src_types[0])));
+        break;
+      case OPCODE_CONVERT: {
+        uint8_t src_type = i.src_types[0];
+        if (type <= INT64_TYPE) {
+          double value = GetFloat(registers, src1, src_type);
+          if (type == INT32_TYPE && src_type == FLOAT64_TYPE) {
+            // Saturates positive overflow (and NaN) like the JIT.
+            value = value < 2147483647.0 ? value : 2147483647.0;
+          }
+          int64_t result = ConvertToInt(value, TypeBits(type), i.flags);
+          if (type == INT64_TYPE && result == INT64_MIN && value >= 0.0) {
+            result = INT64_MAX;
+          }
+          SetInt(registers, dest, type, uint64_t(result));
+        } else if (src_type <= INT64_TYPE) {
+          int64_t value = GetSignedInt(registers, src1, src_type);
+          if (type == FLOAT32_TYPE) {
+            Set(registers, dest, float(value));
+          } else {
+            Set(registers, dest, double(value));
+          }
+        } else {
+          SetFloat(registers, dest, type, GetFloat(registers, src1, src_type));
+        }
+      } break;
+      case OPCODE_ROUND:
+        if (type == FLOAT32_TYPE) {
+          Set(registers, dest, Round(Get<float>(registers, src1), i.flags));
+        } else if (type == FLOAT64_TYPE) {
+          Set(registers, dest, Round(Get<double>(registers, src1), i.flags));
+        } else {
+          uint32_t round_mode = i.flags;
+          registers[dest] = MapF32(njm, registers[src1], [=](float a) {
+            return Round(a, round_mode);
+          });
+        }
+        break;
+      case OPCODE_VECTOR_CONVERT_I2F: {
+        VmxScope vmx_scope;
+        const vec128_t& a = registers[src1];
+        vec128_t result;
+        for (int n = 0; n < 4; ++n) {
+          result.f32[n] = i.flags & ARITHMETIC_UNSIGNED ? float(a.u32[n])
+                                                        : float(a.i32[n]);
+        }
+        registers[dest] = result;
+      } break;
+      case OPCODE_VECTOR_CONVERT_F2I: {
+        const vec128_t& a = registers[src1];
+        vec128_t result;
+        for (int n = 0; n < 4; ++n) {
+          float value = FlushDenormal(njm, a.f32[n]);
+          if (i.flags & ARITHMETIC_UNSIGNED) {
+            value = value > 0.0f ? value : 0.0f;
+            result.u32[n] = value >= 4294967296.0f ? UINT32_MAX
+                                                   : uint32_t(value);
+          } else if (std::isnan(value)) {
+            result.i32[n] = 0;
+          } else if (value >= 2147483648.0f) {
+            result.i32[n] = INT32_MAX;
+          } else if (value < -2147483648.0f) {
+            result.i32[n] = INT32_MIN;
+          } else {
+            result.i32[n] = int32_t(value);
+          }
+        }
+        registers[dest] = result;
+      } break;
+      case OPCODE_LOAD_VECTOR_SHL:
+      case OPCODE_LOAD_VECTOR_SHR: {
+        uint32_t sh = uint32_t(GetInt(registers, src1, i.src_types[0])) & 0xF;
+        uint32_t base = i.opcode == OPCODE_LOAD_VECTOR_SHL ? sh : 16 - sh;
+        vec128_t result;
+        for (uint32_t k = 0; k < 16; ++k) {
+          result.u8[k ^ 3] = uint8_t(base + k);
+        }
+        registers[dest] = result;
+      } break;
+
+      case OPCODE_LOAD_CLOCK:
+        Set(registers, dest, Clock::QueryGuestTickCount());
+        break;
+
+      case OPCODE_LOAD_LOCAL:
+        registers[dest] = registers[src1];
+        break;
+      case OPCODE_STORE_LOCAL:
+        registers[src1] = registers[src2];
+        break;
+
+      case OPCODE_LOAD_CONTEXT:
+        std::memcpy(&registers[dest], context_bytes + i.src[0].offset,
+                    GetTypeSize(TypeName(type)));
+        break;
+      case OPCODE_STORE_CONTEXT:
+        std::memcpy(context_bytes + i.src[0].offset, &registers[src2],
+                    GetTypeSize(TypeName(i.src_types[1])));
+        break;
+
+      case OPCODE_LOAD_MMIO: {
+        auto range = reinterpret_cast<MMIORange*>(i.src[0].offset);
+        uint32_t address = uint32_t(i.src[1].offset);
+        Set(registers, dest,
+            xe::byte_swap(
+                range->read(context, range->callback_context, address)));
+      } break;
+      case OPCODE_STORE_MMIO: {
+        auto range = reinterpret_cast<MMIORange*>(i.src[0].offset);
+        uint32_t address = uint32_t(i.src[1].offset);
+        range->write(context, range->callback_context, address,
+                     xe::byte_swap(Get<uint32_t>(registers, src3)));
+      } break;
+
+      case OPCODE_LOAD:
+      case OPCODE_LOAD_OFFSET: {
+        uint32_t address = Get<uint32_t>(registers, src1);
+        if (i.opcode == OPCODE_LOAD_OFFSET) {
+          address += Get<uint32_t>(registers, src2);
+        }
+        vec128_t value;
+        LoadGuest(context, address, type, &value);
+        if (i.flags & LOAD_STORE_BYTE_SWAP) {
+          if (type == VEC128_TYPE) {
+            value = ByteSwapV128(value);
+          } else {
+            uint64_t swapped = ByteSwap(value.u64[0], type);
+            std::memcpy(&value, &swapped, sizeof(swapped));
+          }
+        }
+        registers[dest] = value;
+      } break;
+      case OPCODE_STORE:
+      case OPCODE_STORE_OFFSET: {
+        bool has_offset = i.opcode == OPCODE_STORE_OFFSET;
+        uint32_t address = Get<uint32_t>(registers, src1);
+        if (has_offset) {
+          address += Get<uint32_t>(registers, src2);
+        }
+        uint32_t value_reg = has_offset ? src3 : src2;
+        uint8_t value_type = i.src_types[has_offset ? 2 : 1];
+        vec128_t value = registers[value_reg];
+        if (i.flags & LOAD_STORE_BYTE_SWAP) {
+          if (value_type == VEC128_TYPE) {
+            value = ByteSwapV128(value);
+          } else {
+            uint64_t swapped = ByteSwap(value.u64[0], value_type);
+            std::memcpy(&value, &swapped, sizeof(swapped));
+          }
+        }
+        StoreGuest(context, address, value_type, &value);
+      } break;
+      case OPCODE_LVL:
+      case OPCODE_LVR: {
+        // Guest byte k of the register is at u8[k ^ 3].
+        uint32_t address = Get<uint32_t>(registers, src1);
+        uint32_t eb = address & 0xF;
+        vec128_t result = vec128i(0);
+        if (i.opcode == OPCODE_LVL || eb) {
+          auto block =
+              context->TranslateVirtual<const uint8_t*>(address & ~0xFu);
+          for (uint32_t k = 0; k < 16; ++k) {
+            if (i.opcode == OPCODE_LVL) {
+              if (k < 16 - eb) {
+                result.u8[k ^ 3] = block[eb + k];
+              }
+            } else if (k >= 16 - eb) {
+              result.u8[k ^ 3] = block[k - (16 - eb)];
+            }
+          }
+        }
+        registers[dest] = result;
+      } break;
+      case OPCODE_STVL:
+      case OPCODE_STVR: {
+        uint32_t address = Get<uint32_t>(registers, src1);
+        uint32_t eb = address & 0xF;
+        const vec128_t& value = registers[src2];
+        if (i.opcode == OPCODE_STVL || eb) {
+          auto block = context->TranslateVirtual<uint8_t*>(address & ~0xFu);
+          for (uint32_t k = 0; k < 16; ++k) {
+            if (i.opcode == OPCODE_STVL) {
+              if (k < 16 - eb) {
+                block[eb + k] = value.u8[k ^ 3];
+              }
+            } else if (k >= 16 - eb) {
+              block[k - (16 - eb)] = value.u8[k ^ 3];
+            }
+          }
+        }
+      } break;
+      case OPCODE_MEMSET: {
+        uint32_t address = Get<uint32_t>(registers, src1);
+        std::memset(context->TranslateVirtual<uint8_t*>(address),
+                    int(GetInt(registers, src2, i.src_types[1])),
+                    size_t(GetInt(registers, src3, i.src_types[2])));
+      } break;
+      case OPCODE_MEMORY_BARRIER:
+        if (i.flags == MEMORY_BARRIER_COMPILER) {
+          std::atomic_signal_fence(std::memory_order_seq_cst);
+        } else {
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        break;
+
+      case OPCODE_MAX:
+      case OPCODE_MIN: {
+        bool is_max = i.opcode == OPCODE_MAX;
+        if (type == VEC128_TYPE) {
+          VmxScope vmx_scope;
+          vec128_t a = registers[src1];
+          vec128_t b = registers[src2];
+          for (int n = 0; n < 4; ++n) {
+            a.f32[n] = FlushDenormal(njm, a.f32[n]);
+            b.f32[n] = FlushDenormal(njm, b.f32[n]);
+          }
+          registers[dest] = is_max ? MaxV128(a, b) : MinV128(a, b);
+        } else if (type >= FLOAT32_TYPE) {
+          double a = GetFloat(registers, src1, type);
+          double b = GetFloat(registers, src2, type);
+          SetFloat(registers, dest, type,
+                   is_max ? (a > b ? a : b) : (a < b ? a : b));
+        } else {
+          int64_t a = GetSignedInt(registers, src1, type);
+          int64_t b = GetSignedInt(registers, src2, type);
+          SetInt(registers, dest, type,
+                 uint64_t(is_max ? std::max(a, b) : std::min(a, b)));
+        }
+      } break;
+      case OPCODE_VECTOR_MAX:
+      case OPCODE_VECTOR_MIN: {
+        bool is_max = i.opcode == OPCODE_VECTOR_MAX;
+        bool is_unsigned = (i.flags & ARITHMETIC_UNSIGNED) != 0;
+        registers[dest] = MapInt(
+            i.flags >> 8, registers[src1], registers[src2],
+            [=](uint64_t a, uint64_t b, uint32_t bits) {
+              int64_t sa = is_unsigned ? int64_t(a) : SignExtend(a, bits);
+              int64_t sb = is_unsigned ? int64_t(b) : SignExtend(b, bits);
+              return uint64_t(is_max ? std::max(sa, sb) : std::min(sa, sb));
+            });
+      } break;
+      case OPCODE_SELECT:
+        if (i.src_types[0] == VEC128_TYPE) {
+          const vec128_t& mask = registers[src1];
+          const vec128_t& a = registers[src2];
+          const vec128_t& b = registers[src3];
+          vec128_t result;
+          for (int n = 0; n < 2; ++n) {
+            result.u64[n] =
+                (b.u64[n] & mask.u64[n]) | (a.u64[n] & ~mask.u64[n]);
+          }
+          registers[dest] = result;
+        } else {
+          registers[dest] = IsTrue(registers, src1, i.src_types[0])
+                                ? registers[src2]
+                                : registers[src3];
+        }
+        break;
+      case OPCODE_IS_NAN:
+        Set(registers, dest,
+            uint8_t(std::isnan(GetFloat(registers, src1, i.src_types[0]))));
+        break;
+
+      case OPCODE_COMPARE_EQ:
+      case OPCODE_COMPARE_NE:
+      case OPCODE_COMPARE_SLT:
+      case OPCODE_COMPARE_SLE:
+      case OPCODE_COMPARE_SGT:
+      case OPCODE_COMPARE_SGE:
+      case OPCODE_COMPARE_ULT:
+      case OPCODE_COMPARE_ULE:
+      case OPCODE_COMPARE_UGT:
+      case OPCODE_COMPARE_UGE: {
+        uint8_t src_type = i.src_types[0];
+        bool result;
+        if (src_type >= FLOAT32_TYPE) {
+          // As the flags of comiss/comisd, unordered is equal and below.
+          double a = GetFloat(registers, src1, src_type);
+          double b = GetFloat(registers, src2, src_type);
+          bool unordered = std::isnan(a) || std::isnan(b);
+          switch (i.opcode) {
+            case OPCODE_COMPARE_EQ:
+              result = unordered || a == b;
+              break;
+            case OPCODE_COMPARE_NE:
+              result = !unordered && a != b;
+              break;
+            case OPCODE_COMPARE_SLT:
+            case OPCODE_COMPARE_ULT:
+              result = unordered || a < b;
+              break;
+            case OPCODE_COMPARE_SLE:
+            case OPCODE_COMPARE_ULE:
+              result = unordered || a <= b;
+              break;
+            case OPCODE_COMPARE_SGT:
+            case OPCODE_COMPARE_UGT:
+              result = !unordered && a > b;
+              break;
+            default:
+              result = !unordered && a >= b;
+              break;
+          }
+        } else {
+          uint64_t a = GetInt(registers, src1, src_type);
+          uint64_t b = GetInt(registers, src2, src_type);
+          int64_t sa = GetSignedInt(registers, src1, src_type);
+          int64_t sb = GetSignedInt(registers, src2, src_type);
+          switch (i.opcode) {
+            case OPCODE_COMPARE_EQ:
+              result = a == b;
+              break;
+            case OPCODE_COMPARE_NE:
+              result = a != b;
+              break;
+            case OPCODE_COMPARE_SLT:
+              result = sa < sb;
+              break;
+            case OPCODE_COMPARE_SLE:
+              result = sa <= sb;
+              break;
+            case OPCODE_COMPARE_SGT:
+              result = sa > sb;
+              break;
+            case OPCODE_COMPARE_SGE:
+              result = sa >= sb;
+              break;
+            case OPCODE_COMPARE_ULT:
+              result = a < b;
+              break;
+            case OPCODE_COMPARE_ULE:
+              result = a <= b;
+              break;
+            case OPCODE_COMPARE_UGT:
+              result = a > b;
+              break;
+            default:
+              result = a >= b;
+              break;
+          }
+        }
+        Set(registers, dest, uint8_t(result));
+      } break;
+      case OPCODE_DID_SATURATE:
+        // Not tracked, as with the JIT.
+        Set(registers, dest, uint8_t(0));
+        break;
+      case OPCODE_VECTOR_COMPARE_EQ:
+      case OPCODE_VECTOR_COMPARE_SGT:
+      case OPCODE_VECTOR_COMPARE_SGE:
+      case OPCODE_VECTOR_COMPARE_UGT:
+      case OPCODE_VECTOR_COMPARE_UGE: {
+        Opcode opcode = Opcode(i.opcode);
+        if (i.flags == FLOAT32_TYPE) {
+          VmxScope vmx_scope;
+          const vec128_t& a = registers[src1];
+          const vec128_t& b = registers[src2];
+          vec128_t result;
+          for (int n = 0; n < 4; ++n) {
+            float fa = FlushDenormal(njm, a.f32[n]);
+            float fb = FlushDenormal(njm, b.f32[n]);
+            bool match = opcode == OPCODE_VECTOR_COMPARE_EQ    ? fa == fb
+                         : opcode == OPCODE_VECTOR_COMPARE_SGT ? fa > fb
+                                                               : fa >= fb;
+            result.u32[n] = match ? UINT32_MAX : 0;
+          }
+          registers[dest] = result;
+          break;
+        }
+        registers[dest] = MapInt(
+            i.flags, registers[src1], registers[src2],
+            [=](uint64_t a, uint64_t b, uint32_t bits) {
+              int64_t sa = SignExtend(a, bits);
+              int64_t sb = SignExtend(b, bits);
+              bool match;
+              switch (opcode) {
+                case OPCODE_VECTOR_COMPARE_EQ:
+                  match = a == b;
+                  break;
+                case OPCODE_VECTOR_COMPARE_SGT:
+                  match = sa > sb;
+                  break;
+                case OPCODE_VECTOR_COMPARE_SGE:
+                  match = sa >= sb;
+                  break;
+                case OPCODE_VECTOR_COMPARE_UGT:
+                  match = a > b;
+                  break;
+                default:
+                  match = a >= b;
+                  break;
+              }
+              return match ? UINT64_MAX : 0;
+            });
+      } break;
+
+      case OPCODE_ADD:
+      case OPCODE_SUB:
+      case OPCODE_MUL:
+      case OPCODE_DIV: {
+        Opcode opcode = Opcode(i.opcode);
+        auto float_op = [opcode](auto a, auto b) {
+          switch (opcode) {
+            case OPCODE_ADD:
+              return a + b;
+            case OPCODE_SUB:
+              return a - b;
+            case OPCODE_MUL:
+              return a * b;
+            default:
+              return a / b;
+          }
+        };
+        if (type == VEC128_TYPE) {
+          registers[dest] =
+              MapF32(njm, registers[src1], registers[src2], float_op);
+        } else if (type == FLOAT32_TYPE) {
+          Set(registers, dest,
+              float_op(Get<float>(registers, src1),
+                       Get<float>(registers, src2)));
+        } else if (type == FLOAT64_TYPE) {
+          Set(registers, dest,
+              float_op(Get<double>(registers, src1),
+                       Get<double>(registers, src2)));
+        } else if (opcode == OPCODE_DIV) {
+          uint64_t result;
+          if (i.flags & ARITHMETIC_UNSIGNED) {
+            uint64_t a = GetInt(registers, src1, type);
+            uint64_t b = GetInt(registers, src2, type);
+            result = b ? a / b : 0;
+          } else {
+            int64_t a = GetSignedInt(registers, src1, type);
+            int64_t b = GetSignedInt(registers, src2, type);
+            int64_t type_min = SignExtend(uint64_t(1) << (TypeBits(type) - 1),
+                                          TypeBits(type));
+            // Division by zero and overflow are undefined on the guest.
+            result = (!b || (b == -1 && a == type_min)) ? 0 : uint64_t(a / b);
+          }
+          SetInt(registers, dest, type, result);
+        } else {
+          uint64_t a = GetInt(registers, src1, type);
+          uint64_t b = GetInt(registers, src2, type);
+          SetInt(registers, dest, type,
+                 opcode == OPCODE_ADD   ? a + b
+                 : opcode == OPCODE_SUB ? a - b
+                                        : a * b);
+        }
+      } break;
+      case OPCODE_ADD_CARRY:
+        SetInt(registers, dest, type,
+               GetInt(registers, src1, type) + GetInt(registers, src2, type) +
+                   (GetInt(registers, src3, i.src_types[2]) & 1));
+        break;
+      case OPCODE_VECTOR_ADD:
+      case OPCODE_VECTOR_SUB: {
+        bool is_add = i.opcode == OPCODE_VECTOR_ADD;
+        uint32_t part_type = i.flags & 0xFF;
+        uint32_t arithmetic_flags = i.flags >> 8;
+        if (part_type == FLOAT32_TYPE) {
+          registers[dest] =
+              MapF32(njm, registers[src1], registers[src2],
+                     [=](float a, float b) { return is_add ? a + b : a - b; });
+          break;
+        }
+        bool is_unsigned = (arithmetic_flags & ARITHMETIC_UNSIGNED) != 0;
+        bool saturate = (arithmetic_flags & ARITHMETIC_SATURATE) != 0;
+        registers[dest] = MapInt(
+            part_type, registers[src1], registers[src2],
+            [=](uint64_t a, uint64_t b, uint32_t bits) {
+              if (!saturate) {
+                return is_add ? a + b : a - b;
+              }
+              int64_t sa = is_unsigned ? int64_t(a) : SignExtend(a, bits);
+              int64_t sb = is_unsigned ? int64_t(b) : SignExtend(b, bits);
+              return Saturate(is_add ? sa + sb : sa - sb, bits, is_unsigned);
+            });
+      } break;
+      case OPCODE_MUL_HI:
+        if (type == INT64_TYPE) {
+          uint64_t a = Get<uint64_t>(registers, src1);
+          uint64_t b = Get<uint64_t>(registers, src2);
+          Set(registers, dest,
+              i.flags & ARITHMETIC_UNSIGNED
+                  ? MultiplyHigh(a, b)
+                  : uint64_t(SignedMultiplyHigh(int64_t(a), int64_t(b))));
+        } else if (i.flags & ARITHMETIC_UNSIGNED) {
+          SetInt(registers, dest, type,
+                 (GetInt(registers, src1, type) *
+                  GetInt(registers, src2, type)) >>
+                     TypeBits(type));
+        } else {
+          SetInt(registers, dest, type,
+                 uint64_t((GetSignedInt(registers, src1, type) *
+                           GetSignedInt(registers, src2, type)) >>
+                          TypeBits(type)));
+        }
+        break;
+      case OPCODE_MUL_ADD:
+      case OPCODE_MUL_SUB: {
+        bool is_sub = i.opcode == OPCODE_MUL_SUB;
+        if (type == VEC128_TYPE) {
+          registers[dest] =
+              MapF32(njm, registers[src1], registers[src2], registers[src3],
+                     [=](float a, float b, float c) {
+                       return std::fma(a, b, is_sub ? -c : c);
+                     });
+        } else if (type == FLOAT32_TYPE) {
+          float c = Get<float>(registers, src3);
+          Set(registers, dest,
+              std::fma(Get<float>(registers, src1),
+                       Get<float>(registers, src2), is_sub ? -c : c));
+        } else {
+          double c = Get<double>(registers, src3);
+          Set(registers, dest,
+              std::fma(Get<double>(registers, src1),
+                       Get<double>(registers, src2), is_sub ? -c : c));
+        }
+      } break;
+      case OPCODE_NEG:
+      case OPCODE_ABS:
+        if (type == VEC128_TYPE) {
+          vec128_t result = registers[src1];
+          for (int n = 0; n < 4; ++n) {
+            result.u32[n] = i.opcode == OPCODE_NEG
+                                ? result.u32[n] ^ 0x80000000
+                                : result.u32[n] & 0x7FFFFFFF;
+          }
+          registers[dest] = result;
+        } else if (type >= FLOAT32_TYPE) {
+          uint64_t sign = type == FLOAT32_TYPE ? uint64_t(0x80000000)
+                                               : uint64_t(1) << 63;
+          uint64_t bits = GetInt(registers, src1, type);
+          SetInt(registers, dest, type,
+                 i.opcode == OPCODE_NEG ? bits ^ sign : bits & ~sign);
+        } else {
+          int64_t value = GetSignedInt(registers, src1, type);
+          SetInt(registers, dest, type,
+                 uint64_t(i.opcode == OPCODE_NEG || value < 0 ? -value
+                                                              : value));
+        }
+        break;
+      case OPCODE_SQRT:
+      case OPCODE_RSQRT:
+      case OPCODE_RECIP:
+      case OPCODE_POW2:
+      case OPCODE_LOG2: {
+        // Estimates are computed exactly.
+        Opcode opcode = Opcode(i.opcode);
+        auto float_op = [opcode](auto a) {
+          using T = decltype(a);
+          switch (opcode) {
+            case OPCODE_SQRT:
+              return T(std::sqrt(a));
+            case OPCODE_RSQRT:
+              return T(1) / T(std::sqrt(a));
+            case OPCODE_RECIP:
+              return T(1) / a;
+            case OPCODE_POW2:
+              return T(std::exp2(a));
+            default:
+              return T(std::log2(a));
+          }
+        };
+        if (type == VEC128_TYPE) {
+          registers[dest] = MapF32(njm, registers[src1], float_op);
+        } else if (type == FLOAT32_TYPE) {
+          Set(registers, dest, float_op(Get<float>(registers, src1)));
+        } else {
+          Set(registers, dest, float_op(Get<double>(registers, src1)));
+        }
+      } break;
+      case OPCODE_DOT_PRODUCT_3:
+      case OPCODE_DOT_PRODUCT_4:
+        registers[dest] = vec128f(DotProduct(
+            njm, registers[src1], registers[src2],
+            i.opcode == OPCODE_DOT_PRODUCT_4));
+        break;
+
+      case OPCODE_AND:
+      case OPCODE_AND_NOT:
+      case OPCODE_OR:
+      case OPCODE_XOR: {
+        const vec128_t& a = registers[src1];
+        const vec128_t& b = registers[src2];
+        vec128_t result;
+        for (int n = 0; n < 2; ++n) {
+          switch (i.opcode) {
+            case OPCODE_AND:
+              result.u64[n] = a.u64[n] & b.u64[n];
+              break;
+            case OPCODE_AND_NOT:
+              result.u64[n] = a.u64[n] & ~b.u64[n];
+              break;
+            case OPCODE_OR:
+              result.u64[n] = a.u64[n] | b.u64[n];
+              break;
+            default:
+              result.u64[n] = a.u64[n] ^ b.u64[n];
+              break;
+          }
+        }
+        registers[dest] = result;
+      } break;
+      case OPCODE_NOT: {
+        vec128_t result = registers[src1];
+        result.u64[0] = ~result.u64[0];
+        result.u64[1] = ~result.u64[1];
+        registers[dest] = result;
+      } break;
+      case OPCODE_SHL:
+      case OPCODE_SHR:
+      case OPCODE_SHA:
+      case OPCODE_ROTATE_LEFT: {
+        uint32_t bits = TypeBits(type);
+        uint32_t count = uint32_t(GetInt(registers, src2, i.src_types[1])) &
+                         (bits == 64 ? 0x3F : 0x1F);
+        uint64_t value = GetInt(registers, src1, type);
+        uint64_t result;
+        switch (i.opcode) {
+          case OPCODE_SHL:
+            result = value << count;
+            break;
+          case OPCODE_SHR:
+            result = value >> count;
+            break;
+          case OPCODE_SHA:
+            result = uint64_t(SignExtend(value, bits) >> count);
+            break;
+          default:
+            count %= bits;
+            result = count ? (value << count) | (value >> (bits - count))
+                           : value;
+            break;
+        }
+        SetInt(registers, dest, type, result);
+      } break;
+      case OPCODE_VECTOR_SHL:
+      case OPCODE_VECTOR_SHR:
+      case OPCODE_VECTOR_SHA:
+      case OPCODE_VECTOR_ROTATE_LEFT: {
+        Opcode opcode = Opcode(i.opcode);
+        registers[dest] = MapInt(
+            i.flags, registers[src1], registers[src2],
+            [=](uint64_t a, uint64_t b, uint32_t bits) {
+              uint32_t count = uint32_t(b) & (bits - 1);
+              switch (opcode) {
+                case OPCODE_VECTOR_SHL:
+                  return a << count;
+                case OPCODE_VECTOR_SHR:
+                  return a >> count;
+                case OPCODE_VECTOR_SHA:
+                  return uint64_t(SignExtend(a, bits) >> count);
+                default:
+                  return count ? (a << count) | (a >> (bits - count)) : a;
+              }
+            });
+      } break;
+      case OPCODE_VECTOR_AVERAGE: {
+        bool is_unsigned = ((i.flags >> 8) & ARITHMETIC_UNSIGNED) != 0;
+        registers[dest] = MapInt(
+            i.flags & 0xFF, registers[src1], registers[src2],
+            [=](uint64_t a, uint64_t b, uint32_t bits) {
+              int64_t sa = is_unsigned ? int64_t(a) : SignExtend(a, bits);
+              int64_t sb = is_unsigned ? int64_t(b) : SignExtend(b, bits);
+              return uint64_t((sa + sb + 1) >> 1);
+            });
+      } break;
+      case OPCODE_BYTE_SWAP:
+        if (type == VEC128_TYPE) {
+          registers[dest] = ByteSwapV128(registers[src1]);
+        } else {
+          SetInt(registers, dest, type,
+                 ByteSwap(GetInt(registers, src1, type), type));
+        }
+        break;
+      case OPCODE_CNTLZ: {
+        uint64_t value = GetInt(registers, src1, i.src_types[0]);
+        uint8_t count;
+        switch (i.src_types[0]) {
+          case INT8_TYPE:
+            count = xe::lzcnt(uint8_t(value));
+            break;
+          case INT16_TYPE:
+            count = xe::lzcnt(uint16_t(value));
+            break;
+          case INT32_TYPE:
+            count = xe::lzcnt(uint32_t(value));
+            break;
+          default:
+            count = xe::lzcnt(value);
+            break;
+        }
+        Set(registers, dest, count);
+      } break;
+
+      case OPCODE_INSERT: {
+        vec128_t result = registers[src1];
+        uint32_t index = uint32_t(GetInt(registers, src2, i.src_types[1]));
+        uint64_t value = GetInt(registers, src3, i.src_types[2]);
+        switch (i.src_types[2]) {
+          case INT8_TYPE:
+            result.u8[(index & 0xF) ^ 3] = uint8_t(value);
+            break;
+          case INT16_TYPE:
+            result.u16[(index & 0x7) ^ 1] = uint16_t(value);
+            break;
+          default:
+            result.u32[index & 0x3] = uint32_t(value);
+            break;
+        }
+        registers[dest] = result;
+      } break;
+      case OPCODE_EXTRACT: {
+        const vec128_t& value = registers[src1];
+        uint32_t index = uint32_t(GetInt(registers, src2, i.src_types[1]));
+        switch (type) {
+          case INT8_TYPE:
+            Set(registers, dest, value.u8[(index & 0xF) ^ 3]);
+            break;
+          case INT16_TYPE:
+            Set(registers, dest, value.u16[(index & 0x7) ^ 1]);
+            break;
+          default:
+            Set(registers, dest, value.u32[index & 0x3]);
+            break;
+        }
+      } break;
+      case OPCODE_SPLAT: {
+        uint64_t value = GetInt(registers, src1, i.src_types[0]);
+        vec128_t result;
+        switch (i.src_types[0]) {
+          case INT8_TYPE:
+            result = vec128b(uint8_t(value));
+            break;
+          case INT16_TYPE:
+            result = vec128s(uint16_t(value));
+            break;
+          case INT32_TYPE:
+          case FLOAT32_TYPE:
+            result = vec128i(uint32_t(value));
+            break;
+          default:
+            result.u64[0] = result.u64[1] = value;
+            break;
+        }
+        registers[dest] = result;
+      } break;
+      case OPCODE_PERMUTE: {
+        const vec128_t& a = registers[src2];
+        const vec128_t& b = registers[src3];
+        vec128_t result;
+        switch (i.flags) {
+          case INT8_TYPE: {
+            const vec128_t& control = registers[src1];
+            for (int n = 0; n < 16; ++n) {
+              uint32_t index = (control.u8[n] & 0x1F) ^ 3;
+              result.u8[n] = index < 16 ? a.u8[index] : b.u8[index - 16];
+            }
+          } break;
+          case INT16_TYPE: {
+            const vec128_t& control = registers[src1];
+            for (int n = 0; n < 8; ++n) {
+              uint32_t index = (control.u16[n] & 0xF) ^ 1;
+              result.u16[n] = index < 8 ? a.u16[index] : b.u16[index - 8];
+            }
+          } break;
+          default: {
+            assert_true(i.flags == INT32_TYPE);
+            uint32_t control = Get<uint32_t>(registers, src1);
+            for (int n = 0; n < 4; ++n) {
+              uint32_t select = control >> (8 * n);
+              result.u32[n] = (select & 4 ? b : a).u32[select & 3];
+            }
+          } break;
+        }
+        registers[dest] = result;
+      } break;
+      case OPCODE_SWIZZLE: {
+        const vec128_t& value = registers[src1];
+        uint32_t mask = uint32_t(i.src[1].offset);
+        vec128_t result;
+        for (int n = 0; n < 4; ++n) {
+          result.u32[n] = value.u32[(mask >> (n * 2)) & 3];
+        }
+        registers[dest] = result;
+      } break;
+      case OPCODE_PACK:
+        registers[dest] =
+            Pack(i.flags, registers[src1],
+                 src2 != InterpreterProgram::kNoRegister ? registers[src2]
+                                                         : vec128i(0));
+        break;
+      case OPCODE_UNPACK:
+        registers[dest] = Unpack(i.flags, registers[src1]);
+        break;
+
+      case OPCODE_ATOMIC_EXCHANGE: {
+        // The address is a host pointer.
+        uint64_t address = Get<uint64_t>(registers, src1);
+        if (type == INT64_TYPE) {
+          Set(registers, dest,
+              xe::atomic_exchange(
+                  Get<uint64_t>(registers, src2),
+                  reinterpret_cast<volatile uint64_t*>(address)));
+        } else {
+          assert_true(type == INT32_TYPE);
+          Set(registers, dest,
+              xe::atomic_exchange(
+                  Get<uint32_t>(registers, src2),
+                  reinterpret_cast<volatile uint32_t*>(address)));
+        }
+      } break;
+      case OPCODE_ATOMIC_COMPARE_EXCHANGE: {
+        auto address = context->TranslateVirtual<uint8_t*>(
+            Get<uint32_t>(registers, src1));
+        bool exchanged;
+        if (i.src_types[1] == INT64_TYPE) {
+          exchanged = xe::atomic_cas(
+              Get<uint64_t>(registers, src2), Get<uint64_t>(registers, src3),
+              reinterpret_cast<volatile uint64_t*>(address));
+        } else {
+          exchanged = xe::atomic_cas(
+              Get<uint32_t>(registers, src2), Get<uint32_t>(registers, src3),
+              reinterpret_cast<volatile uint32_t*>(address));
+        }
+        Set(registers, dest, uint8_t(exchanged));
+      } break;
+      case OPCODE_RESERVED_LOAD: {
+        uint32_t address = Get<uint32_t>(registers, src1);
+        uint64_t value = 0;
+        std::memcpy(&value, context->TranslateVirtual<uint8_t*>(address),
+                    GetTypeSize(TypeName(type)));
+        reservation_.address = address;
+        reservation_.value = value;
+        reservation_.valid = true;
+        Set(registers, dest, value);
+      } break;
+      case OPCODE_RESERVED_STORE: {
+        uint32_t address = Get<uint32_t>(registers, src1);
+        bool stored = false;
+        if (reservation_.valid && reservation_.address == address) {
+          auto host_address = context->TranslateVirtual<uint8_t*>(address);
+          if (i.src_types[1] == INT64_TYPE) {
+            stored = xe::atomic_cas(
+                reservation_.value, Get<uint64_t>(registers, src2),
+                reinterpret_cast<volatile uint64_t*>(host_address));
+          } else {
+            stored = xe::atomic_cas(
+                uint32_t(reservation_.value), Get<uint32_t>(registers, src2),
+                reinterpret_cast<volatile uint32_t*>(host_address));
+          }
+        }
+        reservation_.valid = false;
+        Set(registers, dest, uint8_t(stored));
+      } break;
+
+      case OPCODE_SET_ROUNDING_MODE:
+        backend->SetGuestRoundingMode(context,
+                                      Get<uint32_t>(registers, src1));
+        break;
+      case OPCODE_VECTOR_DENORMFLUSH: {
+        vec128_t result = registers[src1];
+        for (int n = 0; n < 4; ++n) {
+          result.f32[n] = FlushDenormal(true, result.f32[n]);
+        }
+        registers[dest] = result;
+      } break;
+      case OPCODE_TO_SINGLE:
+        Set(registers, dest, double(float(Get<double>(registers, src1))));
+        break;
+      case OPCODE_SET_NJM:
+        njm = Get<uint8_t>(registers, src1) != 0;
+        backend->SetGuestNonJavaMode(context, njm);
+        break;
+      case OPCODE_DELAY_EXECUTION:
+        xe::threading::MaybeYield();
+        break;
+
+      default:
+        XELOGE("Interpreter: unhandled opcode {} in function {:08X}",
+               GetOpcodeName(Opcode(i.opcode)), program.guest_address);
+        assert_always();
+        break;
+    }
+  }
+}
+
+}  // namespace interpreter
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
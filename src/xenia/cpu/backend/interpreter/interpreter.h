@@ -0,0 +1,80 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_H_
+#define XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "xenia/base/vec128.h"
+
+namespace xe {
+namespace cpu {
+class Function;
+class ThreadState;
+}  // namespace cpu
+}  // namespace xe
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace interpreter {
+
+// A finalized HIR instruction with its values resolved to registers and its
+// labels resolved to instruction indices.
+struct InterpreterInstr {
+  union Operand {
+    uint32_t reg;
+    uint32_t target;
+    uint64_t offset;
+    Function* symbol;
+  };
+
+  // hir::Opcode.
+  uint16_t opcode;
+  uint16_t flags;
+  // hir::TypeName of the destination and of each value source.
+  uint8_t dest_type;
+  uint8_t src_types[3];
+  uint32_t dest;
+  Operand src[3];
+};
+
+// A function lowered from finalized HIR, see InterpreterAssembler::Lower.
+struct InterpreterProgram {
+  static constexpr uint32_t kNoRegister = UINT32_MAX;
+
+  std::vector<InterpreterInstr> instrs;
+  // Registers are indexed by value ordinal and hold one value of any type in
+  // their low bytes, and constants follow them, copied in on every call.
+  uint32_t value_register_count = 0;
+  std::vector<vec128_t> constants;
+  uint32_t guest_address = 0;
+
+  uint32_t register_count() const {
+    return value_register_count + uint32_t(constants.size());
+  }
+};
+
+// Executes lowered HIR directly on the guest context. Slow, but needs no code
+// generation, and as it follows the HIR semantics one instruction at a time it
+// serves as a reference for the JIT backends.
+class Interpreter {
+ public:
+  static void Execute(const InterpreterProgram& program,
+                      ThreadState* thread_state, uint32_t return_address);
+};
+
+}  // namespace interpreter
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_H_
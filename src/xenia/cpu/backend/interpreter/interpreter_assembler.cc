@@ -0,0 +1,188 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/backend/interpreter/interpreter_assembler.h"
+
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/backend/interpreter/interpreter_backend.h"
+#include "xenia/cpu/backend/interpreter/interpreter_function.h"
+#include "xenia/cpu/hir/hir_builder.h"
+#include "xenia/cpu/hir/label.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace interpreter {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+InterpreterAssembler::InterpreterAssembler(InterpreterBackend* backend)
+    : Assembler(backend) {}
+
+InterpreterAssembler::~InterpreterAssembler() = default;
+
+bool InterpreterAssembler::Assemble(
+    GuestFunction* function, HIRBuilder* builder, uint32_t debug_info_flags,
+    std::unique_ptr<FunctionDebugInfo> debug_info,
+    const std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls,
+    uint32_t code_generation) {
+  SCOPE_profile_cpu_f("cpu");
+
+  auto program = std::make_shared<InterpreterProgram>();
+  if (!Lower(builder, function->address(), program.get())) {
+    return false;
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  if (function->code_generation() != code_generation) {
+    return false;
+  }
+  function->set_debug_info(std::move(debug_info));
+  function->set_inlined_calls(inlined_calls);
+  static_cast<InterpreterFunction*>(function)->Setup(std::move(program));
+  return true;
+}
+
+bool InterpreterAssembler::Lower(HIRBuilder* builder, uint32_t guest_address,
+                                 InterpreterProgram* program) {
+  program->instrs.clear();
+  program->constants.clear();
+  program->guest_address = guest_address;
+  program->value_register_count = builder->max_value_ordinal();
+
+  // Constants get registers of their own after the values, filled on entry.
+  std::unordered_map<const Value*, uint32_t> constant_registers;
+  auto value_register = [&](const Value* value) {
+    if (!value->IsConstant()) {
+      return value->ordinal;
+    }
+    auto it = constant_registers.find(value);
+    if (it != constant_registers.end()) {
+      return it->second;
+    }
+    uint32_t reg =
+        program->value_register_count + uint32_t(program->constants.size());
+    vec128_t constant = vec128i(0);
+    if (value->type == VEC128_TYPE) {
+      constant = value->constant.v128;
+    } else {
+      constant.u64[0] = value->constant.u64;
+    }
+    program->constants.push_back(constant);
+    constant_registers.emplace(value, reg);
+    return reg;
+  };
+
+  // Branch targets are resolved once all blocks have been placed.
+  std::unordered_map<const Block*, uint32_t> block_starts;
+  struct LabelFixup {
+    size_t instr_index;
+    size_t src_index;
+    const Block* block;
+  };
+  std::vector<LabelFixup> label_fixups;
+
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block_starts.emplace(block, uint32_t(program->instrs.size()));
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      switch (instr->opcode->num) {
+        case OPCODE_COMMENT:
+        case OPCODE_NOP:
+        case OPCODE_SOURCE_OFFSET:
+        case OPCODE_CONTEXT_BARRIER:
+        case OPCODE_CACHE_CONTROL:
+          continue;
+        default:
+          break;
+      }
+      uint32_t signature = instr->opcode->signature;
+      InterpreterInstr lowered = {};
+      lowered.opcode = uint16_t(instr->opcode->num);
+      lowered.flags = instr->flags;
+      lowered.dest = InterpreterProgram::kNoRegister;
+      if (GET_OPCODE_SIG_TYPE_DEST(signature) == OPCODE_SIG_TYPE_V) {
+        if (!instr->dest) {
+          XELOGE("Interpreter: {} in function {:08X} has no destination",
+                 GetOpcodeName(instr->opcode), guest_address);
+          return false;
+        }
+        lowered.dest = instr->dest->ordinal;
+        lowered.dest_type = uint8_t(instr->dest->type);
+      }
+      uint32_t src_signatures[] = {
+          GET_OPCODE_SIG_TYPE_SRC1(signature),
+          GET_OPCODE_SIG_TYPE_SRC2(signature),
+          GET_OPCODE_SIG_TYPE_SRC3(signature),
+      };
+      for (size_t n = 0; n < 3; ++n) {
+        const Instr::Op& src = instr->srcs[n];
+        auto& lowered_src = lowered.src[n];
+        switch (src_signatures[n]) {
+          case OPCODE_SIG_TYPE_V:
+            if (!src.value) {
+              // Optional, such as the second source of pack.
+              lowered_src.reg = InterpreterProgram::kNoRegister;
+            } else if (instr->opcode->num == OPCODE_LOAD_LOCAL ||
+                       instr->opcode->num == OPCODE_STORE_LOCAL) {
+              // Local slots are stored in their own register.
+              if (n == 0) {
+                lowered_src.reg = src.value->ordinal;
+              } else {
+                lowered_src.reg = value_register(src.value);
+              }
+              lowered.src_types[n] = uint8_t(src.value->type);
+            } else {
+              lowered_src.reg = value_register(src.value);
+              lowered.src_types[n] = uint8_t(src.value->type);
+            }
+            break;
+          case OPCODE_SIG_TYPE_L:
+            label_fixups.push_back(
+                {program->instrs.size(), n, src.label->block});
+            break;
+          case OPCODE_SIG_TYPE_O:
+            lowered_src.offset = src.offset;
+            break;
+          case OPCODE_SIG_TYPE_S:
+            lowered_src.symbol = src.symbol;
+            break;
+          default:
+            break;
+        }
+      }
+      program->instrs.push_back(lowered);
+    }
+  }
+
+  for (auto& fixup : label_fixups) {
+    auto it = block_starts.find(fixup.block);
+    if (it == block_starts.end()) {
+      XELOGE("Interpreter: branch to a removed block in function {:08X}",
+             guest_address);
+      return false;
+    }
+    program->instrs[fixup.instr_index].src[fixup.src_index].target =
+        it->second;
+  }
+  return true;
+}
+
+}  // namespace interpreter
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
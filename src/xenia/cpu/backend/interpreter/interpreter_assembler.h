@@ -0,0 +1,52 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_ASSEMBLER_H_
+#define XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_ASSEMBLER_H_
+
+#include <memory>
+
+#include "xenia/base/mutex.h"
+#include "xenia/cpu/backend/assembler.h"
+#include "xenia/cpu/backend/interpreter/interpreter.h"
+#include "xenia/cpu/function.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace interpreter {
+
+class InterpreterBackend;
+
+class InterpreterAssembler : public Assembler {
+ public:
+  explicit InterpreterAssembler(InterpreterBackend* backend);
+  ~InterpreterAssembler() override;
+
+  bool Assemble(
+      GuestFunction* function, hir::HIRBuilder* builder,
+      uint32_t debug_info_flags, std::unique_ptr<FunctionDebugInfo> debug_info,
+      const std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls,
+      uint32_t code_generation) override;
+
+  // Converts finalized HIR into a program for the Interpreter. Also used by
+  // other backends to run some functions interpreted.
+  static bool Lower(hir::HIRBuilder* builder, uint32_t guest_address,
+                    InterpreterProgram* program);
+
+ private:
+  xe::global_critical_region global_critical_region_;
+};
+
+}  // namespace interpreter
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_ASSEMBLER_H_
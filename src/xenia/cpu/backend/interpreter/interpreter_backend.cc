@@ -0,0 +1,119 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/backend/interpreter/interpreter_backend.h"
+
+#include <cfenv>
+#include <cstring>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/backend/interpreter/interpreter_assembler.h"
+#include "xenia/cpu/backend/interpreter/interpreter_function.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+#if XE_ARCH_AMD64
+#include <xmmintrin.h>
+#endif  // XE_ARCH_AMD64
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace interpreter {
+
+InterpreterBackend::InterpreterBackend() = default;
+
+InterpreterBackend::~InterpreterBackend() = default;
+
+bool InterpreterBackend::Initialize(Processor* processor) {
+  if (!Backend::Initialize(processor)) {
+    return false;
+  }
+
+  // Byte swapping loads and stores, see MemorySequenceCombinationPass.
+  machine_info_.supports_extended_load_store = true;
+  // Barriers are executed as host fences.
+  machine_info_.total_store_order = XE_ARCH_AMD64 == 1;
+
+  auto& gprs = machine_info_.register_sets[0];
+  gprs.id = 0;
+  std::strcpy(gprs.name, "gpr");
+  gprs.types = MachineInfo::RegisterSet::INT_TYPES;
+  gprs.count = 32;
+
+  auto& xmms = machine_info_.register_sets[1];
+  xmms.id = 1;
+  std::strcpy(xmms.name, "vec");
+  xmms.types = MachineInfo::RegisterSet::FLOAT_TYPES |
+               MachineInfo::RegisterSet::VEC_TYPES;
+  xmms.count = 32;
+
+  return true;
+}
+
+void InterpreterBackend::CommitExecutableRange(uint32_t guest_low,
+                                               uint32_t guest_high) {}
+
+std::unique_ptr<Assembler> InterpreterBackend::CreateAssembler() {
+  return std::make_unique<InterpreterAssembler>(this);
+}
+
+std::unique_ptr<GuestFunction> InterpreterBackend::CreateGuestFunction(
+    Module* module, uint32_t address) {
+  return std::make_unique<InterpreterFunction>(module, address);
+}
+
+uint64_t InterpreterBackend::CalculateNextHostInstruction(
+    ThreadDebugInfo* thread_info, uint64_t current_pc) {
+  return current_pc;
+}
+
+void InterpreterBackend::InitializeBackendContext(void* ctx) {
+  // NJM on by default, as with the JIT.
+  BackendContextForGuestContext(ctx)->flags = kNonJavaModeFlag;
+}
+
+void InterpreterBackend::SetGuestRoundingMode(void* ctx, unsigned int mode) {
+  uint32_t control = mode & 7;
+#if XE_ARCH_AMD64
+  // Same as mxcsr_table of the x64 backend, flushing to zero in non-IEEE mode.
+  static const uint32_t mxcsr_table[8] = {
+      0x1F80, 0x7F80, 0x5F80, 0x3F80, 0x9F80, 0xFF80, 0xDF80, 0xBF80,
+  };
+  _mm_setcsr(mxcsr_table[control]);
+#else
+  static const int rounding_modes[4] = {
+      FE_TONEAREST,
+      FE_TOWARDZERO,
+      FE_UPWARD,
+      FE_DOWNWARD,
+  };
+  std::fesetround(rounding_modes[control & 3]);
+#endif  // XE_ARCH_AMD64
+  auto ppc_context = reinterpret_cast<ppc::PPCContext*>(ctx);
+  ppc_context->fpscr.bits.rn = control;
+  ppc_context->fpscr.bits.ni = control >> 2;
+}
+
+void InterpreterBackend::SetGuestNonJavaMode(void* ctx, bool enabled) {
+  auto bctx = BackendContextForGuestContext(ctx);
+  if (enabled) {
+    bctx->flags |= kNonJavaModeFlag;
+  } else {
+    bctx->flags &= ~kNonJavaModeFlag;
+  }
+}
+
+bool InterpreterBackend::GetGuestNonJavaMode(void* ctx) {
+  return (BackendContextForGuestContext(ctx)->flags & kNonJavaModeFlag) != 0;
+}
+
+}  // namespace interpreter
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,66 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_BACKEND_H_
+#define XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_BACKEND_H_
+
+#include <memory>
+
+#include "xenia/cpu/backend/backend.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace interpreter {
+
+// Runs guest code through the Interpreter, with no code generation and no
+// code cache. Works on any host, and serves as a reference for the JIT.
+class InterpreterBackend : public Backend {
+ public:
+  InterpreterBackend();
+  ~InterpreterBackend() override;
+
+  bool Initialize(Processor* processor) override;
+
+  void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high) override;
+
+  std::unique_ptr<Assembler> CreateAssembler() override;
+
+  std::unique_ptr<GuestFunction> CreateGuestFunction(Module* module,
+                                                     uint32_t address) override;
+
+  uint64_t CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
+                                        uint64_t current_pc) override;
+
+  void InitializeBackendContext(void* ctx) override;
+  void SetGuestRoundingMode(void* ctx, unsigned int mode) override;
+  void SetGuestNonJavaMode(void* ctx, bool enabled) override;
+  bool GetGuestNonJavaMode(void* ctx) override;
+
+ private:
+  // Stored right before the guest context, as X64BackendContext is.
+  struct InterpreterBackendContext {
+    uint32_t flags;
+  };
+  enum : uint32_t {
+    kNonJavaModeFlag = 1 << 0,
+  };
+
+  static InterpreterBackendContext* BackendContextForGuestContext(void* ctx) {
+    return reinterpret_cast<InterpreterBackendContext*>(
+        reinterpret_cast<intptr_t>(ctx) - sizeof(InterpreterBackendContext));
+  }
+};
+
+}  // namespace interpreter
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_BACKEND_H_
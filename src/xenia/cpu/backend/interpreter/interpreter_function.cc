@@ -0,0 +1,62 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/backend/interpreter/interpreter_function.h"
+
+#include <algorithm>
+
+#include "xenia/base/logging.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/processor.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace interpreter {
+
+InterpreterFunction::InterpreterFunction(Module* module, uint32_t address)
+    : GuestFunction(module, address) {}
+
+InterpreterFunction::~InterpreterFunction() = default;
+
+void InterpreterFunction::Setup(
+    std::shared_ptr<const InterpreterProgram> program) {
+  if (tier() == Tier::kBaseline) {
+    RestartTierUpCountdown();
+  }
+  std::atomic_store(&program_, std::move(program));
+}
+
+void InterpreterFunction::RestartTierUpCountdown() {
+  tier_up_countdown_.store(
+      std::max(cvars::tiered_compilation_threshold, uint32_t(1)),
+      std::memory_order_relaxed);
+}
+
+bool InterpreterFunction::CallImpl(ThreadState* thread_state,
+                                   uint32_t return_address) {
+  auto program = std::atomic_load(&program_);
+  if (!program) {
+    XELOGE("Interpreter: function {:08X} called before being translated",
+           address());
+    return false;
+  }
+  if (tier() == Tier::kBaseline &&
+      tier_up_countdown_.fetch_sub(1, std::memory_order_relaxed) == 1 &&
+      BeginOptimization()) {
+    thread_state->processor()->compile_pool()->QueueOptimization(this);
+  }
+  Interpreter::Execute(*program, thread_state, return_address);
+  return true;
+}
+
+}  // namespace interpreter
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,53 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_FUNCTION_H_
+#define XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_FUNCTION_H_
+
+#include <atomic>
+#include <memory>
+
+#include "xenia/cpu/backend/interpreter/interpreter.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/thread_state.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace interpreter {
+
+class InterpreterFunction : public GuestFunction {
+ public:
+  InterpreterFunction(Module* module, uint32_t address);
+  ~InterpreterFunction() override;
+
+  uint8_t* machine_code() const override { return nullptr; }
+  size_t machine_code_length() const override { return 0; }
+
+  // May replace the program while other threads are still running the old
+  // one, which they keep alive until they return.
+  void Setup(std::shared_ptr<const InterpreterProgram> program);
+
+ protected:
+  bool CallImpl(ThreadState* thread_state, uint32_t return_address) override;
+  void RestartTierUpCountdown() override;
+
+ private:
+  std::shared_ptr<const InterpreterProgram> program_;
+  // Decremented on every call of the baseline program, see
+  // tiered_compilation.
+  std::atomic<uint32_t> tier_up_countdown_ = {0};
+};
+
+}  // namespace interpreter
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BACKEND_INTERPRETER_INTERPRETER_FUNCTION_H_
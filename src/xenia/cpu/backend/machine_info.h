@@ -18,6 +18,9 @@ namespace backend {
 
 struct MachineInfo {
   bool supports_extended_load_store;
+  // Host memory is total store ordered, only a store followed by a load to
+  // another address may be reordered, see MemoryBarrierRelaxationPass.
+  bool total_store_order;
 
   struct RegisterSet {
     enum Types {
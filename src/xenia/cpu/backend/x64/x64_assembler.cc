@@ -10,12 +10,14 @@
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 
 #include <climits>
+#include <memory>
 
 #include "third_party/capstone/include/capstone/capstone.h"
 #include "third_party/capstone/include/capstone/x86.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
 #include "xenia/base/string.h"
+#include "xenia/cpu/backend/interpreter/interpreter_assembler.h"
 #include "xenia/cpu/backend/x64/x64_backend.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
@@ -25,6 +27,8 @@
 #include "xenia/cpu/hir/label.h"
 #include "xenia/cpu/processor.h"
 
+DECLARE_bool(link_guest_calls);
+
 namespace xe {
 namespace cpu {
 namespace backend {
@@ -67,40 +71,101 @@ void X64Assembler::Reset() {
   Assembler::Reset();
 }
 
-bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
-                            uint32_t debug_info_flags,
-                            std::unique_ptr<FunctionDebugInfo> debug_info) {
+bool X64Assembler::Assemble(
+    GuestFunction* function, HIRBuilder* builder, uint32_t debug_info_flags,
+    std::unique_ptr<FunctionDebugInfo> debug_info,
+    const std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls,
+    uint32_t code_generation) {
   SCOPE_profile_cpu_f("cpu");
 
   // Reset when we leave.
   xe::make_reset_scope(this);
 
-  // Lower HIR -> x64.
+  // Baseline code may leave the body to the interpreter until it tiers up.
+  auto x64_function = static_cast<X64Function*>(function);
+  if (cvars::interpret_baseline_functions &&
+      function->tier() == GuestFunction::Tier::kBaseline &&
+      !x64_function->interpreter_program()) {
+    auto program = std::make_unique<interpreter::InterpreterProgram>();
+    if (interpreter::InterpreterAssembler::Lower(builder, function->address(),
+                                                 program.get())) {
+      x64_function->set_interpreter_program(std::move(program));
+    }
+  }
+
+  // Lower HIR -> x64. The baseline code and its source map may be in use by
+  // other threads while tiering up, so the new ones are only published once
+  // complete.
   void* machine_code = nullptr;
   size_t code_size = 0;
+  auto source_map = std::make_unique<SourceMap>();
   if (!emitter_->Emit(function, builder, debug_info_flags, debug_info.get(),
-                      &machine_code, &code_size, &function->source_map())) {
+                      inlined_calls, &machine_code, &code_size,
+                      &source_map->entries)) {
     return false;
   }
+  source_map->code_address = reinterpret_cast<uintptr_t>(machine_code);
+  source_map->code_length = code_size;
+  source_map->inlined_calls = inlined_calls;
 
   // Stash generated machine code.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmMachineCode) {
-    DumpMachineCode(machine_code, code_size, function->source_map(),
+    DumpMachineCode(machine_code, code_size, source_map->entries,
                     &string_buffer_);
     debug_info->set_machine_code_disasm(xe_strdup(string_buffer_.buffer()));
     string_buffer_.Reset();
   }
 
+  // Writes to the guest code are handled with the lock held, so they either
+  // invalidate the published code or the code is dropped here.
+  auto global_lock = global_critical_region_.Acquire();
+  auto code_cache = reinterpret_cast<X64CodeCache*>(backend_->code_cache());
+  bool reclaim_code = cvars::reclaim_code_cache && cvars::link_guest_calls &&
+                      code_cache->has_indirection_table();
+  if (function->code_generation() != code_generation) {
+    // Also drops what was derived from the old guest code while emitting,
+    // unless only other code was written to while optimizing and the baseline
+    // code still uses it (see Processor::OptimizeFunction).
+    if (function->tier() != GuestFunction::Tier::kOptimizing) {
+      x64_backend_->DiscardGuestFunction(function);
+    }
+    code_cache->DropPersistentCode(machine_code);
+    if (reclaim_code) {
+      code_cache->RetireCode(machine_code);
+    }
+    return false;
+  }
+
   function->set_debug_info(std::move(debug_info));
-  static_cast<X64Function*>(function)->Setup(
+  function->set_inlined_calls(inlined_calls);
+  uint8_t* old_machine_code = x64_function->machine_code();
+  x64_function->Setup(
       reinterpret_cast<uint8_t*>(machine_code), code_size);
+  std::unique_ptr<SourceMap> old_source_map =
+      function->PublishSourceMap(std::move(source_map));
+  if (old_source_map) {
+    // Other threads may still be mapping addresses with it.
+    code_cache->RetireCodeData(std::move(old_source_map));
+  }
 
   // Install into indirection table.
   uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
   assert_true((host_address >> 32) == 0);
-  reinterpret_cast<X64CodeCache*>(backend_->code_cache())
-      ->AddIndirection(function->address(),
-                       static_cast<uint32_t>(host_address));
+  code_cache->AddIndirection(function->address(),
+                             static_cast<uint32_t>(host_address));
+  // Baseline code will be replaced, keep calls going through the table.
+  if (function->tier() != GuestFunction::Tier::kBaseline) {
+    code_cache->LinkCallSites(function->address(),
+                              static_cast<uint32_t>(host_address));
+  }
+
+  // The replaced code, such as baseline code after tiering up, is now only
+  // reachable from return addresses on the stacks of guest threads. Without
+  // linked calls other code may call it directly.
+  if (old_machine_code && old_machine_code != machine_code && reclaim_code) {
+    code_cache->RetireCode(old_machine_code);
+    x64_backend_->ReclaimRetiredCode();
+  }
 
   return true;
 }
@@ -13,6 +13,7 @@
 #include <memory>
 #include <vector>
 
+#include "xenia/base/mutex.h"
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/backend/assembler.h"
 #include "xenia/cpu/function.h"
@@ -35,9 +36,11 @@ class X64Assembler : public Assembler {
 
   void Reset() override;
 
-  bool Assemble(GuestFunction* function, hir::HIRBuilder* builder,
-                uint32_t debug_info_flags,
-                std::unique_ptr<FunctionDebugInfo> debug_info) override;
+  bool Assemble(
+      GuestFunction* function, hir::HIRBuilder* builder,
+      uint32_t debug_info_flags, std::unique_ptr<FunctionDebugInfo> debug_info,
+      const std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls,
+      uint32_t code_generation) override;
 
  private:
   void DumpMachineCode(void* machine_code, size_t code_size,
@@ -51,6 +54,8 @@ class X64Assembler : public Assembler {
   uintptr_t capstone_handle_;
 
   StringBuffer string_buffer_;
+
+  xe::global_critical_region global_critical_region_;
 };
 
 }  // namespace x64
@@ -13,9 +13,11 @@
 #include <algorithm>
 #include "third_party/capstone/include/capstone/capstone.h"
 #include "third_party/capstone/include/capstone/x86.h"
-
+#include "xenia/base/cvar.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/platform_amd64.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
@@ -27,6 +29,9 @@
 #include "xenia/cpu/stack_walker.h"
 #include "xenia/cpu/xex_module.h"
 
+// Autogenerated by `xb premake`.
+#include "build/version.h"
+
 DEFINE_bool(record_mmio_access_exceptions, true,
             "For guest addresses records whether we caught any mmio accesses "
             "for them. This info can then be used on a subsequent run to "
@@ -41,6 +46,19 @@ DEFINE_bool(enable_host_guest_stack_synchronization, true,
             "and checks for reentry at return sites. Has slight performance "
             "impact, but fixes crashes in games that use setjmp/longjmp.",
             "x64");
+DEFINE_bool(persistent_code_storage, false,
+            "Store translated guest code in the cache directory and reuse it "
+            "on the next launch of the same title, skipping translation of "
+            "those functions. Discarded whenever CPU/x64 options, the host "
+            "CPU or the emulator build change.",
+            "x64");
+DEFINE_bool(reclaim_code_cache, true,
+            "Reuse the space of translated code that has been replaced, such "
+            "as by an optimized or a new translation, once no guest thread "
+            "can be running it anymore. Guest threads check for that on "
+            "kernel calls.",
+            "x64");
+
 #if XE_X64_PROFILER_AVAILABLE == 1
 DECLARE_bool(instrument_call_times);
 #endif
@@ -136,6 +154,9 @@ X64Backend::X64Backend() : Backend(), code_cache_(nullptr) {
 }
 
 X64Backend::~X64Backend() {
+  if (code_cache_) {
+    code_cache_->ShutdownPersistentStorage();
+  }
   if (capstone_handle_) {
     cs_close(&capstone_handle_);
   }
@@ -236,6 +257,7 @@ bool X64Backend::Initialize(Processor* processor) {
   } else {
     machine_info_.supports_extended_load_store = false;
   }
+  machine_info_.total_store_order = true;
 
   auto& gprs = machine_info_.register_sets[0];
   gprs.id = 0;
@@ -1584,6 +1606,13 @@ void X64Backend::InitializeBackendContext(void* ctx) {
   bctx->Ox1000 = 0x1000;
   bctx->guest_tick_count = Clock::GetGuestTickCountPointer();
   bctx->reserve_helper_ = &reserve_helper_;
+  bctx->code_reclaim_epoch_ptr = code_cache_->reclaim_epoch_address();
+  bctx->code_reclaim_epoch = 0;
+  bctx->host_stack_base = nullptr;
+  bctx->host_call_stack = nullptr;
+  bctx->host_call_count = 0;
+  auto global_lock = global_critical_region_.Acquire();
+  backend_contexts_.push_back(bctx);
 }
 void X64Backend::DeinitializeBackendContext(void* ctx) {
   X64BackendContext* bctx = BackendContextForGuestContext(ctx);
@@ -1592,6 +1621,12 @@ void X64Backend::DeinitializeBackendContext(void* ctx) {
     delete[] bctx->stackpoints;
     bctx->stackpoints = nullptr;
   }
+  auto global_lock = global_critical_region_.Acquire();
+  auto it =
+      std::find(backend_contexts_.begin(), backend_contexts_.end(), bctx);
+  if (it != backend_contexts_.end()) {
+    backend_contexts_.erase(it);
+  }
 }
 
 void X64Backend::PrepareForReentry(void* ctx) {
@@ -1600,6 +1635,87 @@ void X64Backend::PrepareForReentry(void* ctx) {
   bctx->current_stackpoint_depth = 0;
 }
 
+void X64Backend::OnThreadExit(void* ctx) {
+  X64BackendContext* bctx = BackendContextForGuestContext(ctx);
+  // The thread may exit from within guest code, which then never returns.
+  auto global_lock = global_critical_region_.Acquire();
+  bctx->host_stack_base = nullptr;
+  bctx->host_call_stack = nullptr;
+}
+
+uint64_t* X64Backend::EnterGuestCode(X64BackendContext* bctx,
+                                     uint64_t* stack_base) {
+  uint64_t* host_call_stack = bctx->host_call_stack;
+  if (!bctx->host_stack_base) {
+    // Nothing retired so far can be on the stack of this thread. The machine
+    // code to call must be looked up after the stack base is visible to
+    // ReclaimRetiredCode.
+    bctx->code_reclaim_epoch = code_cache_->reclaim_epoch();
+    bctx->host_stack_base = stack_base;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  } else {
+    // Called back from a kernel call, its stack isn't stable anymore.
+    bctx->host_call_stack = nullptr;
+    bctx->host_call_count = bctx->host_call_count + 1;
+  }
+  return host_call_stack;
+}
+
+void X64Backend::LeaveGuestCode(X64BackendContext* bctx, uint64_t* stack_base,
+                                uint64_t* host_call_stack) {
+  if (bctx->host_stack_base == stack_base) {
+    // Not while another thread is scanning the stack.
+    auto global_lock = global_critical_region_.Acquire();
+    bctx->host_stack_base = nullptr;
+  } else {
+    bctx->host_call_stack = host_call_stack;
+  }
+}
+
+void X64Backend::AcknowledgeCodeReclaim(void* ctx) {
+  X64BackendContext* bctx = BackendContextForGuestContext(ctx);
+  auto global_lock = global_critical_region_.Acquire();
+  if (!bctx->host_stack_base) {
+    return;
+  }
+  uint64_t stack_marker = 0;
+  bctx->code_reclaim_epoch =
+      code_cache_->PinRetiredCode(&stack_marker, bctx->host_stack_base);
+  ReclaimRetiredCode();
+}
+
+void X64Backend::ReclaimRetiredCode() {
+  auto global_lock = global_critical_region_.Acquire();
+  uint64_t current_epoch = code_cache_->reclaim_epoch();
+  uint64_t oldest_epoch = current_epoch;
+  for (X64BackendContext* bctx : backend_contexts_) {
+    uint64_t* stack_base = bctx->host_stack_base;
+    if (!stack_base) {
+      continue;
+    }
+    if (bctx->code_reclaim_epoch < current_epoch) {
+      // Threads blocked in the kernel don't reach a safe point, so check
+      // their guest frames on their behalf. Valid only if the thread hasn't
+      // returned from the kernel call meanwhile.
+      uint64_t call_count = bctx->host_call_count;
+      uint64_t* call_stack = bctx->host_call_stack;
+      if (call_stack) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // Including the return address pushed by the call.
+        uint64_t epoch = code_cache_->PinRetiredCode(call_stack - 1,
+                                                     stack_base);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (bctx->host_call_count == call_count &&
+            bctx->host_call_stack == call_stack) {
+          bctx->code_reclaim_epoch = epoch;
+        }
+      }
+    }
+    oldest_epoch = std::min(oldest_epoch, uint64_t(bctx->code_reclaim_epoch));
+  }
+  code_cache_->ReclaimRetiredCode(oldest_epoch);
+}
+
 const uint32_t mxcsr_table[8] = {
     0x1F80, 0x7F80, 0x5F80, 0x3F80, 0x9F80, 0xFF80, 0xDF80, 0xBF80,
 };
@@ -1613,6 +1729,28 @@ void X64Backend::SetGuestRoundingMode(void* ctx, unsigned int mode) {
   auto ppc_context = ((ppc::PPCContext*)ctx);
   ppc_context->fpscr.bits.rn = control;
   ppc_context->fpscr.bits.ni = control >> 2;
+  if (control & 4) {
+    bctx->flags |= 1U << kX64BackendNonIEEEMode;
+  } else {
+    bctx->flags &= ~(1U << kX64BackendNonIEEEMode);
+  }
+}
+
+void X64Backend::SetGuestNonJavaMode(void* ctx, bool enabled) {
+  X64BackendContext* bctx = BackendContextForGuestContext(ctx);
+  // Same as OPCODE_SET_NJM, loaded by the next vector float instruction.
+  if (enabled) {
+    bctx->mxcsr_vmx = DEFAULT_VMX_MXCSR;
+    bctx->flags |= 1U << kX64BackendNJMOn;
+  } else {
+    bctx->mxcsr_vmx = _MM_MASK_MASK;
+    bctx->flags &= ~(1U << kX64BackendNJMOn);
+  }
+}
+
+bool X64Backend::GetGuestNonJavaMode(void* ctx) {
+  return (BackendContextForGuestContext(ctx)->flags &
+          (1U << kX64BackendNJMOn)) != 0;
 }
 
 bool X64Backend::PopulatePseudoStacktrace(GuestPseudoStackTrace* st) {
@@ -1712,6 +1850,96 @@ void X64Backend::FreeGuestTrampoline(uint32_t trampoline_addr) {
       (trampoline_addr - GUEST_TRAMPOLINE_BASE) / GUEST_TRAMPOLINE_MIN_LEN;
   guest_trampoline_address_bitmap_.Release(index);
 }
+
+bool X64Backend::InitializeCodeStorage(
+    const std::filesystem::path& storage_root, uint64_t module_hash,
+    uint32_t guest_low, uint32_t guest_high) {
+  if (!cvars::persistent_code_storage) {
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(storage_root, ec);
+
+  // Everything that can change the generated code must be part of the key.
+  XXH3_state_t hash_state;
+  XXH3_64bits_reset(&hash_state);
+  XXH3_64bits_update(&hash_state, &module_hash, sizeof(module_hash));
+  uint64_t feature_flags = amd64::GetFeatureFlags();
+  XXH3_64bits_update(&hash_state, &feature_flags, sizeof(feature_flags));
+  // Addresses in the host executable are relocated when the code is loaded,
+  // but only stay valid within the same build. Constant data is placed at a
+  // fixed address, and guest memory is only referenced through the membase
+  // register, except for its low 32 bits being used as zero.
+  static const char build_version[] =
+      XE_BUILD_BRANCH "@" XE_BUILD_COMMIT " on " XE_BUILD_DATE;
+  XXH3_64bits_update(&hash_state, build_version, sizeof(build_version));
+  uint64_t host_layout[] = {
+      uint64_t(emitter_data_),
+      uint64_t(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+                   processor()->memory()->virtual_membase())) == 0),
+  };
+  XXH3_64bits_update(&hash_state, host_layout, sizeof(host_layout));
+  if (cvar::ConfigVars) {
+    for (auto& it : *cvar::ConfigVars) {
+      auto config_var = it.second;
+      if (config_var->category() != "CPU" && config_var->category() != "x64") {
+        continue;
+      }
+      std::string value = it.first + "=" + config_var->config_value();
+      XXH3_64bits_update(&hash_state, value.data(), value.size());
+    }
+  }
+
+  return code_cache_->InitializePersistentStorage(
+      storage_root / "x64_code_storage.bin", XXH3_64bits_digest(&hash_state),
+      guest_low, guest_high);
+}
+
+bool X64Backend::RestoreGuestFunction(GuestFunction* function,
+                                      uint32_t code_generation) {
+  // Writes fault from before the stored code is compared with the guest code
+  // until it's published, and wait for the lock to invalidate it.
+  auto global_lock = global_critical_region_.Acquire();
+  uint32_t end_address;
+  std::vector<FunctionDebugInfo::InlinedCall> inlined_calls;
+  if (function->code_generation() != code_generation ||
+      !code_cache_->FindPersistentCode(function->address(), end_address,
+                                       inlined_calls)) {
+    return false;
+  }
+  processor_->WatchGuestCode(function->address(), end_address);
+  for (const auto& inlined_call : inlined_calls) {
+    processor_->WatchGuestCode(inlined_call.callee_address,
+                               inlined_call.callee_end_address);
+  }
+  void* machine_code;
+  size_t code_size;
+  if (!code_cache_->RestorePersistentCode(function, end_address, machine_code,
+                                          code_size)) {
+    return false;
+  }
+  function->set_end_address(end_address);
+  function->set_inlined_calls(inlined_calls);
+  static_cast<X64Function*>(function)->Setup(
+      reinterpret_cast<uint8_t*>(machine_code), code_size);
+  uint32_t host_address =
+      static_cast<uint32_t>(reinterpret_cast<uintptr_t>(machine_code));
+  code_cache_->AddIndirection(function->address(), host_address);
+  code_cache_->LinkCallSites(function->address(), host_address);
+  return true;
+}
+
+void X64Backend::InvalidateGuestFunction(uint32_t guest_address) {
+  code_cache_->UnlinkCallSites(guest_address);
+  code_cache_->RemoveIndirection(guest_address);
+}
+
+void X64Backend::DiscardGuestFunction(GuestFunction* function) {
+  code_cache_->DiscardPersistentCode(function->address());
+  code_cache_->RetireCodeData(
+      static_cast<X64Function*>(function)->DiscardDerivedData());
+}
+
 }  // namespace x64
 }  // namespace backend
 }  // namespace cpu
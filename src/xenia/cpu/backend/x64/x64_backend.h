@@ -10,10 +10,13 @@
 #ifndef XENIA_CPU_BACKEND_X64_X64_BACKEND_H_
 #define XENIA_CPU_BACKEND_X64_X64_BACKEND_H_
 
+#include <atomic>
 #include <memory>
+#include <vector>
 
 #include "xenia/base/bit_map.h"
 #include "xenia/base/cvar.h"
+#include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/backend.h"
 
 #if XE_PLATFORM_WIN32 == 1
@@ -27,6 +30,7 @@
 DECLARE_int64(x64_extension_mask);
 DECLARE_int64(max_stackpoints);
 DECLARE_bool(enable_host_guest_stack_synchronization);
+DECLARE_bool(reclaim_code_cache);
 namespace xe {
 class Exception;
 }  // namespace xe
@@ -111,6 +115,16 @@ struct X64BackendContext {
   unsigned int flags;
   unsigned int Ox1000;  // constant 0x1000 so we can shrink each tail emitted
                         // add of it by... 2 bytes lol
+  // Reclamation of replaced code, see X64CodeCache::RetireCode. The epoch
+  // fields are read by other threads.
+  const std::atomic<uint64_t>* code_reclaim_epoch_ptr;
+  // Newest epoch whose retired code isn't on the host stack of this thread.
+  volatile uint64_t code_reclaim_epoch;
+  // Outermost frame of guest code on the host stack, null outside of it.
+  uint64_t* volatile host_stack_base;
+  // rsp during a call into the kernel, null otherwise.
+  uint64_t* volatile host_call_stack;
+  volatile uint64_t host_call_count;
 };
 constexpr unsigned int DEFAULT_VMX_MXCSR =
     0x8000 |                   // flush to zero
@@ -168,6 +182,7 @@ class X64Backend : public Backend {
   virtual void InitializeBackendContext(void* ctx) override;
   virtual void DeinitializeBackendContext(void* ctx) override;
   virtual void PrepareForReentry(void* ctx) override;
+  void OnThreadExit(void* ctx) override;
   X64BackendContext* BackendContextForGuestContext(void* ctx) {
     return reinterpret_cast<X64BackendContext*>(
         reinterpret_cast<intptr_t>(ctx) - sizeof(X64BackendContext));
@@ -178,7 +193,26 @@ class X64Backend : public Backend {
 
   virtual void FreeGuestTrampoline(uint32_t trampoline_addr) override;
   virtual void SetGuestRoundingMode(void* ctx, unsigned int mode) override;
+  void SetGuestNonJavaMode(void* ctx, bool enabled) override;
+  bool GetGuestNonJavaMode(void* ctx) override;
   virtual bool PopulatePseudoStacktrace(GuestPseudoStackTrace* st) override;
+  bool InitializeCodeStorage(const std::filesystem::path& storage_root,
+                             uint64_t module_hash, uint32_t guest_low,
+                             uint32_t guest_high) override;
+  bool RestoreGuestFunction(GuestFunction* function,
+                            uint32_t code_generation) override;
+  void InvalidateGuestFunction(uint32_t guest_address) override;
+  void DiscardGuestFunction(GuestFunction* function) override;
+  // Bracket guest code called from the host. stack_base is a local of the
+  // caller, the host stack above it is never scanned for retired code.
+  uint64_t* EnterGuestCode(X64BackendContext* bctx, uint64_t* stack_base);
+  void LeaveGuestCode(X64BackendContext* bctx, uint64_t* stack_base,
+                      uint64_t* host_call_stack);
+  // Called by guest code on the thread of ctx when the reclaim epoch has
+  // changed.
+  void AcknowledgeCodeReclaim(void* ctx);
+  // Frees retired code that no thread can be running anymore.
+  void ReclaimRetiredCode();
   void RecordMMIOExceptionForGuestInstruction(void* host_address);
 
   uint32_t LookupXMMConstantAddress32(unsigned index) {
@@ -228,6 +262,9 @@ class X64Backend : public Backend {
   // range that will be used to dispatch to host code
   BitMap guest_trampoline_address_bitmap_;
   uint8_t* guest_trampoline_memory_;
+
+  xe::global_critical_region global_critical_region_;
+  std::vector<X64BackendContext*> backend_contexts_;
 };
 
 }  // namespace x64
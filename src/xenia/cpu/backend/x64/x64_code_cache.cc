@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 
@@ -19,13 +20,18 @@
 
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/literals.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/xxhash.h"
+#include "xenia/cpu/backend/x64/x64_function.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/module.h"
+#include "xenia/memory.h"
 
 namespace xe {
 namespace cpu {
@@ -34,6 +40,40 @@ namespace x64 {
 
 using namespace xe::literals;
 
+// 'XEJC'.
+static const uint32_t kPersistentStorageMagic = 0x434A4558;
+
+struct PersistentStorageHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint64_t host_code_end;
+  uint64_t host_code_layout_hash;
+  // Space taken in the cache by all entries.
+  uint64_t code_size;
+  uint64_t entry_count;
+  // Hash of the machine code of all entries, in order.
+  uint64_t code_hash;
+  // Stored after the code.
+  uint64_t relocation_count;
+  uint64_t inlined_call_count;
+  uint64_t call_site_count;
+};
+
+// Addresses in the host executable are stored relative to this, as it may be
+// loaded at a different address in every launch.
+static uintptr_t HostImageAnchor() {
+  return reinterpret_cast<uintptr_t>(&kPersistentStorageMagic);
+}
+
+// Catches stored addresses in the host executable that don't point to the same
+// function or data anymore, which the storage key should already prevent.
+static constexpr size_t kHostImageHashSize = 16;
+static uint64_t HostImageHash(uintptr_t address) {
+  return XXH3_64bits(reinterpret_cast<const void*>(address),
+                     kHostImageHashSize);
+}
+
 X64CodeCache::X64CodeCache() = default;
 
 X64CodeCache::~X64CodeCache() {
@@ -136,9 +176,15 @@ void X64CodeCache::AddIndirection(uint32_t guest_address,
     return;
   }
 
+  // Retranslated hot functions replace their slot while guest threads may be
+  // calling through it.
   uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
       indirection_table_base_ + (guest_address - kIndirectionTableBase));
-  *indirection_slot = host_address;
+  xe::atomic_exchange(host_address, indirection_slot);
+}
+
+void X64CodeCache::RemoveIndirection(uint32_t guest_address) {
+  AddIndirection(guest_address, indirection_default_value_);
 }
 
 void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
@@ -160,6 +206,32 @@ void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
   }
 }
 
+void X64CodeCache::CommitGeneratedCode(size_t high_mark) {
+  // If we are going above the high water mark of committed memory, commit some
+  // more. It's ok if multiple threads do this, as redundant commits aren't
+  // harmful.
+  size_t old_commit_mark, new_commit_mark;
+  do {
+    old_commit_mark = generated_code_commit_mark_;
+    if (high_mark <= old_commit_mark) break;
+
+    new_commit_mark = old_commit_mark + 16_MiB;
+    if (generated_code_execute_base_ == generated_code_write_base_) {
+      xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
+                             xe::memory::AllocationType::kCommit,
+                             xe::memory::PageAccess::kExecuteReadWrite);
+    } else {
+      xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
+                             xe::memory::AllocationType::kCommit,
+                             xe::memory::PageAccess::kExecuteReadOnly);
+      xe::memory::AllocFixed(generated_code_write_base_, new_commit_mark,
+                             xe::memory::AllocationType::kCommit,
+                             xe::memory::PageAccess::kReadWrite);
+    }
+  } while (generated_code_commit_mark_.compare_exchange_weak(old_commit_mark,
+                                                             new_commit_mark));
+}
+
 void X64CodeCache::PlaceHostCode(uint32_t guest_address, void* machine_code,
                                  const EmitFunctionInfo& func_info,
                                  void*& code_execute_address_out,
@@ -170,11 +242,12 @@ void X64CodeCache::PlaceHostCode(uint32_t guest_address, void* machine_code,
                  code_execute_address_out, code_write_address_out);
 }
 
-void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
-                                  const EmitFunctionInfo& func_info,
-                                  GuestFunction* function_info,
-                                  void*& code_execute_address_out,
-                                  void*& code_write_address_out) {
+void X64CodeCache::PlaceGuestCode(
+    uint32_t guest_address, void* machine_code,
+    const EmitFunctionInfo& func_info, GuestFunction* function_info,
+    void*& code_execute_address_out, void*& code_write_address_out,
+    const std::vector<CodeRelocation>* relocations,
+    const std::vector<FunctionDebugInfo::InlinedCall>* inlined_calls) {
   // Hold a lock while we bump the pointers up. This is important as the
   // unwind table requires entries AND code to be sorted in order.
   size_t low_mark;
@@ -184,67 +257,112 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
   {
     auto global_lock = global_critical_region_.Acquire();
 
-    low_mark = generated_code_offset_;
+    // Guest code may take the place of reclaimed code, keeping its entries in
+    // the map and the unwind table, so they stay sorted.
+    size_t code_reserved_size = xe::round_up(func_info.code_size.total, 16);
+    bool reused = function_info &&
+                  TakeFreeCode(code_reserved_size + unwind_reservation_size(),
+                               low_mark, high_mark);
+    if (!reused) {
+      low_mark = generated_code_offset_;
+      if (!retired_code_.empty()) {
+        // Retired code may be pinned by an old epoch.
+        uint64_t now_millis = Clock::QueryHostUptimeMillis();
+        if (now_millis - reclaim_epoch_start_millis_ >=
+            kPinnedCodeRecheckMillis) {
+          reclaim_epoch_start_millis_ = now_millis;
+          ++reclaim_epoch_;
+        }
+      }
+      if (low_mark + code_reserved_size + unwind_reservation_size() >
+          kGeneratedCodeSize) {
+        xe::FatalError(
+            "Generated code exceeded the size of the code cache! Please "
+            "report this to Xenia/Canary developers");
+      }
+    }
 
     // Reserve code.
     // Always move the code to land on 16b alignment.
-    code_execute_address =
-        generated_code_execute_base_ + generated_code_offset_;
+    code_execute_address = generated_code_execute_base_ + low_mark;
     code_execute_address_out = code_execute_address;
-    uint8_t* code_write_address =
-        generated_code_write_base_ + generated_code_offset_;
+    uint8_t* code_write_address = generated_code_write_base_ + low_mark;
     code_write_address_out = code_write_address;
-    generated_code_offset_ += xe::round_up(func_info.code_size.total, 16);
+    auto tail_write_address = code_write_address + code_reserved_size;
 
-    auto tail_write_address =
-        generated_code_write_base_ + generated_code_offset_;
+    if (reused) {
+      unwind_reservation =
+          ReuseUnwindReservation(tail_write_address, uint32_t(low_mark));
+      auto map_it = std::lower_bound(
+          generated_code_map_.begin(), generated_code_map_.end(),
+          uint64_t(low_mark) << 32,
+          [](const std::pair<uint64_t, GuestFunction*>& element,
+             uint64_t key) { return element.first < key; });
+      assert_true(map_it != generated_code_map_.end() &&
+                  uint32_t(map_it->first >> 32) == low_mark);
+      map_it->second = function_info;
+    } else {
+      generated_code_offset_ += code_reserved_size;
 
-    // Reserve unwind info.
-    // We go on the high size of the unwind info as we don't know how big we
-    // need it, and a few extra bytes of padding isn't the worst thing.
-    unwind_reservation = RequestUnwindReservation(generated_code_write_base_ +
-                                                  generated_code_offset_);
-    generated_code_offset_ += xe::round_up(unwind_reservation.data_size, 16);
+      // Reserve unwind info.
+      // We go on the high size of the unwind info as we don't know how big we
+      // need it, and a few extra bytes of padding isn't the worst thing.
+      unwind_reservation = RequestUnwindReservation(generated_code_write_base_ +
+                                                    generated_code_offset_);
+      generated_code_offset_ += xe::round_up(unwind_reservation.data_size, 16);
 
-    auto end_write_address =
-        generated_code_write_base_ + generated_code_offset_;
+      high_mark = generated_code_offset_;
 
-    high_mark = generated_code_offset_;
+      // Store in map. It is maintained in sorted order of host PC dependent
+      // on us also being append-only.
+      generated_code_map_.emplace_back(
+          (uint64_t(code_execute_address - generated_code_execute_base_)
+           << 32) |
+              generated_code_offset_,
+          function_info);
+    }
 
-    // Store in map. It is maintained in sorted order of host PC dependent on
-    // us also being append-only.
-    generated_code_map_.emplace_back(
-        (uint64_t(code_execute_address - generated_code_execute_base_) << 32) |
-            generated_code_offset_,
-        function_info);
+    auto end_write_address = generated_code_write_base_ + high_mark;
+
+    // Remember code that can be reused by later sessions. Stored code is kept
+    // in placement order, so it must be appended.
+    if (function_info) {
+      PersistentStorage* storage = FindPersistentStorage(guest_address);
+      std::vector<PersistentRelocation> persistent_relocations;
+      bool persistent =
+          storage && !reused && func_info.persistent &&
+          !storage->discarded_addresses.count(guest_address) &&
+          GetPersistentRelocations(*storage, low_mark, relocations,
+                                   persistent_relocations);
+      if (persistent) {
+        PersistentCodeEntry entry;
+        entry.guest_address = guest_address;
+        entry.guest_end_address = function_info->end_address();
+        entry.code_offset = uint32_t(low_mark);
+        entry.reserved_size = uint32_t(high_mark - low_mark);
+        std::vector<FunctionDebugInfo::InlinedCall> entry_inlined_calls;
+        if (inlined_calls) {
+          entry_inlined_calls = *inlined_calls;
+        }
+        entry.guest_code_hash = GuestCodeHash(
+            function_info, entry.guest_end_address, entry_inlined_calls);
+        entry.relocation_count = uint32_t(persistent_relocations.size());
+        entry.inlined_call_count = uint32_t(entry_inlined_calls.size());
+        entry.func_info = func_info;
+        storage->entry_indices[guest_address] = storage->entries.size();
+        storage->entries.push_back(entry);
+        storage->relocations.push_back(std::move(persistent_relocations));
+        storage->inlined_calls.push_back(std::move(entry_inlined_calls));
+        storage->dirty = true;
+      }
+      static_cast<X64Function*>(function_info)->set_persistent_code(persistent);
+    }
 
     // TODO(DrChat): The following code doesn't really need to be under the
     // global lock except for PlaceCode (but it depends on the previous code
     // already being ran)
 
-    // If we are going above the high water mark of committed memory, commit
-    // some more. It's ok if multiple threads do this, as redundant commits
-    // aren't harmful.
-    size_t old_commit_mark, new_commit_mark;
-    do {
-      old_commit_mark = generated_code_commit_mark_;
-      if (high_mark <= old_commit_mark) break;
-
-      new_commit_mark = old_commit_mark + 16_MiB;
-      if (generated_code_execute_base_ == generated_code_write_base_) {
-        xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kExecuteReadWrite);
-      } else {
-        xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kExecuteReadOnly);
-        xe::memory::AllocFixed(generated_code_write_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kReadWrite);
-      }
-    } while (generated_code_commit_mark_.compare_exchange_weak(
-        old_commit_mark, new_commit_mark));
+    CommitGeneratedCode(high_mark);
 
     // Copy code.
     std::memcpy(code_write_address, machine_code, func_info.code_size.total);
@@ -281,8 +399,9 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
 
   // Now that everything is ready, fix up the indirection table.
   // Note that we do support code that doesn't have an indirection fixup, so
-  // ignore those when we see them.
-  if (guest_address && indirection_table_base_) {
+  // ignore those when we see them. Guest functions are installed by their
+  // assembler once the code may be published.
+  if (guest_address && indirection_table_base_ && !function_info) {
     uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
         indirection_table_base_ + (guest_address - kIndirectionTableBase));
     *indirection_slot =
@@ -305,29 +424,7 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
     high_mark = generated_code_offset_;
   }
 
-  // If we are going above the high water mark of committed memory, commit some
-  // more. It's ok if multiple threads do this, as redundant commits aren't
-  // harmful.
-  size_t old_commit_mark, new_commit_mark;
-  do {
-    old_commit_mark = generated_code_commit_mark_;
-    if (high_mark <= old_commit_mark) break;
-
-    new_commit_mark = old_commit_mark + 16_MiB;
-    if (generated_code_execute_base_ == generated_code_write_base_) {
-      xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                             xe::memory::AllocationType::kCommit,
-                             xe::memory::PageAccess::kExecuteReadWrite);
-    } else {
-      xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                             xe::memory::AllocationType::kCommit,
-                             xe::memory::PageAccess::kExecuteReadOnly);
-      xe::memory::AllocFixed(generated_code_write_base_, new_commit_mark,
-                             xe::memory::AllocationType::kCommit,
-                             xe::memory::PageAccess::kReadWrite);
-    }
-  } while (generated_code_commit_mark_.compare_exchange_weak(old_commit_mark,
-                                                             new_commit_mark));
+  CommitGeneratedCode(high_mark);
 
   // Copy code.
   std::memcpy(data_address, data, length);
@@ -335,6 +432,65 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
   return uint32_t(uintptr_t(data_address));
 }
 
+void X64CodeCache::AddCallSite(uint32_t target_guest_address,
+                               uint8_t* operand_execute_address) {
+  assert_zero(reinterpret_cast<uintptr_t>(operand_execute_address) & 3);
+  CallSite site;
+  site.operand_offset =
+      uint32_t(operand_execute_address - generated_code_execute_base_);
+  int32_t stub_displacement;
+  std::memcpy(&stub_displacement,
+              generated_code_write_base_ + site.operand_offset,
+              sizeof(stub_displacement));
+  site.stub_offset =
+      uint32_t(int64_t(site.operand_offset) + 4 + stub_displacement);
+
+  auto global_lock = global_critical_region_.Acquire();
+  call_sites_[target_guest_address].push_back(site);
+  auto linked_it = linked_functions_.find(target_guest_address);
+  if (linked_it != linked_functions_.end()) {
+    PatchCallSite(site, linked_it->second);
+  }
+}
+
+void X64CodeCache::LinkCallSites(uint32_t guest_address,
+                                 uint32_t host_address) {
+  uint32_t target_offset =
+      host_address - uint32_t(uintptr_t(generated_code_execute_base_));
+  auto global_lock = global_critical_region_.Acquire();
+  linked_functions_[guest_address] = target_offset;
+  auto sites_it = call_sites_.find(guest_address);
+  if (sites_it != call_sites_.end()) {
+    for (const CallSite& site : sites_it->second) {
+      PatchCallSite(site, target_offset);
+    }
+  }
+}
+
+void X64CodeCache::UnlinkCallSites(uint32_t guest_address) {
+  auto global_lock = global_critical_region_.Acquire();
+  if (!linked_functions_.erase(guest_address)) {
+    return;
+  }
+  auto sites_it = call_sites_.find(guest_address);
+  if (sites_it != call_sites_.end()) {
+    for (const CallSite& site : sites_it->second) {
+      PatchCallSite(site, site.stub_offset);
+    }
+  }
+}
+
+void X64CodeCache::PatchCallSite(const CallSite& site, uint32_t target_offset) {
+  // The operand is aligned, so threads executing the call see either the old
+  // or the new target.
+  int32_t displacement =
+      int32_t(int64_t(target_offset) - (int64_t(site.operand_offset) + 4));
+  xe::atomic_exchange(
+      uint32_t(displacement),
+      reinterpret_cast<volatile uint32_t*>(generated_code_write_base_ +
+                                           site.operand_offset));
+}
+
 GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
   uint32_t key = uint32_t(host_pc - kGeneratedCodeExecuteBase);
   void* fn_entry = std::bsearch(
@@ -362,6 +518,786 @@ GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
   }
 }
 
+void X64CodeCache::RetireCode(const void* code_execute_address) {
+  uint32_t offset = uint32_t(reinterpret_cast<const uint8_t*>(
+                                 code_execute_address) -
+                             generated_code_execute_base_);
+  auto global_lock = global_critical_region_.Acquire();
+  auto map_it = std::lower_bound(
+      generated_code_map_.cbegin(), generated_code_map_.cend(),
+      uint64_t(offset) << 32,
+      [](const std::pair<uint64_t, GuestFunction*>& element, uint64_t key) {
+        return element.first < key;
+      });
+  if (map_it == generated_code_map_.cend() ||
+      uint32_t(map_it->first >> 32) != offset ||
+      FindPersistentEntry(offset)) {
+    return;
+  }
+  RetiredCode code;
+  code.offset = offset;
+  code.size = uint32_t(map_it->first) - offset;
+  code.epoch = reclaim_epoch_;
+  auto retired_it = std::lower_bound(
+      retired_code_.begin(), retired_code_.end(), offset,
+      [](const RetiredCode& code, uint32_t offset) {
+        return code.offset < offset;
+      });
+  if (retired_it != retired_code_.end() && retired_it->offset == offset) {
+    return;
+  }
+  retired_code_.insert(retired_it, code);
+  reclaim_epoch_start_millis_ = Clock::QueryHostUptimeMillis();
+  ++reclaim_epoch_;
+}
+
+uint64_t X64CodeCache::PinRetiredCode(const uint64_t* stack_low,
+                                      const uint64_t* stack_high) {
+  auto global_lock = global_critical_region_.Acquire();
+  uint64_t epoch = reclaim_epoch_;
+  if (retired_code_.empty()) {
+    return epoch;
+  }
+  uint64_t code_low =
+      uint64_t(generated_code_execute_base_) + retired_code_.front().offset;
+  uint64_t code_high = uint64_t(generated_code_execute_base_) +
+                       retired_code_.back().offset + retired_code_.back().size;
+  for (const uint64_t* slot = stack_low; slot < stack_high; ++slot) {
+    uint64_t value = *slot;
+    if (value < code_low || value >= code_high) {
+      continue;
+    }
+    uint32_t offset = uint32_t(value - uint64_t(generated_code_execute_base_));
+    auto retired_it = std::upper_bound(
+        retired_code_.begin(), retired_code_.end(), offset,
+        [](uint32_t offset, const RetiredCode& code) {
+          return offset < code.offset;
+        });
+    if (retired_it != retired_code_.begin() &&
+        offset < (--retired_it)->offset + retired_it->size) {
+      retired_it->epoch = epoch;
+    }
+  }
+  return epoch;
+}
+
+void X64CodeCache::ReclaimRetiredCode(uint64_t oldest_acknowledged_epoch) {
+  auto global_lock = global_critical_region_.Acquire();
+  retired_code_data_.erase(
+      std::remove_if(retired_code_data_.begin(), retired_code_data_.end(),
+                     [oldest_acknowledged_epoch](const RetiredCodeData& data) {
+                       return data.epoch < oldest_acknowledged_epoch;
+                     }),
+      retired_code_data_.end());
+  std::vector<RetiredCode> reclaimed;
+  size_t retired_count = 0;
+  for (const RetiredCode& code : retired_code_) {
+    if (code.epoch < oldest_acknowledged_epoch) {
+      reclaimed.push_back(code);
+    } else {
+      retired_code_[retired_count++] = code;
+    }
+  }
+  if (reclaimed.empty()) {
+    return;
+  }
+  retired_code_.resize(retired_count);
+
+  auto find_reclaimed = [&reclaimed](uint32_t offset) {
+    auto it = std::upper_bound(reclaimed.cbegin(), reclaimed.cend(), offset,
+                               [](uint32_t offset, const RetiredCode& code) {
+                                 return offset < code.offset;
+                               });
+    return it != reclaimed.cbegin() &&
+           offset < (it - 1)->offset + (it - 1)->size;
+  };
+  // Calls from the code must not be patched anymore.
+  for (auto& sites : call_sites_) {
+    sites.second.erase(
+        std::remove_if(sites.second.begin(), sites.second.end(),
+                       [&find_reclaimed](const CallSite& site) {
+                         return find_reclaimed(site.operand_offset);
+                       }),
+        sites.second.end());
+  }
+  for (const RetiredCode& code : reclaimed) {
+    auto map_it = std::lower_bound(
+        generated_code_map_.begin(), generated_code_map_.end(),
+        uint64_t(code.offset) << 32,
+        [](const std::pair<uint64_t, GuestFunction*>& element, uint64_t key) {
+          return element.first < key;
+        });
+    map_it->second = nullptr;
+    std::memset(generated_code_write_base_ + code.offset, 0xCC, code.size);
+    free_code_[xe::log2_floor(code.size)].push_back(code);
+  }
+}
+
+void X64CodeCache::RetireCodeData(std::shared_ptr<void> data) {
+  auto global_lock = global_critical_region_.Acquire();
+  retired_code_data_.push_back({reclaim_epoch_, std::move(data)});
+  reclaim_epoch_start_millis_ = Clock::QueryHostUptimeMillis();
+  ++reclaim_epoch_;
+}
+
+bool X64CodeCache::TakeFreeCode(size_t size, size_t& offset_out,
+                                size_t& end_offset_out) {
+  // Not from much larger code, as the rest of it would be wasted.
+  uint32_t size_class = xe::log2_floor(uint32_t(size));
+  for (uint32_t i = size_class;
+       i < std::min(size_class + 2, kFreeCodeSizeClassCount); ++i) {
+    auto& free_list = free_code_[i];
+    for (size_t j = 0; j < free_list.size(); ++j) {
+      if (free_list[j].size < size) {
+        continue;
+      }
+      offset_out = free_list[j].offset;
+      end_offset_out = size_t(free_list[j].offset) + free_list[j].size;
+      free_list[j] = free_list.back();
+      free_list.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool X64CodeCache::InitializePersistentStorage(
+    const std::filesystem::path& storage_path, uint64_t storage_key,
+    uint32_t guest_low, uint32_t guest_high) {
+  auto global_lock = global_critical_region_.Acquire();
+  for (const auto& storage : persistent_storages_) {
+    if (storage->path == storage_path ||
+        (guest_low < storage->guest_high && storage->guest_low < guest_high)) {
+      return false;
+    }
+  }
+
+  if (persistent_storages_.empty()) {
+    // Stored code calls the thunks and helpers of the backend placed before.
+    persistent_host_code_end_ = generated_code_offset_;
+    XXH3_state_t hash_state;
+    XXH3_64bits_reset(&hash_state);
+    for (const auto& map_entry : generated_code_map_) {
+      XXH3_64bits_update(&hash_state, &map_entry.first,
+                         sizeof(map_entry.first));
+    }
+    persistent_host_code_layout_hash_ = XXH3_64bits_digest(&hash_state);
+  }
+
+  auto storage = std::make_unique<PersistentStorage>();
+  storage->path = storage_path;
+  storage->key = storage_key;
+  storage->guest_low = guest_low;
+  storage->guest_high = guest_high;
+  if (std::filesystem::exists(storage->path) &&
+      !LoadPersistentStorage(*storage)) {
+    XELOGI("Discarding stale persistent code storage {}",
+           xe::path_to_utf8(storage->path));
+    std::error_code ec;
+    std::filesystem::remove(storage->path, ec);
+  }
+  persistent_storages_.push_back(std::move(storage));
+  return true;
+}
+
+bool X64CodeCache::LoadPersistentStorage(PersistentStorage& storage) {
+  FILE* file = xe::filesystem::OpenFile(storage.path, "rb");
+  if (!file) {
+    return false;
+  }
+
+  size_t base_offset = generated_code_offset_;
+  PersistentStorageHeader header;
+  if (!fread(&header, sizeof(header), 1, file) ||
+      header.magic != kPersistentStorageMagic ||
+      header.version != kPersistentStorageVersion ||
+      header.key != storage.key ||
+      header.host_code_end != persistent_host_code_end_ ||
+      header.host_code_layout_hash != persistent_host_code_layout_hash_ ||
+      header.code_size > kGeneratedCodeSize - base_offset ||
+      header.entry_count > kMaximumFunctionCount ||
+      header.relocation_count > header.code_size / 4 ||
+      header.inlined_call_count > header.code_size / 4 ||
+      header.call_site_count > header.code_size / 4) {
+    fclose(file);
+    return false;
+  }
+
+  std::vector<PersistentCodeEntry> entries(size_t(header.entry_count));
+  if (entries.size() &&
+      fread(entries.data(), sizeof(PersistentCodeEntry), entries.size(),
+            file) != entries.size()) {
+    fclose(file);
+    return false;
+  }
+
+  // Entries must be in placement order and fit within the stored range.
+  size_t code_total = 0;
+  size_t relocation_total = 0;
+  size_t inlined_call_total = 0;
+  size_t next_offset = 0;
+  for (const auto& entry : entries) {
+    if (entry.code_offset < next_offset ||
+        entry.func_info.code_size.total > entry.reserved_size ||
+        entry.guest_address < storage.guest_low ||
+        entry.guest_address >= storage.guest_high) {
+      fclose(file);
+      return false;
+    }
+    next_offset = size_t(entry.code_offset) + entry.reserved_size;
+    code_total += entry.func_info.code_size.total;
+    relocation_total += entry.relocation_count;
+    inlined_call_total += entry.inlined_call_count;
+  }
+  if (next_offset > header.code_size ||
+      relocation_total != header.relocation_count ||
+      inlined_call_total != header.inlined_call_count) {
+    fclose(file);
+    return false;
+  }
+
+  std::vector<uint8_t> code(code_total);
+  bool code_read =
+      !code_total || fread(code.data(), code_total, 1, file) == 1;
+  std::vector<PersistentRelocation> relocations(relocation_total);
+  if (code_read && !relocations.empty()) {
+    code_read = fread(relocations.data(), sizeof(PersistentRelocation),
+                      relocations.size(), file) == relocations.size();
+  }
+  std::vector<FunctionDebugInfo::InlinedCall> inlined_calls(inlined_call_total);
+  if (code_read && !inlined_calls.empty()) {
+    code_read =
+        fread(inlined_calls.data(), sizeof(FunctionDebugInfo::InlinedCall),
+              inlined_calls.size(), file) == inlined_calls.size();
+  }
+  std::vector<PersistentCallSite> stored_call_sites(
+      size_t(header.call_site_count));
+  if (code_read && !stored_call_sites.empty()) {
+    code_read = fread(stored_call_sites.data(), sizeof(PersistentCallSite),
+                      stored_call_sites.size(),
+                      file) == stored_call_sites.size();
+  }
+  fclose(file);
+  if (!code_read || XXH3_64bits(code.data(), code_total) != header.code_hash) {
+    return false;
+  }
+
+  // Every relocation must patch its own entry and target something that is
+  // still there.
+  std::unordered_map<int64_t, bool> host_image_targets;
+  const PersistentRelocation* relocation = relocations.data();
+  for (const auto& entry : entries) {
+    for (uint32_t i = 0; i < entry.relocation_count; ++i, ++relocation) {
+      size_t size =
+          relocation->type == PersistentRelocation::Type::kHostImage ? 8 : 4;
+      if (relocation->offset < entry.code_offset ||
+          size_t(relocation->offset) + size >
+              size_t(entry.code_offset) + entry.func_info.code_size.total) {
+        return false;
+      }
+      switch (relocation->type) {
+        case PersistentRelocation::Type::kHostImage: {
+          auto target_it = host_image_targets.find(relocation->target);
+          if (target_it == host_image_targets.end()) {
+            target_it =
+                host_image_targets
+                    .emplace(relocation->target,
+                             HostImageHash(HostImageAnchor() +
+                                           relocation->target) ==
+                                 relocation->target_hash)
+                    .first;
+          }
+          if (!target_it->second) {
+            return false;
+          }
+        } break;
+        case PersistentRelocation::Type::kHostCode:
+          if (relocation->target < 0 ||
+              uint64_t(relocation->target) >= persistent_host_code_end_) {
+            return false;
+          }
+          break;
+        case PersistentRelocation::Type::kStoredCode:
+          if (relocation->target < 0 ||
+              !FindPersistentEntry(entries, size_t(relocation->target))) {
+            return false;
+          }
+          break;
+        default:
+          return false;
+      }
+    }
+  }
+  // Inlined callees are hashed with the function, so they must be within the
+  // guest code of the module.
+  for (const auto& inlined_call : inlined_calls) {
+    if (inlined_call.callee_address < storage.guest_low ||
+        inlined_call.callee_end_address >= storage.guest_high ||
+        inlined_call.callee_end_address < inlined_call.callee_address) {
+      return false;
+    }
+  }
+
+  size_t end_offset = base_offset + size_t(header.code_size);
+  CommitGeneratedCode(end_offset);
+  std::memset(generated_code_write_base_ + base_offset, 0xCC,
+              end_offset - base_offset);
+
+  const uint8_t* code_ptr = code.data();
+  relocation = relocations.data();
+  const FunctionDebugInfo::InlinedCall* inlined_call = inlined_calls.data();
+  for (auto entry : entries) {
+    entry.code_offset += uint32_t(base_offset);
+    size_t code_size = entry.func_info.code_size.total;
+    uint8_t* code_execute_address =
+        generated_code_execute_base_ + entry.code_offset;
+    uint8_t* code_write_address =
+        generated_code_write_base_ + entry.code_offset;
+    std::memcpy(code_write_address, code_ptr, code_size);
+    code_ptr += code_size;
+
+    // Relocated to where the host executable and the code are now.
+    std::vector<PersistentRelocation> entry_relocations(
+        relocation, relocation + entry.relocation_count);
+    relocation += entry.relocation_count;
+    for (PersistentRelocation& entry_relocation : entry_relocations) {
+      entry_relocation.offset += uint32_t(base_offset);
+      uint8_t* patch_address =
+          generated_code_write_base_ + entry_relocation.offset;
+      if (entry_relocation.type == PersistentRelocation::Type::kHostImage) {
+        uint64_t address = HostImageAnchor() + entry_relocation.target;
+        std::memcpy(patch_address, &address, sizeof(address));
+        continue;
+      }
+      if (entry_relocation.type == PersistentRelocation::Type::kStoredCode) {
+        entry_relocation.target += int64_t(base_offset);
+      }
+      int32_t displacement = int32_t(
+          entry_relocation.target - (int64_t(entry_relocation.offset) + 4));
+      std::memcpy(patch_address, &displacement, sizeof(displacement));
+    }
+
+    // Unwind info isn't stored, it's recreated the same way as when the code
+    // was first placed.
+    UnwindReservation unwind_reservation = RequestUnwindReservation(
+        code_write_address + xe::round_up(code_size, 16));
+    assert_true(xe::round_up(code_size, 16) +
+                    xe::round_up(unwind_reservation.data_size, 16) <=
+                entry.reserved_size);
+    PlaceCode(entry.guest_address, code_write_address, entry.func_info,
+              code_execute_address, unwind_reservation);
+
+    // The function object is attached once the function is demanded.
+    generated_code_map_.emplace_back(
+        (uint64_t(entry.code_offset) << 32) |
+            (entry.code_offset + entry.reserved_size),
+        nullptr);
+    storage.entry_indices[entry.guest_address] = storage.entries.size();
+    storage.entries.push_back(entry);
+    storage.relocations.push_back(std::move(entry_relocations));
+    storage.inlined_calls.emplace_back(
+        inlined_call, inlined_call + entry.inlined_call_count);
+    inlined_call += entry.inlined_call_count;
+  }
+  generated_code_offset_ = end_offset;
+
+  // Stored unlinked, linked again as their callees get code.
+  for (const PersistentCallSite& stored_site : stored_call_sites) {
+    size_t operand_offset = base_offset + stored_site.operand_offset;
+    if ((operand_offset & 3) ||
+        !FindPersistentEntry(storage.entries, operand_offset)) {
+      continue;
+    }
+    AddCallSite(stored_site.target_guest_address,
+                generated_code_execute_base_ + operand_offset);
+  }
+
+  XELOGI("Loaded {} functions from persistent code storage {}",
+         storage.entries.size(), xe::path_to_utf8(storage.path));
+  return true;
+}
+
+void X64CodeCache::ShutdownPersistentStorage() {
+  auto global_lock = global_critical_region_.Acquire();
+  if (persistent_storages_.empty()) {
+    return;
+  }
+  XELOGI("Persistent code storage: {} hits, {} misses",
+         uint32_t(persistent_hits_), uint32_t(persistent_misses_));
+
+  // Stored code must not depend on what gets linked in the next session, so
+  // it's stored unlinked, and linked again once the callees are restored or
+  // translated. Guest code doesn't run anymore at this point.
+  for (const auto& sites : call_sites_) {
+    for (const CallSite& site : sites.second) {
+      if (FindPersistentEntry(site.operand_offset)) {
+        PatchCallSite(site, site.stub_offset);
+      }
+    }
+  }
+  for (const auto& storage : persistent_storages_) {
+    if (storage->dirty) {
+      WritePersistentStorage(*storage);
+    }
+  }
+  persistent_storages_.clear();
+}
+
+void X64CodeCache::WritePersistentStorage(PersistentStorage& storage) {
+  // Code calling code that isn't stored can't be stored either.
+  size_t entry_count = storage.entries.size();
+  std::vector<bool> stored(entry_count, true);
+  bool stored_changed = true;
+  while (stored_changed) {
+    stored_changed = false;
+    for (size_t i = 0; i < entry_count; ++i) {
+      if (!stored[i]) {
+        continue;
+      }
+      for (const PersistentRelocation& relocation : storage.relocations[i]) {
+        if (relocation.type != PersistentRelocation::Type::kStoredCode) {
+          continue;
+        }
+        const PersistentCodeEntry* target =
+            FindPersistentEntry(storage.entries, size_t(relocation.target));
+        if (!target || !stored[target - storage.entries.data()]) {
+          stored[i] = false;
+          stored_changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  // Packed without the code of other modules and the code that isn't stored
+  // in between, with offsets from the start of the stored code.
+  std::vector<uint32_t> packed_offsets(entry_count);
+  uint32_t packed_size = 0;
+  for (size_t i = 0; i < entry_count; ++i) {
+    if (stored[i]) {
+      packed_offsets[i] = packed_size;
+      packed_size += storage.entries[i].reserved_size;
+    }
+  }
+  auto pack_offset = [&storage, &packed_offsets](size_t offset) {
+    const PersistentCodeEntry* entry =
+        FindPersistentEntry(storage.entries, offset);
+    return uint32_t(packed_offsets[entry - storage.entries.data()] +
+                    (offset - entry->code_offset));
+  };
+
+  std::vector<PersistentCodeEntry> packed_entries;
+  std::vector<PersistentRelocation> packed_relocations;
+  std::vector<FunctionDebugInfo::InlinedCall> packed_inlined_calls;
+  XXH3_state_t hash_state;
+  XXH3_64bits_reset(&hash_state);
+  for (size_t i = 0; i < entry_count; ++i) {
+    if (!stored[i]) {
+      continue;
+    }
+    const PersistentCodeEntry& entry = storage.entries[i];
+    XXH3_64bits_update(&hash_state,
+                       generated_code_write_base_ + entry.code_offset,
+                       entry.func_info.code_size.total);
+    PersistentCodeEntry packed_entry = entry;
+    packed_entry.code_offset = packed_offsets[i];
+    packed_entry.relocation_count = uint32_t(storage.relocations[i].size());
+    packed_entry.inlined_call_count =
+        uint32_t(storage.inlined_calls[i].size());
+    packed_entries.push_back(packed_entry);
+    packed_inlined_calls.insert(packed_inlined_calls.end(),
+                                storage.inlined_calls[i].cbegin(),
+                                storage.inlined_calls[i].cend());
+    for (PersistentRelocation relocation : storage.relocations[i]) {
+      relocation.offset = pack_offset(relocation.offset);
+      if (relocation.type == PersistentRelocation::Type::kStoredCode) {
+        relocation.target = pack_offset(size_t(relocation.target));
+      }
+      packed_relocations.push_back(relocation);
+    }
+  }
+
+  std::vector<PersistentCallSite> stored_call_sites;
+  for (const auto& sites : call_sites_) {
+    for (const CallSite& site : sites.second) {
+      const PersistentCodeEntry* entry =
+          FindPersistentEntry(storage.entries, site.operand_offset);
+      if (!entry || !stored[entry - storage.entries.data()]) {
+        continue;
+      }
+      PersistentCallSite stored_site;
+      stored_site.target_guest_address = sites.first;
+      stored_site.operand_offset = pack_offset(site.operand_offset);
+      stored_call_sites.push_back(stored_site);
+    }
+  }
+
+  PersistentStorageHeader header;
+  header.magic = kPersistentStorageMagic;
+  header.version = kPersistentStorageVersion;
+  header.key = storage.key;
+  header.host_code_end = persistent_host_code_end_;
+  header.host_code_layout_hash = persistent_host_code_layout_hash_;
+  header.code_size = packed_size;
+  header.entry_count = packed_entries.size();
+  header.code_hash = XXH3_64bits_digest(&hash_state);
+  header.relocation_count = packed_relocations.size();
+  header.inlined_call_count = packed_inlined_calls.size();
+  header.call_site_count = stored_call_sites.size();
+
+  FILE* file = xe::filesystem::OpenFile(storage.path, "wb");
+  if (!file) {
+    XELOGE("Failed to open persistent code storage {} for writing",
+           xe::path_to_utf8(storage.path));
+    return;
+  }
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+  if (written && !packed_entries.empty()) {
+    written = fwrite(packed_entries.data(), sizeof(PersistentCodeEntry),
+                     packed_entries.size(), file) == packed_entries.size();
+  }
+  for (size_t i = 0; i < entry_count; ++i) {
+    if (!written) {
+      break;
+    }
+    if (!stored[i]) {
+      continue;
+    }
+    const PersistentCodeEntry& entry = storage.entries[i];
+    written = fwrite(generated_code_write_base_ + entry.code_offset,
+                     entry.func_info.code_size.total, 1, file) == 1;
+  }
+  if (written && !packed_relocations.empty()) {
+    written = fwrite(packed_relocations.data(), sizeof(PersistentRelocation),
+                     packed_relocations.size(),
+                     file) == packed_relocations.size();
+  }
+  if (written && !packed_inlined_calls.empty()) {
+    written = fwrite(packed_inlined_calls.data(),
+                     sizeof(FunctionDebugInfo::InlinedCall),
+                     packed_inlined_calls.size(),
+                     file) == packed_inlined_calls.size();
+  }
+  if (written && !stored_call_sites.empty()) {
+    written = fwrite(stored_call_sites.data(), sizeof(PersistentCallSite),
+                     stored_call_sites.size(),
+                     file) == stored_call_sites.size();
+  }
+  fclose(file);
+  if (!written) {
+    XELOGE("Failed to write persistent code storage {}",
+           xe::path_to_utf8(storage.path));
+    std::error_code ec;
+    std::filesystem::remove(storage.path, ec);
+  }
+}
+
+X64CodeCache::PersistentStorage* X64CodeCache::FindPersistentStorage(
+    uint32_t guest_address) {
+  for (const auto& storage : persistent_storages_) {
+    if (guest_address >= storage->guest_low &&
+        guest_address < storage->guest_high) {
+      return storage.get();
+    }
+  }
+  return nullptr;
+}
+
+bool X64CodeCache::GetPersistentRelocations(
+    const PersistentStorage& storage, size_t code_offset,
+    const std::vector<CodeRelocation>* relocations,
+    std::vector<PersistentRelocation>& relocations_out) const {
+  relocations_out.clear();
+  if (!relocations) {
+    return true;
+  }
+  uintptr_t execute_base = uintptr_t(generated_code_execute_base_);
+  for (const CodeRelocation& relocation : *relocations) {
+    PersistentRelocation persistent_relocation;
+    persistent_relocation.offset = uint32_t(code_offset + relocation.offset);
+    persistent_relocation.target_hash = 0;
+    if (relocation.type == CodeRelocation::Type::kHostImage) {
+      persistent_relocation.type = PersistentRelocation::Type::kHostImage;
+      persistent_relocation.target =
+          int64_t(relocation.target) - int64_t(HostImageAnchor());
+      persistent_relocation.target_hash = HostImageHash(relocation.target);
+    } else {
+      if (relocation.target < execute_base) {
+        return false;
+      }
+      size_t target_offset = relocation.target - execute_base;
+      if (target_offset < persistent_host_code_end_) {
+        persistent_relocation.type = PersistentRelocation::Type::kHostCode;
+      } else if (FindPersistentEntry(storage.entries, target_offset)) {
+        persistent_relocation.type = PersistentRelocation::Type::kStoredCode;
+      } else {
+        // Code of another module, or not stored.
+        return false;
+      }
+      persistent_relocation.target = int64_t(target_offset);
+    }
+    relocations_out.push_back(persistent_relocation);
+  }
+  return true;
+}
+
+const X64CodeCache::PersistentCodeEntry* X64CodeCache::FindPersistentEntry(
+    const std::vector<PersistentCodeEntry>& entries, size_t code_offset) {
+  // Entries are in placement order.
+  auto it = std::upper_bound(
+      entries.cbegin(), entries.cend(), code_offset,
+      [](size_t offset, const PersistentCodeEntry& entry) {
+        return offset < entry.code_offset;
+      });
+  if (it == entries.cbegin()) {
+    return nullptr;
+  }
+  --it;
+  if (code_offset + 4 >
+      size_t(it->code_offset) + it->func_info.code_size.total) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+const X64CodeCache::PersistentCodeEntry* X64CodeCache::FindPersistentEntry(
+    size_t code_offset) const {
+  for (const auto& storage : persistent_storages_) {
+    const PersistentCodeEntry* entry =
+        FindPersistentEntry(storage->entries, code_offset);
+    if (entry) {
+      return entry;
+    }
+  }
+  return nullptr;
+}
+
+void X64CodeCache::DiscardPersistentCode(uint32_t guest_address) {
+  auto global_lock = global_critical_region_.Acquire();
+  PersistentStorage* storage = FindPersistentStorage(guest_address);
+  if (!storage) {
+    return;
+  }
+  // The stored code stays for later sessions, which start with the original
+  // guest code again.
+  storage->entry_indices.erase(guest_address);
+  storage->discarded_addresses.insert(guest_address);
+}
+
+void X64CodeCache::DropPersistentCode(const void* code_execute_address) {
+  auto global_lock = global_critical_region_.Acquire();
+  uint32_t offset = uint32_t(
+      reinterpret_cast<const uint8_t*>(code_execute_address) -
+      generated_code_execute_base_);
+  for (const auto& storage : persistent_storages_) {
+    auto it = std::find_if(
+        storage->entries.begin(), storage->entries.end(),
+        [offset](const PersistentCodeEntry& entry) {
+          return entry.code_offset == offset;
+        });
+    if (it == storage->entries.end()) {
+      continue;
+    }
+    // Later sessions don't get the space it takes in the cache.
+    size_t index = size_t(it - storage->entries.begin());
+    auto index_it = storage->entry_indices.find(it->guest_address);
+    if (index_it != storage->entry_indices.end() &&
+        index_it->second == index) {
+      storage->entry_indices.erase(index_it);
+    }
+    storage->entries.erase(it);
+    storage->relocations.erase(storage->relocations.begin() + index);
+    storage->inlined_calls.erase(storage->inlined_calls.begin() + index);
+    for (auto& entry_index : storage->entry_indices) {
+      if (entry_index.second > index) {
+        --entry_index.second;
+      }
+    }
+    storage->dirty = true;
+    return;
+  }
+}
+
+uint64_t X64CodeCache::GuestCodeHash(
+    GuestFunction* function, uint32_t end_address,
+    const std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls) const {
+  Memory* memory = function->module()->memory();
+  XXH3_state_t hash_state;
+  XXH3_64bits_reset(&hash_state);
+  XXH3_64bits_update(&hash_state,
+                     memory->TranslateVirtual(function->address()),
+                     end_address + 4 - function->address());
+  for (const auto& inlined_call : inlined_calls) {
+    XXH3_64bits_update(
+        &hash_state, memory->TranslateVirtual(inlined_call.callee_address),
+        inlined_call.callee_end_address + 4 - inlined_call.callee_address);
+  }
+  return XXH3_64bits_digest(&hash_state);
+}
+
+bool X64CodeCache::FindPersistentCode(
+    uint32_t guest_address, uint32_t& guest_end_address_out,
+    std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls_out) {
+  auto global_lock = global_critical_region_.Acquire();
+  PersistentStorage* storage = FindPersistentStorage(guest_address);
+  if (!storage) {
+    return false;
+  }
+  auto it = storage->entry_indices.find(guest_address);
+  if (it == storage->entry_indices.end()) {
+    return false;
+  }
+  guest_end_address_out = storage->entries[it->second].guest_end_address;
+  inlined_calls_out = storage->inlined_calls[it->second];
+  return true;
+}
+
+bool X64CodeCache::RestorePersistentCode(GuestFunction* function,
+                                         uint32_t& guest_end_address_out,
+                                         void*& code_execute_address_out,
+                                         size_t& code_size_out) {
+  auto global_lock = global_critical_region_.Acquire();
+  uint32_t guest_address = function->address();
+  PersistentStorage* storage = FindPersistentStorage(guest_address);
+  if (!storage) {
+    return false;
+  }
+  auto it = storage->entry_indices.find(guest_address);
+  if (it == storage->entry_indices.end()) {
+    ++persistent_misses_;
+    return false;
+  }
+  const PersistentCodeEntry& entry = storage->entries[it->second];
+  if (entry.guest_code_hash !=
+      GuestCodeHash(function, entry.guest_end_address,
+                    storage->inlined_calls[it->second])) {
+    // Modified before it was first run.
+    ++persistent_misses_;
+    return false;
+  }
+
+  // Attach the function to the map entry added at load time.
+  auto map_it = std::lower_bound(
+      generated_code_map_.begin(), generated_code_map_.end(),
+      uint64_t(entry.code_offset) << 32,
+      [](const std::pair<uint64_t, GuestFunction*>& element, uint64_t key) {
+        return element.first < key;
+      });
+  if (map_it != generated_code_map_.end() &&
+      uint32_t(map_it->first >> 32) == entry.code_offset) {
+    map_it->second = function;
+  }
+  static_cast<X64Function*>(function)->set_persistent_code(true);
+
+  guest_end_address_out = entry.guest_end_address;
+  code_execute_address_out = generated_code_execute_base_ + entry.code_offset;
+  code_size_out = entry.func_info.code_size.total;
+  ++persistent_hits_;
+  ReportPlacedCode(function, code_execute_address_out, code_size_out,
+                   nullptr);
+  return true;
+}
+
 }  // namespace x64
 }  // namespace backend
 }  // namespace cpu
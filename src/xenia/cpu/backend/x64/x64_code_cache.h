@@ -13,14 +13,18 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <filesystem>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/function_debug_info.h"
 
 namespace xe {
 namespace cpu {
@@ -37,6 +41,25 @@ struct EmitFunctionInfo {
   } code_size;
   size_t prolog_stack_alloc_offset;  // offset of instruction after stack alloc
   size_t stack_size;
+  // Whether the code may be written to the persistent code storage (doesn't
+  // reference anything that only lives for the current session).
+  bool persistent;
+};
+
+// Reference from emitted code to something outside of it, which must be
+// patched when stored code is placed at a different address or the host
+// executable is loaded at a different address.
+struct CodeRelocation {
+  enum class Type : uint32_t {
+    // 8 byte absolute address of a host function or data in the executable.
+    kHostImage,
+    // 4 byte rel32 operand of a call or jump to other code in the code cache.
+    kCodeCache,
+  };
+  Type type;
+  // Of the patched bytes, from the start of the code.
+  uint32_t offset;
+  uintptr_t target;
 };
 
 class X64CodeCache : public CodeCache {
@@ -53,13 +76,14 @@ class X64CodeCache : public CodeCache {
   }
   size_t total_size() const override { return kGeneratedCodeSize; }
 
-  // TODO(benvanik): ELF serialization/etc
   // TODO(benvanik): keep track of code blocks
   // TODO(benvanik): padding/guards/etc
 
   bool has_indirection_table() { return indirection_table_base_ != nullptr; }
   void set_indirection_default(uint32_t default_value);
   void AddIndirection(uint32_t guest_address, uint32_t host_address);
+  // Points the indirection table entry back to the resolve thunk.
+  void RemoveIndirection(uint32_t guest_address);
 
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high);
 
@@ -67,15 +91,98 @@ class X64CodeCache : public CodeCache {
                      const EmitFunctionInfo& func_info,
                      void*& code_execute_address_out,
                      void*& code_write_address_out);
-  void PlaceGuestCode(uint32_t guest_address, void* machine_code,
-                      const EmitFunctionInfo& func_info,
-                      GuestFunction* function_info,
-                      void*& code_execute_address_out,
-                      void*& code_write_address_out);
+  // relocations are needed for storing the code in the persistent code
+  // storage, code with references that can't be relocated isn't stored.
+  // inlined_calls are stored with it, as their guest code must be unmodified
+  // as well for the code to be restored.
+  void PlaceGuestCode(
+      uint32_t guest_address, void* machine_code,
+      const EmitFunctionInfo& func_info, GuestFunction* function_info,
+      void*& code_execute_address_out, void*& code_write_address_out,
+      const std::vector<CodeRelocation>* relocations = nullptr,
+      const std::vector<FunctionDebugInfo::InlinedCall>* inlined_calls =
+          nullptr);
   uint32_t PlaceData(const void* data, size_t length);
+  // Called once code placed with PlaceGuestCode or PlaceHostCode has been
+  // relocated, or restored from persistent storage, for host profilers (see
+  // perf_map and perf_jitdump). source_map is of the placed code, if any.
+  virtual void ReportPlacedCode(
+      GuestFunction* function_info, const void* code_execute_address,
+      size_t code_size, const std::vector<SourceMapEntry>* source_map) {}
+
+  // Direct call linking: guest calls are emitted as rel32 calls to a stub in
+  // the caller that loads the target from the indirection table. Once the
+  // callee has its final code, the operands of the calls to it are rewritten
+  // to call it directly, and pointed back to the stubs if it's invalidated.
+  // operand_execute_address is the 4 byte aligned rel32 operand of a placed
+  // call, currently targeting the stub.
+  void AddCallSite(uint32_t target_guest_address,
+                   uint8_t* operand_execute_address);
+  void LinkCallSites(uint32_t guest_address, uint32_t host_address);
+  void UnlinkCallSites(uint32_t guest_address);
 
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
+  // Code reclamation: guest code replaced by a new translation is retired,
+  // and its space is reused for new guest code once no guest thread can
+  // return into it anymore. Every retirement starts a new reclaim epoch, and
+  // threads acknowledge epochs after looking for return addresses into
+  // retired code on their host stack (see X64Backend::AcknowledgeCodeReclaim).
+  // Code kept for the persistent code storage is never reused.
+  void RetireCode(const void* code_execute_address);
+  uint64_t reclaim_epoch() const { return reclaim_epoch_; }
+  const std::atomic<uint64_t>* reclaim_epoch_address() const {
+    return &reclaim_epoch_;
+  }
+  // Keeps retired code that the return addresses in [stack_low, stack_high)
+  // may point into from being reused until the next epoch is acknowledged.
+  // Returns the epoch the stack has been checked for.
+  uint64_t PinRetiredCode(const uint64_t* stack_low,
+                          const uint64_t* stack_high);
+  // Frees retired code for reuse if every thread running guest code has
+  // acknowledged an epoch after the code was retired or last pinned.
+  void ReclaimRetiredCode(uint64_t oldest_acknowledged_epoch);
+  // Frees host data that guest threads may still be using, such as a replaced
+  // source map or the interpreter program of invalidated code, once all of
+  // them have acknowledged a later epoch, like retired code.
+  void RetireCodeData(std::shared_ptr<void> data);
+  // Makes sure code stored for the function in the persistent code storage
+  // isn't used anymore, and new code for it isn't stored, as its guest code
+  // was modified.
+  void DiscardPersistentCode(uint32_t guest_address);
+  // Keeps code placed for a translation that was discarded before being
+  // published from being stored, as the guest code it was hashed with may
+  // differ from the code it was translated from.
+  void DropPersistentCode(const void* code_execute_address);
+
+  // Persistent code storage: guest code placed within [guest_low, guest_high)
+  // is written to storage_path on shutdown, and placed back at the end of the
+  // cache when the storage is opened in the next launch, with its references
+  // to the host executable, host code and other code of the same storage
+  // relocated. Each module has its own storage. A storage is only reused if
+  // the key (module, codegen options, build) and the layout of the host code
+  // placed before the first storage was opened are identical, otherwise it's
+  // discarded.
+  // Must be called before any guest code within the range is placed.
+  bool InitializePersistentStorage(const std::filesystem::path& storage_path,
+                                   uint64_t storage_key, uint32_t guest_low,
+                                   uint32_t guest_high);
+  void ShutdownPersistentStorage();
+  // Gets the extents of the guest code stored for the address, if any, and the
+  // callees inlined into it, which must be watched like the function itself.
+  bool FindPersistentCode(
+      uint32_t guest_address, uint32_t& guest_end_address_out,
+      std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls_out);
+  // Looks up code for the function stored by a previous session. On success
+  // the code is already placed and registered for host PC lookups, but the
+  // indirection table is left for the caller to update.
+  bool RestorePersistentCode(GuestFunction* function,
+                             uint32_t& guest_end_address_out,
+                             void*& code_execute_address_out,
+                             size_t& code_size_out);
+  uint32_t persistent_storage_hits() const { return persistent_hits_; }
+  uint32_t persistent_storage_misses() const { return persistent_misses_; }
+
  protected:
   // All executable code falls within 0x80000000 to 0x9FFFFFFF, so we can
   // only map enough for lookups within that range.
@@ -103,11 +210,130 @@ class X64CodeCache : public CodeCache {
     uint8_t* entry_address = 0;
   };
 
+  // Bump this whenever the layout of stored code changes in a way the storage
+  // key doesn't capture.
+  static constexpr uint32_t kPersistentStorageVersion = 5;
+
+  struct PersistentCodeEntry {
+    uint32_t guest_address;
+    uint32_t guest_end_address;
+    // Offset from generated_code_execute_base_, or from the start of the
+    // stored code in the storage file.
+    uint32_t code_offset;
+    // Total space taken in the cache, including unwind info and padding.
+    uint32_t reserved_size;
+    // Of the guest code it was translated from, including that of the inlined
+    // callees, which may have been modified since then.
+    uint64_t guest_code_hash;
+    // Only valid in the storage file, the relocations and then the inlined
+    // calls of the entries are stored after the code in the same order.
+    uint32_t relocation_count;
+    uint32_t inlined_call_count;
+    EmitFunctionInfo func_info;
+  };
+
+  struct PersistentRelocation {
+    enum class Type : uint32_t {
+      // target is the offset of an address in the host executable from
+      // HostImageAnchor, of which target_hash is the hash of the first bytes.
+      kHostImage,
+      // target is the offset of a rel32 target in host code placed before the
+      // first storage was opened.
+      kHostCode,
+      // target is the offset of a rel32 target in code of the same storage.
+      kStoredCode,
+    };
+    Type type;
+    // Offset of the patched bytes, relative like code_offset of the entries.
+    uint32_t offset;
+    // Relative like code_offset of the entries for kStoredCode.
+    int64_t target;
+    uint64_t target_hash;
+  };
+
+  struct CallSite {
+    // Offsets from generated_code_execute_base_.
+    uint32_t operand_offset;
+    uint32_t stub_offset;
+  };
+
+  // Call sites within stored code, which is stored unlinked.
+  struct PersistentCallSite {
+    uint32_t target_guest_address;
+    // Relative like code_offset of the entries.
+    uint32_t operand_offset;
+  };
+
+  // The storage of a module, see InitializePersistentStorage.
+  struct PersistentStorage {
+    std::filesystem::path path;
+    uint64_t key = 0;
+    uint32_t guest_low = 0;
+    uint32_t guest_high = 0;
+    bool dirty = false;
+    // Stored code in placement order (thus ordered by code_offset). Superseded
+    // code for a guest address is kept as other stored code may still call
+    // it.
+    std::vector<PersistentCodeEntry> entries;
+    // Of each entry, targets of kStoredCode are offsets from
+    // generated_code_execute_base_ like code_offset of the entries.
+    std::vector<std::vector<PersistentRelocation>> relocations;
+    // Of each entry, see GuestFunction::inlined_calls.
+    std::vector<std::vector<FunctionDebugInfo::InlinedCall>> inlined_calls;
+    // Guest address -> index of the most recent entry in entries.
+    std::unordered_map<uint32_t, size_t> entry_indices;
+    // Guest addresses whose guest code was modified in this session.
+    std::unordered_set<uint32_t> discarded_addresses;
+  };
+
   X64CodeCache();
 
+  // Retired or reclaimed code, by the offset from generated_code_execute_base_
+  // of the space it takes, which is the same as in generated_code_map_.
+  struct RetiredCode {
+    uint32_t offset;
+    uint32_t size;
+    // The last epoch it was retired or pinned in.
+    uint64_t epoch;
+  };
+  // Free code is kept in lists by the binary logarithm of its size.
+  static constexpr uint32_t kFreeCodeSizeClassCount = 32;
+  // Epochs are only started for pinned code after this much time, as all
+  // threads check their stacks again for every epoch.
+  static constexpr uint64_t kPinnedCodeRecheckMillis = 100;
+
+  void CommitGeneratedCode(size_t high_mark);
+  // Takes free code of at least size bytes for placing guest code.
+  bool TakeFreeCode(size_t size, size_t& offset_out, size_t& end_offset_out);
+  uint64_t GuestCodeHash(
+      GuestFunction* function, uint32_t end_address,
+      const std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls) const;
+  PersistentStorage* FindPersistentStorage(uint32_t guest_address);
+  bool LoadPersistentStorage(PersistentStorage& storage);
+  void WritePersistentStorage(PersistentStorage& storage);
+  // Converts the relocations of code placed at code_offset for storing it,
+  // fails if any of them can't be relocated.
+  bool GetPersistentRelocations(
+      const PersistentStorage& storage, size_t code_offset,
+      const std::vector<CodeRelocation>* relocations,
+      std::vector<PersistentRelocation>& relocations_out) const;
+  // Stored code containing the 4 bytes at code_offset, if any.
+  static const PersistentCodeEntry* FindPersistentEntry(
+      const std::vector<PersistentCodeEntry>& entries, size_t code_offset);
+  // Of any storage.
+  const PersistentCodeEntry* FindPersistentEntry(size_t code_offset) const;
+  void PatchCallSite(const CallSite& site, uint32_t target_offset);
+
   virtual UnwindReservation RequestUnwindReservation(uint8_t* entry_address) {
     return UnwindReservation();
   }
+  // For code placed over reclaimed code at code_offset, which had unwind info
+  // reserved with RequestUnwindReservation.
+  virtual UnwindReservation ReuseUnwindReservation(uint8_t* entry_address,
+                                                   uint32_t code_offset) {
+    return UnwindReservation();
+  }
+  virtual size_t unwind_reservation_size() const { return 0; }
   virtual void PlaceCode(uint32_t guest_address, void* machine_code,
                          const EmitFunctionInfo& func_info,
                          void* code_execute_address,
@@ -143,6 +369,37 @@ class X64CodeCache : public CodeCache {
   // This can be used to bsearch on host PC to find the guest function.
   // The key is [start address | end address].
   std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+
+  // Protected with global_critical_region_.
+  // Guest address of the callee -> sites calling it.
+  std::unordered_map<uint32_t, std::vector<CallSite>> call_sites_;
+  // Guest address -> code offset the calls to it are linked to.
+  std::unordered_map<uint32_t, uint32_t> linked_functions_;
+
+  // Code reclamation state, see RetireCode. Protected with
+  // global_critical_region_ except for reads of the epoch.
+  std::atomic<uint64_t> reclaim_epoch_ = {1};
+  uint64_t reclaim_epoch_start_millis_ = 0;
+  // Sorted by offset.
+  std::vector<RetiredCode> retired_code_;
+  std::vector<RetiredCode> free_code_[kFreeCodeSizeClassCount];
+  struct RetiredCodeData {
+    // The epoch it was retired in.
+    uint64_t epoch;
+    std::shared_ptr<void> data;
+  };
+  std::vector<RetiredCodeData> retired_code_data_;
+
+  // Persistent code storage state, see InitializePersistentStorage.
+  std::vector<std::unique_ptr<PersistentStorage>> persistent_storages_;
+  // Host code placed before the first storage was opened, such as the thunks
+  // and helpers of the backend, which stored code may call. Its layout must
+  // match between sessions, but not its contents, as it embeds addresses in
+  // the host executable.
+  size_t persistent_host_code_end_ = 0;
+  uint64_t persistent_host_code_layout_hash_ = 0;
+  std::atomic<uint32_t> persistent_hits_ = {0};
+  std::atomic<uint32_t> persistent_misses_ = {0};
 };
 
 }  // namespace x64
@@ -9,11 +9,99 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/cpu/function.h"
+
+DEFINE_bool(perf_map, false,
+            "Write /tmp/perf-<pid>.map entries for generated code, so perf can "
+            "name the guest functions it samples.",
+            "x64");
+DEFINE_bool(perf_jitdump, false,
+            "Write generated code to /tmp/jit-<pid>.dump for perf inject "
+            "--jit. Record with perf record -k mono.",
+            "x64");
+DEFINE_bool(perf_jitdump_debug_info, false,
+            "Include the guest address of each range of generated code in the "
+            "jitdump, shown by perf annotate as the source file.",
+            "x64");
+
 namespace xe {
 namespace cpu {
 namespace backend {
 namespace x64 {
 
+namespace {
+// See tools/perf/Documentation/jitdump-specification.txt in the Linux tree.
+// 'JiTD'.
+const uint32_t kJitDumpMagic = 0x4A695444;
+const uint32_t kJitDumpVersion = 1;
+// EM_X86_64.
+const uint32_t kJitDumpElfMachine = 62;
+enum : uint32_t {
+  kJitDumpCodeLoad = 0,
+  kJitDumpCodeDebugInfo = 2,
+};
+
+struct JitDumpHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct JitDumpRecordHeader {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+// Followed by the name and the code.
+struct JitDumpCodeLoad {
+  JitDumpRecordHeader header;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+};
+
+// Followed by nr_entry entries, each followed by its file name.
+struct JitDumpCodeDebugInfo {
+  JitDumpRecordHeader header;
+  uint64_t code_addr;
+  uint64_t nr_entry;
+};
+struct JitDumpDebugEntry {
+  uint64_t code_addr;
+  int32_t line;
+  int32_t discrim;
+};
+
+// Must match the clock perf records with (-k mono).
+uint64_t GetJitDumpTimestamp() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + uint64_t(ts.tv_nsec);
+}
+}  // namespace
+
 class PosixX64CodeCache : public X64CodeCache {
  public:
   PosixX64CodeCache();
@@ -23,7 +111,25 @@ class PosixX64CodeCache : public X64CodeCache {
 
   void* LookupUnwindInfo(uint64_t host_pc) override { return nullptr; }
 
+  void ReportPlacedCode(
+      GuestFunction* function_info, const void* code_execute_address,
+      size_t code_size,
+      const std::vector<SourceMapEntry>* source_map) override;
+
  private:
+  void OpenPerfFiles();
+  void WriteJitDumpDebugInfo(const std::vector<SourceMapEntry>& source_map,
+                             const void* code_execute_address,
+                             uint64_t timestamp);
+
+  // Held while writing to the files, placement may happen on any thread.
+  std::mutex perf_mutex_;
+  FILE* perf_map_file_ = nullptr;
+  FILE* jitdump_file_ = nullptr;
+  // perf only picks up the jitdump through an executable mapping of it.
+  void* jitdump_marker_ = nullptr;
+  size_t jitdump_marker_size_ = 0;
+  uint64_t jitdump_code_index_ = 0;
   /*
   UnwindReservation RequestUnwindReservation(uint8_t* entry_address) override;
   void PlaceCode(uint32_t guest_address, void* machine_code, size_t code_size,
@@ -41,9 +147,144 @@ std::unique_ptr<X64CodeCache> X64CodeCache::Create() {
 }
 
 PosixX64CodeCache::PosixX64CodeCache() = default;
-PosixX64CodeCache::~PosixX64CodeCache() = default;
 
-bool PosixX64CodeCache::Initialize() { return X64CodeCache::Initialize(); }
+PosixX64CodeCache::~PosixX64CodeCache() {
+  if (perf_map_file_) {
+    std::fclose(perf_map_file_);
+  }
+  if (jitdump_marker_) {
+    munmap(jitdump_marker_, jitdump_marker_size_);
+  }
+  if (jitdump_file_) {
+    std::fclose(jitdump_file_);
+  }
+}
+
+bool PosixX64CodeCache::Initialize() {
+  if (!X64CodeCache::Initialize()) {
+    return false;
+  }
+  OpenPerfFiles();
+  return true;
+}
+
+void PosixX64CodeCache::OpenPerfFiles() {
+  pid_t pid = getpid();
+  if (cvars::perf_map) {
+    auto path = fmt::format("/tmp/perf-{}.map", pid);
+    perf_map_file_ = std::fopen(path.c_str(), "w");
+    if (!perf_map_file_) {
+      XELOGW("Unable to open {} for writing", path);
+    }
+  }
+
+  if (cvars::perf_jitdump) {
+    auto path = fmt::format("/tmp/jit-{}.dump", pid);
+    int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0) {
+      XELOGW("Unable to open {} for writing", path);
+      return;
+    }
+    jitdump_marker_size_ = size_t(sysconf(_SC_PAGESIZE));
+    jitdump_marker_ = mmap(nullptr, jitdump_marker_size_, PROT_READ | PROT_EXEC,
+                           MAP_PRIVATE, fd, 0);
+    if (jitdump_marker_ == MAP_FAILED) {
+      XELOGW("Unable to map {}, perf won't find it", path);
+      jitdump_marker_ = nullptr;
+      close(fd);
+      return;
+    }
+    jitdump_file_ = fdopen(fd, "wb");
+    JitDumpHeader header = {};
+    header.magic = kJitDumpMagic;
+    header.version = kJitDumpVersion;
+    header.total_size = sizeof(header);
+    header.elf_mach = kJitDumpElfMachine;
+    header.pid = uint32_t(pid);
+    header.timestamp = GetJitDumpTimestamp();
+    std::fwrite(&header, sizeof(header), 1, jitdump_file_);
+    std::fflush(jitdump_file_);
+  }
+}
+
+void PosixX64CodeCache::ReportPlacedCode(
+    GuestFunction* function_info, const void* code_execute_address,
+    size_t code_size, const std::vector<SourceMapEntry>* source_map) {
+  if (!perf_map_file_ && !jitdump_file_) {
+    return;
+  }
+  std::string name;
+  if (!function_info) {
+    name = fmt::format("xenia_host_{:X}", uintptr_t(code_execute_address));
+  } else if (function_info->name().empty()) {
+    name = fmt::format("sub_{:08X}", function_info->address());
+  } else {
+    name = function_info->name();
+  }
+
+  std::lock_guard<std::mutex> lock(perf_mutex_);
+  if (perf_map_file_) {
+    auto line = fmt::format("{:x} {:x} {}\n", uintptr_t(code_execute_address),
+                            code_size, name);
+    std::fputs(line.c_str(), perf_map_file_);
+    std::fflush(perf_map_file_);
+  }
+
+  if (jitdump_file_) {
+    uint64_t timestamp = GetJitDumpTimestamp();
+    // Debug info must come before the code it is for.
+    if (cvars::perf_jitdump_debug_info && source_map) {
+      WriteJitDumpDebugInfo(*source_map, code_execute_address, timestamp);
+    }
+    JitDumpCodeLoad record = {};
+    record.header.id = kJitDumpCodeLoad;
+    record.header.total_size =
+        uint32_t(sizeof(record) + name.size() + 1 + code_size);
+    record.header.timestamp = timestamp;
+    record.pid = uint32_t(getpid());
+    record.tid = uint32_t(syscall(SYS_gettid));
+    record.vma = uint64_t(uintptr_t(code_execute_address));
+    record.code_addr = record.vma;
+    record.code_size = code_size;
+    record.code_index = jitdump_code_index_++;
+    std::fwrite(&record, sizeof(record), 1, jitdump_file_);
+    std::fwrite(name.c_str(), name.size() + 1, 1, jitdump_file_);
+    std::fwrite(code_execute_address, code_size, 1, jitdump_file_);
+    std::fflush(jitdump_file_);
+  }
+}
+
+void PosixX64CodeCache::WriteJitDumpDebugInfo(
+    const std::vector<SourceMapEntry>& source_map,
+    const void* code_execute_address, uint64_t timestamp) {
+  // One entry per guest instruction, with its address as the file name, as
+  // line numbers are signed and too small for guest addresses.
+  if (source_map.empty()) {
+    return;
+  }
+  uint64_t code_base = uint64_t(uintptr_t(code_execute_address));
+  JitDumpCodeDebugInfo record = {};
+  record.header.id = kJitDumpCodeDebugInfo;
+  record.header.timestamp = timestamp;
+  record.code_addr = code_base;
+  record.nr_entry = source_map.size();
+  const size_t entry_name_size = 9;
+  record.header.total_size = uint32_t(
+      sizeof(record) +
+      source_map.size() * (sizeof(JitDumpDebugEntry) + entry_name_size));
+  std::fwrite(&record, sizeof(record), 1, jitdump_file_);
+  char entry_name[16];
+  for (auto& source_map_entry : source_map) {
+    JitDumpDebugEntry entry = {};
+    entry.code_addr = code_base + source_map_entry.code_offset;
+    entry.line = 1;
+    std::fwrite(&entry, sizeof(entry), 1, jitdump_file_);
+    auto result = fmt::format_to_n(entry_name, entry_name_size - 1, "{:08X}",
+                                   source_map_entry.guest_address);
+    entry_name[result.size] = '\0';
+    std::fwrite(entry_name, entry_name_size, 1, jitdump_file_);
+  }
+}
 
 }  // namespace x64
 }  // namespace backend
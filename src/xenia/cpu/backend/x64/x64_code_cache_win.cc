@@ -106,6 +106,11 @@ class Win32X64CodeCache : public X64CodeCache {
 
  private:
   UnwindReservation RequestUnwindReservation(uint8_t* entry_address) override;
+  UnwindReservation ReuseUnwindReservation(uint8_t* entry_address,
+                                           uint32_t code_offset) override;
+  size_t unwind_reservation_size() const override {
+    return xe::round_up(kUnwindInfoSize, 16);
+  }
   void PlaceCode(uint32_t guest_address, void* machine_code,
                  const EmitFunctionInfo& func_info, void* code_execute_address,
                  UnwindReservation unwind_reservation) override;
@@ -221,12 +226,27 @@ Win32X64CodeCache::RequestUnwindReservation(uint8_t* entry_address) {
   assert_false(unwind_table_count_ >= kMaximumFunctionCount);
 #endif
   UnwindReservation unwind_reservation;
-  unwind_reservation.data_size = xe::round_up(kUnwindInfoSize, 16);
+  unwind_reservation.data_size = unwind_reservation_size();
   unwind_reservation.table_slot = unwind_table_count_++;
   unwind_reservation.entry_address = entry_address;
   return unwind_reservation;
 }
 
+Win32X64CodeCache::UnwindReservation
+Win32X64CodeCache::ReuseUnwindReservation(uint8_t* entry_address,
+                                          uint32_t code_offset) {
+  // The entry of the reclaimed code starts at the same offset, so the table
+  // stays sorted.
+  auto fn_entry = reinterpret_cast<RUNTIME_FUNCTION*>(
+      LookupUnwindInfo(kGeneratedCodeExecuteBase + code_offset));
+  assert_true(fn_entry && fn_entry->BeginAddress == code_offset);
+  UnwindReservation unwind_reservation;
+  unwind_reservation.data_size = unwind_reservation_size();
+  unwind_reservation.table_slot = size_t(fn_entry - unwind_table_.data());
+  unwind_reservation.entry_address = entry_address;
+  return unwind_reservation;
+}
+
 void Win32X64CodeCache::PlaceCode(uint32_t guest_address, void* machine_code,
                                   const EmitFunctionInfo& func_info,
                                   void* code_execute_address,
@@ -11,6 +11,7 @@
 
 #include <stddef.h>
 
+#include <algorithm>
 #include <climits>
 #include <cstring>
 
@@ -24,11 +25,13 @@
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/vec128.h"
+#include "xenia/cpu/backend/interpreter/interpreter.h"
 #include "xenia/cpu/backend/x64/x64_backend.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/backend/x64/x64_function.h"
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/backend/x64/x64_stack_layout.h"
+#include "xenia/cpu/compiler/compiler_statistics.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_debug_info.h"
@@ -39,14 +42,15 @@
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
 
-DEFINE_bool(debugprint_trap_log, false,
-            "Log debugprint traps to the active debugger", "CPU");
-DEFINE_bool(ignore_undefined_externs, true,
-            "Don't exit when an undefined extern is called.", "CPU");
 DEFINE_bool(emit_source_annotations, false,
             "Add extra movs and nops to make disassembly easier to read.",
             "CPU");
 
+DEFINE_bool(link_guest_calls, true,
+            "Rewrite calls to guest functions into direct calls once the "
+            "callee is translated, instead of loading the target from the "
+            "indirection table on every call.",
+            "x64");
 DEFINE_bool(enable_incorrect_roundingmode_behavior, false,
             "Disables the FPU/VMX MXCSR sharing workaround, potentially "
             "causing incorrect rounding behavior and denormal handling in VMX "
@@ -58,11 +62,30 @@ DEFINE_uint32(align_all_basic_blocks, 0,
               "power of 2, 16 is the recommended value. Results in larger "
               "icache usage, but potentially faster loops",
               "x64");
+DEFINE_bool(profile_block_layout, true,
+            "Count the runs of the blocks of baseline code (see "
+            "tiered_compilation), and move the blocks that rarely ran to the "
+            "end of the final translation, after the epilog. Blocks that "
+            "trap are moved even without counts.",
+            "x64");
+DEFINE_bool(propagate_mxcsr_mode, true,
+            "Carry the known FPU/VMX MXCSR mode into blocks whose "
+            "predecessors all end in that mode, instead of checking the mode "
+            "at the start of every block.",
+            "x64");
+DEFINE_bool(indirect_call_inline_caches, true,
+            "Profile the targets of indirect calls (bctr/bctrl) in baseline "
+            "code, and call the ones seen directly in the final code when "
+            "the target address matches.",
+            "x64");
 #if XE_X64_PROFILER_AVAILABLE == 1
 DEFINE_bool(instrument_call_times, false,
             "Compute time taken for functions, for profiling guest code",
             "x64");
 #endif
+
+DECLARE_bool(invalidate_written_code);
+
 namespace xe {
 namespace cpu {
 namespace backend {
@@ -99,7 +122,10 @@ X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
     return;
   }
 
-  feature_flags_ = amd64::GetFeatureFlags();
+  // Masked again so tools can compare code generated with fewer extensions
+  // without restarting.
+  feature_flags_ =
+      amd64::GetFeatureFlags() & uint64_t(cvars::x64_extension_mask);
 
   may_use_membase32_as_zero_reg_ =
       static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
@@ -108,10 +134,36 @@ X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
 
 X64Emitter::~X64Emitter() = default;
 
-bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
-                      uint32_t debug_info_flags, FunctionDebugInfo* debug_info,
-                      void** out_code_address, size_t* out_code_size,
-                      std::vector<SourceMapEntry>* out_source_map) {
+// Called by baseline code once its countdown runs out.
+static uint64_t RequestFunctionOptimization(void* raw_context,
+                                            uint64_t function_ptr) {
+  auto guest_context = reinterpret_cast<ppc::PPCContext_s*>(raw_context);
+  auto processor = guest_context->thread_state->processor();
+  auto function = reinterpret_cast<GuestFunction*>(function_ptr);
+  if (function->BeginOptimization()) {
+    processor->compile_pool()->QueueOptimization(function);
+  }
+  return 0;
+}
+
+// Called by baseline code instead of its body when it was lowered for the
+// interpreter.
+static uint64_t InterpretFunction(void* raw_context, uint64_t function_ptr,
+                                  uint64_t return_address) {
+  auto guest_context = reinterpret_cast<ppc::PPCContext_s*>(raw_context);
+  auto function = reinterpret_cast<X64Function*>(function_ptr);
+  interpreter::Interpreter::Execute(*function->interpreter_program(),
+                                    guest_context->thread_state,
+                                    static_cast<uint32_t>(return_address));
+  return 0;
+}
+
+bool X64Emitter::Emit(
+    GuestFunction* function, HIRBuilder* builder, uint32_t debug_info_flags,
+    FunctionDebugInfo* debug_info,
+    const std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls,
+    void** out_code_address, size_t* out_code_size,
+    std::vector<SourceMapEntry>* out_source_map) {
   SCOPE_profile_cpu_f("cpu");
   guest_module_ = dynamic_cast<XexModule*>(function->module());
   current_guest_function_ = function->address();
@@ -120,24 +172,58 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
   source_map_arena_.Reset();
+  // Trace data lives in a buffer allocated for this session only.
+  persistent_code_ =
+      !(debug_info_flags & DebugInfoFlags::kDebugInfoTraceFunctions);
+  call_sites_.clear();
+  relocations_.clear();
+  inlined_calls_ = &inlined_calls;
+  tier_up_function_ = nullptr;
+  layout_function_ = static_cast<X64Function*>(function);
+  if (function->tier() == GuestFunction::Tier::kBaseline) {
+    // Baseline code is temporary, and the countdown is in the host heap.
+    tier_up_function_ = static_cast<X64Function*>(function);
+    tier_up_function_->RestartTierUpCountdown();
+    persistent_code_ = false;
+  }
+  interpreted_function_ = nullptr;
+  if (tier_up_function_ && tier_up_function_->interpreter_program()) {
+    interpreted_function_ = tier_up_function_;
+  }
 
   // Fill the generator with code.
   EmitFunctionInfo func_info = {};
   if (!Emit(builder, func_info)) {
     return false;
   }
+  func_info.persistent = persistent_code_;
+  if (compiler::CompilerStatistics::is_enabled()) {
+    compiler::CompilerStatistics::RecordCodeSize(
+        func_info.code_size.prolog, func_info.code_size.body,
+        func_info.code_size.epilog, func_info.code_size.tail);
+    compiler::CompilerStatistics::RecordMxcsrModes(
+        mxcsr_known_block_entries_, mxcsr_dynamic_checks_, mxcsr_loads_);
+  }
+
+  // Stash source map, already needed when the code is placed.
+  source_map_arena_.CloneContents(out_source_map);
 
   // Copy the final code to the cache and relocate it.
   *out_code_size = getSize();
-  *out_code_address = Emplace(func_info, function);
+  *out_code_address = Emplace(func_info, function, out_source_map);
 
-  // Stash source map.
-  source_map_arena_.CloneContents(out_source_map);
+  // Call sites can only be linked once their address is final.
+  for (const auto& call_site : call_sites_) {
+    code_cache_->AddCallSite(
+        call_site.first,
+        reinterpret_cast<uint8_t*>(*out_code_address) + call_site.second);
+  }
 
   return true;
 }
 void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
-                          GuestFunction* function) {
+                          GuestFunction* function,
+                          const std::vector<SourceMapEntry>* source_map) {
   // To avoid changing xbyak, we do a switcharoo here.
   // top_ points to the Xbyak buffer, and since we are in AutoGrow mode
   // it has pending relocations. We copy the top_ to our buffer, swap the
@@ -152,7 +238,8 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
   assert_true(func_info.code_size.total == size_);
   if (function) {
     code_cache_->PlaceGuestCode(function->address(), top_, func_info, function,
-                                new_execute_address, new_write_address);
+                                new_execute_address, new_write_address,
+                                &relocations_, inlined_calls_);
   } else {
     code_cache_->PlaceHostCode(0, top_, func_info, new_execute_address,
                                new_write_address);
@@ -160,6 +247,8 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
   top_ = reinterpret_cast<uint8_t*>(new_write_address);
   ready();
   top_ = old_address;
+  code_cache_->ReportPlacedCode(function, new_execute_address,
+                                func_info.code_size.total, source_map);
   reset();
   tail_code_.clear();
   for (auto&& cached_label : label_cache_) {
@@ -172,6 +261,7 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
 bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   Xbyak::Label epilog_label;
   epilog_label_ = &epilog_label;
+  call_link_stub_label_ = nullptr;
 
   // Calculate stack size. We need to align things to their natural sizes.
   // This could be much better (sort by type/etc).
@@ -250,6 +340,26 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
 
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);  // 0
 
+  if (tier_up_function_) {
+    // Not atomic, racing threads may miss some calls or both hit zero, which
+    // RequestFunctionOptimization tolerates.
+    mov(rax,
+        reinterpret_cast<uint64_t>(tier_up_function_->tier_up_countdown()));
+    sub(dword[rax], 1);
+    Xbyak::Label& tier_up_done = NewCachedLabel();
+    GuestFunction* function = tier_up_function_;
+    Xbyak::Label& tier_up =
+        AddToTail([&tier_up_done, function](X64Emitter& e,
+                                            Xbyak::Label& our_tail_label) {
+          e.L(our_tail_label);
+          e.CallNative(RequestFunctionOptimization,
+                       reinterpret_cast<uint64_t>(function));
+          e.jmp(tier_up_done, X64Emitter::T_NEAR);
+        });
+    jz(tier_up, T_NEAR);
+    L(tier_up_done);
+  }
+
 #if XE_X64_PROFILER_AVAILABLE == 1
   if (cvars::instrument_call_times) {
     mov(rdx, 0x7ffe0014);  // load pointer to kusershared systemtime
@@ -293,48 +403,35 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
       qword[GetContextReg() + offsetof(ppc::PPCContext, virtual_membase)]);
   */
   // Body.
-  auto block = builder->first_block();
+  if (interpreted_function_) {
+    // Only the prolog and epilog are generated, the interpreter does the rest.
+    ChangeMxcsrMode(MXCSRMode::Fpu);
+    mov(GetNativeParam(0), reinterpret_cast<uint64_t>(interpreted_function_));
+    mov(GetNativeParam(1), qword[rsp + StackLayout::GUEST_RET_ADDR]);
+    CallNativeSafe(reinterpret_cast<void*>(InterpretFunction));
+    ForgetMxcsrMode();
+  }
+  auto block = interpreted_function_ ? nullptr : builder->first_block();
   synchronize_stack_on_next_instruction_ = false;
-  while (block) {
-    ForgetMxcsrMode();  // at start of block, mxcsr mode is undefined
-
-    // Mark block labels.
-    auto label = block->label_head;
-    while (label) {
-      L(std::to_string(label->id));
-      label = label->next;
-    }
-
-    if (cvars::align_all_basic_blocks) {
-      align(cvars::align_all_basic_blocks, true);
-    }
-    // Process instructions.
-    const Instr* instr = block->instr_head;
-    while (instr) {
-      if (synchronize_stack_on_next_instruction_) {
-        if (instr->GetOpcodeNum() != hir::OPCODE_SOURCE_OFFSET) {
-          synchronize_stack_on_next_instruction_ = false;
-          EnsureSynchronizedGuestAndHostStack();
-        }
-      }
-      const Instr* new_tail = instr;
-      if (!SelectSequence(this, instr, &new_tail)) {
-        // No sequence found!
-        // NOTE: If you encounter this after adding a new instruction, do a full
-        // rebuild!
-        assert_always();
-        XELOGE("Unable to process HIR opcode {}", GetOpcodeName(instr->opcode));
-        break;
-      }
-      instr = new_tail;
-    }
-
-    block = block->next;
+  block_mxcsr_modes_.clear();
+  mxcsr_known_block_entries_ = 0;
+  mxcsr_dynamic_checks_ = 0;
+  mxcsr_loads_ = 0;
+  if (cvars::propagate_mxcsr_mode && block) {
+    CountBlockMxcsrModeEdges(builder);
+  }
+  std::vector<hir::Block*> hot_blocks, cold_blocks;
+  if (block) {
+    SelectBlockLayout(builder, &hot_blocks, &cold_blocks);
+    PrepareIndirectCallProfiles(builder);
+  }
+  for (size_t n = 0; n < hot_blocks.size(); ++n) {
+    EmitBlock(hot_blocks[n],
+              n + 1 < hot_blocks.size() ? hot_blocks[n + 1] : nullptr, true);
   }
 
   // Function epilog.
   L(epilog_label);
-  epilog_label_ = nullptr;
   EmitTraceUserCallReturn();
   /*
   * chrispy: removed this, it serves no purpose
@@ -346,6 +443,20 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   add(rsp, (uint32_t)stack_size);
   PopStackpoint();
   ret();
+
+  // Rarely executed blocks, out of the way of the hot path. They are only
+  // entered through jumps.
+  synchronize_stack_on_next_instruction_ = false;
+  for (size_t n = 0; n < cold_blocks.size(); ++n) {
+    EmitBlock(cold_blocks[n],
+              n + 1 < cold_blocks.size() ? cold_blocks[n + 1] : nullptr,
+              false);
+  }
+  epilog_label_ = nullptr;
+  block_labels_.clear();
+  profiled_blocks_.clear();
+  indirect_call_profiles_.clear();
+
   // todo: do some kind of sorting by alignment?
   for (auto&& tail_item : tail_code_) {
     if (tail_item.alignment) {
@@ -377,6 +488,7 @@ void X64Emitter::EmitProfilerEpilogue() {
   if (cvars::instrument_call_times) {
     uint64_t* profiler_entry =
         backend()->GetProfilerRecordForFunction(current_guest_function_);
+    MarkCodeNonPersistent();
 
     mov(ecx, 0x7ffe0014);
     mov(rdx, qword[rcx]);
@@ -700,13 +812,31 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   assert_not_null(function);
   ForgetMxcsrMode();
   auto fn = static_cast<X64Function*>(function);
-  // Resolve address to the function to call and store in rax.
 
-  if (fn->machine_code()) {
+  if (cvars::link_guest_calls && code_cache_->has_indirection_table()) {
+    // Linked right away if the callee already has its final code, so it can
+    // still be unlinked if the callee is invalidated.
+    mov(ebx, function->address());
+    CallLinkable(instr, function);
+    return;
+  }
+
+  // Resolve address to the function to call and store in rax.
+  // Baseline code is replaced once it gets hot, only the indirection table
+  // entry is kept up to date for it. So is the code of functions invalidated
+  // when their guest code is written to, as calls baked in here can't be
+  // unlinked.
+  if (fn->machine_code() && fn->tier() == GuestFunction::Tier::kOptimized &&
+      !cvars::invalidate_written_code) {
+    // The callee's address is baked in, so if its code can't be restored in a
+    // later session neither can ours.
+    if (!fn->persistent_code()) {
+      MarkCodeNonPersistent();
+    }
     if (!(instr->flags & hir::CALL_TAIL)) {
       mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
 
-      call((void*)fn->machine_code());
+      CallCodeCache(fn->machine_code());
       synchronize_stack_on_next_instruction_ = true;
     } else {
       // tail call
@@ -717,7 +847,7 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
 
       add(rsp, static_cast<uint32_t>(stack_size()));
       PopStackpoint();
-      jmp((void*)fn->machine_code(), T_NEAR);
+      JmpCodeCache(fn->machine_code());
     }
 
     return;
@@ -754,6 +884,51 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   }
 }
 
+void X64Emitter::CallLinkable(const hir::Instr* instr,
+                              GuestFunction* function) {
+  if (!call_link_stub_label_) {
+    // Unlinked sites end up here with the guest address still in ebx, like
+    // resolve_function_thunk expects.
+    Xbyak::Label* stub_label = &NewCachedLabel();
+    call_link_stub_label_ = stub_label;
+    AddToTail([stub_label](X64Emitter& e, Xbyak::Label& our_tail_label) {
+      e.L(*stub_label);
+      e.mov(e.eax, e.dword[e.ebx]);
+      e.jmp(e.rax);
+    });
+  }
+
+  bool is_tail = (instr->flags & hir::CALL_TAIL) != 0;
+  if (is_tail) {
+    // Since we skip the prolog we need to mark the return here.
+    EmitTraceUserCallReturn();
+    EmitProfilerEpilogue();
+    // Pass the callers return address over.
+    mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+
+    add(rsp, static_cast<uint32_t>(stack_size()));
+    PopStackpoint();
+  } else {
+    // Return address is from the previous SET_RETURN_ADDRESS.
+    mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+  }
+
+  // The rel32 operand must be aligned so it can be rewritten with a single
+  // store while other threads may be executing the call. Functions are
+  // placed at 16 byte alignment, so the offset in the code is enough.
+  size_t operand_misalignment = (getSize() + 1) & 3;
+  if (operand_misalignment) {
+    nop(4 - operand_misalignment);
+  }
+  if (is_tail) {
+    jmp(*call_link_stub_label_, T_NEAR);
+  } else {
+    call(*call_link_stub_label_);
+    synchronize_stack_on_next_instruction_ = true;
+  }
+  call_sites_.emplace_back(function->address(), uint32_t(getSize() - 4));
+}
+
 void X64Emitter::CallIndirect(const hir::Instr* instr,
                               const Xbyak::Reg64& reg) {
   ForgetMxcsrMode();
@@ -763,11 +938,27 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     je(epilog_label(), CodeGenerator::T_NEAR);
   }
 
+  Xbyak::Label inline_cache_done;
+  bool inline_cached = false;
+  auto profile = indirect_call_profiles_.find(instr);
+  if (profile != indirect_call_profiles_.end()) {
+    if (tier_up_function_) {
+      EmitIndirectCallProfile(profile->second, reg.cvt32());
+    } else if (cvars::link_guest_calls &&
+               code_cache_->has_indirection_table()) {
+      if (reg.cvt32() != ebx) {
+        mov(ebx, reg.cvt32());
+      }
+      inline_cached = EmitIndirectCallInlineCache(instr, profile->second,
+                                                  inline_cache_done);
+    }
+  }
+
   // Load the pointer to the indirection table maintained in X64CodeCache.
   // The target dword will either contain the address of the generated code
   // or a thunk to ResolveAddress.
   if (code_cache_->has_indirection_table()) {
-    if (reg.cvt32() != ebx) {
+    if (!inline_cached && reg.cvt32() != ebx) {
       mov(ebx, reg.cvt32());
     }
     mov(eax, dword[ebx]);
@@ -775,7 +966,7 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     mov(edx, reg.cvt32());
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostAddress(rax, reinterpret_cast<void*>(ResolveFunction));
     mov(rcx, GetContextReg());
     call(rax);
   }
@@ -798,6 +989,114 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     call(rax);
     synchronize_stack_on_next_instruction_ = true;
   }
+  if (inline_cached) {
+    L(inline_cache_done);
+  }
+}
+
+void X64Emitter::EmitIndirectCallProfile(size_t profile_index,
+                                         const Xbyak::Reg32& target) {
+  using Profile = X64Function::IndirectCallProfile;
+  auto& profile = (*tier_up_function_->indirect_call_profiles())[profile_index];
+  // Racy between threads, but only steers the final translation.
+  Xbyak::Label same_target;
+  mov(rax, reinterpret_cast<uint64_t>(&profile));
+  cmp(dword[rax + offsetof(Profile, targets)], target);
+  je(same_target);
+  mov(edx, dword[rax + offsetof(Profile, targets)]);
+  mov(dword[rax + offsetof(Profile, targets) + 4], edx);
+  mov(dword[rax + offsetof(Profile, targets)], target);
+  add(dword[rax + offsetof(Profile, target_changes)], 1);
+  L(same_target);
+  add(dword[rax + offsetof(Profile, calls)], 1);
+}
+
+bool X64Emitter::EmitIndirectCallInlineCache(const hir::Instr* instr,
+                                             size_t profile_index,
+                                             Xbyak::Label& done) {
+  const auto& profile =
+      (*layout_function_->indirect_call_profiles())[profile_index];
+  // Sites where the target keeps changing are left to the indirection table.
+  if (!profile.calls ||
+      uint64_t(profile.target_changes) * 4 > uint64_t(profile.calls)) {
+    return false;
+  }
+  GuestFunction* targets[2];
+  uint32_t target_count = 0;
+  for (uint32_t address : profile.targets) {
+    if (!address || (target_count && targets[0]->address() == address)) {
+      continue;
+    }
+    auto function = processor()->QueryFunction(address);
+    if (function && function->is_guest() &&
+        function->behavior() == Function::Behavior::kDefault) {
+      targets[target_count++] = static_cast<GuestFunction*>(function);
+    }
+  }
+  if (!target_count) {
+    return false;
+  }
+
+  compiler::CompilerStatistics::InlineCacheStatistics* statistics = nullptr;
+  if (compiler::CompilerStatistics::is_enabled()) {
+    statistics = compiler::CompilerStatistics::RegisterInlineCache(
+        layout_function_->address(), profile.call_address, target_count);
+    if (statistics) {
+      // The counters are in this session's host heap.
+      MarkCodeNonPersistent();
+    }
+  }
+  bool is_tail = (instr->flags & hir::CALL_TAIL) != 0;
+  for (uint32_t i = 0; i < target_count; ++i) {
+    Xbyak::Label next_target;
+    cmp(ebx, targets[i]->address());
+    jne(next_target, T_NEAR);
+    if (statistics) {
+      mov(rax, reinterpret_cast<uint64_t>(&statistics->hits));
+      add(qword[rax], 1);
+    }
+    CallLinkable(instr, targets[i]);
+    if (!is_tail) {
+      jmp(done, T_NEAR);
+    }
+    L(next_target);
+  }
+  if (statistics) {
+    mov(rax, reinterpret_cast<uint64_t>(&statistics->misses));
+    add(qword[rax], 1);
+  }
+  return true;
+}
+
+// Called after kernel calls when code has been retired since the thread last
+// checked its stack.
+static uint64_t AcknowledgeCodeReclaim(void* raw_context) {
+  auto guest_context = reinterpret_cast<ppc::PPCContext_s*>(raw_context);
+  auto backend = static_cast<X64Backend*>(
+      guest_context->thread_state->processor()->backend());
+  backend->AcknowledgeCodeReclaim(raw_context);
+  return 0;
+}
+
+void X64Emitter::EmitCodeReclaimSafePoint() {
+  mov(rax, GetBackendCtxPtr(offsetof(X64BackendContext, host_call_count)));
+  inc(rax);
+  mov(GetBackendCtxPtr(offsetof(X64BackendContext, host_call_count)), rax);
+  xor_(eax, eax);
+  mov(GetBackendCtxPtr(offsetof(X64BackendContext, host_call_stack)), rax);
+  mov(rcx,
+      GetBackendCtxPtr(offsetof(X64BackendContext, code_reclaim_epoch_ptr)));
+  mov(rcx, qword[rcx]);
+  cmp(rcx, GetBackendCtxPtr(offsetof(X64BackendContext, code_reclaim_epoch)));
+  Xbyak::Label& done = NewCachedLabel();
+  Xbyak::Label& acknowledge =
+      AddToTail([&done](X64Emitter& e, Xbyak::Label& our_tail_label) {
+        e.L(our_tail_label);
+        e.CallNative(AcknowledgeCodeReclaim);
+        e.jmp(done, X64Emitter::T_NEAR);
+      });
+  jne(acknowledge, T_NEAR);
+  L(done);
 }
 
 uint64_t UndefinedCallExtern(void* raw_context, uint64_t function_ptr) {
@@ -822,10 +1121,13 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // rdx = arg0
       // r8  = arg1
       // r9  = arg2
+      // Builtin arguments are heap objects owned by the frontend.
+      MarkCodeNonPersistent();
       mov(rcx, reinterpret_cast<uint64_t>(builtin_function->handler()));
       mov(rdx, reinterpret_cast<uint64_t>(builtin_function->arg0()));
       mov(r8, reinterpret_cast<uint64_t>(builtin_function->arg1()));
-      call(backend()->guest_to_host_thunk());
+      CallCodeCache(
+          reinterpret_cast<const void*>(backend()->guest_to_host_thunk()));
       // rax = host return
     }
   } else if (function->behavior() == Function::Behavior::kExtern) {
@@ -836,14 +1138,26 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // rdx = arg0
       // r8  = arg1
       // r9  = arg2
-      mov(rcx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      if (cvars::reclaim_code_cache) {
+        // Lets other threads check the guest frames of this one while it's
+        // blocked in the kernel.
+        mov(GetBackendCtxPtr(offsetof(X64BackendContext, host_call_stack)),
+            rsp);
+      }
+      MovHostAddress(
+          rcx, reinterpret_cast<void*>(extern_function->extern_handler()));
       mov(rdx,
           qword[GetContextReg() + offsetof(ppc::PPCContext, kernel_state)]);
-      call(backend()->guest_to_host_thunk());
+      CallCodeCache(
+          reinterpret_cast<const void*>(backend()->guest_to_host_thunk()));
       // rax = host return
+      if (cvars::reclaim_code_cache) {
+        EmitCodeReclaimSafePoint();
+      }
     }
   }
   if (undefined) {
+    MarkCodeNonPersistent();
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
@@ -869,11 +1183,37 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // rdx = arg0
   // r8  = arg1
   // r9  = arg2
-  mov(rcx, reinterpret_cast<uint64_t>(fn));
-  call(backend()->guest_to_host_thunk());
+  MovHostAddress(rcx, fn);
+  CallCodeCache(
+      reinterpret_cast<const void*>(backend()->guest_to_host_thunk()));
   // rax = host return
 }
 
+void X64Emitter::MovHostAddress(const Xbyak::Reg64& reg, const void* address) {
+  // Always a mov with a 64 bit immediate, so it can be patched with any
+  // address.
+  db(0x48 | (reg.getIdx() >= 8 ? 0x01 : 0x00));
+  db(0xB8 | (reg.getIdx() & 7));
+  relocations_.push_back({CodeRelocation::Type::kHostImage,
+                          uint32_t(getSize()),
+                          reinterpret_cast<uintptr_t>(address)});
+  dq(reinterpret_cast<uint64_t>(address));
+}
+
+void X64Emitter::CallCodeCache(const void* address) {
+  call(address);
+  relocations_.push_back({CodeRelocation::Type::kCodeCache,
+                          uint32_t(getSize() - 4),
+                          reinterpret_cast<uintptr_t>(address)});
+}
+
+void X64Emitter::JmpCodeCache(const void* address) {
+  jmp(address, T_NEAR);
+  relocations_.push_back({CodeRelocation::Type::kCodeCache,
+                          uint32_t(getSize() - 4),
+                          reinterpret_cast<uintptr_t>(address)});
+}
+
 void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(rax, value);
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);
@@ -937,6 +1277,8 @@ void X64Emitter::MovMem64(const Xbyak::RegExp& addr, uint64_t v) {
   uint32_t highpart = static_cast<uint32_t>(v >> 32);
   // check whether the constant coincidentally collides with our membase
   if (v == (uintptr_t)processor()->memory()->virtual_membase()) {
+    // Guest memory may be elsewhere in later sessions.
+    MarkCodeNonPersistent();
     mov(qword[addr], GetMembaseReg());
   } else if ((v & ~0x7FFFFFFF) == 0) {
     // Fits under 31 bits, so just load using normal mov.
@@ -1672,6 +2014,294 @@ static void ChangeMxcsrModeDynamicHelper(X64Emitter& e) {
   e.L(come_back);
 }
 
+void X64Emitter::EmitBlock(hir::Block* block, const hir::Block* next_block,
+                           bool epilog_follows) {
+  EnterBlockMxcsrMode(block);
+
+  // Mark block labels.
+  auto block_label = block_labels_.find(block);
+  if (block_label != block_labels_.end()) {
+    L(*block_label->second);
+  }
+  auto label = block->label_head;
+  while (label) {
+    L(std::to_string(label->id));
+    label = label->next;
+  }
+
+  if (cvars::align_all_basic_blocks) {
+    align(cvars::align_all_basic_blocks, true);
+  }
+  auto profiled_block = profiled_blocks_.find(block);
+  if (profiled_block != profiled_blocks_.end()) {
+    // Not atomic, the counts only need to tell rare blocks apart. Flags and
+    // rax don't live across blocks.
+    mov(rax, reinterpret_cast<uint64_t>(profiled_block->second));
+    add(dword[rax], 1);
+  }
+  // Process instructions.
+  const Instr* instr = block->instr_head;
+  while (instr) {
+    if (synchronize_stack_on_next_instruction_) {
+      if (instr->GetOpcodeNum() != hir::OPCODE_SOURCE_OFFSET) {
+        synchronize_stack_on_next_instruction_ = false;
+        EnsureSynchronizedGuestAndHostStack();
+      }
+    }
+    const Instr* new_tail = instr;
+    if (!SelectSequence(this, instr, &new_tail)) {
+      // No sequence found!
+      // NOTE: If you encounter this after adding a new instruction, do a full
+      // rebuild!
+      assert_always();
+      XELOGE("Unable to process HIR opcode {}", GetOpcodeName(instr->opcode));
+      break;
+    }
+    if (!block_mxcsr_modes_.empty()) {
+      // Branches are emitted last in their sequences, so the mode now is
+      // the one they leave with.
+      for (auto branch = instr; branch != new_tail; branch = branch->next) {
+        switch (branch->GetOpcodeNum()) {
+          case hir::OPCODE_BRANCH:
+            RecordBlockMxcsrModeEdge(branch->src1.label->block);
+            break;
+          case hir::OPCODE_BRANCH_TRUE:
+          case hir::OPCODE_BRANCH_FALSE:
+            RecordBlockMxcsrModeEdge(branch->src2.label->block);
+            break;
+          default:
+            break;
+        }
+      }
+    }
+    instr = new_tail;
+  }
+
+  if (block->next && !block_mxcsr_modes_.empty()) {
+    // Falling through is always counted, for a block ending in a branch or
+    // a return the edge is only more conservative.
+    RecordBlockMxcsrModeEdge(block->next);
+  }
+
+  // Falling through to a block that was moved, or out of a cold block.
+  bool falls_through =
+      !block->instr_tail ||
+      block->instr_tail->GetOpcodeNum() != hir::OPCODE_BRANCH;
+  if (falls_through && block->next != next_block &&
+      (block->next || !epilog_follows)) {
+    if (synchronize_stack_on_next_instruction_) {
+      synchronize_stack_on_next_instruction_ = false;
+      EnsureSynchronizedGuestAndHostStack();
+    }
+    if (block->next) {
+      jmp(*block_labels_[block->next], T_NEAR);
+    } else {
+      jmp(epilog_label(), T_NEAR);
+    }
+  }
+}
+
+void X64Emitter::SelectBlockLayout(HIRBuilder* builder,
+                                   std::vector<hir::Block*>* hot_blocks,
+                                   std::vector<hir::Block*>* cold_blocks) {
+  auto first_block = builder->first_block();
+  if (tier_up_function_) {
+    // Baseline code counts the runs of its blocks for the final translation.
+    for (auto block = first_block; block; block = block->next) {
+      hot_blocks->push_back(block);
+    }
+    if (!cvars::profile_block_layout ||
+        tier_up_function_->block_profile()) {
+      // Counters of earlier baseline code may still be written.
+      return;
+    }
+    auto profile = std::make_unique<X64Function::BlockProfile>();
+    for (auto block = first_block; block; block = block->next) {
+      uint32_t guest_address = GetBlockGuestAddress(block);
+      if (guest_address) {
+        profile->guest_addresses.push_back(guest_address);
+      }
+    }
+    profile->counts =
+        std::make_unique<uint32_t[]>(profile->guest_addresses.size());
+    size_t index = 0;
+    for (auto block = first_block; block; block = block->next) {
+      if (GetBlockGuestAddress(block)) {
+        profiled_blocks_.emplace(block, &profile->counts[index++]);
+      }
+    }
+    tier_up_function_->set_block_profile(std::move(profile));
+    return;
+  }
+
+  if (!cvars::profile_block_layout) {
+    for (auto block = first_block; block; block = block->next) {
+      hot_blocks->push_back(block);
+    }
+    return;
+  }
+
+  // Counts from the baseline code, if it ran long enough to tier up.
+  std::unordered_map<uint32_t, uint32_t> counts;
+  uint32_t max_count = 0;
+  auto profile = layout_function_ ? layout_function_->block_profile() : nullptr;
+  if (profile) {
+    for (size_t i = 0; i < profile->guest_addresses.size(); ++i) {
+      uint32_t count = profile->counts[i];
+      uint32_t& block_count = counts[profile->guest_addresses[i]];
+      block_count = std::max(block_count, count);
+      max_count = std::max(max_count, count);
+    }
+  }
+  for (auto block = first_block; block; block = block->next) {
+    bool cold = false;
+    if (block != first_block) {
+      for (auto i = block->instr_head; i; i = i->next) {
+        auto opcode = i->GetOpcodeNum();
+        if (opcode == hir::OPCODE_TRAP || opcode == hir::OPCODE_DEBUG_BREAK) {
+          // Exception paths.
+          cold = true;
+          break;
+        }
+      }
+      auto count = counts.find(GetBlockGuestAddress(block));
+      if (count != counts.end() &&
+          uint64_t(count->second) * kColdBlockRatio < max_count) {
+        cold = true;
+      }
+    }
+    (cold ? cold_blocks : hot_blocks)->push_back(block);
+  }
+  if (!cold_blocks->empty()) {
+    // Any block may need a jump to it for falling through.
+    for (auto block = first_block; block; block = block->next) {
+      block_labels_.emplace(block, &NewCachedLabel());
+    }
+  }
+}
+
+void X64Emitter::PrepareIndirectCallProfiles(HIRBuilder* builder) {
+  if (!cvars::indirect_call_inline_caches || !layout_function_) {
+    return;
+  }
+  // Created by the first baseline translation, and only read by the final one.
+  auto profiles = layout_function_->indirect_call_profiles();
+  std::unique_ptr<std::vector<X64Function::IndirectCallProfile>>
+      new_profiles;
+  if (!profiles) {
+    if (!tier_up_function_) {
+      return;
+    }
+    new_profiles =
+        std::make_unique<std::vector<X64Function::IndirectCallProfile>>();
+    profiles = new_profiles.get();
+  }
+  // Calls are told apart by the guest address of their instruction, which is
+  // the same in every translation.
+  uint32_t guest_address = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      auto opcode = i->GetOpcodeNum();
+      if (opcode == hir::OPCODE_SOURCE_OFFSET) {
+        guest_address = uint32_t(i->src1.offset);
+        continue;
+      }
+      if ((opcode != hir::OPCODE_CALL_INDIRECT &&
+           opcode != hir::OPCODE_CALL_INDIRECT_TRUE) ||
+          !guest_address) {
+        continue;
+      }
+      if (new_profiles) {
+        X64Function::IndirectCallProfile profile = {};
+        profile.call_address = guest_address;
+        indirect_call_profiles_.emplace(i, new_profiles->size());
+        new_profiles->push_back(profile);
+        continue;
+      }
+      for (size_t n = 0; n < profiles->size(); ++n) {
+        if ((*profiles)[n].call_address == guest_address) {
+          indirect_call_profiles_.emplace(i, n);
+          break;
+        }
+      }
+    }
+  }
+  if (new_profiles) {
+    tier_up_function_->set_indirect_call_profiles(std::move(new_profiles));
+  }
+}
+
+uint32_t X64Emitter::GetBlockGuestAddress(const hir::Block* block) {
+  for (auto i = block->instr_head; i; i = i->next) {
+    if (i->GetOpcodeNum() == hir::OPCODE_SOURCE_OFFSET) {
+      return uint32_t(i->src1.offset);
+    }
+  }
+  return 0;
+}
+
+void X64Emitter::CountBlockMxcsrModeEdges(HIRBuilder* builder) {
+  // The function entry, never recorded, so the first block starts unknown.
+  AddBlockMxcsrModeEdge(builder->first_block());
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block_mxcsr_modes_.emplace(block, BlockMxcsrMode());
+    for (auto i = block->instr_head; i; i = i->next) {
+      switch (i->GetOpcodeNum()) {
+        case hir::OPCODE_BRANCH:
+          AddBlockMxcsrModeEdge(i->src1.label->block);
+          break;
+        case hir::OPCODE_BRANCH_TRUE:
+        case hir::OPCODE_BRANCH_FALSE:
+          AddBlockMxcsrModeEdge(i->src2.label->block);
+          break;
+        default:
+          break;
+      }
+    }
+    if (block->next) {
+      AddBlockMxcsrModeEdge(block->next);
+    }
+  }
+}
+
+void X64Emitter::AddBlockMxcsrModeEdge(const hir::Block* block) {
+  ++block_mxcsr_modes_[block].pending_edges;
+}
+
+void X64Emitter::RecordBlockMxcsrModeEdge(const hir::Block* block) {
+  auto it = block_mxcsr_modes_.find(block);
+  if (it == block_mxcsr_modes_.end() || !it->second.pending_edges) {
+    // Edges into blocks already emitted are counted, but never recorded.
+    return;
+  }
+  auto& block_mode = it->second;
+  --block_mode.pending_edges;
+  if (!block_mode.has_mode) {
+    block_mode.has_mode = true;
+    block_mode.mode = mxcsr_mode_;
+  } else if (block_mode.mode != mxcsr_mode_) {
+    block_mode.mode = MXCSRMode::Unknown;
+  }
+}
+
+void X64Emitter::EnterBlockMxcsrMode(const hir::Block* block) {
+  // At the start of a block the mode is undefined unless all the edges into
+  // it have been emitted in the same mode.
+  ForgetMxcsrMode();
+  auto it = block_mxcsr_modes_.find(block);
+  if (it == block_mxcsr_modes_.end()) {
+    return;
+  }
+  auto& block_mode = it->second;
+  if (!block_mode.pending_edges && block_mode.has_mode &&
+      block_mode.mode != MXCSRMode::Unknown) {
+    mxcsr_mode_ = block_mode.mode;
+    ++mxcsr_known_block_entries_;
+  }
+  // Edges from blocks emitted later can't be recorded anymore.
+  block_mode.pending_edges = 0;
+}
+
 bool X64Emitter::ChangeMxcsrMode(MXCSRMode new_mode, bool already_set) {
   if (cvars::enable_incorrect_roundingmode_behavior) {
     return false;  // no MXCSR mode handling!
@@ -1685,6 +2315,7 @@ bool X64Emitter::ChangeMxcsrMode(MXCSRMode new_mode, bool already_set) {
     // check the mode dynamically
     mxcsr_mode_ = new_mode;
     if (!already_set) {
+      ++mxcsr_dynamic_checks_;
       if (new_mode == MXCSRMode::Fpu) {
         ChangeMxcsrModeDynamicHelper<true>(*this);
       } else if (new_mode == MXCSRMode::Vmx) {
@@ -1705,6 +2336,7 @@ bool X64Emitter::ChangeMxcsrMode(MXCSRMode new_mode, bool already_set) {
   } else {
     mxcsr_mode_ = new_mode;
     if (!already_set) {
+      ++mxcsr_loads_;
       if (new_mode == MXCSRMode::Fpu) {
         LoadFpuMxcsrDirect();
         btr(GetBackendFlagsPtr(), kX64BackendMXCSRModeBit);
@@ -1820,15 +2452,18 @@ void X64Emitter::EnsureSynchronizedGuestAndHostStack() {
         uint32_t stack32 = static_cast<uint32_t>(e.stack_size());
         auto backend = e.backend();
         if (stack32 < 256) {
-          e.call(backend->synchronize_guest_and_host_stack_helper_for_size(1));
+          e.CallCodeCache(
+              backend->synchronize_guest_and_host_stack_helper_for_size(1));
           e.db(stack32);
 
         } else if (stack32 < 65536) {
-          e.call(backend->synchronize_guest_and_host_stack_helper_for_size(2));
+          e.CallCodeCache(
+              backend->synchronize_guest_and_host_stack_helper_for_size(2));
           e.dw(stack32);
         } else {
           // ought to be impossible, a host stack bigger than 65536??
-          e.call(backend->synchronize_guest_and_host_stack_helper_for_size(4));
+          e.CallCodeCache(
+              backend->synchronize_guest_and_host_stack_helper_for_size(4));
           e.dd(stack32);
         }
         e.jmp(return_from_sync, T_NEAR);
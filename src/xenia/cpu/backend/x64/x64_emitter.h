@@ -10,9 +10,11 @@
 #ifndef XENIA_CPU_BACKEND_X64_X64_EMITTER_H_
 #define XENIA_CPU_BACKEND_X64_X64_EMITTER_H_
 
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/hir/hir_builder.h"
@@ -218,9 +220,16 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   bool Emit(GuestFunction* function, hir::HIRBuilder* builder,
             uint32_t debug_info_flags, FunctionDebugInfo* debug_info,
+            const std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls,
             void** out_code_address, size_t* out_code_size,
             std::vector<SourceMapEntry>* out_source_map);
 
+  // Whether the function being emitted may be written to the persistent code
+  // storage. Code that embeds pointers only valid for the current session
+  // (heap objects, trace buffers, etc) must call MarkCodeNonPersistent.
+  bool persistent_code() const { return persistent_code_; }
+  void MarkCodeNonPersistent() { persistent_code_ = false; }
+
  public:
   // Reserved:  rsp, rsi, rdi
   // Scratch:   rax/rcx/rdx
@@ -260,8 +269,19 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void UnimplementedInstr(const hir::Instr* i);
 
   void Call(const hir::Instr* instr, GuestFunction* function);
+  // Emits a call (or tail jump) that X64CodeCache rewrites into a direct call
+  // once the callee has its final code. The guest address must be in ebx.
+  void CallLinkable(const hir::Instr* instr, GuestFunction* function);
   void CallIndirect(const hir::Instr* instr, const Xbyak::Reg64& reg);
+  // Profiled or inline cached indirect calls emit too much code to be skipped
+  // with a short jump.
+  bool HasIndirectCallProfile(const hir::Instr* instr) const {
+    return indirect_call_profiles_.count(instr) != 0;
+  }
   void CallExtern(const hir::Instr* instr, const Function* function);
+  // Clears the kernel call state of the thread, and acknowledges the reclaim
+  // epoch if it changed. See X64Backend::AcknowledgeCodeReclaim.
+  void EmitCodeReclaimSafePoint();
   void CallNative(void* fn);
   void CallNative(uint64_t (*fn)(void* raw_context));
   void CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0));
@@ -269,6 +289,13 @@ class X64Emitter : public Xbyak::CodeGenerator {
                   uint64_t arg0);
   void CallNativeSafe(void* fn);
   void SetReturnAddress(uint64_t value);
+  // Loads the address of a function or data in the host executable, and calls
+  // or jumps to code in the code cache outside of the function, recording the
+  // reference so the code can be relocated when stored (see
+  // X64CodeCache::InitializePersistentStorage).
+  void MovHostAddress(const Xbyak::Reg64& reg, const void* address);
+  void CallCodeCache(const void* address);
+  void JmpCodeCache(const void* address);
 
   Xbyak::Reg64 GetNativeParam(uint32_t param);
 
@@ -388,7 +415,8 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
  protected:
   void* Emplace(const EmitFunctionInfo& func_info,
-                GuestFunction* function = nullptr);
+                GuestFunction* function = nullptr,
+                const std::vector<SourceMapEntry>* source_map = nullptr);
   bool Emit(hir::HIRBuilder* builder, EmitFunctionInfo& func_info);
   void EmitGetCurrentThreadId();
   void EmitTraceUserCallReturn();
@@ -405,6 +433,12 @@ class X64Emitter : public Xbyak::CodeGenerator {
   Xbyak::util::Cpu cpu_;
   uint64_t feature_flags_ = 0;
   uint32_t current_guest_function_ = 0;
+  bool persistent_code_ = true;
+  // Function whose baseline code is being emitted, nullptr otherwise.
+  X64Function* tier_up_function_ = nullptr;
+  // Baseline function run by the interpreter, see
+  // interpret_baseline_functions.
+  X64Function* interpreted_function_ = nullptr;
   Xbyak::Label* epilog_label_ = nullptr;
 
   hir::Instr* current_instr_ = nullptr;
@@ -428,7 +462,59 @@ class X64Emitter : public Xbyak::CodeGenerator {
   std::vector<Xbyak::Label*>
       label_cache_;  // for creating labels that need to be referenced much
                      // later by tail emitters
+  // Shared by all linkable call sites of the function, goes through the
+  // indirection table.
+  Xbyak::Label* call_link_stub_label_ = nullptr;
+  // Guest address of the callee and code offset of the rel32 operand.
+  std::vector<std::pair<uint32_t, uint32_t>> call_sites_;
+  std::vector<CodeRelocation> relocations_;
+  // Of the function being emitted, stored with its code.
+  const std::vector<FunctionDebugInfo::InlinedCall>* inlined_calls_ = nullptr;
   MXCSRMode mxcsr_mode_ = MXCSRMode::Unknown;
+
+  // MXCSR modes on the edges into blocks, so a block only reached from
+  // blocks already emitted, all in the same mode, can start in that mode
+  // instead of checking it dynamically.
+  struct BlockMxcsrMode {
+    // Edges into the block, including the function entry, not emitted yet.
+    uint32_t pending_edges = 0;
+    bool has_mode = false;
+    MXCSRMode mode = MXCSRMode::Unknown;
+  };
+  void EmitBlock(hir::Block* block, const hir::Block* next_block,
+                 bool epilog_follows);
+  // Blocks in the order they are emitted in, before and after the epilog.
+  void SelectBlockLayout(hir::HIRBuilder* builder,
+                         std::vector<hir::Block*>* hot_blocks,
+                         std::vector<hir::Block*>* cold_blocks);
+  static uint32_t GetBlockGuestAddress(const hir::Block* block);
+  // A block is cold if it ran less than once per this many runs of the
+  // busiest block of the baseline code.
+  static constexpr uint32_t kColdBlockRatio = 1000;
+  X64Function* layout_function_ = nullptr;
+  std::unordered_map<const hir::Block*, Xbyak::Label*> block_labels_;
+  std::unordered_map<const hir::Block*, uint32_t*> profiled_blocks_;
+
+  // Finds the profiles of the indirect calls, created for baseline code.
+  void PrepareIndirectCallProfiles(hir::HIRBuilder* builder);
+  void EmitIndirectCallProfile(size_t profile_index,
+                               const Xbyak::Reg32& target);
+  // With the target in ebx, calls the targets the baseline code saw through
+  // linkable calls if the address matches, then jumps to done. Returns false
+  // if nothing was emitted.
+  bool EmitIndirectCallInlineCache(const hir::Instr* instr,
+                                   size_t profile_index, Xbyak::Label& done);
+  // Indices into the indirect call profiles of layout_function_.
+  std::unordered_map<const hir::Instr*, size_t> indirect_call_profiles_;
+
+  void CountBlockMxcsrModeEdges(hir::HIRBuilder* builder);
+  void AddBlockMxcsrModeEdge(const hir::Block* block);
+  void RecordBlockMxcsrModeEdge(const hir::Block* block);
+  void EnterBlockMxcsrMode(const hir::Block* block);
+  std::unordered_map<const hir::Block*, BlockMxcsrMode> block_mxcsr_modes_;
+  uint32_t mxcsr_known_block_entries_ = 0;
+  uint32_t mxcsr_dynamic_checks_ = 0;
+  uint32_t mxcsr_loads_ = 0;
 };
 
 }  // namespace x64
@@ -9,7 +9,10 @@
 
 #include "xenia/cpu/backend/x64/x64_function.h"
 
+#include <algorithm>
+
 #include "xenia/cpu/backend/x64/x64_backend.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/thread_state.h"
 
@@ -34,11 +37,28 @@ bool X64Function::CallImpl(ThreadState* thread_state, uint32_t return_address) {
   auto backend =
       reinterpret_cast<X64Backend*>(thread_state->processor()->backend());
   auto thunk = backend->host_to_guest_thunk();
+  auto bctx = backend->BackendContextForGuestContext(thread_state->context());
+  uint64_t stack_base = 0;
+  uint64_t* host_call_stack = backend->EnterGuestCode(bctx, &stack_base);
   thunk(machine_code_, thread_state->context(),
         reinterpret_cast<void*>(uintptr_t(return_address)));
+  backend->LeaveGuestCode(bctx, &stack_base, host_call_stack);
   return true;
 }
 
+void X64Function::RestartTierUpCountdown() {
+  tier_up_countdown_ =
+      std::max(cvars::tiered_compilation_threshold, uint32_t(1));
+}
+
+std::shared_ptr<void> X64Function::DiscardDerivedData() {
+  auto discarded = std::make_shared<DiscardedData>();
+  discarded->interpreter_program = std::move(interpreter_program_);
+  discarded->block_profile = std::move(block_profile_);
+  discarded->indirect_call_profiles = std::move(indirect_call_profiles_);
+  return discarded;
+}
+
 }  // namespace x64
 }  // namespace backend
 }  // namespace cpu
@@ -10,6 +10,10 @@
 #ifndef XENIA_CPU_BACKEND_X64_X64_FUNCTION_H_
 #define XENIA_CPU_BACKEND_X64_X64_FUNCTION_H_
 
+#include <memory>
+#include <vector>
+
+#include "xenia/cpu/backend/interpreter/interpreter.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/thread_state.h"
 
@@ -28,12 +32,76 @@ class X64Function : public GuestFunction {
 
   void Setup(uint8_t* machine_code, size_t machine_code_length);
 
+  // True if the machine code may be reused by a later session through the
+  // persistent code storage of X64CodeCache.
+  bool persistent_code() const { return persistent_code_; }
+  void set_persistent_code(bool value) { persistent_code_ = value; }
+
+  // Decremented by baseline code on every call, see tiered_compilation.
+  uint32_t* tier_up_countdown() { return &tier_up_countdown_; }
+  void RestartTierUpCountdown() override;
+
+  // Run by the baseline code instead of a translated body, see
+  // interpret_baseline_functions. Kept once set, as the baseline code may
+  // still be executing after the function was retranslated.
+  const interpreter::InterpreterProgram* interpreter_program() const {
+    return interpreter_program_.get();
+  }
+  void set_interpreter_program(
+      std::unique_ptr<interpreter::InterpreterProgram> program) {
+    interpreter_program_ = std::move(program);
+  }
+
+  // Run counts of the blocks of the baseline code by the guest address they
+  // start at, see profile_block_layout. Kept once set for the same reason as
+  // the interpreter program.
+  struct BlockProfile {
+    std::vector<uint32_t> guest_addresses;
+    std::unique_ptr<uint32_t[]> counts;
+  };
+  const BlockProfile* block_profile() const { return block_profile_.get(); }
+  void set_block_profile(std::unique_ptr<BlockProfile> profile) {
+    block_profile_ = std::move(profile);
+  }
+
+  // Targets of an indirect call of the baseline code, see
+  // indirect_call_inline_caches. Kept once set, like the block profile.
+  struct IndirectCallProfile {
+    uint32_t call_address;
+    // The last two different targets, the latest first.
+    uint32_t targets[2];
+    uint32_t target_changes;
+    uint32_t calls;
+  };
+  std::vector<IndirectCallProfile>* indirect_call_profiles() {
+    return indirect_call_profiles_.get();
+  }
+  void set_indirect_call_profiles(
+      std::unique_ptr<std::vector<IndirectCallProfile>> profiles) {
+    indirect_call_profiles_ = std::move(profiles);
+  }
+
+  // Drops the above when the guest code was modified, so the new translation
+  // doesn't use them. Returned for keeping them allocated while the old code
+  // may be running, see X64CodeCache::RetireCodeData.
+  std::shared_ptr<void> DiscardDerivedData();
+
  protected:
   bool CallImpl(ThreadState* thread_state, uint32_t return_address) override;
 
  private:
   uint8_t* machine_code_ = nullptr;
   size_t machine_code_length_ = 0;
+  bool persistent_code_ = false;
+  uint32_t tier_up_countdown_ = 0;
+  std::unique_ptr<interpreter::InterpreterProgram> interpreter_program_;
+  std::unique_ptr<BlockProfile> block_profile_;
+  std::unique_ptr<std::vector<IndirectCallProfile>> indirect_call_profiles_;
+  struct DiscardedData {
+    std::unique_ptr<interpreter::InterpreterProgram> interpreter_program;
+    std::unique_ptr<BlockProfile> block_profile;
+    std::unique_ptr<std::vector<IndirectCallProfile>> indirect_call_profiles;
+  };
 };
 
 }  // namespace x64
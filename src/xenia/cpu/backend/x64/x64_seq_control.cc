@@ -348,7 +348,8 @@ struct CALL_INDIRECT_TRUE_I32
     : Sequence<CALL_INDIRECT_TRUE_I32,
                I<OPCODE_CALL_INDIRECT_TRUE, VoidOp, I32Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    if (e.IsFeatureEnabled(kX64FastJrcx)) {
+    if (e.IsFeatureEnabled(kX64FastJrcx) &&
+        !e.HasIndirectCallProfile(i.instr)) {
       e.mov(e.ecx, i.src1);
       Xbyak::Label skip;
       e.jrcxz(skip);
@@ -367,7 +368,8 @@ struct CALL_INDIRECT_TRUE_I64
     : Sequence<CALL_INDIRECT_TRUE_I64,
                I<OPCODE_CALL_INDIRECT_TRUE, VoidOp, I64Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    if (e.IsFeatureEnabled(kX64FastJrcx)) {
+    if (e.IsFeatureEnabled(kX64FastJrcx) &&
+        !e.HasIndirectCallProfile(i.instr)) {
       e.mov(e.rcx, i.src1);
       Xbyak::Label skip;
       e.jrcxz(skip);
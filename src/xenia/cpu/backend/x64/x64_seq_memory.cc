@@ -495,7 +495,7 @@ struct RESERVED_LOAD_INT32
     // atomic op in the store
     e.prefetchw(e.ptr[e.rax]);
     e.mov(e.ecx, i.src1.reg().cvt32());
-    e.call(e.backend()->try_acquire_reservation_helper_);
+    e.CallCodeCache(e.backend()->try_acquire_reservation_helper_);
     e.mov(i.dest, e.dword[e.rax]);
 
     e.mov(
@@ -515,7 +515,7 @@ struct RESERVED_LOAD_INT64
     // atomic op in the store
     e.prefetchw(e.ptr[e.rax]);
 
-    e.call(e.backend()->try_acquire_reservation_helper_);
+    e.CallCodeCache(e.backend()->try_acquire_reservation_helper_);
     e.mov(i.dest, e.qword[ComputeMemoryAddress(e, i.src1)]);
 
     e.mov(
@@ -540,7 +540,7 @@ struct RESERVED_STORE_INT32
     e.mov(e.ecx, i.src1.reg().cvt32());
     e.lea(e.r9, e.ptr[ComputeMemoryAddress(e, i.src1)]);
     e.mov(e.r8d, i.src2);
-    e.call(e.backend()->reserved_store_32_helper);
+    e.CallCodeCache(e.backend()->reserved_store_32_helper);
     e.setz(i.dest);
   }
 };
@@ -552,7 +552,7 @@ struct RESERVED_STORE_INT64
     e.mov(e.ecx, i.src1.reg().cvt32());
     e.lea(e.r9, e.ptr[ComputeMemoryAddress(e, i.src1)]);
     e.mov(e.r8, i.src2);
-    e.call(e.backend()->reserved_store_64_helper);
+    e.CallCodeCache(e.backend()->reserved_store_64_helper);
     e.setz(i.dest);
   }
 };
@@ -567,7 +567,12 @@ struct ATOMIC_COMPARE_EXCHANGE_I32
     : Sequence<ATOMIC_COMPARE_EXCHANGE_I32,
                I<OPCODE_ATOMIC_COMPARE_EXCHANGE, I8Op, I64Op, I32Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    e.mov(e.eax, i.src2);
+    // Intrinsics compare and exchange constants, which have no register.
+    if (i.src2.is_constant) {
+      e.mov(e.eax, i.src2.constant());
+    } else {
+      e.mov(e.eax, i.src2);
+    }
     if (xe::memory::allocation_granularity() > 0x1000) {
       // Emulate the 4 KB physical address offset in 0xE0000000+ when can't do
       // it via memory mapping.
@@ -588,8 +593,14 @@ struct ATOMIC_COMPARE_EXCHANGE_I32
     } else {
       e.mov(e.ecx, i.src1.reg().cvt32());
     }
-    e.lock();
-    e.cmpxchg(e.dword[e.GetMembaseReg() + e.rcx], i.src3);
+    if (i.src3.is_constant) {
+      e.mov(e.edx, i.src3.constant());
+      e.lock();
+      e.cmpxchg(e.dword[e.GetMembaseReg() + e.rcx], e.edx);
+    } else {
+      e.lock();
+      e.cmpxchg(e.dword[e.GetMembaseReg() + e.rcx], i.src3);
+    }
     e.sete(i.dest);
   }
 };
@@ -597,7 +608,12 @@ struct ATOMIC_COMPARE_EXCHANGE_I64
     : Sequence<ATOMIC_COMPARE_EXCHANGE_I64,
                I<OPCODE_ATOMIC_COMPARE_EXCHANGE, I8Op, I64Op, I64Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    e.mov(e.rax, i.src2);
+    // Intrinsics compare and exchange constants, which have no register.
+    if (i.src2.is_constant) {
+      e.mov(e.rax, i.src2.constant());
+    } else {
+      e.mov(e.rax, i.src2);
+    }
     if (xe::memory::allocation_granularity() > 0x1000) {
       // Emulate the 4 KB physical address offset in 0xE0000000+ when can't do
       // it via memory mapping.
@@ -618,8 +634,14 @@ struct ATOMIC_COMPARE_EXCHANGE_I64
     } else {
       e.mov(e.ecx, i.src1.reg().cvt32());
     }
-    e.lock();
-    e.cmpxchg(e.qword[e.GetMembaseReg() + e.rcx], i.src3);
+    if (i.src3.is_constant) {
+      e.mov(e.rdx, i.src3.constant());
+      e.lock();
+      e.cmpxchg(e.qword[e.GetMembaseReg() + e.rcx], e.rdx);
+    } else {
+      e.lock();
+      e.cmpxchg(e.qword[e.GetMembaseReg() + e.rcx], i.src3);
+    }
     e.sete(i.dest);
   }
 };
@@ -1126,6 +1148,8 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
+    // The callback context is a heap object.
+    e.MarkCodeNonPersistent();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
@@ -1151,6 +1175,8 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
+    // The callback context is a heap object.
+    e.MarkCodeNonPersistent();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), write_address);
     if (i.src3.is_constant) {
@@ -1878,7 +1904,11 @@ EMITTER_OPCODE_TABLE(OPCODE_CACHE_CONTROL, CACHE_CONTROL);
 // ============================================================================
 struct MEMORY_BARRIER
     : Sequence<MEMORY_BARRIER, I<OPCODE_MEMORY_BARRIER, VoidOp>> {
-  static void Emit(X64Emitter& e, const EmitArgType& i) { e.mfence(); }
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (i.instr->flags != MEMORY_BARRIER_COMPILER) {
+      e.mfence();
+    }
+  }
 };
 EMITTER_OPCODE_TABLE(OPCODE_MEMORY_BARRIER, MEMORY_BARRIER);
 
@@ -421,6 +421,49 @@ struct VECTOR_COMPARE_SGT_V128
 };
 EMITTER_OPCODE_TABLE(OPCODE_VECTOR_COMPARE_SGT, VECTOR_COMPARE_SGT_V128);
 
+// Integer compares that have no single AVX2 instruction, done into k1 and
+// expanded back to a vector.
+static bool CanEmitAVX512VectorCompare(X64Emitter& e, uint16_t type) {
+  return type != FLOAT32_TYPE &&
+         e.IsFeatureEnabled(kX64EmitAVX512Ortho | kX64EmitAVX512BW |
+                            kX64EmitAVX512DQ);
+}
+template <typename T>
+static void EmitAVX512VectorCompare(X64Emitter& e, const T& i,
+                                    uint8_t predicate, bool is_unsigned) {
+  Xmm src1 = GetInputRegOrConstant(e, i.src1, e.xmm0);
+  Xmm src2 = GetInputRegOrConstant(e, i.src2, e.xmm1);
+  switch (i.instr->flags) {
+    case INT8_TYPE:
+      if (is_unsigned) {
+        e.vpcmpub(e.k1, src1, src2, predicate);
+      } else {
+        e.vpcmpb(e.k1, src1, src2, predicate);
+      }
+      e.vpmovm2b(i.dest, e.k1);
+      break;
+    case INT16_TYPE:
+      if (is_unsigned) {
+        e.vpcmpuw(e.k1, src1, src2, predicate);
+      } else {
+        e.vpcmpw(e.k1, src1, src2, predicate);
+      }
+      e.vpmovm2w(i.dest, e.k1);
+      break;
+    case INT32_TYPE:
+      if (is_unsigned) {
+        e.vpcmpud(e.k1, src1, src2, predicate);
+      } else {
+        e.vpcmpd(e.k1, src1, src2, predicate);
+      }
+      e.vpmovm2d(i.dest, e.k1);
+      break;
+    default:
+      assert_always();
+      break;
+  }
+}
+
 // ============================================================================
 // OPCODE_VECTOR_COMPARE_SGE
 // ============================================================================
@@ -428,6 +471,11 @@ struct VECTOR_COMPARE_SGE_V128
     : Sequence<VECTOR_COMPARE_SGE_V128,
                I<OPCODE_VECTOR_COMPARE_SGE, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (CanEmitAVX512VectorCompare(e, i.instr->flags)) {
+      // _MM_CMPINT_NLT
+      EmitAVX512VectorCompare(e, i, 0x5, false);
+      return;
+    }
     EmitAssociativeBinaryXmmOp(
         e, i, [&i](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
           if (cvars::xop_compares && e.IsFeatureEnabled(kX64EmitXOP)) {
@@ -481,40 +529,9 @@ struct VECTOR_COMPARE_UGT_V128
     : Sequence<VECTOR_COMPARE_UGT_V128,
                I<OPCODE_VECTOR_COMPARE_UGT, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    if (e.IsFeatureEnabled(kX64EmitAVX512Ortho | kX64EmitAVX512BW |
-                           kX64EmitAVX512DQ) &&
-        (i.instr->flags != FLOAT32_TYPE)) {
-      Xmm src1 = e.xmm0;
-      if (i.src1.is_constant) {
-        e.LoadConstantXmm(src1, i.src1.constant());
-      } else {
-        src1 = i.src1;
-      }
-
-      Xmm src2 = e.xmm1;
-      if (i.src2.is_constant) {
-        e.LoadConstantXmm(src2, i.src2.constant());
-      } else {
-        src2 = i.src2;
-      }
-
-      switch (i.instr->flags) {
-        case INT8_TYPE:
-          e.vpcmpub(e.k1, src1, src2, 0x6);
-          e.vpmovm2b(i.dest, e.k1);
-          break;
-        case INT16_TYPE:
-          e.vpcmpuw(e.k1, src1, src2, 0x6);
-          e.vpmovm2w(i.dest, e.k1);
-          break;
-        case INT32_TYPE:
-          e.vpcmpud(e.k1, src1, src2, 0x6);
-          e.vpmovm2d(i.dest, e.k1);
-          break;
-        default:
-          assert_always();
-          break;
-      }
+    if (CanEmitAVX512VectorCompare(e, i.instr->flags)) {
+      // _MM_CMPINT_NLE
+      EmitAVX512VectorCompare(e, i, 0x6, true);
       return;
     }
 
@@ -576,6 +593,11 @@ struct VECTOR_COMPARE_UGE_V128
     : Sequence<VECTOR_COMPARE_UGE_V128,
                I<OPCODE_VECTOR_COMPARE_UGE, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (CanEmitAVX512VectorCompare(e, i.instr->flags)) {
+      // _MM_CMPINT_NLT
+      EmitAVX512VectorCompare(e, i, 0x5, true);
+      return;
+    }
     Xbyak::Address sign_addr = e.ptr[e.rax];  // dummy
     switch (i.instr->flags) {
       case INT8_TYPE:
@@ -1784,6 +1806,32 @@ EMITTER_OPCODE_TABLE(OPCODE_VECTOR_SHA, VECTOR_SHA_V128);
 struct VECTOR_ROTATE_LEFT_V128
     : Sequence<VECTOR_ROTATE_LEFT_V128,
                I<OPCODE_VECTOR_ROTATE_LEFT, V128Op, V128Op, V128Op>> {
+  // AVX-512BW has variable word shifts, so no element loop is needed.
+  static void EmitAVX512Int8Int16(X64Emitter& e, const EmitArgType& i) {
+    Xmm src1 = GetInputRegOrConstant(e, i.src1, e.xmm0);
+    Xmm src2 = GetInputRegOrConstant(e, i.src2, e.xmm1);
+    e.vpand(e.xmm2, src2,
+            e.GetXmmConstPtr(GetShiftmaskForType(i.instr->flags)));
+    if (i.instr->flags == INT8_TYPE) {
+      // Each byte doubled into a word, so the high byte of the word shifted
+      // left is the byte rotated.
+      e.vpmovzxbw(e.ymm2, e.xmm2);
+      e.vpmovzxbw(e.ymm0, src1);
+      e.vpsllw(e.ymm1, e.ymm0, 8);
+      e.vpor(e.ymm0, e.ymm0, e.ymm1);
+      e.vpsllvw(e.ymm0, e.ymm0, e.ymm2);
+      e.vpsrlw(e.ymm0, e.ymm0, 8);
+      e.vpmovwb(i.dest, e.ymm0);
+    } else {
+      e.vpsllvw(e.xmm3, src1, e.xmm2);
+      e.LoadConstantXmm(e.xmm1, vec128s(16));
+      e.vpsubw(e.xmm2, e.xmm1, e.xmm2);
+      // Shifts of 16 give zero.
+      e.vpsrlvw(i.dest, src1, e.xmm2);
+      e.vpor(i.dest, e.xmm3);
+    }
+  }
+
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     if (cvars::xop_rotates && e.IsFeatureEnabled(kX64EmitXOP)) {
       Xmm src1 = GetInputRegOrConstant(e, i.src1, e.xmm0);
@@ -1804,6 +1852,9 @@ struct VECTOR_ROTATE_LEFT_V128
           break;
       }
 
+    } else if (i.instr->flags != INT32_TYPE &&
+               e.IsFeatureEnabled(kX64EmitAVX512Ortho | kX64EmitAVX512BW)) {
+      EmitAVX512Int8Int16(e, i);
     } else {
       unsigned stack_offset_src1 = StackLayout::GUEST_SCRATCH;
       unsigned stack_offset_src2 = StackLayout::GUEST_SCRATCH + 16;
@@ -1873,7 +1924,9 @@ struct VECTOR_ROTATE_LEFT_V128
         } break;
         case INT32_TYPE: {
           if (e.IsFeatureEnabled(kX64EmitAVX512Ortho)) {
-            e.vprolvd(i.dest, i.src1, i.src2);
+            Xmm src1 = GetInputRegOrConstant(e, i.src1, e.xmm0);
+            Xmm src2 = GetInputRegOrConstant(e, i.src2, e.xmm1);
+            e.vprolvd(i.dest, src1, src2);
           } else if (e.IsFeatureEnabled(kX64EmitAVX2)) {
             Xmm temp = i.dest;
             if (i.dest == i.src1 || i.dest == i.src2) {
@@ -2171,7 +2224,7 @@ struct EXTRACT_I32
       e.mov(e.al, i.src2);
       e.and_(e.al, 0x03);
       e.shl(e.al, 4);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(extract_table_32));
+      e.MovHostAddress(e.rdx, extract_table_32);
       e.vmovaps(e.xmm0, e.ptr[e.rdx + e.rax]);
       e.vpshufb(e.xmm0, src1, e.xmm0);
       e.vpextrd(i.dest, e.xmm0, 0);
@@ -2297,6 +2350,16 @@ struct PERMUTE_I32
         blend_control |= blend_control << 1;
       }
 
+      // All words from one source, as left by PermuteCombinationPass for
+      // some of the shuffles it can't turn into a swizzle.
+      uint32_t select_src3 = control & 0x04040404;
+      if (!select_src3 || select_src3 == 0x04040404) {
+        Xmm src = select_src3 ? GetInputRegOrConstant(e, i.src3, e.xmm0)
+                              : GetInputRegOrConstant(e, i.src2, e.xmm0);
+        e.vpshufd(i.dest, src, src_control);
+        return;
+      }
+
       // TODO(benvanik): if src2/src3 are constants, shuffle now!
       Xmm src2;
       if (i.src2.is_constant) {
@@ -2332,7 +2395,6 @@ struct PERMUTE_I32
     }
   }
 };
-// todo: use this on const src1
 static vec128_t FixupConstantShuf8(vec128_t input) {
   for (uint32_t i = 0; i < 16; ++i) {
     input.u8[i] ^= 0x03;
@@ -2343,7 +2405,52 @@ static vec128_t FixupConstantShuf8(vec128_t input) {
 struct PERMUTE_V128
     : Sequence<PERMUTE_V128,
                I<OPCODE_PERMUTE, V128Op, V128Op, V128Op, V128Op>> {
+  // With a constant control the indices are known, so vpshufb controls that
+  // zero the bytes taken from the other source can be built here instead of
+  // the selection mask being computed in generated code.
+  static void EmitByInt8Constant(X64Emitter& e, const EmitArgType& i) {
+    vec128_t indices = FixupConstantShuf8(i.src1.constant());
+    bool src3_zero = i.src3.value->IsConstantZero();
+    bool uses_src2 = false, uses_src3 = false;
+    vec128_t src2_control, src3_control;
+    for (uint32_t n = 0; n < 16; ++n) {
+      uint8_t index = indices.u8[n];
+      if (index < 16) {
+        uses_src2 = true;
+        src2_control.u8[n] = index;
+        src3_control.u8[n] = 0x80;
+      } else {
+        uses_src3 |= !src3_zero;
+        src2_control.u8[n] = 0x80;
+        src3_control.u8[n] = index & 0xF;
+      }
+    }
+    if (!uses_src2 && !uses_src3) {
+      e.vpxor(i.dest, i.dest);
+      return;
+    }
+    if (uses_src2 != uses_src3) {
+      // Only one source, a single shuffle.
+      Xmm src = uses_src2 ? GetInputRegOrConstant(e, i.src2, e.xmm1)
+                          : GetInputRegOrConstant(e, i.src3, e.xmm1);
+      e.LoadConstantXmm(e.xmm0, uses_src2 ? src2_control : src3_control);
+      e.vpshufb(i.dest, src, e.xmm0);
+      return;
+    }
+    Xmm src2 = GetInputRegOrConstant(e, i.src2, e.xmm1);
+    Xmm src3 = GetInputRegOrConstant(e, i.src3, e.xmm2);
+    e.LoadConstantXmm(e.xmm0, src2_control);
+    e.vpshufb(e.xmm0, src2, e.xmm0);
+    e.LoadConstantXmm(e.xmm3, src3_control);
+    e.vpshufb(i.dest, src3, e.xmm3);
+    e.vpor(i.dest, e.xmm0);
+  }
+
   static void EmitByInt8(X64Emitter& e, const EmitArgType& i) {
+    if (i.src1.is_constant) {
+      EmitByInt8Constant(e, i);
+      return;
+    }
     // TODO(benvanik): find out how to do this with only one temp register!
     // Permute bytes between src2 and src3.
     // src1 is an array of indices corresponding to positions within src2 and
@@ -0,0 +1,219 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compile_pool.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/cpu/processor.h"
+
+DEFINE_int32(cpu_compilation_threads, -1,
+             "Number of threads used to translate guest functions ahead of "
+             "time (see enable_early_precompilation). -1 to calculate "
+             "automatically (half of the logical CPU cores), a positive number "
+             "to specify the number of threads explicitly (up to the number "
+             "of logical CPU cores), 0 to translate on the loading thread.",
+             "CPU");
+
+namespace xe {
+namespace cpu {
+
+CompilePool::CompilePool(Processor* processor) : processor_(processor) {}
+
+CompilePool::~CompilePool() { Shutdown(); }
+
+bool CompilePool::Initialize() {
+  if (cvars::cpu_compilation_threads == 0) {
+    return true;
+  }
+  uint32_t logical_processor_count = xe::threading::logical_processor_count();
+  if (!logical_processor_count) {
+    // Pick some reasonable amount if couldn't determine the number of cores.
+    logical_processor_count = 4;
+  }
+  size_t worker_count;
+  if (cvars::cpu_compilation_threads < 0) {
+    worker_count = std::max(logical_processor_count / 2, uint32_t(1));
+  } else {
+    worker_count = std::min(uint32_t(cvars::cpu_compilation_threads),
+                            logical_processor_count);
+  }
+
+  shutdown_ = false;
+  for (size_t i = 0; i < worker_count; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  // Threads are only started once all workers exist, as they steal from each
+  // other.
+  for (size_t i = 0; i < worker_count; ++i) {
+    auto thread =
+        xe::threading::Thread::Create({}, [this, i]() { WorkerThread(i); });
+    if (!thread) {
+      XELOGE("Failed to create CPU compilation thread {}", i);
+      Shutdown();
+      return false;
+    }
+    thread->set_name("CPU Compilation");
+    // Guest threads take precedence, they'd translate what they need
+    // themselves anyway.
+    thread->set_priority(xe::threading::ThreadPriority::kBelowNormal);
+    workers_[i]->thread = std::move(thread);
+  }
+  return true;
+}
+
+void CompilePool::Shutdown() {
+  if (workers_.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<xe_mutex> lock(request_lock_);
+    shutdown_ = true;
+  }
+  request_cond_.notify_all();
+  for (auto& worker : workers_) {
+    if (worker->thread) {
+      xe::threading::Wait(worker->thread.get(), false);
+    }
+  }
+  workers_.clear();
+  {
+    std::lock_guard<xe_mutex> lock(request_lock_);
+    pending_count_ = 0;
+    optimization_queue_.clear();
+  }
+  completion_cond_.notify_all();
+}
+
+void CompilePool::QueueFunctions(const std::vector<uint32_t>& addresses) {
+  if (addresses.empty()) {
+    return;
+  }
+  if (workers_.empty()) {
+    for (uint32_t address : addresses) {
+      processor_->ResolveFunction(address);
+    }
+    return;
+  }
+
+  size_t worker_count = workers_.size();
+  {
+    // The queues are filled under the same lock workers wait with, so a woken
+    // worker always finds what it was woken for.
+    std::lock_guard<xe_mutex> lock(request_lock_);
+    pending_count_ += addresses.size();
+    size_t worker_index = next_worker_;
+    next_worker_ = (next_worker_ + 1) % worker_count;
+    // Spread contiguous runs over the workers, stealing evens it out later.
+    size_t run_length = (addresses.size() + worker_count - 1) / worker_count;
+    for (size_t i = 0; i < addresses.size(); i += run_length) {
+      Worker& worker = *workers_[worker_index];
+      worker_index = (worker_index + 1) % worker_count;
+      size_t end = std::min(i + run_length, addresses.size());
+      worker.queue.insert(worker.queue.end(), addresses.begin() + i,
+                          addresses.begin() + end);
+    }
+  }
+  request_cond_.notify_all();
+}
+
+void CompilePool::QueueOptimization(GuestFunction* function) {
+  if (workers_.empty()) {
+    if (processor_->OptimizeFunction(function)) {
+      ++optimized_count_;
+    }
+    return;
+  }
+  {
+    std::lock_guard<xe_mutex> lock(request_lock_);
+    optimization_queue_.push_back(function);
+  }
+  request_cond_.notify_one();
+}
+
+void CompilePool::WaitForCompletion() {
+  std::unique_lock<xe_mutex> lock(request_lock_);
+  completion_cond_.wait(lock, [this]() { return !pending_count_; });
+}
+
+bool CompilePool::DequeueFunction(size_t worker_index, uint32_t& address_out) {
+  // Own queue first, from the front.
+  {
+    Worker& worker = *workers_[worker_index];
+    if (!worker.queue.empty()) {
+      address_out = worker.queue.front();
+      worker.queue.pop_front();
+      return true;
+    }
+  }
+  // Steal from the back of the others.
+  size_t worker_count = workers_.size();
+  for (size_t i = 1; i < worker_count; ++i) {
+    Worker& victim = *workers_[(worker_index + i) % worker_count];
+    if (!victim.queue.empty()) {
+      address_out = victim.queue.back();
+      victim.queue.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void CompilePool::WorkerThread(size_t worker_index) {
+  while (true) {
+    GuestFunction* hot_function = nullptr;
+    uint32_t address = 0;
+    bool dequeued = false;
+    {
+      std::unique_lock<xe_mutex> lock(request_lock_);
+      // Hot code is already running, so it's worth more than precompilation.
+      request_cond_.wait(lock, [&]() {
+        if (shutdown_ || !optimization_queue_.empty()) {
+          return true;
+        }
+        dequeued = DequeueFunction(worker_index, address);
+        return dequeued;
+      });
+      if (shutdown_) {
+        return;
+      }
+      if (!dequeued) {
+        hot_function = optimization_queue_.front();
+        optimization_queue_.pop_front();
+      }
+    }
+    if (hot_function) {
+      if (processor_->OptimizeFunction(hot_function)) {
+        ++optimized_count_;
+      }
+      continue;
+    }
+
+    // Already resolved functions (by guest threads or earlier queueing) return
+    // immediately, and ones being resolved elsewhere only wait on their entry.
+    if (processor_->ResolveFunction(address)) {
+      ++resolved_count_;
+    }
+
+    bool completed;
+    {
+      std::lock_guard<xe_mutex> lock(request_lock_);
+      completed = !--pending_count_;
+    }
+    if (completed) {
+      completion_cond_.notify_all();
+    }
+  }
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,94 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILE_POOL_H_
+#define XENIA_CPU_COMPILE_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+
+class GuestFunction;
+class Processor;
+
+// Resolves (translates) guest functions on background host threads, so that
+// module precompilation doesn't hold up the title, and retranslates hot
+// functions with tiered_compilation.
+// Each worker owns a queue, and idle workers steal from the back of the queues
+// of busy ones. Guest threads resolving a function the pool is currently
+// translating only wait for that function's entry, and functions a guest
+// thread got to first are skipped by the pool.
+class CompilePool {
+ public:
+  explicit CompilePool(Processor* processor);
+  ~CompilePool();
+
+  bool Initialize();
+  void Shutdown();
+
+  // False if background compilation is disabled, in which case callers should
+  // resolve functions themselves.
+  bool is_enabled() const { return !workers_.empty(); }
+
+  void QueueFunctions(const std::vector<uint32_t>& addresses);
+  // Retranslates a hot function with the full pass list (see
+  // tiered_compilation), ahead of any queued resolution. The function must have
+  // been moved to the kOptimizing tier.
+  void QueueOptimization(GuestFunction* function);
+  // Blocks until all queued functions have been resolved.
+  void WaitForCompletion();
+
+  uint64_t resolved_count() const { return resolved_count_; }
+  uint64_t optimized_count() const { return optimized_count_; }
+
+ private:
+  struct Worker {
+    std::unique_ptr<xe::threading::Thread> thread;
+    // Protected with request_lock_.
+    std::deque<uint32_t> queue;
+  };
+
+  void WorkerThread(size_t worker_index);
+  // Must be called with request_lock_ held.
+  bool DequeueFunction(size_t worker_index, uint32_t& address_out);
+
+  Processor* processor_ = nullptr;
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  xe_mutex request_lock_;
+  // Notified when functions are queued or on shutdown.
+  std::condition_variable_any request_cond_;
+  // Notified when pending_count_ drops to zero.
+  std::condition_variable_any completion_cond_;
+  // Protected with request_lock_.
+  // Worker that receives the first run of the next queueing.
+  size_t next_worker_ = 0;
+  // Functions queued or being resolved.
+  size_t pending_count_ = 0;
+  // Not tracked by pending_count_, as they're requested by running code.
+  std::deque<GuestFunction*> optimization_queue_;
+  bool shutdown_ = false;
+
+  std::atomic<uint64_t> resolved_count_ = {0};
+  std::atomic<uint64_t> optimized_count_ = {0};
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILE_POOL_H_
@@ -9,19 +9,31 @@
 
 #include "xenia/cpu/compiler/compiler.h"
 
+#include "xenia/base/clock.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/utf8.h"
 #include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/cpu_flags.h"
 
 namespace xe {
 namespace cpu {
 namespace compiler {
 
-Compiler::Compiler(Processor* processor) : processor_(processor) {}
+Compiler::Compiler(Processor* processor, const char* name)
+    : processor_(processor), name_(name) {}
 
 Compiler::~Compiler() { Reset(); }
 
 void Compiler::AddPass(std::unique_ptr<CompilerPass> pass) {
+  if (IsPassDisabled(pass->name())) {
+    return;
+  }
   pass->Initialize(this);
+  pass_statistics_.push_back(
+      CompilerStatistics::is_enabled()
+          ? CompilerStatistics::RegisterPass(
+                name_, uint32_t(passes_.size()), pass->name())
+          : nullptr);
   passes_.push_back(std::move(pass));
 }
 
@@ -33,7 +45,20 @@ bool Compiler::Compile(xe::cpu::hir::HIRBuilder* builder) {
   for (size_t i = 0; i < passes_.size(); ++i) {
     auto& pass = passes_[i];
     scratch_arena_.Reset();
-    if (!pass->Run(builder)) {
+    auto pass_statistics = pass_statistics_[i];
+    if (!pass_statistics) {
+      if (!pass->Run(builder)) {
+        return false;
+      }
+      continue;
+    }
+    uint32_t instrs_before = CountInstrs(builder);
+    uint64_t start_ticks = Clock::QueryHostTickCount();
+    bool succeeded = pass->Run(builder);
+    uint64_t ticks = Clock::QueryHostTickCount() - start_ticks;
+    CompilerStatistics::RecordPass(pass_statistics, ticks, instrs_before,
+                                   CountInstrs(builder), succeeded);
+    if (!succeeded) {
       return false;
     }
   }
@@ -41,6 +66,33 @@ bool Compiler::Compile(xe::cpu::hir::HIRBuilder* builder) {
   return true;
 }
 
+uint32_t Compiler::CountInstrs(hir::HIRBuilder* builder) {
+  uint32_t count = 0;
+  auto block = builder->first_block();
+  while (block) {
+    auto instr = block->instr_head;
+    while (instr) {
+      ++count;
+      instr = instr->next;
+    }
+    block = block->next;
+  }
+  return count;
+}
+
+bool Compiler::IsPassDisabled(const char* name) {
+  if (cvars::disabled_compiler_passes.empty()) {
+    return false;
+  }
+  for (auto disabled_name :
+       xe::utf8::split(cvars::disabled_compiler_passes, ", ", true)) {
+    if (disabled_name == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace compiler
 }  // namespace cpu
 }  // namespace xe
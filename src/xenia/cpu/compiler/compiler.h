@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/compiler/compiler_statistics.h"
 #include "xenia/cpu/hir/hir_builder.h"
 
 namespace xe {
@@ -30,11 +31,14 @@ class CompilerPass;
 
 class Compiler {
  public:
-  explicit Compiler(Processor* processor);
+  // The name must be a static string, and tells the pipelines apart in the
+  // compiler statistics.
+  Compiler(Processor* processor, const char* name);
   ~Compiler();
 
   Processor* processor() const { return processor_; }
   Arena* scratch_arena() { return &scratch_arena_; }
+  const char* name() const { return name_; }
 
   void AddPass(std::unique_ptr<CompilerPass> pass);
 
@@ -42,11 +46,20 @@ class Compiler {
 
   bool Compile(hir::HIRBuilder* builder);
 
+  static uint32_t CountInstrs(hir::HIRBuilder* builder);
+
+  // Whether the pass is listed in disabled_compiler_passes, and is left out
+  // when added.
+  static bool IsPassDisabled(const char* name);
+
  private:
   Processor* processor_;
+  const char* name_;
   Arena scratch_arena_;
 
   std::vector<std::unique_ptr<CompilerPass>> passes_;
+  // Parallel to passes_, null when statistics are disabled.
+  std::vector<CompilerStatistics::PassStatistics*> pass_statistics_;
 };
 
 }  // namespace compiler
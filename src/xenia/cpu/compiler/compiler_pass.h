@@ -30,6 +30,9 @@ class CompilerPass {
   CompilerPass();
   virtual ~CompilerPass();
 
+  // Identifies the pass in the compiler statistics.
+  virtual const char* name() const = 0;
+
   virtual bool Initialize(Compiler* compiler);
 
   virtual bool Run(hir::HIRBuilder* builder) = 0;
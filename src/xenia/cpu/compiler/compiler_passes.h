@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_COMPILER_COMPILER_PASSES_H_
 #define XENIA_CPU_COMPILER_COMPILER_PASSES_H_
 
+#include "xenia/cpu/compiler/passes/conditional_constant_propagation_pass.h"
 #include "xenia/cpu/compiler/passes/conditional_group_pass.h"
 #include "xenia/cpu/compiler/passes/conditional_group_subpass.h"
 #include "xenia/cpu/compiler/passes/constant_propagation_pass.h"
@@ -19,7 +20,12 @@
 #include "xenia/cpu/compiler/passes/data_flow_analysis_pass.h"
 #include "xenia/cpu/compiler/passes/dead_code_elimination_pass.h"
 #include "xenia/cpu/compiler/passes/finalization_pass.h"
+#include "xenia/cpu/compiler/passes/global_register_allocation_pass.h"
+#include "xenia/cpu/compiler/passes/loop_analysis_pass.h"
+#include "xenia/cpu/compiler/passes/loop_invariant_code_motion_pass.h"
+#include "xenia/cpu/compiler/passes/memory_barrier_relaxation_pass.h"
 #include "xenia/cpu/compiler/passes/memory_sequence_combination_pass.h"
+#include "xenia/cpu/compiler/passes/permute_combination_pass.h"
 #include "xenia/cpu/compiler/passes/register_allocation_pass.h"
 #include "xenia/cpu/compiler/passes/simplification_pass.h"
 #include "xenia/cpu/compiler/passes/validation_pass.h"
@@ -0,0 +1,342 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/compiler_statistics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string_buffer.h"
+
+DEFINE_bool(compiler_statistics, false,
+            "Gather per-pass compile times, HIR instruction counts and code "
+            "sizes of the JIT, written to compiler_statistics_path at exit or "
+            "with Ctrl+F3.",
+            "CPU");
+DEFINE_path(compiler_statistics_path, "compiler_statistics.json",
+            "File to write the JIT statistics to as JSON.", "CPU");
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+namespace {
+
+CompilerStatistics::PassStatistics passes_[CompilerStatistics::kMaxPasses];
+
+std::atomic<uint64_t> functions_{0};
+std::atomic<uint64_t> baseline_functions_{0};
+std::atomic<uint64_t> function_ticks_{0};
+std::atomic<uint64_t> compile_ticks_{0};
+std::atomic<uint64_t> hir_instrs_{0};
+std::atomic<uint64_t> arena_chunk_allocations_{0};
+std::atomic<uint64_t> first_function_tick_{0};
+std::atomic<uint64_t> last_function_tick_{0};
+
+std::atomic<uint64_t> code_prolog_{0};
+std::atomic<uint64_t> code_body_{0};
+std::atomic<uint64_t> code_epilog_{0};
+std::atomic<uint64_t> code_tail_{0};
+
+std::atomic<uint64_t> mxcsr_known_block_entries_{0};
+std::atomic<uint64_t> mxcsr_dynamic_checks_{0};
+std::atomic<uint64_t> mxcsr_loads_{0};
+
+std::atomic<uint64_t> memory_barrier_fences_{0};
+std::atomic<uint64_t> memory_barriers_relaxed_{0};
+
+CompilerStatistics::InlineCacheStatistics
+    inline_caches_[CompilerStatistics::kMaxInlineCaches];
+std::atomic<uint32_t> inline_cache_count_{0};
+
+// Microseconds in the upper 31 bits, then whether the function was a baseline
+// translation, then its guest address, so entries compare by time.
+std::atomic<uint64_t>
+    slowest_functions_[CompilerStatistics::kSlowestFunctionCount];
+
+double TicksToMilliseconds(uint64_t ticks) {
+  return double(ticks) * 1000.0 / double(Clock::QueryHostTickFrequency());
+}
+
+}  // namespace
+
+CompilerStatistics::PassStatistics* CompilerStatistics::RegisterPass(
+    const char* compiler_name, uint32_t index, const char* pass_name) {
+  for (auto& pass : passes_) {
+    uint32_t state = pass.state.load(std::memory_order_acquire);
+    if (!state) {
+      if (pass.state.compare_exchange_strong(state, 1,
+                                             std::memory_order_acquire)) {
+        pass.compiler_name = compiler_name;
+        pass.pass_name = pass_name;
+        pass.index = index;
+        pass.state.store(2, std::memory_order_release);
+        return &pass;
+      }
+    }
+    // Lost to another thread claiming the slot, which may be for this pass.
+    while (state == 1) {
+      state = pass.state.load(std::memory_order_acquire);
+    }
+    if (pass.index == index &&
+        !std::strcmp(pass.compiler_name, compiler_name) &&
+        !std::strcmp(pass.pass_name, pass_name)) {
+      return &pass;
+    }
+  }
+  return nullptr;
+}
+
+void CompilerStatistics::RecordPass(PassStatistics* pass, uint64_t ticks,
+                                    uint32_t instrs_before,
+                                    uint32_t instrs_after, bool succeeded) {
+  if (!pass) {
+    return;
+  }
+  pass->runs.fetch_add(1, std::memory_order_relaxed);
+  if (!succeeded) {
+    pass->failures.fetch_add(1, std::memory_order_relaxed);
+  }
+  pass->ticks.fetch_add(ticks, std::memory_order_relaxed);
+  pass->instrs_before.fetch_add(instrs_before, std::memory_order_relaxed);
+  pass->instrs_after.fetch_add(instrs_after, std::memory_order_relaxed);
+}
+
+void CompilerStatistics::RecordFunction(uint32_t guest_address, bool baseline,
+                                        uint64_t ticks, uint64_t compile_ticks,
+                                        uint32_t hir_instrs,
+                                        uint32_t arena_chunk_allocations) {
+  uint64_t now = Clock::QueryHostTickCount();
+  uint64_t zero = 0;
+  first_function_tick_.compare_exchange_strong(zero, now - ticks,
+                                               std::memory_order_relaxed);
+  last_function_tick_.store(now, std::memory_order_relaxed);
+  functions_.fetch_add(1, std::memory_order_relaxed);
+  if (baseline) {
+    baseline_functions_.fetch_add(1, std::memory_order_relaxed);
+  }
+  function_ticks_.fetch_add(ticks, std::memory_order_relaxed);
+  compile_ticks_.fetch_add(compile_ticks, std::memory_order_relaxed);
+  hir_instrs_.fetch_add(hir_instrs, std::memory_order_relaxed);
+  arena_chunk_allocations_.fetch_add(arena_chunk_allocations,
+                                     std::memory_order_relaxed);
+
+  // Replace the fastest of the slowest functions, retrying if another thread
+  // changed it in the meantime.
+  uint64_t microseconds =
+      ticks * 1000000 / std::max(Clock::QueryHostTickFrequency(), uint64_t(1));
+  uint64_t entry = (std::min(microseconds, uint64_t(INT32_MAX)) << 33) |
+                   (uint64_t(baseline) << 32) | guest_address;
+  while (true) {
+    size_t fastest_index = 0;
+    uint64_t fastest = UINT64_MAX;
+    for (size_t i = 0; i < kSlowestFunctionCount; ++i) {
+      uint64_t slow_entry =
+          slowest_functions_[i].load(std::memory_order_relaxed);
+      if (slow_entry < fastest) {
+        fastest = slow_entry;
+        fastest_index = i;
+      }
+    }
+    if (entry <= fastest ||
+        slowest_functions_[fastest_index].compare_exchange_weak(
+            fastest, entry, std::memory_order_relaxed)) {
+      break;
+    }
+  }
+}
+
+void CompilerStatistics::RecordCodeSize(size_t prolog, size_t body,
+                                        size_t epilog, size_t tail) {
+  code_prolog_.fetch_add(prolog, std::memory_order_relaxed);
+  code_body_.fetch_add(body, std::memory_order_relaxed);
+  code_epilog_.fetch_add(epilog, std::memory_order_relaxed);
+  code_tail_.fetch_add(tail, std::memory_order_relaxed);
+}
+
+void CompilerStatistics::RecordMxcsrModes(uint32_t known_block_entries,
+                                          uint32_t dynamic_checks,
+                                          uint32_t loads) {
+  mxcsr_known_block_entries_.fetch_add(known_block_entries,
+                                       std::memory_order_relaxed);
+  mxcsr_dynamic_checks_.fetch_add(dynamic_checks, std::memory_order_relaxed);
+  mxcsr_loads_.fetch_add(loads, std::memory_order_relaxed);
+}
+
+void CompilerStatistics::RecordMemoryBarriers(uint32_t fences,
+                                              uint32_t relaxed) {
+  memory_barrier_fences_.fetch_add(fences, std::memory_order_relaxed);
+  memory_barriers_relaxed_.fetch_add(relaxed, std::memory_order_relaxed);
+}
+
+CompilerStatistics::InlineCacheStatistics*
+CompilerStatistics::RegisterInlineCache(uint32_t function_address,
+                                        uint32_t call_address,
+                                        uint32_t target_count) {
+  uint32_t index = inline_cache_count_.fetch_add(1, std::memory_order_relaxed);
+  if (index >= kMaxInlineCaches) {
+    return nullptr;
+  }
+  auto& inline_cache = inline_caches_[index];
+  inline_cache.function_address = function_address;
+  inline_cache.call_address = call_address;
+  inline_cache.target_count = target_count;
+  return &inline_cache;
+}
+
+bool CompilerStatistics::DumpJson(const std::filesystem::path& path) {
+  // Counters keep moving while this runs, so the totals are only consistent
+  // with each other once compilation is idle.
+  StringBuffer buffer;
+  uint64_t functions = functions_.load(std::memory_order_relaxed);
+  uint64_t function_ticks = function_ticks_.load(std::memory_order_relaxed);
+  uint64_t wall_ticks = last_function_tick_.load(std::memory_order_relaxed) -
+                        first_function_tick_.load(std::memory_order_relaxed);
+  double function_ms = TicksToMilliseconds(function_ticks);
+  double wall_ms = TicksToMilliseconds(wall_ticks);
+  buffer.Append("{\n  \"functions\": {\n");
+  buffer.AppendFormat("    \"count\": {},\n", functions);
+  buffer.AppendFormat("    \"baseline\": {},\n",
+                      baseline_functions_.load(std::memory_order_relaxed));
+  buffer.AppendFormat("    \"total_ms\": {:.3f},\n", function_ms);
+  buffer.AppendFormat(
+      "    \"compile_ms\": {:.3f},\n",
+      TicksToMilliseconds(compile_ticks_.load(std::memory_order_relaxed)));
+  buffer.AppendFormat("    \"wall_ms\": {:.3f},\n", wall_ms);
+  // Per compile thread, and over the time from the first to the last one.
+  buffer.AppendFormat("    \"per_second\": {:.1f},\n",
+                      function_ms > 0.0 ? functions * 1000.0 / function_ms
+                                        : 0.0);
+  buffer.AppendFormat("    \"wall_per_second\": {:.1f},\n",
+                      wall_ms > 0.0 ? functions * 1000.0 / wall_ms : 0.0);
+  buffer.AppendFormat("    \"hir_instrs\": {},\n",
+                      hir_instrs_.load(std::memory_order_relaxed));
+  uint64_t arena_chunk_allocations =
+      arena_chunk_allocations_.load(std::memory_order_relaxed);
+  buffer.AppendFormat("    \"arena_chunk_allocations\": {},\n",
+                      arena_chunk_allocations);
+  buffer.AppendFormat(
+      "    \"arena_chunk_allocations_per_function\": {:.3f}\n  }},\n",
+      functions ? double(arena_chunk_allocations) / functions : 0.0);
+
+  uint64_t code_prolog = code_prolog_.load(std::memory_order_relaxed);
+  uint64_t code_body = code_body_.load(std::memory_order_relaxed);
+  uint64_t code_epilog = code_epilog_.load(std::memory_order_relaxed);
+  uint64_t code_tail = code_tail_.load(std::memory_order_relaxed);
+  buffer.AppendFormat(
+      "  \"code_size\": {{\n    \"prolog\": {},\n    \"body\": {},\n    "
+      "\"epilog\": {},\n    \"tail\": {},\n    \"total\": {}\n  }},\n",
+      code_prolog, code_body, code_epilog, code_tail,
+      code_prolog + code_body + code_epilog + code_tail);
+  buffer.AppendFormat(
+      "  \"mxcsr\": {{\n    \"known_block_entries\": {},\n    "
+      "\"dynamic_checks\": {},\n    \"loads\": {}\n  }},\n",
+      mxcsr_known_block_entries_.load(std::memory_order_relaxed),
+      mxcsr_dynamic_checks_.load(std::memory_order_relaxed),
+      mxcsr_loads_.load(std::memory_order_relaxed));
+  buffer.AppendFormat(
+      "  \"memory_barriers\": {{\n    \"fences\": {},\n    "
+      "\"relaxed\": {}\n  }},\n",
+      memory_barrier_fences_.load(std::memory_order_relaxed),
+      memory_barriers_relaxed_.load(std::memory_order_relaxed));
+
+  std::vector<const PassStatistics*> passes;
+  for (auto& pass : passes_) {
+    if (pass.state.load(std::memory_order_acquire) == 2) {
+      passes.push_back(&pass);
+    }
+  }
+  std::sort(passes.begin(), passes.end(),
+            [](const PassStatistics* a, const PassStatistics* b) {
+              int compiler_order =
+                  std::strcmp(a->compiler_name, b->compiler_name);
+              return compiler_order ? compiler_order < 0 : a->index < b->index;
+            });
+  buffer.Append("  \"passes\": [");
+  for (size_t i = 0; i < passes.size(); ++i) {
+    auto pass = passes[i];
+    uint64_t runs = pass->runs.load(std::memory_order_relaxed);
+    double pass_ms = TicksToMilliseconds(
+        pass->ticks.load(std::memory_order_relaxed));
+    buffer.AppendFormat(
+        "{}\n    {{\"compiler\": \"{}\", \"index\": {}, \"pass\": \"{}\", "
+        "\"runs\": {}, \"failures\": {}, \"total_ms\": {:.3f}, "
+        "\"average_us\": {:.3f}, \"instrs_before\": {}, "
+        "\"instrs_after\": {}}}",
+        i ? "," : "", pass->compiler_name, pass->index, pass->pass_name, runs,
+        pass->failures.load(std::memory_order_relaxed), pass_ms,
+        runs ? pass_ms * 1000.0 / runs : 0.0,
+        pass->instrs_before.load(std::memory_order_relaxed),
+        pass->instrs_after.load(std::memory_order_relaxed));
+  }
+  buffer.Append("\n  ],\n");
+
+  std::vector<uint64_t> slowest_functions;
+  for (auto& slow_entry : slowest_functions_) {
+    uint64_t entry = slow_entry.load(std::memory_order_relaxed);
+    if (entry) {
+      slowest_functions.push_back(entry);
+    }
+  }
+  std::sort(slowest_functions.rbegin(), slowest_functions.rend());
+  buffer.Append("  \"slowest_functions\": [");
+  for (size_t i = 0; i < slowest_functions.size(); ++i) {
+    uint64_t entry = slowest_functions[i];
+    buffer.AppendFormat(
+        "{}\n    {{\"address\": \"{:08X}\", \"baseline\": {}, \"ms\": "
+        "{:.3f}}}",
+        i ? "," : "", uint32_t(entry), (entry >> 32) & 1 ? "true" : "false",
+        double(entry >> 33) / 1000.0);
+  }
+  buffer.Append("\n  ],\n");
+
+  uint32_t inline_cache_count =
+      std::min(inline_cache_count_.load(std::memory_order_relaxed),
+               uint32_t(kMaxInlineCaches));
+  buffer.Append("  \"inline_caches\": [");
+  for (uint32_t i = 0; i < inline_cache_count; ++i) {
+    const auto& inline_cache = inline_caches_[i];
+    uint64_t runs = inline_cache.hits + inline_cache.misses;
+    buffer.AppendFormat(
+        "{}\n    {{\"function\": \"{:08X}\", \"call\": \"{:08X}\", "
+        "\"targets\": {}, \"hits\": {}, \"misses\": {}, "
+        "\"hit_rate\": {:.3f}}}",
+        i ? "," : "", inline_cache.function_address, inline_cache.call_address,
+        inline_cache.target_count, inline_cache.hits, inline_cache.misses,
+        runs ? double(inline_cache.hits) / double(runs) : 0.0);
+  }
+  buffer.Append("\n  ]\n}\n");
+
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Failed to open {} for writing compiler statistics",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  fwrite(buffer.buffer(), 1, buffer.length(), file);
+  fclose(file);
+  XELOGI("Compiler statistics for {} functions written to {}", functions,
+         xe::path_to_utf8(path));
+  return true;
+}
+
+void CompilerStatistics::DumpIfEnabled() {
+  if (!is_enabled() || cvars::compiler_statistics_path.empty()) {
+    return;
+  }
+  DumpJson(cvars::compiler_statistics_path);
+}
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
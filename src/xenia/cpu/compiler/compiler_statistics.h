@@ -0,0 +1,100 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_COMPILER_STATISTICS_H_
+#define XENIA_CPU_COMPILER_COMPILER_STATISTICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+
+#include "xenia/base/cvar.h"
+
+DECLARE_bool(compiler_statistics);
+DECLARE_path(compiler_statistics_path);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// Process-wide JIT cost counters, shared by all compilers and compile threads.
+// Everything is recorded with atomics into fixed tables so that compile
+// threads never wait on each other. Only gathered with --compiler_statistics.
+class CompilerStatistics {
+ public:
+  // Totals for one pass at one position in one compiler's pipeline.
+  struct PassStatistics {
+    // Static strings, both set once the slot is claimed.
+    const char* compiler_name;
+    const char* pass_name;
+    uint32_t index;
+    // 0 - free, 1 - being claimed, 2 - ready.
+    std::atomic<uint32_t> state;
+    std::atomic<uint64_t> runs;
+    std::atomic<uint64_t> failures;
+    std::atomic<uint64_t> ticks;
+    std::atomic<uint64_t> instrs_before;
+    std::atomic<uint64_t> instrs_after;
+  };
+
+  // Runs of one inline cache of an indirect call, counted by the generated
+  // code itself without atomics.
+  struct InlineCacheStatistics {
+    uint32_t function_address;
+    uint32_t call_address;
+    uint32_t target_count;
+    uint64_t hits;
+    uint64_t misses;
+  };
+
+  static constexpr size_t kMaxPasses = 128;
+  static constexpr size_t kMaxInlineCaches = 4096;
+  static constexpr size_t kSlowestFunctionCount = 32;
+
+  static bool is_enabled() { return cvars::compiler_statistics; }
+
+  // Returns the slot for the pass, shared with any other compiler using the
+  // same names, or nullptr if the table is full.
+  static PassStatistics* RegisterPass(const char* compiler_name,
+                                      uint32_t index, const char* pass_name);
+  static void RecordPass(PassStatistics* pass, uint64_t ticks,
+                         uint32_t instrs_before, uint32_t instrs_after,
+                         bool succeeded);
+  // Called once per translated function, with the time spent from the scan to
+  // the machine code being placed. arena_chunk_allocations is the number of
+  // chunks the HIR and compiler scratch arenas had to allocate for it, which
+  // should be 0 once the arenas fit the largest function.
+  static void RecordFunction(uint32_t guest_address, bool baseline,
+                             uint64_t ticks, uint64_t compile_ticks,
+                             uint32_t hir_instrs,
+                             uint32_t arena_chunk_allocations);
+  static void RecordCodeSize(size_t prolog, size_t body, size_t epilog,
+                             size_t tail);
+  // Blocks started in a known MXCSR mode, and the mode switches emitted as
+  // dynamic checks and as direct loads.
+  static void RecordMxcsrModes(uint32_t known_block_entries,
+                               uint32_t dynamic_checks, uint32_t loads);
+  // Guest memory barriers kept as fences and relaxed to compiler barriers.
+  static void RecordMemoryBarriers(uint32_t fences, uint32_t relaxed);
+  // Returns the counters for a new inline cache, never freed as the code may
+  // run until shutdown, or nullptr if the table is full.
+  static InlineCacheStatistics* RegisterInlineCache(uint32_t function_address,
+                                                    uint32_t call_address,
+                                                    uint32_t target_count);
+
+  static bool DumpJson(const std::filesystem::path& path);
+  // Dumps to --compiler_statistics_path if statistics are enabled.
+  static void DumpIfEnabled();
+};
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_COMPILER_STATISTICS_H_
@@ -0,0 +1,530 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/conditional_constant_propagation_pass.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::TypeName;
+using xe::cpu::hir::Value;
+
+namespace {
+// Conditional branches and the other volatile instructions leave the context
+// alone.
+bool ClobbersContext(const Instr* i) {
+  switch (i->opcode->num) {
+    case OPCODE_CALL:
+    case OPCODE_CALL_TRUE:
+    case OPCODE_CALL_INDIRECT:
+    case OPCODE_CALL_INDIRECT_TRUE:
+    case OPCODE_CALL_EXTERN:
+    case OPCODE_DEBUG_BREAK:
+    case OPCODE_DEBUG_BREAK_TRUE:
+    case OPCODE_TRAP:
+    case OPCODE_TRAP_TRUE:
+    case OPCODE_CONTEXT_BARRIER:
+    case OPCODE_MEMORY_BARRIER:
+      return true;
+    default:
+      return false;
+  }
+}
+}  // namespace
+
+ConditionalConstantPropagationPass::ConditionalConstantPropagationPass()
+    : ConditionalGroupSubpass() {}
+
+ConditionalConstantPropagationPass::~ConditionalConstantPropagationPass() {}
+
+bool ConditionalConstantPropagationPass::Run(HIRBuilder* builder,
+                                             bool& result) {
+  // Example of what local propagation can't see:
+  //   store_context +100, 0
+  //   branch_true v0, label1
+  //   ...
+  // label1:
+  //   v1 = load_context +100  <-- 0 on both paths
+  //   v2 = compare_ne v1, 0
+  //   branch_true v2, label2  <-- never taken, label2 may be unreachable
+  // Blocks are only visited once an edge to them may be taken, and their
+  // entry context is the meet of the context at the end of those edges.
+  result = false;
+
+  blocks_.clear();
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = static_cast<uint16_t>(blocks_.size());
+    blocks_.push_back(block);
+    block = block->next;
+  }
+  if (blocks_.empty()) {
+    return true;
+  }
+  uint32_t block_count = static_cast<uint32_t>(blocks_.size());
+  reached_.assign(block_count, false);
+  entry_states_.assign(block_count, EntryState());
+  stops_.assign(block_count, nullptr);
+  queued_.assign(block_count, false);
+  worklist_.clear();
+  value_cells_.assign(builder->max_value_ordinal(), {Cell::kTop, nullptr});
+
+  // The entry block is entered by callers with an unknown context.
+  reached_[0] = true;
+  Enqueue(0);
+  while (!worklist_.empty()) {
+    uint16_t ordinal = worklist_.back();
+    worklist_.pop_back();
+    queued_[ordinal] = false;
+    VisitBlock(ordinal);
+  }
+
+  result = Rewrite(builder);
+  return true;
+}
+
+void ConditionalConstantPropagationPass::VisitBlock(uint16_t ordinal) {
+  Block* block = blocks_[ordinal];
+  auto& context = context_;
+  const auto& entry_state = entry_states_[ordinal];
+  context.assign(entry_state.begin(), entry_state.end());
+  stops_[ordinal] = nullptr;
+  for (auto i = block->instr_head; i; i = i->next) {
+    if (ClobbersContext(i)) {
+      // Calls, traps and barriers may change anything in the context.
+      context.clear();
+    }
+
+    if (i->dest) {
+      Cell cell = Evaluate(i, context);
+      Cell& old_cell = value_cells_[i->dest->ordinal];
+      if (!IsSameCell(cell, old_cell)) {
+        old_cell = cell;
+        // Revisit users, which may be in other blocks.
+        for (auto use = i->dest->use_head; use; use = use->next) {
+          uint16_t use_ordinal = use->instr->block->ordinal;
+          if (use_ordinal != ordinal && reached_[use_ordinal]) {
+            Enqueue(use_ordinal);
+          }
+        }
+      }
+    }
+
+    if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t end =
+          offset + static_cast<uint32_t>(GetTypeSize(i->src2.value->type));
+      // Drop anything the store overlaps. Slots are at most 16 bytes.
+      auto it = std::lower_bound(context.begin(), context.end(),
+                                 offset > 15 ? offset - 15 : 0, IsSlotBefore);
+      while (it != context.end() && it->offset < end) {
+        if (it->offset + GetTypeSize(it->type) > offset) {
+          it = context.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      // Everything left from it on is past the store.
+      context.insert(it, ContextSlot{offset, i->src2.value->type,
+                                     GetCell(i->src2.value)});
+    } else if (i->opcode == &OPCODE_BRANCH_info) {
+      MarkEdge(i->src1.label->block->ordinal, context);
+      stops_[ordinal] = i;
+      return;
+    } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+               i->opcode == &OPCODE_BRANCH_FALSE_info) {
+      Cell cond = GetCell(i->src1.value);
+      if (cond.state == Cell::kTop) {
+        // Not known yet, will be revisited once it is.
+        stops_[ordinal] = i;
+        return;
+      }
+      bool always_taken = false;
+      if (cond.state == Cell::kConstant) {
+        always_taken = i->opcode == &OPCODE_BRANCH_TRUE_info
+                           ? cond.constant->IsConstantTrue()
+                           : cond.constant->IsConstantFalse();
+        if (!always_taken) {
+          continue;
+        }
+      }
+      MarkEdge(i->src2.label->block->ordinal, context);
+      if (always_taken) {
+        stops_[ordinal] = i;
+        return;
+      }
+    } else if (i->opcode == &OPCODE_RETURN_info) {
+      stops_[ordinal] = i;
+      return;
+    }
+  }
+  if (block->next) {
+    MarkEdge(block->next->ordinal, context);
+  }
+}
+
+void ConditionalConstantPropagationPass::MarkEdge(
+    uint16_t to, const ContextState& context) {
+  auto& entry_state = entry_states_[to];
+  if (!reached_[to]) {
+    reached_[to] = true;
+    entry_state.Initialize(scratch_arena(), uint32_t(context.size()));
+    for (auto& slot : context) {
+      entry_state.push_back(slot);
+    }
+    Enqueue(to);
+    return;
+  }
+  // Meet with what's known from the other edges, only ever going down.
+  bool changed = false;
+  uint32_t kept_count = 0;
+  for (auto& slot : entry_state) {
+    auto other = std::lower_bound(context.begin(), context.end(), slot.offset,
+                                  IsSlotBefore);
+    Cell cell = {Cell::kBottom, nullptr};
+    if (other != context.end() && other->offset == slot.offset &&
+        other->type == slot.type) {
+      cell = Meet(slot.cell, other->cell);
+    }
+    if (cell.state == Cell::kBottom) {
+      changed = true;
+      continue;
+    }
+    if (!IsSameCell(cell, slot.cell)) {
+      changed = true;
+    }
+    ContextSlot& kept = entry_state[kept_count++];
+    kept = slot;
+    kept.cell = cell;
+  }
+  entry_state.resize(kept_count);
+  if (changed) {
+    Enqueue(to);
+  }
+}
+
+void ConditionalConstantPropagationPass::Enqueue(uint16_t ordinal) {
+  if (!queued_[ordinal]) {
+    queued_[ordinal] = true;
+    worklist_.push_back(ordinal);
+  }
+}
+
+ConditionalConstantPropagationPass::Cell
+ConditionalConstantPropagationPass::Evaluate(Instr* i,
+                                             const ContextState& context) {
+  const Cell bottom = {Cell::kBottom, nullptr};
+  const Cell top = {Cell::kTop, nullptr};
+  switch (i->opcode->num) {
+    case OPCODE_LOAD_CONTEXT: {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      auto slot = std::lower_bound(context.begin(), context.end(), offset,
+                                   IsSlotBefore);
+      if (slot == context.end() || slot->offset != offset ||
+          slot->type != i->dest->type) {
+        return bottom;
+      }
+      return slot->cell;
+    }
+    case OPCODE_ASSIGN:
+      return GetCell(i->src1.value);
+    case OPCODE_SELECT: {
+      if (i->src1.value->type == VEC128_TYPE) {
+        return bottom;
+      }
+      Cell cond = GetCell(i->src1.value);
+      if (cond.state == Cell::kConstant) {
+        return GetCell(cond.constant->IsConstantTrue() ? i->src2.value
+                                                       : i->src3.value);
+      }
+      if (cond.state == Cell::kTop) {
+        return top;
+      }
+      return Meet(GetCell(i->src2.value), GetCell(i->src3.value));
+    }
+    default:
+      break;
+  }
+
+  // Only integer operations, leaving floats to ConstantPropagationPass (see
+  // permit_float_constant_evaluation), and nothing with a paired instruction
+  // depending on how it was calculated, such as did_carry.
+  if (i->dest->type > INT64_TYPE ||
+      (i->next && i->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV)) {
+    return bottom;
+  }
+  uint32_t signature = i->opcode->signature;
+  Value* operands[2] = {nullptr, nullptr};
+  if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+    operands[0] = i->src1.value;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
+    operands[1] = i->src2.value;
+  }
+  if (!operands[0] || GET_OPCODE_SIG_TYPE_SRC3(signature)) {
+    return bottom;
+  }
+  bool any_top = false;
+  for (size_t n = 0; n < xe::countof(operands); ++n) {
+    if (!operands[n]) {
+      continue;
+    }
+    if (operands[n]->type > INT64_TYPE) {
+      return bottom;
+    }
+    Cell cell = GetCell(operands[n]);
+    if (cell.state == Cell::kBottom) {
+      return bottom;
+    }
+    if (cell.state == Cell::kTop) {
+      any_top = true;
+    } else {
+      operands[n] = cell.constant;
+    }
+  }
+
+  Value* v;
+  switch (i->opcode->num) {
+    case OPCODE_COMPARE_EQ:
+    case OPCODE_COMPARE_NE:
+    case OPCODE_COMPARE_SLT:
+    case OPCODE_COMPARE_SLE:
+    case OPCODE_COMPARE_SGT:
+    case OPCODE_COMPARE_SGE:
+    case OPCODE_COMPARE_ULT:
+    case OPCODE_COMPARE_ULE:
+    case OPCODE_COMPARE_UGT:
+    case OPCODE_COMPARE_UGE:
+      if (any_top) {
+        return top;
+      }
+      v = NewConstant(operands[0]);
+      v->set_constant(uint8_t(v->Compare(i->opcode->num, operands[1])));
+      break;
+    case OPCODE_ADD:
+    case OPCODE_SUB:
+    case OPCODE_AND:
+    case OPCODE_AND_NOT:
+    case OPCODE_OR:
+    case OPCODE_XOR:
+    case OPCODE_NOT:
+    case OPCODE_SHL:
+    case OPCODE_SHR:
+    case OPCODE_SHA:
+    case OPCODE_ZERO_EXTEND:
+    case OPCODE_SIGN_EXTEND:
+    case OPCODE_TRUNCATE:
+      if (any_top) {
+        return top;
+      }
+      v = NewConstant(operands[0]);
+      switch (i->opcode->num) {
+        case OPCODE_ADD:
+          v->Add(operands[1]);
+          break;
+        case OPCODE_SUB:
+          v->Sub(operands[1]);
+          break;
+        case OPCODE_AND:
+          v->And(operands[1]);
+          break;
+        case OPCODE_AND_NOT:
+          v->set_from(operands[1]);
+          v->Not();
+          v->And(operands[0]);
+          break;
+        case OPCODE_OR:
+          v->Or(operands[1]);
+          break;
+        case OPCODE_XOR:
+          v->Xor(operands[1]);
+          break;
+        case OPCODE_NOT:
+          v->Not();
+          break;
+        case OPCODE_SHL:
+          v->Shl(operands[1]);
+          break;
+        case OPCODE_SHR:
+          v->Shr(operands[1]);
+          break;
+        case OPCODE_SHA:
+          v->Sha(operands[1]);
+          break;
+        case OPCODE_ZERO_EXTEND:
+          v->ZeroExtend(i->dest->type);
+          break;
+        case OPCODE_SIGN_EXTEND:
+          v->SignExtend(i->dest->type);
+          break;
+        case OPCODE_TRUNCATE:
+          v->Truncate(i->dest->type);
+          break;
+      }
+      break;
+    default:
+      return bottom;
+  }
+  return {Cell::kConstant, v};
+}
+
+bool ConditionalConstantPropagationPass::Rewrite(HIRBuilder* builder) {
+  // A condition still unknown in a reached block means its def was never
+  // visited, which shouldn't happen - don't trust anything then.
+  for (size_t n = 0; n < blocks_.size(); ++n) {
+    auto stop = stops_[n];
+    if (reached_[n] && stop && stop->opcode != &OPCODE_BRANCH_info &&
+        stop->opcode != &OPCODE_RETURN_info &&
+        GetCell(stop->src1.value).state == Cell::kTop) {
+      assert_always();
+      return false;
+    }
+  }
+
+  bool changed = false;
+  for (size_t n = 0; n < blocks_.size(); ++n) {
+    Block* block = blocks_[n];
+    if (!reached_[n]) {
+      // Unlink everything so that values used here are released.
+      while (block->instr_head) {
+        block->instr_head->UnlinkAndNOP();
+      }
+      builder->RemoveBlock(block);
+      changed = true;
+      continue;
+    }
+
+    bool stopped = false;
+    for (auto i = block->instr_head; i;) {
+      auto next = i->next;
+      if (stopped) {
+        // Never executed, and may branch to removed blocks.
+        i->UnlinkAndNOP();
+        changed = true;
+        i = next;
+        continue;
+      }
+      stopped = i == stops_[n];
+
+      if (i->dest && !i->dest->IsConstant()) {
+        Cell cell = value_cells_[i->dest->ordinal];
+        if (cell.state == Cell::kConstant) {
+          i->dest->set_from(cell.constant);
+          i->UnlinkAndNOP();
+          changed = true;
+          i = next;
+          continue;
+        }
+      }
+
+      if ((i->opcode == &OPCODE_BRANCH_TRUE_info ||
+           i->opcode == &OPCODE_BRANCH_FALSE_info) &&
+          GetCell(i->src1.value).state == Cell::kConstant) {
+        Value* cond = GetCell(i->src1.value).constant;
+        bool taken = i->opcode == &OPCODE_BRANCH_TRUE_info
+                         ? cond->IsConstantTrue()
+                         : cond->IsConstantFalse();
+        if (taken) {
+          auto label = i->src2.label;
+          i->Replace(&OPCODE_BRANCH_info, i->flags);
+          i->src1.label = label;
+        } else {
+          i->UnlinkAndNOP();
+        }
+        changed = true;
+      }
+      i = next;
+    }
+  }
+  return changed;
+}
+
+ConditionalConstantPropagationPass::Cell
+ConditionalConstantPropagationPass::GetCell(Value* value) const {
+  if (value->IsConstant()) {
+    return {Cell::kConstant, value};
+  }
+  if (!value->def || value->ordinal >= value_cells_.size()) {
+    return {Cell::kBottom, nullptr};
+  }
+  return value_cells_[value->ordinal];
+}
+
+Value* ConditionalConstantPropagationPass::NewConstant(const Value* from) {
+  auto value = scratch_arena()->Alloc<Value>();
+  std::memset(value, 0, sizeof(Value));
+  value->set_from(from);
+  return value;
+}
+
+ConditionalConstantPropagationPass::Cell
+ConditionalConstantPropagationPass::Meet(const Cell& a, const Cell& b) {
+  if (a.state == Cell::kTop) {
+    return b;
+  }
+  if (b.state == Cell::kTop) {
+    return a;
+  }
+  if (a.state == Cell::kConstant && IsSameCell(a, b)) {
+    return a;
+  }
+  return {Cell::kBottom, nullptr};
+}
+
+bool ConditionalConstantPropagationPass::IsSameCell(const Cell& a,
+                                                    const Cell& b) {
+  if (a.state != b.state) {
+    return false;
+  }
+  if (a.state != Cell::kConstant) {
+    return true;
+  }
+  const Value* x = a.constant;
+  const Value* y = b.constant;
+  if (x->type != y->type) {
+    return false;
+  }
+  switch (x->type) {
+    case INT8_TYPE:
+      return x->constant.i8 == y->constant.i8;
+    case INT16_TYPE:
+      return x->constant.i16 == y->constant.i16;
+    case INT32_TYPE:
+    case FLOAT32_TYPE:
+      return x->constant.i32 == y->constant.i32;
+    case INT64_TYPE:
+    case FLOAT64_TYPE:
+      return x->constant.i64 == y->constant.i64;
+    case VEC128_TYPE:
+      return x->constant.v128 == y->constant.v128;
+    default:
+      return false;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
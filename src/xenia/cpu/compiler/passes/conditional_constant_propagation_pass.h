@@ -0,0 +1,98 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_CONDITIONAL_CONSTANT_PROPAGATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_CONDITIONAL_CONSTANT_PROPAGATION_PASS_H_
+
+#include <vector>
+
+#include "xenia/cpu/compiler/passes/conditional_group_subpass.h"
+#include "xenia/cpu/compiler/scratch_containers.h"
+#include "xenia/cpu/hir/value.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Sparse conditional constant propagation (Wegman-Zadeck) of integer values
+// over the whole CFG, following only the edges that may be taken given the
+// constants found so far.
+// Context slots play the role of phis at joins. Values proven constant are
+// folded, branches with constant conditions are resolved and unreachable
+// blocks are removed, leaving the rest to ConstantPropagationPass and
+// ControlFlowSimplificationPass.
+class ConditionalConstantPropagationPass : public ConditionalGroupSubpass {
+ public:
+  ConditionalConstantPropagationPass();
+  ~ConditionalConstantPropagationPass() override;
+
+  const char* name() const override { return "ConditionalConstantPropagation"; }
+
+  bool Run(hir::HIRBuilder* builder, bool& result) override;
+
+ private:
+  // Not known yet (top), a single constant, or varying (bottom).
+  struct Cell {
+    enum State : uint8_t {
+      kTop,
+      kConstant,
+      kBottom,
+    };
+    State state;
+    hir::Value* constant;
+  };
+  struct ContextSlot {
+    uint32_t offset;
+    hir::TypeName type;
+    Cell cell;
+  };
+  // Sorted by context offset. Offsets not in it are varying.
+  using ContextState = std::vector<ContextSlot>;
+  // Entry states only lose slots after the first edge to the block, so they
+  // are allocated from the scratch arena with that size.
+  using EntryState = ScratchVector<ContextSlot>;
+
+  void VisitBlock(uint16_t ordinal);
+  void MarkEdge(uint16_t to, const ContextState& context);
+  void Enqueue(uint16_t ordinal);
+  Cell Evaluate(hir::Instr* instr, const ContextState& context);
+  // For std::lower_bound by offset.
+  static bool IsSlotBefore(const ContextSlot& slot, uint32_t offset) {
+    return slot.offset < offset;
+  }
+  bool Rewrite(hir::HIRBuilder* builder);
+
+  Cell GetCell(hir::Value* value) const;
+  hir::Value* NewConstant(const hir::Value* from);
+  static Cell Meet(const Cell& a, const Cell& b);
+  static bool IsSameCell(const Cell& a, const Cell& b);
+
+  // Indexed by block ordinal.
+  std::vector<hir::Block*> blocks_;
+  std::vector<bool> reached_;
+  std::vector<EntryState> entry_states_;
+  // Instruction evaluation stopped at, where the block leaves unconditionally
+  // or on an unknown condition.
+  std::vector<hir::Instr*> stops_;
+  std::vector<uint16_t> worklist_;
+  std::vector<bool> queued_;
+  // Indexed by value ordinal.
+  std::vector<Cell> value_cells_;
+  // The state while visiting a block, kept across functions so it stops
+  // reallocating.
+  ContextState context_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_CONDITIONAL_CONSTANT_PROPAGATION_PASS_H_
@@ -71,6 +71,9 @@ bool ConditionalGroupPass::Run(HIRBuilder* builder) {
 }
 
 void ConditionalGroupPass::AddPass(std::unique_ptr<CompilerPass> pass) {
+  if (Compiler::IsPassDisabled(pass->name())) {
+    return;
+  }
   passes_.push_back(std::move(pass));
 }
 
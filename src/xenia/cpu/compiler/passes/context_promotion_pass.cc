@@ -13,6 +13,7 @@
 #include "xenia/base/cvar.h"
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/passes/data_flow_analysis_pass.h"
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/processor.h"
 
@@ -39,7 +40,8 @@ using xe::cpu::hir::HIRBuilder;
 using xe::cpu::hir::Instr;
 using xe::cpu::hir::Value;
 
-ContextPromotionPass::ContextPromotionPass() : CompilerPass() {}
+ContextPromotionPass::ContextPromotionPass(bool across_blocks)
+    : CompilerPass(), across_blocks_(across_blocks) {}
 
 ContextPromotionPass::~ContextPromotionPass() {}
 
@@ -71,12 +73,40 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
   // This is more generally done by DSE, however if it could be done here
   // instead as it may be faster (at least on the block-level).
 
+  // Values are only kept within blocks while debugging, as with dead store
+  // removal below.
+  bool across_blocks = across_blocks_ &&
+                       (cvars::full_optimization_even_with_debug ||
+                        !cvars::debug);
+  if (across_blocks) {
+    // Sequential block ordinals, for indexing.
+    uint32_t block_count = 0;
+    auto block = builder->first_block();
+    while (block) {
+      block->ordinal = static_cast<uint16_t>(block_count++);
+      block = block->next;
+    }
+    blocks_.Initialize(scratch_arena(), block_count);
+    block = builder->first_block();
+    while (block) {
+      blocks_.push_back(block);
+      block = block->next;
+    }
+    successors_ = DataFlowAnalysisPass::GatherSuccessors(builder, block_count,
+                                                         scratch_arena());
+  }
+
   // Promote loads to values.
-  // Process each block independently, for now.
-  auto block = builder->first_block();
-  while (block) {
-    PromoteBlock(block);
-    block = block->next;
+  if (across_blocks) {
+    PromoteAcrossBlocks();
+  } else {
+    // Process each block independently.
+    auto block = builder->first_block();
+    while (block) {
+      context_validity_.reset();
+      PromoteBlock(block);
+      block = block->next;
+    }
   }
 
   // Remove all dead stores.
@@ -84,10 +114,14 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
   // trying to extract stack traces/register values, so we don't do that.
   if (cvars::full_optimization_even_with_debug ||
       (!cvars::debug && !cvars::store_all_context_values)) {
-    block = builder->first_block();
-    while (block) {
-      RemoveDeadStoresBlock(block);
-      block = block->next;
+    if (across_blocks) {
+      RemoveDeadStoresAcrossBlocks();
+    } else {
+      auto block = builder->first_block();
+      while (block) {
+        RemoveDeadStoresBlock(block);
+        block = block->next;
+      }
     }
   }
 
@@ -95,8 +129,8 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
 }
 
 void ContextPromotionPass::PromoteBlock(Block* block) {
+  // Starts with the values already known at the beginning of the block.
   auto& validity = context_validity_;
-  validity.reset();
 
   Instr* i = block->instr_head;
   while (i) {
@@ -153,6 +187,130 @@ void ContextPromotionPass::RemoveDeadStoresBlock(Block* block) {
   }
 }
 
+void ContextPromotionPass::PromoteAcrossBlocks() {
+  // A block with a single predecessor coming before it is dominated by it, so
+  // it can start with the values known at the end of the predecessor. Joins
+  // start empty, as the values may differ between paths.
+  uint32_t block_count = blocks_.size();
+  auto predecessor_counts =
+      AllocScratchArray<uint32_t>(scratch_arena(), block_count);
+  auto predecessors = AllocScratchArray<uint16_t>(scratch_arena(), block_count);
+  for (uint32_t n = 0; n < block_count; ++n) {
+    for (uint16_t successor : successors_[n]) {
+      ++predecessor_counts[successor];
+      predecessors[successor] = static_cast<uint16_t>(n);
+    }
+  }
+
+  // Allocated for blocks dominating a successor once their values are known.
+  using ExitValues = ScratchVector<std::pair<uint32_t, Value*>>;
+  auto exit_values =
+      AllocScratchArray<ExitValues>(scratch_arena(), block_count);
+  for (uint32_t n = 0; n < block_count; ++n) {
+    context_validity_.reset();
+    // The entry block is also entered from the caller.
+    if (n && predecessor_counts[n] == 1 && predecessors[n] < n) {
+      for (auto& exit_value : exit_values[predecessors[n]]) {
+        context_values_[exit_value.first] = exit_value.second;
+        context_validity_.set(exit_value.first);
+      }
+    }
+
+    PromoteBlock(blocks_[n]);
+
+    bool dominates_successor = false;
+    for (uint16_t successor : successors_[n]) {
+      if (successor > n && predecessor_counts[successor] == 1) {
+        dominates_successor = true;
+        break;
+      }
+    }
+    if (!dominates_successor) {
+      continue;
+    }
+    auto& block_exit_values = exit_values[n];
+    block_exit_values.Initialize(scratch_arena(), context_validity_.count());
+    for (int offset = context_validity_.find_first(); offset != -1;
+         offset = context_validity_.find_next(offset)) {
+      block_exit_values.push_back(std::make_pair(
+          static_cast<uint32_t>(offset), context_values_[offset]));
+    }
+  }
+}
+
+void ContextPromotionPass::RemoveDeadStoresAcrossBlocks() {
+  // A store is dead if on every path from it all the bytes it writes are
+  // written again before being loaded, and before a volatile instruction or
+  // an exit, which may read the whole context. Blocks start out fully dead
+  // (for loops) and are refined until nothing changes, then stores are
+  // removed.
+  uint32_t block_count = blocks_.size();
+  uint32_t context_size = static_cast<uint32_t>(sizeof(ppc::PPCContext));
+  auto dead_in =
+      AllocScratchArray<ScratchBitVector>(scratch_arena(), block_count);
+  for (uint32_t n = 0; n < block_count; ++n) {
+    dead_in[n].Initialize(scratch_arena(), context_size, true);
+  }
+  ScratchBitVector dead_bytes(scratch_arena(), context_size);
+  auto gather_dead_out = [&](uint32_t n) {
+    if (successors_[n].empty()) {
+      dead_bytes.reset();
+      return;
+    }
+    dead_bytes.set();
+    for (uint16_t successor : successors_[n]) {
+      dead_bytes &= dead_in[successor];
+    }
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t n = block_count; n-- > 0;) {
+      gather_dead_out(n);
+      PropagateDeadBytes(blocks_[n], dead_bytes, false);
+      if (dead_bytes != dead_in[n]) {
+        dead_in[n].CopyFrom(dead_bytes);
+        changed = true;
+      }
+    }
+  }
+  for (uint32_t n = 0; n < block_count; ++n) {
+    gather_dead_out(n);
+    PropagateDeadBytes(blocks_[n], dead_bytes, true);
+  }
+}
+
+void ContextPromotionPass::PropagateDeadBytes(Block* block,
+                                              ScratchBitVector& dead_bytes,
+                                              bool remove_stores) {
+  // Walk backwards from the bytes dead at the end of the block.
+  Instr* i = block->instr_tail;
+  while (i) {
+    Instr* prev = i->prev;
+    if (i->opcode->flags & OPCODE_FLAG_VOLATILE) {
+      dead_bytes.reset();
+    } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t end =
+          offset + static_cast<uint32_t>(GetTypeSize(i->src2.value->type));
+      bool dead = remove_stores;
+      for (uint32_t n = offset; dead && n < end; ++n) {
+        dead = dead_bytes.test(n);
+      }
+      if (dead) {
+        i->UnlinkAndNOP();
+      } else {
+        dead_bytes.set(offset, end);
+      }
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      dead_bytes.reset(
+          offset, offset + static_cast<uint32_t>(GetTypeSize(i->dest->type)));
+    }
+    i = prev;
+  }
+}
+
 }  // namespace passes
 }  // namespace compiler
 }  // namespace cpu
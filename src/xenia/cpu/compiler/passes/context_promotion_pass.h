@@ -15,6 +15,7 @@
 
 #include "xenia/base/platform.h"
 #include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/scratch_containers.h"
 
 #if XE_COMPILER_MSVC
 #pragma warning(push)
@@ -33,9 +34,13 @@ namespace passes {
 
 class ContextPromotionPass : public CompilerPass {
  public:
-  ContextPromotionPass();
+  // Promoting across blocks leaves values used outside of the block defining
+  // them, which only GlobalRegisterAllocationPass supports.
+  explicit ContextPromotionPass(bool across_blocks = false);
   virtual ~ContextPromotionPass() override;
 
+  const char* name() const override { return "ContextPromotion"; }
+
   bool Initialize(Compiler* compiler) override;
 
   bool Run(hir::HIRBuilder* builder) override;
@@ -43,10 +48,19 @@ class ContextPromotionPass : public CompilerPass {
  private:
   void PromoteBlock(hir::Block* block);
   void RemoveDeadStoresBlock(hir::Block* block);
+  void PromoteAcrossBlocks();
+  void RemoveDeadStoresAcrossBlocks();
+  void PropagateDeadBytes(hir::Block* block, ScratchBitVector& dead_bytes,
+                          bool remove_stores);
 
  private:
+  bool across_blocks_;
   std::vector<hir::Value*> context_values_;
   llvm::BitVector context_validity_;
+  // Indexed by block ordinal when working across blocks, from the scratch
+  // arena.
+  ScratchVector<hir::Block*> blocks_;
+  ScratchVector<uint16_t>* successors_ = nullptr;
 };
 
 }  // namespace passes
@@ -16,17 +16,6 @@
 #include "xenia/cpu/compiler/compiler.h"
 #include "xenia/cpu/processor.h"
 
-#if XE_COMPILER_MSVC
-#pragma warning(push)
-#pragma warning(disable : 4244)
-#pragma warning(disable : 4267)
-#include <llvm/ADT/BitVector.h>
-#pragma warning(pop)
-#else
-#include <llvm/ADT/BitVector.h>
-#include <cmath>
-#endif  // XE_COMPILER_MSVC
-
 namespace xe {
 namespace cpu {
 namespace compiler {
@@ -71,26 +60,23 @@ void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
       builder->max_value_ordinal() + 1 + block_count * 4;
 
   // Stash for value map. We may want to maintain this during building.
-  auto arena = builder->arena();
-  auto value_map = reinterpret_cast<Value**>(
-      arena->Alloc(sizeof(Value*) * max_value_estimate, alignof(Value)));
+  auto value_map =
+      AllocScratchArray<Value*>(scratch_arena(), max_value_estimate);
 
-  // Allocate incoming bitvectors for use by blocks. We don't need outgoing
+  // Allocate incoming bitvectors for use by blocks. We only need one outgoing
   // because they are only used during the block iteration.
   // Mapped by block ordinal.
-  // TODO(benvanik): cache this list, grow as needed, etc.
-  auto incoming_bitvectors = (llvm::BitVector**)arena->Alloc(
-      sizeof(llvm::BitVector*) * block_count, alignof(llvm::BitVector));
+  auto incoming_bitvectors = AllocScratchArray<ScratchBitVector>(
+      scratch_arena(), block_count);
   for (auto n = 0u; n < block_count; n++) {
-    incoming_bitvectors[n] = new llvm::BitVector(max_value_estimate);
+    incoming_bitvectors[n].Initialize(scratch_arena(), max_value_estimate);
   }
+  ScratchBitVector outgoing_values(scratch_arena(), max_value_estimate);
 
   // Walk blocks in reverse and calculate incoming/outgoing values.
   auto block = builder->last_block();
   while (block) {
-    // Allocate bitsets based on max value number.
-    block->incoming_values = incoming_bitvectors[block->ordinal];
-    auto& incoming_values = *block->incoming_values;
+    auto& incoming_values = incoming_bitvectors[block->ordinal];
 
     // Walk instructions and gather up incoming values.
     auto instr = block->instr_head;
@@ -117,11 +103,11 @@ void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
 
     // Add all successor incoming values to our outgoing, as we need to
     // pass them through.
-    llvm::BitVector outgoing_values(max_value_estimate);
+    outgoing_values.reset();
     auto outgoing_edge = block->outgoing_edge_head;
     while (outgoing_edge) {
       if (outgoing_edge->dest->ordinal > block->ordinal) {
-        outgoing_values |= *outgoing_edge->dest->incoming_values;
+        outgoing_values |= incoming_bitvectors[outgoing_edge->dest->ordinal];
       }
       outgoing_edge = outgoing_edge->outgoing_next;
     }
@@ -201,11 +187,119 @@ void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
 
     block = block->prev;
   }
+}
 
-  // Cleanup bitvectors.
-  for (auto n = 0u; n < block_count; n++) {
-    delete incoming_bitvectors[n];
+void DataFlowAnalysisPass::AnalyzeLiveness(HIRBuilder* builder,
+                                           uint32_t block_count, Arena* arena,
+                                           ScratchBitVector** live_in_out,
+                                           ScratchBitVector** live_out_out) {
+  uint32_t value_count = builder->max_value_ordinal();
+  auto live_in = AllocScratchArray<ScratchBitVector>(arena, block_count);
+  auto live_out = AllocScratchArray<ScratchBitVector>(arena, block_count);
+  // Values read before being defined in each block and values defined in it.
+  auto used = AllocScratchArray<ScratchBitVector>(arena, block_count);
+  auto defined = AllocScratchArray<ScratchBitVector>(arena, block_count);
+  for (uint32_t n = 0; n < block_count; ++n) {
+    live_in[n].Initialize(arena, value_count);
+    live_out[n].Initialize(arena, value_count);
+    used[n].Initialize(arena, value_count);
+    defined[n].Initialize(arena, value_count);
+  }
+  *live_in_out = live_in;
+  *live_out_out = live_out;
+
+  auto block = builder->first_block();
+  while (block) {
+    auto& block_used = used[block->ordinal];
+    auto& block_defined = defined[block->ordinal];
+    auto instr = block->instr_head;
+    while (instr) {
+      uint32_t signature = instr->opcode->signature;
+#define ADD_USED_VALUE(v)                                               \
+  if (!v->IsConstant() && v->def && !block_defined.test(v->ordinal)) { \
+    block_used.set(v->ordinal);                                         \
+  }
+      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+        ADD_USED_VALUE(instr->src1.value);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
+        ADD_USED_VALUE(instr->src2.value);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V) {
+        ADD_USED_VALUE(instr->src3.value);
+      }
+#undef ADD_USED_VALUE
+      if (GET_OPCODE_SIG_TYPE_DEST(signature) == OPCODE_SIG_TYPE_V) {
+        block_defined.set(instr->dest->ordinal);
+      }
+      instr = instr->next;
+    }
+    block = block->next;
+  }
+  auto successors = GatherSuccessors(builder, block_count, arena);
+
+  // Iterate to a fixed point, in reverse as values mostly flow forward.
+  ScratchBitVector block_in(arena, value_count);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t n = block_count; n-- > 0;) {
+      auto& block_out = live_out[n];
+      for (uint16_t successor : successors[n]) {
+        block_out |= live_in[successor];
+      }
+      block_in.CopyFrom(block_out);
+      block_in.reset(defined[n]);
+      block_in |= used[n];
+      if (block_in != live_in[n]) {
+        live_in[n].CopyFrom(block_in);
+        changed = true;
+      }
+    }
+  }
+}
+
+ScratchVector<uint16_t>* DataFlowAnalysisPass::GatherSuccessors(
+    HIRBuilder* builder, uint32_t block_count, Arena* arena) {
+  // Counted first, so each list is allocated at its final size.
+  auto successors =
+      AllocScratchArray<ScratchVector<uint16_t>>(arena, block_count);
+  auto block = builder->first_block();
+  while (block) {
+    uint32_t successor_count = 1;
+    auto instr = block->instr_head;
+    while (instr) {
+      if (instr->opcode == &OPCODE_BRANCH_info ||
+          instr->opcode == &OPCODE_BRANCH_TRUE_info ||
+          instr->opcode == &OPCODE_BRANCH_FALSE_info) {
+        ++successor_count;
+      }
+      instr = instr->next;
+    }
+    successors[block->ordinal].Initialize(arena, successor_count);
+    block = block->next;
+  }
+  block = builder->first_block();
+  while (block) {
+    auto& block_successors = successors[block->ordinal];
+    auto instr = block->instr_head;
+    while (instr) {
+      if (instr->opcode == &OPCODE_BRANCH_info) {
+        block_successors.push_back(instr->src1.label->block->ordinal);
+      } else if (instr->opcode == &OPCODE_BRANCH_TRUE_info ||
+                 instr->opcode == &OPCODE_BRANCH_FALSE_info) {
+        block_successors.push_back(instr->src2.label->block->ordinal);
+      }
+      instr = instr->next;
+    }
+    auto tail = block->instr_tail;
+    if (block->next && (!tail || (tail->opcode != &OPCODE_BRANCH_info &&
+                                  tail->opcode != &OPCODE_RETURN_info))) {
+      block_successors.push_back(block->next->ordinal);
+    }
+    block = block->next;
   }
+  return successors;
 }
 
 }  // namespace passes
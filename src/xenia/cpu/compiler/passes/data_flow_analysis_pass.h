@@ -10,7 +10,10 @@
 #ifndef XENIA_CPU_COMPILER_PASSES_DATA_FLOW_ANALYSIS_PASS_H_
 #define XENIA_CPU_COMPILER_PASSES_DATA_FLOW_ANALYSIS_PASS_H_
 
+#include <vector>
+
 #include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/scratch_containers.h"
 
 namespace xe {
 namespace cpu {
@@ -22,8 +25,24 @@ class DataFlowAnalysisPass : public CompilerPass {
   DataFlowAnalysisPass();
   ~DataFlowAnalysisPass() override;
 
+  const char* name() const override { return "DataFlowAnalysis"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
+  // Computes the values live on entry to and exit from each block, indexed by
+  // block ordinal and then value ordinal, without modifying the HIR. Block
+  // ordinals must be sequential. The results are allocated from arena.
+  static void AnalyzeLiveness(hir::HIRBuilder* builder, uint32_t block_count,
+                              Arena* arena, ScratchBitVector** live_in,
+                              ScratchBitVector** live_out);
+  // Gathers the ordinals of the blocks each block may continue in, by
+  // branching or falling through, which edges don't record. Block ordinals
+  // must be sequential. Returns an array indexed by block ordinal, allocated
+  // from arena.
+  static ScratchVector<uint16_t>* GatherSuccessors(hir::HIRBuilder* builder,
+                                                   uint32_t block_count,
+                                                   Arena* arena);
+
  private:
   uint32_t LinearizeBlocks(hir::HIRBuilder* builder);
   void AnalyzeFlow(hir::HIRBuilder* builder, uint32_t block_count);
@@ -0,0 +1,455 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/global_register_allocation_pass.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/passes/data_flow_analysis_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+namespace {
+// Instr only supports moving before another one.
+void MoveAfter(Instr* instr, Instr* other) {
+  if (other->next) {
+    instr->MoveBefore(other->next);
+  } else {
+    instr->MoveBefore(other);
+    other->MoveBefore(instr);
+  }
+}
+}  // namespace
+
+GlobalRegisterAllocationPass::GlobalRegisterAllocationPass(
+    const MachineInfo* machine_info)
+    : CompilerPass() {
+  auto mi_sets = machine_info->register_sets;
+  std::memset(&usage_sets_, 0, sizeof(usage_sets_));
+  uint32_t n = 0;
+  while (mi_sets[n].count) {
+    auto& mi_set = mi_sets[n];
+    auto usage_set = new RegisterSetUsage();
+    usage_sets_.all_sets[n] = usage_set;
+    usage_set->count = mi_set.count;
+    usage_set->set = &mi_set;
+    if (mi_set.types & MachineInfo::RegisterSet::INT_TYPES) {
+      usage_sets_.int_set = usage_set;
+    }
+    if (mi_set.types & MachineInfo::RegisterSet::FLOAT_TYPES) {
+      usage_sets_.float_set = usage_set;
+    }
+    if (mi_set.types & MachineInfo::RegisterSet::VEC_TYPES) {
+      usage_sets_.vec_set = usage_set;
+    }
+    n++;
+  }
+}
+
+GlobalRegisterAllocationPass::~GlobalRegisterAllocationPass() {
+  for (size_t n = 0; n < xe::countof(usage_sets_.all_sets); n++) {
+    if (!usage_sets_.all_sets[n]) {
+      break;
+    }
+    delete usage_sets_.all_sets[n];
+  }
+}
+
+bool GlobalRegisterAllocationPass::Run(HIRBuilder* builder) {
+  // Positions are 2 * ordinal for the reads of an instruction and
+  // 2 * ordinal + 1 for its write, so a dest can take the register of a source
+  // dying at the same instruction, but not of a value live into the block.
+  // Spilling rewrites the HIR, so everything is redone until nothing spills.
+  unspillable_values_.clear();
+  auto& spilled_values = spilled_values_;
+  while (true) {
+    uint32_t block_count = NumberInstructions(builder);
+    BuildIntervals(builder, block_count);
+    spilled_values.clear();
+    SpillAcrossCalls(&spilled_values);
+    if (spilled_values.empty() && !ScanIntervals(&spilled_values)) {
+      // Only reloads left, and too many of them - this shouldn't happen.
+      XELOGE("Register allocation failed");
+      assert_always();
+      return false;
+    }
+    if (spilled_values.empty()) {
+      break;
+    }
+    for (auto value : spilled_values) {
+      SpillValue(builder, value);
+    }
+  }
+
+  return true;
+}
+
+uint32_t GlobalRegisterAllocationPass::NumberInstructions(
+    HIRBuilder* builder) {
+  block_starts_.clear();
+  block_ends_.clear();
+  uint16_t block_ordinal = 0;
+  uint32_t instr_ordinal = 0;
+  auto block = builder->first_block();
+  while (block) {
+    // Sequential block and global instruction ordinals, as with
+    // RegisterAllocationPass.
+    block->ordinal = block_ordinal++;
+    block_starts_.push_back(instr_ordinal * 2);
+    auto instr = block->instr_head;
+    while (instr) {
+      instr->ordinal = instr_ordinal++;
+      instr = instr->next;
+    }
+    block_ends_.push_back(instr_ordinal * 2);
+    block = block->next;
+  }
+
+  // Reloads in loops are paid for on every iteration. Loop depths are from
+  // LoopAnalysisPass.
+  block_weights_.resize(block_ordinal);
+  block = builder->first_block();
+  while (block) {
+    float weight = 1.0f;
+    for (uint32_t depth = std::min(uint32_t(block->loop_depth), 5u); depth;
+         --depth) {
+      weight *= 8.0f;
+    }
+    block_weights_[block->ordinal] = weight;
+    block = block->next;
+  }
+
+  return block_ordinal;
+}
+
+void GlobalRegisterAllocationPass::BuildIntervals(HIRBuilder* builder,
+                                                  uint32_t block_count) {
+  DataFlowAnalysisPass::AnalyzeLiveness(builder, block_count, scratch_arena(),
+                                        &live_in_, &live_out_);
+  intervals_.clear();
+  value_intervals_.assign(builder->max_value_ordinal(), UINT32_MAX);
+  call_positions_.clear();
+
+  // Defs first, as in loops a use may precede the def in block order.
+  auto block = builder->first_block();
+  while (block) {
+    auto instr = block->instr_head;
+    while (instr) {
+      uint32_t signature = instr->opcode->signature;
+      if (GET_OPCODE_SIG_TYPE_DEST(signature) == OPCODE_SIG_TYPE_V) {
+        // Must not have been set already, or is from the previous round.
+        instr->dest->reg.set = nullptr;
+        Interval interval;
+        interval.value = instr->dest;
+        interval.start = interval.end = instr->ordinal * 2 + 1;
+        interval.use_weight = block_weights_[block->ordinal];
+        interval.spillable = IsSpillable(instr->dest);
+        interval.hint = nullptr;
+        if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+            !instr->src1.value->IsConstant()) {
+          interval.hint = instr->src1.value;
+        }
+        value_intervals_[instr->dest->ordinal] = uint32_t(intervals_.size());
+        intervals_.push_back(interval);
+      }
+      instr = instr->next;
+    }
+    block = block->next;
+  }
+
+  auto add_use = [this](Value* value, uint32_t position, float weight) {
+    if (value->IsConstant() || value->ordinal >= value_intervals_.size() ||
+        value_intervals_[value->ordinal] == UINT32_MAX) {
+      // Constants and local slots.
+      return;
+    }
+    auto& interval = intervals_[value_intervals_[value->ordinal]];
+    interval.start = std::min(interval.start, position);
+    interval.end = std::max(interval.end, position);
+    interval.use_weight += weight;
+  };
+  block = builder->first_block();
+  while (block) {
+    float weight = block_weights_[block->ordinal];
+    auto instr = block->instr_head;
+    while (instr) {
+      switch (instr->opcode->num) {
+        case OPCODE_CALL:
+        case OPCODE_CALL_TRUE:
+        case OPCODE_CALL_INDIRECT:
+        case OPCODE_CALL_INDIRECT_TRUE:
+        case OPCODE_CALL_EXTERN:
+          call_positions_.push_back(instr->ordinal * 2 + 1);
+          break;
+        default:
+          break;
+      }
+      uint32_t signature = instr->opcode->signature;
+      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+        add_use(instr->src1.value, instr->ordinal * 2, weight);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
+        add_use(instr->src2.value, instr->ordinal * 2, weight);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V) {
+        add_use(instr->src3.value, instr->ordinal * 2, weight);
+      }
+      instr = instr->next;
+    }
+    block = block->next;
+  }
+
+  // Cover whole blocks values flow into, out of or through. A single interval
+  // per value may include holes, but it's what keeps the register the same on
+  // every path.
+  for (uint32_t n = 0; n < block_count; ++n) {
+    auto& block_in = live_in_[n];
+    for (int ordinal = block_in.find_first(); ordinal != -1;
+         ordinal = block_in.find_next(ordinal)) {
+      uint32_t index = value_intervals_[ordinal];
+      if (index != UINT32_MAX) {
+        auto& interval = intervals_[index];
+        interval.start = std::min(interval.start, block_starts_[n]);
+      }
+    }
+    auto& block_out = live_out_[n];
+    for (int ordinal = block_out.find_first(); ordinal != -1;
+         ordinal = block_out.find_next(ordinal)) {
+      uint32_t index = value_intervals_[ordinal];
+      if (index != UINT32_MAX) {
+        auto& interval = intervals_[index];
+        interval.end = std::max(interval.end, block_ends_[n]);
+      }
+    }
+  }
+}
+
+void GlobalRegisterAllocationPass::SpillAcrossCalls(
+    std::vector<Value*>* spilled_values) {
+  if (call_positions_.empty()) {
+    return;
+  }
+  for (auto& interval : intervals_) {
+    // Sources of the call itself die before it, and its dest starts after it.
+    auto call_it = std::upper_bound(call_positions_.begin(),
+                                    call_positions_.end(), interval.start);
+    if (call_it == call_positions_.end() || *call_it >= interval.end) {
+      continue;
+    }
+    // Only defs stored for spilling and reloads are unspillable, and they end
+    // right after or before the instructions next to them.
+    assert_true(interval.spillable);
+    if (interval.spillable) {
+      spilled_values->push_back(interval.value);
+    }
+  }
+}
+
+bool GlobalRegisterAllocationPass::ScanIntervals(
+    std::vector<Value*>* spilled_values) {
+  for (size_t i = 0; i < xe::countof(usage_sets_.all_sets); ++i) {
+    auto usage_set = usage_sets_.all_sets[i];
+    if (!usage_set) {
+      break;
+    }
+    usage_set->availability.set();
+    usage_set->active.clear();
+  }
+
+  // Stable without the buffer std::stable_sort allocates, as the intervals
+  // are in order in intervals_.
+  auto& sorted_intervals = sorted_intervals_;
+  sorted_intervals.clear();
+  for (auto& interval : intervals_) {
+    sorted_intervals.push_back(&interval);
+  }
+  std::sort(sorted_intervals.begin(), sorted_intervals.end(),
+            [](const Interval* a, const Interval* b) {
+              return a->start != b->start ? a->start < b->start : a < b;
+            });
+
+  for (auto interval : sorted_intervals) {
+    auto usage_set = RegisterSetForValue(interval->value);
+    auto& active = usage_set->active;
+
+    // Retire everything that ended before this starts.
+    for (size_t i = 0; i < active.size();) {
+      if (active[i]->end < interval->start) {
+        usage_set->availability.set(active[i]->value->reg.index, true);
+        active[i] = active.back();
+        active.pop_back();
+      } else {
+        ++i;
+      }
+    }
+
+    // Coalesce with src1 if its register was freed here (or is free anyway),
+    // helping along the two operand X86 instructions and assignments.
+    int32_t reg_index = -1;
+    auto hint = interval->hint;
+    if (hint && hint->reg.set == usage_set->set &&
+        usage_set->availability.test(hint->reg.index)) {
+      reg_index = hint->reg.index;
+    }
+    if (reg_index == -1) {
+      uint32_t first_unused = 0;
+      bool none_used = xe::bit_scan_forward(
+          static_cast<uint32_t>(usage_set->availability.to_ulong()),
+          &first_unused);
+      if (none_used && first_unused < usage_set->count) {
+        reg_index = int32_t(first_unused);
+      }
+    }
+
+    if (reg_index == -1) {
+      // Spill whichever of the live values is the cheapest to keep in memory,
+      // which may be this one.
+      Interval* victim = interval->spillable ? interval : nullptr;
+      for (auto other : active) {
+        if (other->spillable &&
+            (!victim || SpillWeight(other) < SpillWeight(victim))) {
+          victim = other;
+        }
+      }
+      if (!victim) {
+        return false;
+      }
+      spilled_values->push_back(victim->value);
+      if (victim == interval) {
+        continue;
+      }
+      reg_index = victim->value->reg.index;
+      victim->value->reg.set = nullptr;
+      active.erase(std::find(active.begin(), active.end(), victim));
+    }
+
+    interval->value->reg.set = usage_set->set;
+    interval->value->reg.index = reg_index;
+    usage_set->availability.set(reg_index, false);
+    active.push_back(interval);
+  }
+
+  return true;
+}
+
+void GlobalRegisterAllocationPass::SpillValue(HIRBuilder* builder,
+                                              Value* value) {
+  auto& use_instrs = use_instrs_;
+  use_instrs.clear();
+  for (auto use = value->use_head; use; use = use->next) {
+    if (std::find(use_instrs.begin(), use_instrs.end(), use->instr) ==
+        use_instrs.end()) {
+      use_instrs.push_back(use->instr);
+    }
+  }
+
+  // Store right after the def, or as soon after as we can (respecting PAIRED
+  // flags).
+  auto def_tail = value->def;
+  while (def_tail->next &&
+         def_tail->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+    def_tail = def_tail->next;
+  }
+  if (!value->HasLocalSlot()) {
+    value->SetLocalSlot(builder->AllocLocal(value->type));
+    builder->StoreLocal(value->GetLocalSlot(), value);
+    MoveAfter(builder->last_instr(), def_tail);
+  }
+  MarkUnspillable(value);
+
+  // Reload before each use, which also can't go in between paired
+  // instructions. Uses paired with the def itself keep the original value.
+  for (auto instr : use_instrs) {
+    bool paired_with_def = false;
+    for (auto paired = value->def; paired != def_tail; paired = paired->next) {
+      if (paired->next == instr) {
+        paired_with_def = true;
+        break;
+      }
+    }
+    if (paired_with_def) {
+      continue;
+    }
+    auto insert_before = instr;
+    while (insert_before->prev &&
+           insert_before->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+      insert_before = insert_before->prev;
+    }
+    auto new_value = builder->LoadLocal(value->GetLocalSlot());
+    builder->last_instr()->MoveBefore(insert_before);
+    new_value->SetLocalSlot(value->GetLocalSlot());
+    MarkUnspillable(new_value);
+
+    uint32_t signature = instr->opcode->signature;
+    if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+      if (instr->src1.value == value) {
+        instr->set_src1(new_value);
+      }
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
+      if (instr->src2.value == value) {
+        instr->set_src2(new_value);
+      }
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V) {
+      if (instr->src3.value == value) {
+        instr->set_src3(new_value);
+      }
+    }
+  }
+}
+
+GlobalRegisterAllocationPass::RegisterSetUsage*
+GlobalRegisterAllocationPass::RegisterSetForValue(const Value* value) {
+  if (value->type <= INT64_TYPE) {
+    return usage_sets_.int_set;
+  } else if (value->type <= FLOAT64_TYPE) {
+    return usage_sets_.float_set;
+  } else {
+    return usage_sets_.vec_set;
+  }
+}
+
+bool GlobalRegisterAllocationPass::IsSpillable(const Value* value) const {
+  return value->ordinal >= unspillable_values_.size() ||
+         !unspillable_values_[value->ordinal];
+}
+
+void GlobalRegisterAllocationPass::MarkUnspillable(const Value* value) {
+  if (value->ordinal >= unspillable_values_.size()) {
+    unspillable_values_.resize(value->ordinal + 1);
+  }
+  unspillable_values_[value->ordinal] = true;
+}
+
+float GlobalRegisterAllocationPass::SpillWeight(const Interval* interval) {
+  return interval->use_weight / float(interval->end - interval->start + 1);
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
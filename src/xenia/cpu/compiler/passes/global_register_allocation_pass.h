@@ -0,0 +1,105 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_GLOBAL_REGISTER_ALLOCATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_GLOBAL_REGISTER_ALLOCATION_PASS_H_
+
+#include <bitset>
+#include <vector>
+
+#include "xenia/cpu/backend/machine_info.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/scratch_containers.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Linear scan allocator over whole-function live intervals, so values may stay
+// in registers across blocks. Unlike RegisterAllocationPass, spill victims are
+// picked by use frequency (weighted by loop depth) over interval length, and
+// dests preferably take the register of a src1 dying at the same instruction.
+// Called guest code uses the same registers, so values live across calls are
+// always spilled.
+class GlobalRegisterAllocationPass : public CompilerPass {
+ public:
+  explicit GlobalRegisterAllocationPass(
+      const backend::MachineInfo* machine_info);
+  ~GlobalRegisterAllocationPass() override;
+
+  const char* name() const override { return "GlobalRegisterAllocation"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  struct Interval {
+    hir::Value* value;
+    // Instruction ordinals, inclusive.
+    uint32_t start;
+    uint32_t end;
+    // Uses and the def, weighted by the loop depth of their blocks.
+    float use_weight;
+    // Spilled values and reloads, which are as short as they can get.
+    bool spillable;
+    // src1 of the def, worth sharing the register with if it dies there.
+    hir::Value* hint;
+  };
+  struct RegisterSetUsage {
+    const backend::MachineInfo::RegisterSet* set = nullptr;
+    uint32_t count = 0;
+    std::bitset<32> availability = 0;
+    std::vector<Interval*> active;
+  };
+
+  uint32_t NumberInstructions(hir::HIRBuilder* builder);
+  void BuildIntervals(hir::HIRBuilder* builder, uint32_t block_count);
+  void SpillAcrossCalls(std::vector<hir::Value*>* spilled_values);
+  bool ScanIntervals(std::vector<hir::Value*>* spilled_values);
+  void SpillValue(hir::HIRBuilder* builder, hir::Value* value);
+
+  RegisterSetUsage* RegisterSetForValue(const hir::Value* value);
+  bool IsSpillable(const hir::Value* value) const;
+  void MarkUnspillable(const hir::Value* value);
+  static float SpillWeight(const Interval* interval);
+
+  struct {
+    RegisterSetUsage* int_set = nullptr;
+    RegisterSetUsage* float_set = nullptr;
+    RegisterSetUsage* vec_set = nullptr;
+    RegisterSetUsage* all_sets[3];
+  } usage_sets_;
+
+  // Indexed by block ordinal.
+  std::vector<uint32_t> block_starts_;
+  std::vector<uint32_t> block_ends_;
+  std::vector<float> block_weights_;
+  // Write positions of the calls, in order.
+  std::vector<uint32_t> call_positions_;
+  // From the scratch arena.
+  ScratchBitVector* live_in_ = nullptr;
+  ScratchBitVector* live_out_ = nullptr;
+
+  std::vector<Interval> intervals_;
+  // Indexed by value ordinal.
+  std::vector<uint32_t> value_intervals_;
+  std::vector<bool> unspillable_values_;
+
+  // Kept across functions so they stop reallocating.
+  std::vector<hir::Value*> spilled_values_;
+  std::vector<Interval*> sorted_intervals_;
+  std::vector<hir::Instr*> use_instrs_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_GLOBAL_REGISTER_ALLOCATION_PASS_H_
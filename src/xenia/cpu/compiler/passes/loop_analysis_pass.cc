@@ -0,0 +1,255 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/loop_analysis_pass.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/passes/data_flow_analysis_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+
+LoopAnalysisPass::LoopAnalysisPass() : CompilerPass() {}
+
+LoopAnalysisPass::~LoopAnalysisPass() {}
+
+bool LoopAnalysisPass::Run(HIRBuilder* builder) {
+  auto& loops = loops_;
+  AnalyzeLoops(builder, scratch_arena(), &loops);
+
+  auto block = builder->first_block();
+  while (block) {
+    block->loop_depth = 0;
+    block = block->next;
+  }
+  for (auto& loop : loops) {
+    block = builder->first_block();
+    while (block) {
+      if (loop.blocks[block->ordinal]) {
+        block->loop_depth = std::max(block->loop_depth,
+                                     static_cast<uint16_t>(loop.depth));
+      }
+      block = block->next;
+    }
+  }
+
+  return true;
+}
+
+void LoopAnalysisPass::AnalyzeLoops(HIRBuilder* builder, Arena* arena,
+                                    std::vector<Loop>* loops) {
+  loops->clear();
+  uint32_t block_count = 0;
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = static_cast<uint16_t>(block_count++);
+    block = block->next;
+  }
+  if (!block_count) {
+    return;
+  }
+  auto blocks = AllocScratchArray<Block*>(arena, block_count);
+  block = builder->first_block();
+  while (block) {
+    blocks[block->ordinal] = block;
+    block = block->next;
+  }
+
+  auto successors =
+      DataFlowAnalysisPass::GatherSuccessors(builder, block_count, arena);
+  auto predecessor_counts = AllocScratchArray<uint32_t>(arena, block_count);
+  for (uint16_t n = 0; n < block_count; ++n) {
+    for (uint16_t successor : successors[n]) {
+      ++predecessor_counts[successor];
+    }
+  }
+  auto predecessors =
+      AllocScratchArray<ScratchVector<uint16_t>>(arena, block_count);
+  for (uint16_t n = 0; n < block_count; ++n) {
+    predecessors[n].Initialize(arena, predecessor_counts[n]);
+  }
+  for (uint16_t n = 0; n < block_count; ++n) {
+    for (uint16_t successor : successors[n]) {
+      predecessors[successor].push_back(n);
+    }
+  }
+
+  // Reverse postorder from the entry block. Blocks that can't be reached from
+  // it keep UINT32_MAX and are ignored.
+  auto rpo_numbers = AllocScratchArray<uint32_t>(arena, block_count);
+  std::fill_n(rpo_numbers, block_count, UINT32_MAX);
+  ScratchVector<uint16_t> postorder(arena, block_count);
+  ScratchBitVector visited(arena, block_count);
+  // Every block is on the stack at most once.
+  ScratchVector<std::pair<uint16_t, uint32_t>> stack(arena, block_count);
+  visited.set(0);
+  stack.push_back(std::make_pair(uint16_t(0), uint32_t(0)));
+  while (!stack.empty()) {
+    auto& top = stack.back();
+    auto& top_successors = successors[top.first];
+    if (top.second < top_successors.size()) {
+      uint16_t successor = top_successors[top.second++];
+      if (!visited[successor]) {
+        visited.set(successor);
+        stack.push_back(std::make_pair(successor, uint32_t(0)));
+      }
+    } else {
+      postorder.push_back(top.first);
+      stack.pop_back();
+    }
+  }
+  for (uint32_t n = 0; n < postorder.size(); ++n) {
+    rpo_numbers[postorder[n]] = postorder.size() - 1 - n;
+  }
+
+  // Immediate dominators (Cooper, Harvey, Kennedy).
+  auto idoms = AllocScratchArray<uint16_t>(arena, block_count);
+  std::fill_n(idoms, block_count, uint16_t(UINT16_MAX));
+  idoms[0] = 0;
+  auto intersect = [&](uint16_t a, uint16_t b) {
+    while (a != b) {
+      while (rpo_numbers[a] > rpo_numbers[b]) {
+        a = idoms[a];
+      }
+      while (rpo_numbers[b] > rpo_numbers[a]) {
+        b = idoms[b];
+      }
+    }
+    return a;
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t i = postorder.size(); i-- > 0;) {
+      uint16_t n = postorder[i];
+      if (!n) {
+        continue;
+      }
+      uint16_t new_idom = UINT16_MAX;
+      for (uint16_t predecessor : predecessors[n]) {
+        if (idoms[predecessor] == UINT16_MAX) {
+          continue;
+        }
+        new_idom = new_idom == UINT16_MAX ? predecessor
+                                          : intersect(predecessor, new_idom);
+      }
+      if (idoms[n] != new_idom) {
+        idoms[n] = new_idom;
+        changed = true;
+      }
+    }
+  }
+  auto dominates = [&](uint16_t a, uint16_t b) {
+    while (b != a) {
+      if (!b) {
+        return false;
+      }
+      b = idoms[b];
+    }
+    return true;
+  };
+
+  // A back edge is one to a block dominating the source, and the loop is
+  // everything that reaches the source without passing the header.
+  auto header_loops = AllocScratchArray<int32_t>(arena, block_count);
+  std::fill_n(header_loops, block_count, -1);
+  // Blocks are only added once per loop.
+  ScratchVector<uint16_t> worklist(arena, block_count);
+  for (uint16_t n : postorder) {
+    for (uint16_t successor : successors[n]) {
+      if (!dominates(successor, n)) {
+        continue;
+      }
+      if (header_loops[successor] == -1) {
+        header_loops[successor] = int32_t(loops->size());
+        Loop loop;
+        loop.header = blocks[successor];
+        loop.preheader = nullptr;
+        loop.parent = -1;
+        loop.depth = 1;
+        loop.blocks.Initialize(arena, block_count);
+        loop.blocks.set(successor);
+        loops->push_back(loop);
+      }
+      auto& loop_blocks = (*loops)[header_loops[successor]].blocks;
+      if (!loop_blocks[n]) {
+        loop_blocks.set(n);
+        worklist.push_back(n);
+      }
+      while (!worklist.empty()) {
+        uint16_t m = worklist.back();
+        worklist.pop_back();
+        for (uint16_t predecessor : predecessors[m]) {
+          if (rpo_numbers[predecessor] != UINT32_MAX &&
+              !loop_blocks[predecessor]) {
+            loop_blocks.set(predecessor);
+            worklist.push_back(predecessor);
+          }
+        }
+      }
+    }
+  }
+
+  // An enclosing loop always has more blocks than the loops nested in it.
+  // Stable by the header, without the buffer std::stable_sort allocates.
+  for (auto& loop : *loops) {
+    loop.block_count = loop.blocks.count();
+  }
+  std::sort(loops->begin(), loops->end(), [](const Loop& a, const Loop& b) {
+    return a.block_count != b.block_count
+               ? a.block_count > b.block_count
+               : a.header->ordinal < b.header->ordinal;
+  });
+  for (size_t n = 0; n < loops->size(); ++n) {
+    auto& loop = (*loops)[n];
+    for (size_t m = n; m-- > 0;) {
+      if ((*loops)[m].blocks[loop.header->ordinal]) {
+        loop.parent = int32_t(m);
+        loop.depth = (*loops)[m].depth + 1;
+        break;
+      }
+    }
+
+    Block* preheader = nullptr;
+    for (uint16_t predecessor : predecessors[loop.header->ordinal]) {
+      if (rpo_numbers[predecessor] == UINT32_MAX ||
+          loop.blocks[predecessor]) {
+        continue;
+      }
+      if (preheader && preheader != blocks[predecessor]) {
+        preheader = nullptr;
+        break;
+      }
+      preheader = blocks[predecessor];
+    }
+    if (preheader) {
+      for (uint16_t successor : successors[preheader->ordinal]) {
+        if (successor != loop.header->ordinal) {
+          preheader = nullptr;
+          break;
+        }
+      }
+    }
+    loop.preheader = preheader;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,65 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LOOP_ANALYSIS_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LOOP_ANALYSIS_PASS_H_
+
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/scratch_containers.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Finds the natural loops of the CFG (the blocks that can reach a back edge to
+// a header dominating them) and their nesting, and records the loop depth of
+// each block in Block::loop_depth.
+class LoopAnalysisPass : public CompilerPass {
+ public:
+  struct Loop {
+    hir::Block* header;
+    // The only block entering the header from outside the loop, if it
+    // continues into nothing but the header, so instructions can be placed
+    // before its tail branch to run once before the loop.
+    hir::Block* preheader;
+    // Index of the innermost enclosing loop, or -1.
+    int32_t parent;
+    // 1 for outermost loops.
+    uint32_t depth;
+    // Indexed by block ordinal, from the arena passed to AnalyzeLoops.
+    ScratchBitVector blocks;
+    uint32_t block_count;
+  };
+
+  LoopAnalysisPass();
+  ~LoopAnalysisPass() override;
+
+  const char* name() const override { return "LoopAnalysis"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+  // Finds the loops, with enclosing loops before the loops they contain, and
+  // numbers the blocks sequentially. Loops sharing a header are merged.
+  static void AnalyzeLoops(hir::HIRBuilder* builder, Arena* arena,
+                           std::vector<Loop>* loops);
+
+ private:
+  // Kept across functions so it stops reallocating.
+  std::vector<Loop> loops_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LOOP_ANALYSIS_PASS_H_
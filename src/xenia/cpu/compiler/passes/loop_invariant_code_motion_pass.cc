@@ -0,0 +1,275 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/loop_invariant_code_motion_pass.h"
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+
+DEFINE_bool(trace_loop_invariant_code_motion, false,
+            "Log how many instructions were hoisted out of loops for each "
+            "function.",
+            "CPU");
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+LoopInvariantCodeMotionPass::LoopInvariantCodeMotionPass() : CompilerPass() {}
+
+LoopInvariantCodeMotionPass::~LoopInvariantCodeMotionPass() {}
+
+bool LoopInvariantCodeMotionPass::Run(HIRBuilder* builder) {
+  // Example:
+  //   label0:
+  //     v0 = load_context +40      <-- r3, never stored in the loop
+  //     v1 = add v0, 0x1000        <-- only depends on v0
+  //     ...
+  //     branch_true v9, label0
+  // Both are moved into the block entering the loop and run once.
+  LoopAnalysisPass::AnalyzeLoops(builder, scratch_arena(), &loops_);
+  if (loops_.empty()) {
+    return true;
+  }
+  Statistics old_statistics = statistics_;
+
+  // Enclosing loops come first, so walk backwards to do the innermost first.
+  auto& effects = effects_;
+  for (auto it = loops_.rbegin(); it != loops_.rend(); ++it) {
+    auto& loop = *it;
+    ++statistics_.loops;
+    // The tail must be a jump, so that hoisted instructions can be placed
+    // before it and still after everything else in the preheader.
+    Instr* insert_point = loop.preheader ? loop.preheader->instr_tail : nullptr;
+    auto is_jump = [](const Instr* instr) {
+      return instr->opcode == &OPCODE_BRANCH_info ||
+             instr->opcode == &OPCODE_BRANCH_TRUE_info ||
+             instr->opcode == &OPCODE_BRANCH_FALSE_info;
+    };
+    if (!insert_point || !is_jump(insert_point)) {
+      ++statistics_.loops_without_preheader;
+      continue;
+    }
+    while (insert_point->prev && is_jump(insert_point->prev)) {
+      insert_point = insert_point->prev;
+    }
+
+    GatherEffects(builder, loop, &effects);
+    // Hoisting an instruction may make those using it invariant.
+    bool hoisted_any = true;
+    while (hoisted_any) {
+      hoisted_any = false;
+      auto block = builder->first_block();
+      while (block) {
+        if (!loop.blocks[block->ordinal]) {
+          block = block->next;
+          continue;
+        }
+        auto instr = block->instr_head;
+        while (instr) {
+          auto next = instr->next;
+          if (IsInvariant(loop, effects, instr)) {
+            if (instr->opcode == &OPCODE_LOAD_CONTEXT_info) {
+              ++statistics_.hoisted_context_loads;
+            }
+            instr->MoveBefore(insert_point);
+            ++statistics_.hoisted_instrs;
+            hoisted_any = true;
+          }
+          instr = next;
+        }
+        block = block->next;
+      }
+    }
+  }
+
+  if (cvars::trace_loop_invariant_code_motion &&
+      statistics_.hoisted_instrs != old_statistics.hoisted_instrs) {
+    XELOGD(
+        "LICM: {} loops ({} without preheader), hoisted {} instructions ({} "
+        "context loads)",
+        statistics_.loops - old_statistics.loops,
+        statistics_.loops_without_preheader -
+            old_statistics.loops_without_preheader,
+        statistics_.hoisted_instrs - old_statistics.hoisted_instrs,
+        statistics_.hoisted_context_loads -
+            old_statistics.hoisted_context_loads);
+  }
+
+  return true;
+}
+
+void LoopInvariantCodeMotionPass::GatherEffects(
+    HIRBuilder* builder, const LoopAnalysisPass::Loop& loop,
+    LoopEffects* effects) {
+  effects->has_volatile = false;
+  effects->changes_fp_mode = false;
+  effects->stores.clear();
+  auto block = builder->first_block();
+  while (block) {
+    if (!loop.blocks[block->ordinal]) {
+      block = block->next;
+      continue;
+    }
+    auto instr = block->instr_head;
+    while (instr) {
+      if (instr->opcode->flags & OPCODE_FLAG_VOLATILE) {
+        effects->has_volatile = true;
+      } else if (instr->opcode == &OPCODE_SET_ROUNDING_MODE_info ||
+                 instr->opcode == &OPCODE_SET_NJM_info) {
+        effects->changes_fp_mode = true;
+      } else if (instr->opcode == &OPCODE_STORE_CONTEXT_info) {
+        uint32_t offset = static_cast<uint32_t>(instr->src1.offset);
+        effects->stores.emplace_back(
+            offset, offset + static_cast<uint32_t>(
+                                 GetTypeSize(instr->src2.value->type)));
+      } else if (instr->opcode == &OPCODE_CONTEXT_BARRIER_info) {
+        effects->stores.emplace_back(0, UINT32_MAX);
+      }
+      instr = instr->next;
+    }
+    block = block->next;
+  }
+}
+
+bool LoopInvariantCodeMotionPass::IsInvariant(
+    const LoopAnalysisPass::Loop& loop, const LoopEffects& effects,
+    Instr* instr) const {
+  if (!instr->dest || !IsHoistableOpcode(instr->opcode->num)) {
+    return false;
+  }
+  // Pairs such as did_carry depend on how the previous instruction ran.
+  if (instr->opcode->flags & OPCODE_FLAG_PAIRED_PREV ||
+      (instr->next && instr->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV)) {
+    return false;
+  }
+
+  // Float and vector results may depend on the rounding and denormal modes,
+  // which calls may change too.
+  bool fp_mode_stable = !effects.has_volatile && !effects.changes_fp_mode;
+  if (!fp_mode_stable && instr->dest->type > INT64_TYPE) {
+    return false;
+  }
+  uint32_t signature = instr->opcode->signature;
+  Value* sources[3] = {nullptr, nullptr, nullptr};
+  if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+    sources[0] = instr->src1.value;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
+    sources[1] = instr->src2.value;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V) {
+    sources[2] = instr->src3.value;
+  }
+  for (auto source : sources) {
+    if (!source) {
+      continue;
+    }
+    if (!fp_mode_stable && source->type > INT64_TYPE) {
+      return false;
+    }
+    if (source->IsConstant()) {
+      continue;
+    }
+    if (!source->def || loop.blocks[source->def->block->ordinal]) {
+      return false;
+    }
+  }
+
+  if (instr->opcode == &OPCODE_LOAD_CONTEXT_info) {
+    if (effects.has_volatile) {
+      return false;
+    }
+    uint32_t offset = static_cast<uint32_t>(instr->src1.offset);
+    uint32_t end =
+        offset + static_cast<uint32_t>(GetTypeSize(instr->dest->type));
+    for (auto& store : effects.stores) {
+      if (store.first < end && offset < store.second) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool LoopInvariantCodeMotionPass::IsHoistableOpcode(Opcode opcode) {
+  // Pure and unable to fault, as they may be hoisted from paths the loop
+  // doesn't always take. Guest memory loads are left alone, as other threads
+  // (and MMIO) may change the memory while a loop polls it.
+  switch (opcode) {
+    case OPCODE_LOAD_CONTEXT:
+    case OPCODE_ASSIGN:
+    case OPCODE_CAST:
+    case OPCODE_ZERO_EXTEND:
+    case OPCODE_SIGN_EXTEND:
+    case OPCODE_TRUNCATE:
+    case OPCODE_SELECT:
+    case OPCODE_COMPARE_EQ:
+    case OPCODE_COMPARE_NE:
+    case OPCODE_COMPARE_SLT:
+    case OPCODE_COMPARE_SLE:
+    case OPCODE_COMPARE_SGT:
+    case OPCODE_COMPARE_SGE:
+    case OPCODE_COMPARE_ULT:
+    case OPCODE_COMPARE_ULE:
+    case OPCODE_COMPARE_UGT:
+    case OPCODE_COMPARE_UGE:
+    case OPCODE_VECTOR_COMPARE_EQ:
+    case OPCODE_VECTOR_COMPARE_SGT:
+    case OPCODE_VECTOR_COMPARE_SGE:
+    case OPCODE_VECTOR_COMPARE_UGT:
+    case OPCODE_VECTOR_COMPARE_UGE:
+    case OPCODE_ADD:
+    case OPCODE_SUB:
+    case OPCODE_MUL:
+    case OPCODE_MUL_HI:
+    case OPCODE_NEG:
+    case OPCODE_AND:
+    case OPCODE_AND_NOT:
+    case OPCODE_OR:
+    case OPCODE_XOR:
+    case OPCODE_NOT:
+    case OPCODE_SHL:
+    case OPCODE_SHR:
+    case OPCODE_SHA:
+    case OPCODE_VECTOR_SHL:
+    case OPCODE_VECTOR_SHR:
+    case OPCODE_VECTOR_SHA:
+    case OPCODE_ROTATE_LEFT:
+    case OPCODE_VECTOR_ROTATE_LEFT:
+    case OPCODE_BYTE_SWAP:
+    case OPCODE_CNTLZ:
+    case OPCODE_INSERT:
+    case OPCODE_EXTRACT:
+    case OPCODE_SPLAT:
+    case OPCODE_PERMUTE:
+    case OPCODE_SWIZZLE:
+    case OPCODE_LOAD_VECTOR_SHL:
+    case OPCODE_LOAD_VECTOR_SHR:
+      return true;
+    default:
+      return false;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
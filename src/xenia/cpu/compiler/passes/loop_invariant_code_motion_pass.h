@@ -0,0 +1,79 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/passes/loop_analysis_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Hoists pure instructions whose sources are all defined outside of a loop
+// into its preheader, innermost loops first so they may keep moving outwards.
+// Context loads are hoisted when nothing in the loop may write the slot.
+// The hoisted values live across blocks, so this requires the global register
+// allocator.
+class LoopInvariantCodeMotionPass : public CompilerPass {
+ public:
+  // Totals over all functions run through the pass.
+  struct Statistics {
+    uint64_t loops;
+    // Loops that had no block to hoist into.
+    uint64_t loops_without_preheader;
+    uint64_t hoisted_instrs;
+    // Included in hoisted_instrs.
+    uint64_t hoisted_context_loads;
+  };
+
+  LoopInvariantCodeMotionPass();
+  ~LoopInvariantCodeMotionPass() override;
+
+  const char* name() const override { return "LoopInvariantCodeMotion"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+  const Statistics& statistics() const { return statistics_; }
+
+ private:
+  // Clobbers found in a loop that limit what may be hoisted out of it.
+  struct LoopEffects {
+    // Calls and other volatile instructions, which may do anything.
+    bool has_volatile;
+    // Rounding or denormal mode changes, affecting float and vector results.
+    bool changes_fp_mode;
+    // Bytes of the context written to, by offset.
+    std::vector<std::pair<uint32_t, uint32_t>> stores;
+  };
+
+  void GatherEffects(hir::HIRBuilder* builder,
+                     const LoopAnalysisPass::Loop& loop, LoopEffects* effects);
+  bool IsInvariant(const LoopAnalysisPass::Loop& loop,
+                   const LoopEffects& effects, hir::Instr* instr) const;
+  static bool IsHoistableOpcode(hir::Opcode opcode);
+
+  std::vector<LoopAnalysisPass::Loop> loops_;
+  // Kept across functions so the stores don't reallocate.
+  LoopEffects effects_;
+  Statistics statistics_ = {};
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
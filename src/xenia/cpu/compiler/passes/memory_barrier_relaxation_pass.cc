@@ -0,0 +1,130 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/memory_barrier_relaxation_pass.h"
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler_statistics.h"
+
+DEFINE_bool(relax_memory_barriers, true,
+            "Emit guest memory barriers that the host memory model already "
+            "guarantees as compiler barriers only, instead of fences.",
+            "CPU");
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+MemoryBarrierRelaxationPass::MemoryBarrierRelaxationPass() : CompilerPass() {}
+
+MemoryBarrierRelaxationPass::~MemoryBarrierRelaxationPass() = default;
+
+bool MemoryBarrierRelaxationPass::Run(HIRBuilder* builder) {
+  if (!cvars::relax_memory_barriers) {
+    return true;
+  }
+  uint32_t fences = 0;
+  uint32_t relaxed = 0;
+  // In order, so barriers before have their final type when scanning back.
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode != &OPCODE_MEMORY_BARRIER_info ||
+          i->flags == MEMORY_BARRIER_COMPILER) {
+        continue;
+      }
+      if (i->flags == MEMORY_BARRIER_FULL && IsStoreBefore(i) &&
+          IsLoadAfter(i)) {
+        ++fences;
+      } else {
+        i->flags = MEMORY_BARRIER_COMPILER;
+        ++relaxed;
+      }
+    }
+  }
+  if (CompilerStatistics::is_enabled()) {
+    CompilerStatistics::RecordMemoryBarriers(fences, relaxed);
+  }
+  return true;
+}
+
+uint32_t MemoryBarrierRelaxationPass::GetAccess(const Instr* i) {
+  switch (i->GetOpcodeNum()) {
+    case OPCODE_LOAD:
+    case OPCODE_LOAD_OFFSET:
+    case OPCODE_LVL:
+    case OPCODE_LVR:
+    case OPCODE_RESERVED_LOAD:
+      return kAccessLoad;
+    case OPCODE_STORE:
+    case OPCODE_STORE_OFFSET:
+    case OPCODE_STVL:
+    case OPCODE_STVR:
+    case OPCODE_MEMSET:
+    case OPCODE_CACHE_CONTROL:
+    case OPCODE_RESERVED_STORE:
+      return kAccessStore;
+    case OPCODE_ATOMIC_EXCHANGE:
+    case OPCODE_ATOMIC_COMPARE_EXCHANGE:
+      return kAccessFence;
+    case OPCODE_MEMORY_BARRIER:
+      return i->flags == MEMORY_BARRIER_COMPILER ? 0 : kAccessFence;
+    case OPCODE_CALL:
+    case OPCODE_CALL_TRUE:
+    case OPCODE_CALL_INDIRECT:
+    case OPCODE_CALL_INDIRECT_TRUE:
+    case OPCODE_CALL_EXTERN:
+    case OPCODE_LOAD_MMIO:
+    case OPCODE_STORE_MMIO:
+      // Anything may happen in host code.
+      return kAccessLoad | kAccessStore;
+    default:
+      return 0;
+  }
+}
+
+bool MemoryBarrierRelaxationPass::IsStoreBefore(const Instr* barrier) {
+  // Anything may come before the block.
+  for (auto i = barrier->prev; i; i = i->prev) {
+    uint32_t access = GetAccess(i);
+    if (access & kAccessFence) {
+      return false;
+    }
+    if (access & kAccessStore) {
+      return true;
+    }
+  }
+  return true;
+}
+
+bool MemoryBarrierRelaxationPass::IsLoadAfter(const Instr* barrier) {
+  // Anything may come after the block.
+  for (auto i = barrier->next; i; i = i->next) {
+    uint32_t access = GetAccess(i);
+    if (access & kAccessFence) {
+      return false;
+    }
+    if (access & kAccessLoad) {
+      return true;
+    }
+  }
+  return true;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,54 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_MEMORY_BARRIER_RELAXATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_MEMORY_BARRIER_RELAXATION_PASS_H_
+
+#include <cstdint>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Relaxes guest memory barriers (sync, lwsync, eieio) that a total store
+// ordered host doesn't need to compiler barriers. Only a store followed by a
+// load can be reordered there, so lightweight barriers never need a fence, and
+// a full one only if a store may come before it and a load after it without a
+// locked instruction in between. MMIO accesses are host calls, and reserved
+// stores are treated as plain stores.
+class MemoryBarrierRelaxationPass : public CompilerPass {
+ public:
+  MemoryBarrierRelaxationPass();
+  ~MemoryBarrierRelaxationPass() override;
+
+  const char* name() const override { return "MemoryBarrierRelaxation"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  enum AccessFlags : uint32_t {
+    kAccessLoad = 1 << 0,
+    kAccessStore = 1 << 1,
+    // Orders everything on the host, like a locked instruction.
+    kAccessFence = 1 << 2,
+  };
+  static uint32_t GetAccess(const hir::Instr* i);
+  static bool IsStoreBefore(const hir::Instr* barrier);
+  static bool IsLoadAfter(const hir::Instr* barrier);
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_MEMORY_BARRIER_RELAXATION_PASS_H_
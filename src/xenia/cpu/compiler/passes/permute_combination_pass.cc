@@ -0,0 +1,242 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/permute_combination_pass.h"
+
+#include "xenia/base/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+PermuteCombinationPass::PermuteCombinationPass() : CompilerPass() {}
+
+PermuteCombinationPass::~PermuteCombinationPass() = default;
+
+bool PermuteCombinationPass::Run(HIRBuilder* builder) {
+  // Shuffles are visited in order, so the sources of a shuffle have already
+  // been combined as far as possible and only one level needs to be looked
+  // through.
+  auto block = builder->first_block();
+  while (block) {
+    auto i = block->instr_head;
+    while (i) {
+      CombineShuffle(builder, i);
+      i = i->next;
+    }
+    block = block->next;
+  }
+  return true;
+}
+
+bool PermuteCombinationPass::GetShuffle(Instr* i, Shuffle* out_shuffle) {
+  if (!i->dest || i->dest->type != VEC128_TYPE) {
+    return false;
+  }
+  switch (i->GetOpcodeNum()) {
+    case OPCODE_PERMUTE: {
+      if (!i->src1.value->IsConstant()) {
+        return false;
+      }
+      out_shuffle->sources[0] = i->src2.value;
+      out_shuffle->sources[1] = i->src3.value;
+      const auto& control = i->src1.value->constant;
+      switch (i->flags) {
+        case INT8_TYPE:
+          for (uint32_t n = 0; n < 16; ++n) {
+            out_shuffle->bytes[n] = (control.v128.u8[n] & 0x1F) ^ 3;
+          }
+          return true;
+        case INT16_TYPE:
+          for (uint32_t n = 0; n < 8; ++n) {
+            uint32_t index = (control.v128.u16[n] & 0xF) ^ 1;
+            uint8_t byte = uint8_t(((index & 8) << 1) | ((index & 7) * 2));
+            out_shuffle->bytes[n * 2] = byte;
+            out_shuffle->bytes[n * 2 + 1] = byte + 1;
+          }
+          return true;
+        case INT32_TYPE:
+          for (uint32_t n = 0; n < 4; ++n) {
+            uint32_t select = control.u32 >> (n * 8);
+            uint8_t byte = uint8_t(((select & 4) << 2) | ((select & 3) * 4));
+            for (uint32_t j = 0; j < 4; ++j) {
+              out_shuffle->bytes[n * 4 + j] = byte + j;
+            }
+          }
+          return true;
+        default:
+          return false;
+      }
+    }
+    case OPCODE_SWIZZLE: {
+      if (i->flags != INT32_TYPE && i->flags != FLOAT32_TYPE) {
+        return false;
+      }
+      uint32_t mask = uint32_t(i->src2.offset);
+      out_shuffle->sources[0] = out_shuffle->sources[1] = i->src1.value;
+      for (uint32_t n = 0; n < 4; ++n) {
+        uint8_t byte = uint8_t(((mask >> (n * 2)) & 3) * 4);
+        for (uint32_t j = 0; j < 4; ++j) {
+          out_shuffle->bytes[n * 4 + j] = byte + j;
+        }
+      }
+      return true;
+    }
+    case OPCODE_SPLAT: {
+      // Of a constant element of a vector, as vsplt* emit.
+      Instr* extract = i->src1.value->GetDefSkipAssigns();
+      if (!extract || extract->GetOpcodeNum() != OPCODE_EXTRACT ||
+          extract->block != i->block ||
+          !extract->src2.value->IsConstant() ||
+          extract->src1.value->type != VEC128_TYPE) {
+        return false;
+      }
+      uint32_t index = extract->src2.value->AsUint32();
+      out_shuffle->sources[0] = out_shuffle->sources[1] =
+          extract->src1.value;
+      for (uint32_t n = 0; n < 16; ++n) {
+        switch (extract->dest->type) {
+          case INT8_TYPE:
+            out_shuffle->bytes[n] = uint8_t((index & 0xF) ^ 3);
+            break;
+          case INT16_TYPE:
+            out_shuffle->bytes[n] =
+                uint8_t(((index & 7) ^ 1) * 2 + (n & 1));
+            break;
+          case INT32_TYPE:
+          case FLOAT32_TYPE:
+            out_shuffle->bytes[n] = uint8_t((index & 3) * 4 + (n & 3));
+            break;
+          default:
+            return false;
+        }
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+bool PermuteCombinationPass::CombineShuffle(HIRBuilder* builder, Instr* i) {
+  // A chain:
+  //   v1 = permute c0, v0, v0, [i8]
+  //   v2 = swizzle v1, [XXYY]
+  //   v3 = permute c1, v2, v9, [i32]
+  // becomes:
+  //   v3 = permute c2, v0, v9, [i8]
+  // or a swizzle or word permute if whole words are moved.
+  Shuffle shuffle;
+  if (!GetShuffle(i, &shuffle)) {
+    return false;
+  }
+
+  Value* sources[2] = {nullptr, nullptr};
+  uint8_t bytes[16];
+  bool composed = false;
+  for (uint32_t n = 0; n < 16; ++n) {
+    Value* source = shuffle.sources[shuffle.bytes[n] >> 4];
+    uint32_t byte = shuffle.bytes[n] & 0xF;
+    // Only through shuffles in the same block, so no value has to live longer
+    // than it did across blocks.
+    Instr* def = source->GetDefSkipAssigns();
+    Shuffle source_shuffle;
+    if (def && def->block == i->block && GetShuffle(def, &source_shuffle)) {
+      source = source_shuffle.sources[source_shuffle.bytes[byte] >> 4];
+      byte = source_shuffle.bytes[byte] & 0xF;
+      composed = true;
+    }
+    uint32_t slot;
+    if (!sources[0] || sources[0] == source) {
+      slot = 0;
+    } else if (!sources[1] || sources[1] == source) {
+      slot = 1;
+    } else {
+      // Needs more than two vectors.
+      return false;
+    }
+    sources[slot] = source;
+    bytes[n] = uint8_t((slot << 4) | byte);
+  }
+
+  bool identity = !sources[1];
+  bool words = true;
+  for (uint32_t n = 0; n < 16; ++n) {
+    identity &= bytes[n] == n;
+    words &= bytes[n] == (bytes[n & ~3u] & ~3u) + (n & 3);
+  }
+
+  // Cheapest first: assign, swizzle, word permute, byte permute.
+  uint32_t rank = identity ? 0 : !words ? 3 : sources[1] ? 2 : 1;
+  uint32_t current_rank;
+  switch (i->GetOpcodeNum()) {
+    case OPCODE_SWIZZLE:
+      current_rank = 1;
+      break;
+    case OPCODE_PERMUTE:
+      current_rank = i->flags == INT32_TYPE ? 2 : 3;
+      break;
+    default:
+      // An extract and a splat.
+      current_rank = 4;
+      break;
+  }
+  if (!composed && rank >= current_rank) {
+    return false;
+  }
+
+  Value* a = sources[0];
+  Value* b = sources[1] ? sources[1] : sources[0];
+  if (identity) {
+    i->Replace(&OPCODE_ASSIGN_info, 0);
+    i->set_src1(a);
+  } else if (words && !sources[1]) {
+    uint32_t mask = 0;
+    for (uint32_t n = 0; n < 4; ++n) {
+      mask |= uint32_t((bytes[n * 4] >> 2) & 3) << (n * 2);
+    }
+    i->Replace(&OPCODE_SWIZZLE_info, INT32_TYPE);
+    i->set_src1(a);
+    i->src2.offset = mask;
+    i->src3.value = nullptr;
+  } else if (words) {
+    uint32_t control = 0;
+    for (uint32_t n = 0; n < 4; ++n) {
+      uint32_t select = ((bytes[n * 4] >> 4) << 2) | ((bytes[n * 4] >> 2) & 3);
+      control |= select << (n * 8);
+    }
+    i->Replace(&OPCODE_PERMUTE_info, INT32_TYPE);
+    i->set_src1(builder->LoadConstantUint32(control));
+    i->set_src2(a);
+    i->set_src3(b);
+  } else {
+    vec128_t control;
+    for (uint32_t n = 0; n < 16; ++n) {
+      control.u8[n] = bytes[n] ^ 3;
+    }
+    i->Replace(&OPCODE_PERMUTE_info, INT8_TYPE);
+    i->set_src1(builder->LoadConstantVec128(control));
+    i->set_src2(a);
+    i->set_src3(b);
+  }
+  return true;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
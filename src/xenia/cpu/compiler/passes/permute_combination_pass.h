@@ -0,0 +1,53 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_PERMUTE_COMBINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_PERMUTE_COMBINATION_PASS_H_
+
+#include <cstdint>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Composes chains of constant vector shuffles (vperm, vsldoi, vmrg*, vsplt*,
+// vpermwi128 and so on) into a single permutation of at most two vectors, in
+// the cheapest form the backends know: a SWIZZLE if whole words of one vector
+// are moved, an INT32 PERMUTE if whole words of two, otherwise an INT8
+// PERMUTE. Intermediate shuffles left without uses are removed by DCE.
+class PermuteCombinationPass : public CompilerPass {
+ public:
+  PermuteCombinationPass();
+  ~PermuteCombinationPass() override;
+
+  const char* name() const override { return "PermuteCombination"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  // Byte n of the result, in host order, is byte (bytes[n] & 0xF) of
+  // sources[bytes[n] >> 4].
+  struct Shuffle {
+    hir::Value* sources[2];
+    uint8_t bytes[16];
+  };
+
+  static bool GetShuffle(hir::Instr* i, Shuffle* out_shuffle);
+  bool CombineShuffle(hir::HIRBuilder* builder, hir::Instr* i);
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_PERMUTE_COMBINATION_PASS_H_
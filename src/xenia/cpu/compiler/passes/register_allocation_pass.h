@@ -28,6 +28,8 @@ class RegisterAllocationPass : public CompilerPass {
   explicit RegisterAllocationPass(const backend::MachineInfo* machine_info);
   ~RegisterAllocationPass() override;
 
+  const char* name() const override { return "RegisterAllocation"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
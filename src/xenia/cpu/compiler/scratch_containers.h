@@ -0,0 +1,240 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_SCRATCH_CONTAINERS_H_
+#define XENIA_CPU_COMPILER_SCRATCH_CONTAINERS_H_
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#include "xenia/base/arena.h"
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// Containers for the per-function data of compiler passes. Their memory comes
+// from an arena, usually CompilerPass::scratch_arena(), and their capacity is
+// fixed when they are initialized, so they never touch the heap once the arena
+// has grown to fit the largest function. Nothing is ever destroyed, the arena
+// is just reset, so elements must be trivially destructible.
+
+// Default-constructs count elements.
+template <typename T>
+T* AllocScratchArray(Arena* arena, size_t count) {
+  static_assert(std::is_trivially_destructible<T>::value,
+                "scratch elements are never destroyed");
+  T* elements = reinterpret_cast<T*>(
+      arena->Alloc(sizeof(T) * (count ? count : 1), alignof(T)));
+  for (size_t i = 0; i < count; ++i) {
+    new (&elements[i]) T();
+  }
+  return elements;
+}
+
+template <typename T>
+class ScratchVector {
+ public:
+  ScratchVector() = default;
+  ScratchVector(Arena* arena, uint32_t capacity) {
+    Initialize(arena, capacity);
+  }
+
+  void Initialize(Arena* arena, uint32_t capacity) {
+    data_ = AllocScratchArray<T>(arena, capacity);
+    size_ = 0;
+    capacity_ = capacity;
+  }
+
+  T* data() const { return data_; }
+  uint32_t size() const { return size_; }
+  uint32_t capacity() const { return capacity_; }
+  bool empty() const { return !size_; }
+
+  T* begin() const { return data_; }
+  T* end() const { return data_ + size_; }
+  T& operator[](uint32_t index) const {
+    assert_true(index < size_);
+    return data_[index];
+  }
+  T& back() const {
+    assert_true(size_ != 0);
+    return data_[size_ - 1];
+  }
+
+  void push_back(const T& value) {
+    assert_true(size_ < capacity_);
+    data_[size_++] = value;
+  }
+  void pop_back() {
+    assert_true(size_ != 0);
+    --size_;
+  }
+  void clear() { size_ = 0; }
+  void resize(uint32_t size, const T& value = T()) {
+    assert_true(size <= capacity_);
+    for (uint32_t i = size_; i < size; ++i) {
+      data_[i] = value;
+    }
+    size_ = size;
+  }
+
+ private:
+  T* data_ = nullptr;
+  uint32_t size_ = 0;
+  uint32_t capacity_ = 0;
+};
+
+// Bit vector with the subset of the interface of llvm::BitVector the passes
+// use. Copies refer to the same bits, use CopyFrom to copy the bits.
+class ScratchBitVector {
+ public:
+  ScratchBitVector() = default;
+  ScratchBitVector(Arena* arena, uint32_t size, bool value = false) {
+    Initialize(arena, size, value);
+  }
+
+  void Initialize(Arena* arena, uint32_t size, bool value = false) {
+    size_ = size;
+    words_ = reinterpret_cast<uint64_t*>(arena->Alloc(
+        sizeof(uint64_t) * (word_count() ? word_count() : 1),
+        alignof(uint64_t)));
+    if (value) {
+      set();
+    } else {
+      reset();
+    }
+  }
+
+  uint32_t size() const { return size_; }
+
+  bool test(uint32_t index) const {
+    assert_true(index < size_);
+    return (words_[index >> 6] >> (index & 63)) & 1;
+  }
+  bool operator[](uint32_t index) const { return test(index); }
+
+  void set(uint32_t index) {
+    assert_true(index < size_);
+    words_[index >> 6] |= uint64_t(1) << (index & 63);
+  }
+  void reset(uint32_t index) {
+    assert_true(index < size_);
+    words_[index >> 6] &= ~(uint64_t(1) << (index & 63));
+  }
+  // [begin, end).
+  void set(uint32_t begin, uint32_t end) {
+    assert_true(begin <= end && end <= size_);
+    for (uint32_t i = begin; i < end; ++i) {
+      set(i);
+    }
+  }
+  void reset(uint32_t begin, uint32_t end) {
+    assert_true(begin <= end && end <= size_);
+    for (uint32_t i = begin; i < end; ++i) {
+      reset(i);
+    }
+  }
+  void set() {
+    std::memset(words_, 0xFF, sizeof(uint64_t) * word_count());
+    ClearUnusedBits();
+  }
+  void reset() { std::memset(words_, 0, sizeof(uint64_t) * word_count()); }
+  // Clears the bits set in other.
+  void reset(const ScratchBitVector& other) {
+    assert_true(size_ == other.size_);
+    for (uint32_t i = 0; i < word_count(); ++i) {
+      words_[i] &= ~other.words_[i];
+    }
+  }
+
+  void CopyFrom(const ScratchBitVector& other) {
+    assert_true(size_ == other.size_);
+    std::memcpy(words_, other.words_, sizeof(uint64_t) * word_count());
+  }
+  ScratchBitVector& operator|=(const ScratchBitVector& other) {
+    assert_true(size_ == other.size_);
+    for (uint32_t i = 0; i < word_count(); ++i) {
+      words_[i] |= other.words_[i];
+    }
+    return *this;
+  }
+  ScratchBitVector& operator&=(const ScratchBitVector& other) {
+    assert_true(size_ == other.size_);
+    for (uint32_t i = 0; i < word_count(); ++i) {
+      words_[i] &= other.words_[i];
+    }
+    return *this;
+  }
+  bool operator==(const ScratchBitVector& other) const {
+    assert_true(size_ == other.size_);
+    return !std::memcmp(words_, other.words_, sizeof(uint64_t) * word_count());
+  }
+  bool operator!=(const ScratchBitVector& other) const {
+    return !(*this == other);
+  }
+
+  uint32_t count() const {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < word_count(); ++i) {
+      count += xe::bit_count(words_[i]);
+    }
+    return count;
+  }
+  // The first set bit, or -1 if none.
+  int find_first() const { return FindFrom(0); }
+  int find_next(int previous) const {
+    return FindFrom(uint32_t(previous) + 1);
+  }
+  // The first clear bit, or -1 if none.
+  int find_first_unset() const {
+    for (uint32_t i = 0; i < word_count(); ++i) {
+      if (~words_[i]) {
+        uint32_t index = (i << 6) + xe::tzcnt(~words_[i]);
+        return index < size_ ? int(index) : -1;
+      }
+    }
+    return -1;
+  }
+
+ private:
+  uint32_t word_count() const { return (size_ + 63) >> 6; }
+  void ClearUnusedBits() {
+    if (size_ & 63) {
+      words_[size_ >> 6] &= (uint64_t(1) << (size_ & 63)) - 1;
+    }
+  }
+  int FindFrom(uint32_t index) const {
+    if (index >= size_) {
+      return -1;
+    }
+    uint32_t word_index = index >> 6;
+    uint64_t word = words_[word_index] & (~uint64_t(0) << (index & 63));
+    while (!word) {
+      if (++word_index >= word_count()) {
+        return -1;
+      }
+      word = words_[word_index];
+    }
+    return int((word_index << 6) + xe::tzcnt(word));
+  }
+
+  uint64_t* words_ = nullptr;
+  uint32_t size_ = 0;
+};
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_SCRATCH_CONTAINERS_H_
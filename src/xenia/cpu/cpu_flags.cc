@@ -9,7 +9,7 @@
 
 #include "xenia/cpu/cpu_flags.h"
 
-DEFINE_string(cpu, "any", "CPU backend [any, x64].", "CPU");
+DEFINE_string(cpu, "any", "CPU backend [any, x64, interpreter].", "CPU");
 
 DEFINE_string(
     load_module_map, "",
@@ -33,6 +33,37 @@ DEFINE_bool(trace_function_data, false,
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.", "CPU");
 
+DEFINE_bool(tiered_compilation, false,
+            "Translate functions with a reduced set of optimization passes "
+            "first, and retranslate them with the full set in the background "
+            "once they have been called tiered_compilation_threshold times. "
+            "Reduces stutter when new code is reached.",
+            "CPU");
+DEFINE_uint32(tiered_compilation_threshold, 1000,
+              "Number of calls after which a function translated with the "
+              "reduced set of optimization passes is retranslated.",
+              "CPU");
+DEFINE_bool(interpret_baseline_functions, false,
+            "Run the first translation of functions (see tiered_compilation) "
+            "in the HIR interpreter instead of generating machine code for it. "
+            "Starts faster, but runs much slower until functions are "
+            "retranslated.",
+            "CPU");
+DEFINE_bool(global_register_allocation, true,
+            "Allocate registers over whole functions, so values can stay in "
+            "registers across blocks. If disabled, registers are allocated "
+            "per block, as with baseline translation (see "
+            "tiered_compilation).",
+            "CPU");
+
+DEFINE_string(disabled_compiler_passes, "",
+              "Comma-separated names of optimization passes to leave out of "
+              "the translation pipelines, such as "
+              "\"LoopInvariantCodeMotion,MemorySequenceCombination\". For "
+              "narrowing down translation bugs, passes needed for code "
+              "generation must not be listed.",
+              "CPU");
+
 DEFINE_uint64(
     pvr, 0x710700,
     "Processor version and revision number.\nBits 0 to 15 are the version "
@@ -48,5 +79,10 @@ DEFINE_uint64(break_condition_value, 0, "value compared against", "CPU");
 DEFINE_string(break_condition_op, "eq", "comparison operator", "CPU");
 DEFINE_bool(break_condition_truncate, true, "truncate value to 32-bits", "CPU");
 
+DEFINE_bool(debugprint_trap_log, false,
+            "Log debugprint traps to the active debugger", "CPU");
+DEFINE_bool(ignore_undefined_externs, true,
+            "Don't exit when an undefined extern is called.", "CPU");
+
 DEFINE_bool(break_on_debugbreak, true, "int3 on JITed __debugbreak requests.",
             "CPU");
@@ -24,6 +24,12 @@ DECLARE_bool(trace_function_data);
 
 DECLARE_bool(validate_hir);
 
+DECLARE_bool(tiered_compilation);
+DECLARE_uint32(tiered_compilation_threshold);
+DECLARE_bool(interpret_baseline_functions);
+DECLARE_bool(global_register_allocation);
+DECLARE_string(disabled_compiler_passes);
+
 DECLARE_uint64(pvr);
 
 // Breakpoints:
@@ -33,6 +39,9 @@ DECLARE_uint64(break_condition_value);
 DECLARE_string(break_condition_op);
 DECLARE_bool(break_condition_truncate);
 
+DECLARE_bool(debugprint_trap_log);
+DECLARE_bool(ignore_undefined_externs);
+
 DECLARE_bool(break_on_debugbreak);
 
 #endif  // XENIA_CPU_CPU_FLAGS_H_
@@ -9,29 +9,95 @@
 
 #include "xenia/cpu/entry_table.h"
 
+#include <algorithm>
+
+#include "xenia/base/assert.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
+#include "xenia/cpu/function.h"
 
 namespace xe {
 namespace cpu {
 
-EntryTable::EntryTable() = default;
+EntryTable::EntryTable()
+    : pages_(new std::atomic<std::atomic<Entry*>*>[kPageCount]()),
+      range_pages_(new std::atomic<RangeNode*>[kPageCount]()) {}
 
 EntryTable::~EntryTable() {
-  auto global_lock = global_critical_region_.Acquire();
-  for (auto it : map_.Values()) {
-    Entry* entry = it;
+  for (uint32_t i = 0; i < kPageCount; ++i) {
+    delete[] pages_[i].load(std::memory_order_relaxed);
+    RangeNode* node = range_pages_[i].load(std::memory_order_relaxed);
+    while (node) {
+      RangeNode* next = node->next;
+      delete node;
+      node = next;
+    }
+  }
+  for (Entry* entry : entries_) {
+    delete entry;
+  }
+  for (Entry* entry : deleted_entries_) {
     delete entry;
   }
 }
 
-Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  uint32_t idx = map_.IndexForKey(address);
-  if (idx == map_.size() || *map_.KeyAt(idx) != address) {
+std::atomic<Entry*>* EntryTable::LookupSlot(uint32_t address) const {
+  if (!IsInTable(address)) {
+    return nullptr;
+  }
+  uint32_t offset = address - kTableBase;
+  std::atomic<Entry*>* page =
+      pages_[offset >> kPageShift].load(std::memory_order_acquire);
+  if (!page) {
     return nullptr;
   }
-  Entry* entry = *map_.ValueAt(idx);
+  return &page[(offset & (kPageSize - 1)) >> 2];
+}
+
+std::atomic<Entry*>* EntryTable::GetOrCreateSlot(uint32_t address) {
+  assert_true(IsInTable(address));
+  uint32_t offset = address - kTableBase;
+  auto& page_ptr = pages_[offset >> kPageShift];
+  std::atomic<Entry*>* page = page_ptr.load(std::memory_order_relaxed);
+  if (!page) {
+    page = new std::atomic<Entry*>[kPageSlotCount]();
+    page_ptr.store(page, std::memory_order_release);
+  }
+  return &page[(offset & (kPageSize - 1)) >> 2];
+}
+
+void EntryTable::AddToRangePages(Entry* entry) {
+  // Code past the end of the table is never looked up in it.
+  uint32_t last_offset =
+      std::min(entry->end_address, kTableBase + kTableSize - 1) - kTableBase;
+  for (uint32_t page_index = (entry->address - kTableBase) >> kPageShift;
+       page_index <= last_offset >> kPageShift; ++page_index) {
+    auto& head = range_pages_[page_index];
+    head.store(new RangeNode{entry, head.load(std::memory_order_relaxed)},
+               std::memory_order_release);
+  }
+}
+
+bool EntryTable::IsCurrent(const Entry* entry) const {
+  if (entry->status != Entry::STATUS_READY) {
+    return false;
+  }
+  std::atomic<Entry*>* slot = LookupSlot(entry->address);
+  return slot && slot->load(std::memory_order_acquire) == entry;
+}
+
+Entry* EntryTable::Find(uint32_t address) {
+  if (IsInTable(address)) {
+    std::atomic<Entry*>* slot = LookupSlot(address);
+    return slot ? slot->load(std::memory_order_acquire) : nullptr;
+  }
+  std::lock_guard<xe_mutex> lock(table_lock_);
+  auto it = outside_entries_.find(address);
+  return it != outside_entries_.end() ? it->second : nullptr;
+}
+
+Entry* EntryTable::Get(uint32_t address) {
+  Entry* entry = Find(address);
   if (entry) {
     // TODO(benvanik): wait if needed?
     if (entry->status != Entry::STATUS_READY) {
@@ -42,68 +108,152 @@ Entry* EntryTable::Get(uint32_t address) {
 }
 
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
+  // Lookups of existing entries don't lock.
+  Entry* entry = Find(address);
+  if (!entry) {
+    std::lock_guard<xe_mutex> lock(table_lock_);
+    // Another thread may have created it meanwhile.
+    std::atomic<Entry*>* slot = nullptr;
+    if (IsInTable(address)) {
+      slot = GetOrCreateSlot(address);
+      entry = slot->load(std::memory_order_relaxed);
+    } else {
+      auto it = outside_entries_.find(address);
+      if (it != outside_entries_.end()) {
+        entry = it->second;
+      }
+    }
+    if (!entry) {
+      // Create and return for initialization.
+      entry = new Entry();
+      entry->address = address;
+      entry->end_address = 0;
+      entry->status = Entry::STATUS_COMPILING;
+      entry->function = 0;
+      entries_.push_back(entry);
+      if (slot) {
+        slot->store(entry, std::memory_order_release);
+      } else {
+        outside_entries_.emplace(address, entry);
+      }
+      *out_entry = entry;
+      return Entry::STATUS_NEW;
+    }
+  }
 
-  auto global_lock = global_critical_region_.Acquire();
+  // If we aren't ready yet wait.
+  if (entry->status == Entry::STATUS_COMPILING) {
+    // Another thread (guest or background compilation) is translating it.
+    // Only wait for this entry, so lookups and other translations can go on.
+    std::unique_lock<xe_mutex> wait_lock(compile_wait_lock_);
+    compile_wait_cond_.wait(wait_lock, [entry]() {
+      return entry->status != Entry::STATUS_COMPILING;
+    });
+  }
+  *out_entry = entry;
+  return entry->status;
+}
 
-  uint32_t idx = map_.IndexForKey(address);
+void EntryTable::FinishCompiling(Entry* entry, Entry::Status status) {
+  assert_true(status != Entry::STATUS_COMPILING);
+  if (status == Entry::STATUS_READY && IsInTable(entry->address) &&
+      entry->end_address >= entry->address) {
+    std::lock_guard<xe_mutex> lock(table_lock_);
+    AddToRangePages(entry);
+  }
+  {
+    std::lock_guard<xe_mutex> wait_lock(compile_wait_lock_);
+    entry->status = status;
+  }
+  compile_wait_cond_.notify_all();
+}
 
-  Entry* entry = idx != map_.size() && *map_.KeyAt(idx) == address
-                     ? *map_.ValueAt(idx)
-                     : nullptr;
-  Entry::Status status;
-  if (entry) {
-    // If we aren't ready yet spin and wait.
-    if (entry->status == Entry::STATUS_COMPILING) {
-      // chrispy: i think this is dead code, if we are compiling we're holding
-      // the global lock, arent we? so we wouldnt be executing here
-      // Still compiling, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(10));
-        global_lock.lock();
-      } while (entry->status == Entry::STATUS_COMPILING);
+void EntryTable::Delete(uint32_t address) {
+  std::lock_guard<xe_mutex> lock(table_lock_);
+  Entry* entry = nullptr;
+  if (IsInTable(address)) {
+    std::atomic<Entry*>* slot = LookupSlot(address);
+    if (slot) {
+      entry = slot->exchange(nullptr, std::memory_order_acq_rel);
     }
-    status = entry->status;
   } else {
-    // Create and return for initialization.
-    entry = new Entry();
-    entry->address = address;
-    entry->end_address = 0;
-    entry->status = Entry::STATUS_COMPILING;
-    entry->function = 0;
-    map_.InsertAt(address, entry, idx);
-    // map_[address] = entry;
-    status = Entry::STATUS_NEW;
-  }
-  global_lock.unlock();
-  *out_entry = entry;
-  return status;
+    auto it = outside_entries_.find(address);
+    if (it != outside_entries_.end()) {
+      entry = it->second;
+      outside_entries_.erase(it);
+    }
+  }
+  if (entry) {
+    entries_.erase(std::find(entries_.begin(), entries_.end(), entry));
+    deleted_entries_.push_back(entry);
+  }
 }
 
-void EntryTable::Delete(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  // doesnt this leak memory by not deleting the entry?
-  uint32_t idx = map_.IndexForKey(address);
-  if (idx != map_.size() && *map_.KeyAt(idx) == address) {
-    map_.EraseAt(idx);
+std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
+  std::vector<Function*> fns;
+  if (address - kTableBase < kTableSize) {
+    for (const RangeNode* node =
+             range_pages_[(address - kTableBase) >> kPageShift].load(
+                 std::memory_order_acquire);
+         node; node = node->next) {
+      const Entry* entry = node->entry;
+      if (address >= entry->address && address <= entry->end_address &&
+          IsCurrent(entry)) {
+        fns.push_back(entry->function);
+      }
+    }
+    return fns;
+  }
+  std::lock_guard<xe_mutex> lock(table_lock_);
+  for (const auto& outside_entry : outside_entries_) {
+    const Entry* entry = outside_entry.second;
+    // The end address is only valid once ready.
+    if (entry->status == Entry::STATUS_READY && address >= entry->address &&
+        address <= entry->end_address) {
+      fns.push_back(entry->function);
+    }
   }
+  return fns;
 }
 
-std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
+std::vector<Function*> EntryTable::FindWithinRange(uint32_t low_address,
+                                                   uint32_t high_address) {
   std::vector<Function*> fns;
-  for (auto& it : map_.Values()) {
-    Entry* entry = it;
-    if (address >= entry->address && address <= entry->end_address) {
-      if (entry->status == Entry::STATUS_READY) {
+  uint32_t table_low_address = std::max(low_address, kTableBase);
+  uint32_t table_high_address = std::min(high_address, kTableBase + kTableSize);
+  for (uint32_t page_index = (table_low_address - kTableBase) >> kPageShift;
+       table_low_address < table_high_address &&
+       page_index <= (table_high_address - 1 - kTableBase) >> kPageShift;
+       ++page_index) {
+    for (const RangeNode* node =
+             range_pages_[page_index].load(std::memory_order_acquire);
+         node; node = node->next) {
+      const Entry* entry = node->entry;
+      if (entry->address >= high_address || entry->end_address < low_address) {
+        continue;
+      }
+      // Entries listed for several pages are only taken from the first page
+      // they overlap the range in.
+      uint32_t first_address = std::max(entry->address, table_low_address);
+      if ((first_address - kTableBase) >> kPageShift == page_index &&
+          IsCurrent(entry)) {
         fns.push_back(entry->function);
       }
     }
   }
+  if (low_address >= kTableBase && high_address <= kTableBase + kTableSize) {
+    return fns;
+  }
+  std::lock_guard<xe_mutex> lock(table_lock_);
+  for (const auto& outside_entry : outside_entries_) {
+    const Entry* entry = outside_entry.second;
+    if (entry->status == Entry::STATUS_READY &&
+        entry->address < high_address && entry->end_address >= low_address) {
+      fns.push_back(entry->function);
+    }
+  }
   return fns;
 }
+
 }  // namespace cpu
 }  // namespace xe
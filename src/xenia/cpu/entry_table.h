@@ -10,11 +10,14 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
 #include "xenia/base/mutex.h"
-#include "xenia/base/split_map.h"
+
 namespace xe {
 namespace cpu {
 
@@ -30,7 +33,9 @@ typedef struct Entry_t {
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
+  // Read without locking, set last when compiling finishes, so everything
+  // else is visible once it's STATUS_READY.
+  std::atomic<Status> status;
   Function* function;
 } Entry;
 
@@ -41,15 +46,70 @@ class EntryTable {
 
   Entry* Get(uint32_t address);
   Entry::Status GetOrCreate(uint32_t address, Entry** out_entry);
+  // Sets the final status of an entry GetOrCreate returned as STATUS_NEW and
+  // wakes up threads waiting for it.
+  void FinishCompiling(Entry* entry, Entry::Status status);
   void Delete(uint32_t address);
 
+  // Functions of ready entries with code containing the address. Doesn't lock
+  // for addresses within the table.
   std::vector<Function*> FindWithAddress(uint32_t address);
+  // Functions of ready entries with code within [low_address, high_address).
+  // Doesn't lock for ranges within the table.
+  std::vector<Function*> FindWithinRange(uint32_t low_address,
+                                         uint32_t high_address);
 
  private:
-  xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
-  xe::split_map<uint32_t, Entry*> map_;
-  // std::unordered_map<uint32_t, Entry*> map_;
+  // Guest code of titles lives within the range of the indirection table, and
+  // entries in it are found through a two-level table without locking. The
+  // second level is allocated per kPageSize bytes of guest code as entries are
+  // created. Entries are never freed before the table, as other threads may
+  // still be using them after they're deleted.
+  static constexpr uint32_t kTableBase = 0x80000000;
+  static constexpr uint32_t kTableSize = 0x20000000;
+  static constexpr uint32_t kPageShift = 14;
+  static constexpr uint32_t kPageSize = uint32_t(1) << kPageShift;
+  static constexpr uint32_t kPageCount = kTableSize >> kPageShift;
+  static constexpr uint32_t kPageSlotCount = kPageSize >> 2;
+
+  static bool IsInTable(uint32_t address) {
+    return !(address & 3) && address - kTableBase < kTableSize;
+  }
+  // nullptr if the address is outside the table or no page exists for it.
+  std::atomic<Entry*>* LookupSlot(uint32_t address) const;
+  // Must be called with table_lock_ held.
+  std::atomic<Entry*>* GetOrCreateSlot(uint32_t address);
+  Entry* Find(uint32_t address);
+
+  // Ready entries of the table are also listed for every page their code is
+  // within, so functions containing an address are found without locking.
+  // Nodes are prepended with table_lock_ held and only freed with the table.
+  // Deleted entries stay listed, and are skipped as their slot no longer
+  // points to them.
+  struct RangeNode {
+    Entry* entry;
+    RangeNode* next;
+  };
+  // Must be called with table_lock_ held.
+  void AddToRangePages(Entry* entry);
+  // Whether the entry is ready and hasn't been deleted.
+  bool IsCurrent(const Entry* entry) const;
+
+  std::unique_ptr<std::atomic<std::atomic<Entry*>*>[]> pages_;
+  std::unique_ptr<std::atomic<RangeNode*>[]> range_pages_;
+  // Guards creation and deletion of entries and pages.
+  xe_mutex table_lock_;
+  // Protected with table_lock_.
+  // Entries for addresses outside the table (builtins and such).
+  std::unordered_map<uint32_t, Entry*> outside_entries_;
+  // Entries that can currently be found.
+  std::vector<Entry*> entries_;
+  // Deleted entries, freed with the table.
+  std::vector<Entry*> deleted_entries_;
+  // Guards status changes away from STATUS_COMPILING, so threads can wait for
+  // an entry without holding any other lock.
+  xe_mutex compile_wait_lock_;
+  std::condition_variable_any compile_wait_cond_;
 };
 
 }  // namespace cpu
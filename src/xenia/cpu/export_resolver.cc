@@ -93,5 +93,13 @@ void ExportResolver::SetFunctionMapping(const std::string_view module_name,
   export_entry->function_data.trampoline = trampoline;
 }
 
+void ExportResolver::SetFunctionIntrinsic(const std::string_view module_name,
+                                          uint16_t ordinal,
+                                          ExportIntrinsic intrinsic) {
+  auto export_entry = GetExportByOrdinal(module_name, ordinal);
+  assert_not_null(export_entry);
+  export_entry->intrinsic = intrinsic;
+}
+
 }  // namespace cpu
 }  // namespace xe
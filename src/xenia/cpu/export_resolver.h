@@ -16,6 +16,17 @@
 #include "xenia/base/math.h"
 #include "xenia/cpu/ppc/ppc_context.h"
 
+namespace xe {
+namespace cpu {
+namespace hir {
+class Label;
+}  // namespace hir
+namespace ppc {
+class PPCHIRBuilder;
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
+
 namespace xe {
 namespace cpu {
 
@@ -69,6 +80,11 @@ struct ExportTag {
 typedef void (*xe_kernel_export_shim_fn)(void*, void*);
 
 typedef void (*ExportTrampoline)(ppc::PPCContext* ppc_context);
+// Emits the fast path of an export in place of a call to its import thunk, see
+// PPCHIRBuilder::EmitExportIntrinsic. The arguments are in the guest registers.
+// Branches to slow_path, with no guest state changed, to call the export.
+// Values must not be used across the branches it emits.
+typedef void (*ExportIntrinsic)(ppc::PPCHIRBuilder& f, hir::Label* slow_path);
 #pragma pack(push, 1)
 class Export {
  public:
@@ -103,6 +119,7 @@ class Export {
   const char* const name;
   ExportTag::type tags;
   uint16_t ordinal;
+  ExportIntrinsic intrinsic = nullptr;
   // Type type;
 
   constexpr bool is_implemented() const {
@@ -154,6 +171,8 @@ class ExportResolver {
                           xe_kernel_export_shim_fn shim);
   void SetFunctionMapping(const std::string_view module_name, uint16_t ordinal,
                           ExportTrampoline trampoline);
+  void SetFunctionIntrinsic(const std::string_view module_name,
+                            uint16_t ordinal, ExportIntrinsic intrinsic);
 
  private:
   std::vector<Table> tables_;
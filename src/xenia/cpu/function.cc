@@ -10,6 +10,8 @@
 #include "xenia/cpu/function.h"
 
 #include "xenia/base/logging.h"
+#include "xenia/cpu/module.h"
+#include "xenia/cpu/processor.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
 
@@ -58,7 +60,7 @@ GuestFunction::GuestFunction(Module* module, uint32_t address)
   behavior_ = Behavior::kDefault;
 }
 
-GuestFunction::~GuestFunction() = default;
+GuestFunction::~GuestFunction() { delete source_map_.load(); }
 
 void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
   behavior_ = Behavior::kExtern;
@@ -66,11 +68,24 @@ void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
   export_data_ = export_data;
 }
 
+const std::vector<SourceMapEntry>& GuestFunction::source_map() const {
+  static const std::vector<SourceMapEntry> empty_source_map;
+  const SourceMap* source_map = source_map_.load(std::memory_order_acquire);
+  return source_map ? source_map->entries : empty_source_map;
+}
+
+std::unique_ptr<SourceMap> GuestFunction::PublishSourceMap(
+    std::unique_ptr<SourceMap> source_map) {
+  return std::unique_ptr<SourceMap>(
+      source_map_.exchange(source_map.release(), std::memory_order_acq_rel));
+}
+
 const SourceMapEntry* GuestFunction::LookupGuestAddress(
     uint32_t guest_address) const {
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
+  const auto& source_map = this->source_map();
+  for (size_t i = 0; i < source_map.size(); ++i) {
+    const auto& entry = source_map[i];
     if (entry.guest_address == guest_address) {
       return &entry;
     }
@@ -80,8 +95,9 @@ const SourceMapEntry* GuestFunction::LookupGuestAddress(
 
 const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
+  const auto& source_map = this->source_map();
+  for (size_t i = 0; i < source_map.size(); ++i) {
+    const auto& entry = source_map[i];
     if (entry.hir_offset >= offset) {
       return &entry;
     }
@@ -91,14 +107,19 @@ const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
 
 const SourceMapEntry* GuestFunction::LookupMachineCodeOffset(
     uint32_t offset) const {
+  return LookupMachineCodeOffset(source_map(), offset);
+}
+
+const SourceMapEntry* GuestFunction::LookupMachineCodeOffset(
+    const std::vector<SourceMapEntry>& source_map, uint32_t offset) {
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (int64_t i = source_map_.size() - 1; i >= 0; --i) {
-    const auto& entry = source_map_[i];
+  for (int64_t i = source_map.size() - 1; i >= 0; --i) {
+    const auto& entry = source_map[i];
     if (entry.code_offset <= offset) {
       return &entry;
     }
   }
-  return source_map_.empty() ? nullptr : &source_map_[0];
+  return source_map.empty() ? nullptr : &source_map[0];
 }
 
 uint32_t GuestFunction::MapGuestAddressToMachineCodeOffset(
@@ -109,22 +130,66 @@ uint32_t GuestFunction::MapGuestAddressToMachineCodeOffset(
 
 uintptr_t GuestFunction::MapGuestAddressToMachineCode(
     uint32_t guest_address) const {
-  auto entry = LookupGuestAddress(guest_address);
-
-  if (entry) {
-    return reinterpret_cast<uintptr_t>(machine_code()) + entry->code_offset;
-  } else {
+  // The code the offsets are relative to is published with the map.
+  const SourceMap* source_map = source_map_.load(std::memory_order_acquire);
+  if (!source_map) {
     return 0;
   }
+  for (const auto& entry : source_map->entries) {
+    if (entry.guest_address == guest_address) {
+      return source_map->code_address + entry.code_offset;
+    }
+  }
+  return 0;
 }
 
 uint32_t GuestFunction::MapMachineCodeToGuestAddress(
     uintptr_t host_address) const {
-  auto entry = LookupMachineCodeOffset(static_cast<uint32_t>(
-      host_address - reinterpret_cast<uintptr_t>(machine_code())));
+  // Replaced baseline code may still be running, but its source map is gone.
+  const SourceMap* source_map = source_map_.load(std::memory_order_acquire);
+  if (!source_map || host_address < source_map->code_address ||
+      host_address >= source_map->code_address + source_map->code_length) {
+    return address();
+  }
+  auto entry = LookupMachineCodeOffset(
+      source_map->entries,
+      static_cast<uint32_t>(host_address - source_map->code_address));
   return entry ? entry->guest_address : address();
 }
 
+uint32_t GuestFunction::MapInlinedAddress(uint32_t guest_address) const {
+  const SourceMap* source_map = source_map_.load(std::memory_order_acquire);
+  if (!source_map) {
+    return guest_address;
+  }
+  for (const auto& inlined_call : source_map->inlined_calls) {
+    if (guest_address >= inlined_call.callee_address &&
+        guest_address <= inlined_call.callee_end_address) {
+      return inlined_call.call_address;
+    }
+  }
+  return guest_address;
+}
+
+void GuestFunction::set_inlined_calls(
+    const std::vector<FunctionDebugInfo::InlinedCall>& value) {
+  inlined_calls_ = value;
+  if (!inlined_calls_.empty()) {
+    module()->processor()->AddInliningFunction(this);
+  }
+}
+
+bool GuestFunction::InlinesGuestCode(uint32_t low_address,
+                                     uint32_t high_address) const {
+  for (const auto& inlined_call : inlined_calls_) {
+    if (inlined_call.callee_address < high_address &&
+        inlined_call.callee_end_address >= low_address) {
+      return true;
+    }
+  }
+  return false;
+}
+
 bool GuestFunction::Call(ThreadState* thread_state, uint32_t return_address) {
   // SCOPE_profile_cpu_f("cpu");
 
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -33,6 +34,17 @@ struct SourceMapEntry {
 };
 enum class SaveRestoreType : uint8_t { NONE, GPR, VMX, FPR };
 
+// Source map of one translation of a function. Never modified once published,
+// as it's read by other threads (exception handling, stack walking) while the
+// function may be retranslated.
+struct SourceMap {
+  uintptr_t code_address = 0;
+  size_t code_length = 0;
+  std::vector<SourceMapEntry> entries;
+  // Callees emitted in place of calls, kept regardless of debug info.
+  std::vector<FunctionDebugInfo::InlinedCall> inlined_calls;
+};
+
 class Function : public Symbol {
  public:
   enum class Behavior : uint8_t {
@@ -135,12 +147,61 @@ class GuestFunction : public Function {
     debug_info_ = std::move(debug_info);
   }
   FunctionTraceData& trace_data() { return trace_data_; }
-  std::vector<SourceMapEntry>& source_map() { return source_map_; }
+  // Of the current machine code.
+  const std::vector<SourceMapEntry>& source_map() const;
+  // Makes source_map the one of the current machine code, returning the
+  // replaced one. That may still be in use by other threads, so it must be
+  // kept until its machine code can't be running anymore.
+  std::unique_ptr<SourceMap> PublishSourceMap(
+      std::unique_ptr<SourceMap> source_map);
 
   ExternHandler extern_handler() const { return extern_handler_; }
   Export* export_data() const { return export_data_; }
   void SetupExtern(ExternHandler handler, Export* export_data = nullptr);
 
+  // How thoroughly the current machine code has been optimized, see
+  // tiered_compilation.
+  enum class Tier : uint32_t {
+    // Translated with the reduced pass list, counting down calls.
+    kBaseline,
+    // Baseline code, queued for retranslation with the full pass list.
+    kOptimizing,
+    // Translated with the full pass list, never replaced.
+    kOptimized,
+  };
+  Tier tier() const { return tier_; }
+  void set_tier(Tier tier) { tier_ = tier; }
+  // Moves baseline code to kOptimizing, false if another thread did already.
+  bool BeginOptimization() {
+    Tier expected = Tier::kBaseline;
+    return tier_.compare_exchange_strong(expected, Tier::kOptimizing);
+  }
+  // Moves kOptimizing code back to kBaseline if it couldn't be retranslated,
+  // so it's requested again once it's been called enough.
+  void AbortOptimization() {
+    Tier expected = Tier::kOptimizing;
+    if (tier_.compare_exchange_strong(expected, Tier::kBaseline)) {
+      RestartTierUpCountdown();
+    }
+  }
+
+  // Bumped with the global lock held whenever the guest code of the function
+  // may have been written to (see invalidate_written_code). Translations
+  // started in an older generation are discarded instead of being published.
+  uint32_t code_generation() const { return code_generation_; }
+  void InvalidateCode() { ++code_generation_; }
+
+  // Callees emitted into the current code, which must be invalidated too when
+  // their guest code is written to. Guarded by the global lock.
+  const std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls() const {
+    return inlined_calls_;
+  }
+  // Also makes the processor find the function by its inlined callees, see
+  // Processor::AddInliningFunction.
+  void set_inlined_calls(
+      const std::vector<FunctionDebugInfo::InlinedCall>& value);
+  bool InlinesGuestCode(uint32_t low_address, uint32_t high_address) const;
+
   const SourceMapEntry* LookupGuestAddress(uint32_t guest_address) const;
   const SourceMapEntry* LookupHIROffset(uint32_t offset) const;
   const SourceMapEntry* LookupMachineCodeOffset(uint32_t offset) const;
@@ -148,18 +209,29 @@ class GuestFunction : public Function {
   uint32_t MapGuestAddressToMachineCodeOffset(uint32_t guest_address) const;
   uintptr_t MapGuestAddressToMachineCode(uint32_t guest_address) const;
   uint32_t MapMachineCodeToGuestAddress(uintptr_t host_address) const;
+  // Source map entries of inlined code have the callee addresses. Maps them
+  // back to the call in the current code, leaving other addresses as they are.
+  uint32_t MapInlinedAddress(uint32_t guest_address) const;
 
   bool Call(ThreadState* thread_state, uint32_t return_address) override;
 
  protected:
   virtual bool CallImpl(ThreadState* thread_state, uint32_t return_address) = 0;
+  // Restarts counting down calls of baseline code, see tiered_compilation.
+  virtual void RestartTierUpCountdown() {}
+
+  static const SourceMapEntry* LookupMachineCodeOffset(
+      const std::vector<SourceMapEntry>& source_map, uint32_t offset);
 
  protected:
   std::unique_ptr<FunctionDebugInfo> debug_info_;
   FunctionTraceData trace_data_;
-  std::vector<SourceMapEntry> source_map_;
+  std::atomic<SourceMap*> source_map_ = {nullptr};
   ExternHandler extern_handler_ = nullptr;
   Export* export_data_ = nullptr;
+  std::atomic<Tier> tier_ = {Tier::kOptimized};
+  std::atomic<uint32_t> code_generation_ = {0};
+  std::vector<FunctionDebugInfo::InlinedCall> inlined_calls_;
 };
 
 }  // namespace cpu
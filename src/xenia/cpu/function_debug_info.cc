@@ -43,6 +43,10 @@ void FunctionDebugInfo::Dump() {
   if (machine_code_disasm_) {
     XELOGD("Machine Code:\n{}\n", machine_code_disasm_);
   }
+  for (auto& inlined_call : inlined_calls_) {
+    XELOGD("Inlined {:08X}-{:08X} at {:08X}", inlined_call.callee_address,
+           inlined_call.callee_end_address, inlined_call.call_address);
+  }
 }
 
 }  // namespace cpu
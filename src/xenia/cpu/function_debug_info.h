@@ -12,6 +12,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 namespace xe {
 namespace cpu {
@@ -40,6 +41,14 @@ enum DebugInfoFlags : uint32_t {
 // disassembly data.
 class FunctionDebugInfo {
  public:
+  // A leaf function, or a save/restore helper, emitted in place of the
+  // branch to it at call_address.
+  struct InlinedCall {
+    uint32_t call_address;
+    uint32_t callee_address;
+    uint32_t callee_end_address;
+  };
+
   FunctionDebugInfo();
   ~FunctionDebugInfo();
 
@@ -63,6 +72,13 @@ class FunctionDebugInfo {
   const char* machine_code_disasm() const { return machine_code_disasm_; }
   void set_machine_code_disasm(char* value) { machine_code_disasm_ = value; }
 
+  const std::vector<InlinedCall>& inlined_calls() const {
+    return inlined_calls_;
+  }
+  void set_inlined_calls(const std::vector<InlinedCall>& value) {
+    inlined_calls_ = value;
+  }
+
   void Dump();
 
  private:
@@ -73,6 +89,7 @@ class FunctionDebugInfo {
   char* raw_hir_disasm_;
   char* hir_disasm_;
   char* machine_code_disasm_;
+  std::vector<InlinedCall> inlined_calls_;
 };
 
 }  // namespace cpu
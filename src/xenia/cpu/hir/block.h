@@ -12,10 +12,6 @@
 
 #include "xenia/base/arena.h"
 
-namespace llvm {
-class BitVector;
-}  // namespace llvm
-
 namespace xe {
 namespace cpu {
 namespace hir {
@@ -53,7 +49,6 @@ class Block {
 
   Edge* incoming_edge_head;
   Edge* outgoing_edge_head;
-  llvm::BitVector* incoming_values;
 
   Label* label_head;
   Label* label_tail;
@@ -62,6 +57,8 @@ class Block {
   Instr* instr_tail;
 
   uint16_t ordinal;
+  // Number of loops containing the block, set by LoopAnalysisPass.
+  uint16_t loop_depth;
 
   void AssertNoCycles();
 };
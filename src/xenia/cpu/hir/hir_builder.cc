@@ -429,7 +429,7 @@ void HIRBuilder::InsertLabel(Label* label, Instr* prev_instr) {
 
   Block* new_block = arena_->Alloc<Block>();
   new_block->ordinal = UINT16_MAX;
-  new_block->incoming_values = nullptr;
+  new_block->loop_depth = 0;
   new_block->arena = arena_;
   new_block->prev = prev_block;
   new_block->next = next_block;
@@ -674,7 +674,7 @@ void HIRBuilder::MergeAdjacentBlocks(Block* left, Block* right) {
 Block* HIRBuilder::AppendBlock() {
   Block* block = arena_->Alloc<Block>();
   block->ordinal = UINT16_MAX;
-  block->incoming_values = nullptr;
+  block->loop_depth = 0;
   block->arena = arena_;
   block->next = NULL;
   block->prev = block_tail_;
@@ -1354,7 +1354,9 @@ void HIRBuilder::CacheControl(Value* address, size_t cache_line_size,
   i->src3.value = NULL;
 }
 
-void HIRBuilder::MemoryBarrier() { AppendInstr(OPCODE_MEMORY_BARRIER_info, 0); }
+void HIRBuilder::MemoryBarrier(uint32_t barrier_type) {
+  AppendInstr(OPCODE_MEMORY_BARRIER_info, barrier_type);
+}
 
 void HIRBuilder::DelayExecution() {
   AppendInstr(OPCODE_DELAY_EXECUTION_info, 0);
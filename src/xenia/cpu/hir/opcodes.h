@@ -39,6 +39,16 @@ enum LoadStoreFlags {
   LOAD_STORE_BYTE_SWAP = 1 << 0,
 };
 
+enum MemoryBarrierType {
+  // sync, orders all accesses.
+  MEMORY_BARRIER_FULL = 0,
+  // lwsync and eieio, order all but stores followed by loads.
+  MEMORY_BARRIER_LIGHTWEIGHT,
+  // Only keeps accesses from being moved across it, where the host already
+  // provides the ordering, see MemoryBarrierRelaxationPass.
+  MEMORY_BARRIER_COMPILER,
+};
+
 enum CacheControlType {
   CACHE_CONTROL_TYPE_DATA_TOUCH,
   CACHE_CONTROL_TYPE_DATA_TOUCH_FOR_STORE,
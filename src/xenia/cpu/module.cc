@@ -131,7 +131,14 @@ Symbol::Status Module::DefineSymbol(Symbol* symbol) {
       xe::threading::Sleep(std::chrono::microseconds(100));
       global_lock.lock();
     } while (symbol->status() == Symbol::Status::kDefining);
-    status = symbol->status();
+    if (symbol->status() == Symbol::Status::kDeclared) {
+      // Its guest code was written to while it was being retranslated, see
+      // Processor::OptimizeFunction.
+      symbol->set_status(Symbol::Status::kDefining);
+      status = Symbol::Status::kNew;
+    } else {
+      status = symbol->status();
+    }
   } else {
     status = symbol->status();
   }
@@ -31,12 +31,18 @@ class Module {
   explicit Module(Processor* processor);
   virtual ~Module();
 
+  Processor* processor() const { return processor_; }
   Memory* memory() const { return memory_; }
 
   virtual const std::string& name() const = 0;
   virtual bool is_executable() const = 0;
 
   virtual bool ContainsAddress(uint32_t address);
+  // The single range [low, high) ContainsAddress is true for, which Processor
+  // indexes modules by. False if there's no such range (yet).
+  virtual bool GetAddressRange(uint32_t* out_low, uint32_t* out_high) {
+    return false;
+  }
 
   Symbol* LookupSymbol(uint32_t address, bool wait = true);
   virtual Symbol::Status DeclareFunction(uint32_t address,
@@ -38,6 +38,27 @@ int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
                      bool expect_true = true, bool nia_is_lr = false) {
   uint32_t call_flags = 0;
 
+  // Unconditional calls to small leaf functions and to kernel exports with
+  // intrinsics may be emitted in place.
+  if (lk && !cond && nia->IsConstant() &&
+      (f.EmitExportIntrinsic(static_cast<uint32_t>(cia),
+                             static_cast<uint32_t>(nia->AsUint64())) ||
+       f.EmitInlinedCall(static_cast<uint32_t>(cia),
+                         static_cast<uint32_t>(nia->AsUint64())))) {
+    return 0;
+  }
+  // Stack save/restore helpers are lowered to their stores and loads.
+  if (!cond && nia->IsConstant() &&
+      f.EmitSaveRestoreCall(static_cast<uint32_t>(cia),
+                            static_cast<uint32_t>(nia->AsUint64()), lk)) {
+    if (lk) {
+      return 0;
+    }
+    // __restgprlr ends in a blr to the restored LR.
+    return InstrEmit_branch(f, src, cia, f.LoadLR(), false, nullptr, true,
+                            true);
+  }
+
   // TODO(benvanik): this may be wrong and overwrite LRs when not desired!
   // The docs say always, though...
   // Note that we do the update before we branch/call as we need it to
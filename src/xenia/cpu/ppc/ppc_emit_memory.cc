@@ -747,12 +747,14 @@ int InstrEmit_stswx(PPCHIRBuilder& f, const InstrData& i) {
 // Memory synchronization (A-18)
 
 int InstrEmit_eieio(PPCHIRBuilder& f, const InstrData& i) {
-  f.MemoryBarrier();
+  f.MemoryBarrier(MEMORY_BARRIER_LIGHTWEIGHT);
   return 0;
 }
 
 int InstrEmit_sync(PPCHIRBuilder& f, const InstrData& i) {
-  f.MemoryBarrier();
+  // L = 1 is lwsync.
+  f.MemoryBarrier((i.X.RT & 3) == 1 ? MEMORY_BARRIER_LIGHTWEIGHT
+                                    : MEMORY_BARRIER_FULL);
   return 0;
 }
 
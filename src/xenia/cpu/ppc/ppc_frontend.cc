@@ -121,9 +121,25 @@ bool PPCFrontend::DeclareFunction(GuestFunction* function) {
 }
 
 bool PPCFrontend::DefineFunction(GuestFunction* function,
-                                 uint32_t debug_info_flags) {
+                                 uint32_t debug_info_flags,
+                                 uint32_t code_generation) {
+  // Debug info is only produced by translation, so don't bypass it then.
+  if (!debug_info_flags && processor_->backend()->RestoreGuestFunction(
+                               function, code_generation)) {
+    return true;
+  }
+  auto translator = translator_pool_.Allocate(this);
+  bool result =
+      translator->Translate(function, debug_info_flags, code_generation);
+  translator->Reset();
+  translator_pool_.Release(translator);
+  return result;
+}
+
+bool PPCFrontend::OptimizeFunction(GuestFunction* function,
+                                   uint32_t code_generation) {
   auto translator = translator_pool_.Allocate(this);
-  bool result = translator->Translate(function, debug_info_flags);
+  bool result = translator->Translate(function, 0, code_generation);
   translator->Reset();
   translator_pool_.Release(translator);
   return result;
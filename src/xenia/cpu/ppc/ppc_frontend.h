@@ -48,7 +48,12 @@ class PPCFrontend {
   PPCBuiltins* builtins() { return &builtins_; }
 
   bool DeclareFunction(GuestFunction* function);
-  bool DefineFunction(GuestFunction* function, uint32_t debug_info_flags);
+  // Both fail if the guest code was written to since code_generation, see
+  // GuestFunction::code_generation.
+  bool DefineFunction(GuestFunction* function, uint32_t debug_info_flags,
+                      uint32_t code_generation);
+  // Replaces the baseline code of a defined function, see tiered_compilation.
+  bool OptimizeFunction(GuestFunction* function, uint32_t code_generation);
 
  private:
   Processor* processor_;
@@ -14,6 +14,7 @@
 
 #include "third_party/fmt/include/fmt/format.h"
 
+#include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/cvar.h"
 #include "xenia/base/logging.h"
@@ -21,6 +22,7 @@
 #include "xenia/base/profiling.h"
 #include "xenia/base/string.h"
 #include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/hir/label.h"
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
@@ -33,6 +35,19 @@ DEFINE_bool(
     "Break to the host debugger (or crash if no debugger attached) if an "
     "unimplemented PowerPC instruction is encountered.",
     "CPU");
+DEFINE_uint32(inline_leaf_max_instructions, 8,
+              "Maximum size, including the blr, of leaf functions emitted in "
+              "place of calls to them. 0 to disable.",
+              "CPU");
+DEFINE_bool(inline_export_intrinsics, true,
+            "Emit the fast paths of frequently called kernel exports, such as "
+            "critical sections, in place of calls to their import thunks.",
+            "CPU");
+DEFINE_bool(inline_save_restore_helpers, true,
+            "Emit the register stores and loads of the __savegprlr, "
+            "__restgprlr, __savefpr, __restfpr, __savevmx and __restvmx "
+            "helpers in place of calls to them.",
+            "CPU");
 
 namespace xe {
 namespace cpu {
@@ -79,6 +94,8 @@ void PPCHIRBuilder::Reset() {
   instr_offset_list_ = NULL;
   label_list_ = NULL;
   with_debug_info_ = false;
+  inline_leaf_calls_ = false;
+  inlined_calls_.clear();
   HIRBuilder::Reset();
 }
 
@@ -96,6 +113,8 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   instr_count_ = (function_->end_address() - function_->address()) / 4 + 1;
 
   with_debug_info_ = (flags & EMIT_DEBUG_COMMENTS) == EMIT_DEBUG_COMMENTS;
+  inline_leaf_calls_ =
+      (flags & EMIT_INLINE_LEAF_CALLS) == EMIT_INLINE_LEAF_CALLS;
   if (with_debug_info_) {
     CommentFormat("{} fn {:08X}-{:08X} {}", function_->module()->name().c_str(),
                   function_->address(), function_->end_address(),
@@ -125,7 +144,6 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
     uint32_t code =
         xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
     auto opcode = LookupOpcode(code);
-    auto& opcode_info = GetOpcodeInfo(opcode);
 
     // Mark label, if we were assigned one earlier on in the walk.
     // We may still get a label, but it'll be inserted by LookupLabel
@@ -163,40 +181,257 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
       // TraceInvalidInstruction(i);
       continue;
     }
-    ++opcode_translation_counts[static_cast<int>(opcode)];
+    EmitInstr(address, code, opcode);
+  }
+
+  if (false) {
+    DumpAllOpcodeCounts();
+  }
+
+  return Finalize();
+}
 
-    // Synchronize the PPC context as required.
-    // This will ensure all registers are saved to the PPC context before this
-    // instruction executes.
-    if (opcode_info.type == PPCOpcodeType::kSync) {
-      ContextBarrier();
+void PPCHIRBuilder::EmitInstr(uint32_t address, uint32_t code,
+                              PPCOpcode opcode) {
+  auto& opcode_info = GetOpcodeInfo(opcode);
+  ++opcode_translation_counts[static_cast<int>(opcode)];
+
+  // Synchronize the PPC context as required.
+  // This will ensure all registers are saved to the PPC context before this
+  // instruction executes.
+  if (opcode_info.type == PPCOpcodeType::kSync) {
+    ContextBarrier();
+  }
+
+  MaybeBreakOnInstruction(address);
+
+  InstrData i;
+  i.address = address;
+  i.code = code;
+  i.opcode = opcode;
+  i.opcode_info = &opcode_info;
+  if (!opcode_info.emit || opcode_info.emit(*this, i)) {
+    auto& disasm_info = GetOpcodeDisasmInfo(opcode);
+    XELOGE(
+        "Unimplemented instr {:08X} {:08X} {} - report the game to Xenia "
+        "developers; to skip, disable break_on_unimplemented_instructions",
+        address, code, disasm_info.name);
+    Comment("UNIMPLEMENTED!");
+    if (cvars::break_on_unimplemented_instructions) {
+      DebugBreak();
     }
+  }
+}
 
-    MaybeBreakOnInstruction(address);
-
-    InstrData i;
-    i.address = address;
-    i.code = code;
-    i.opcode = opcode;
-    i.opcode_info = &opcode_info;
-    if (!opcode_info.emit || opcode_info.emit(*this, i)) {
-      auto& disasm_info = GetOpcodeDisasmInfo(opcode);
-      XELOGE(
-          "Unimplemented instr {:08X} {:08X} {} - report the game to Xenia "
-          "developers; to skip, disable break_on_unimplemented_instructions",
-          address, code, disasm_info.name);
-      Comment("UNIMPLEMENTED!");
-      if (cvars::break_on_unimplemented_instructions) {
-        DebugBreak();
+bool PPCHIRBuilder::EmitInlinedCall(uint32_t call_address,
+                                    uint32_t target_address) {
+  if (!inline_leaf_calls_ || !cvars::inline_leaf_max_instructions ||
+      (target_address >= function_->address() &&
+       target_address <= function_->end_address())) {
+    // Disabled, or a branch within the function (including recursion).
+    return false;
+  }
+  // Only functions the scanner has found the extents of.
+  auto callee = LookupFunction(target_address);
+  if (!callee || !callee->is_guest() ||
+      callee->behavior() != Function::Behavior::kDefault ||
+      !callee->has_end_address() ||
+      static_cast<GuestFunction*>(callee)->extern_handler()) {
+    return false;
+  }
+  uint32_t end_address = callee->end_address();
+  if (end_address < target_address ||
+      (end_address - target_address) / 4 + 1 >
+          cvars::inline_leaf_max_instructions) {
+    return false;
+  }
+
+  // Writes to the callee must invalidate this function too (see
+  // GuestFunction::inlined_calls), so its code is watched before it's read.
+  frontend_->processor()->WatchGuestCode(target_address, end_address);
+
+  // A straight run of instructions ending in a plain blr. Branches, traps and
+  // syscalls need the callee's own frame, and moving LR would make the blr
+  // return somewhere else.
+  Memory* memory = frontend_->memory();
+  for (uint32_t address = target_address; address <= end_address;
+       address += 4) {
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    if (address == end_address) {
+      if (code != 0x4E800020) {
+        return false;
       }
+      break;
+    }
+    auto opcode = LookupOpcode(code);
+    if (opcode == PPCOpcode::kInvalid) {
+      return false;
+    }
+    auto& opcode_info = GetOpcodeInfo(opcode);
+    if (!opcode_info.emit || opcode_info.group == PPCOpcodeGroup::kB ||
+        opcode == PPCOpcode::mtspr || opcode == PPCOpcode::mtmsr ||
+        opcode == PPCOpcode::mtmsrd) {
+      return false;
     }
   }
 
-  if (false) {
-    DumpAllOpcodeCounts();
+  if (with_debug_info_) {
+    CommentFormat("inlined {:08X}-{:08X} {}", target_address, end_address,
+                  callee->name().c_str());
+  }
+  // LR is still set by the bl, the blr just falls through.
+  StoreLR(LoadConstantUint64(uint64_t(call_address) + 4));
+  for (uint32_t address = target_address; address < end_address;
+       address += 4) {
+    trace_info_.dest_count = 0;
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    if (with_debug_info_) {
+      comment_buffer_.Reset();
+      comment_buffer_.AppendFormat("{:08X} {:08X} ", address, code);
+      DisasmPPC(address, code, &comment_buffer_);
+      Comment(comment_buffer_);
+    }
+    // Callee addresses, so that faults (such as MMIO accesses) are attributed
+    // to the right instruction. See GuestFunction::MapInlinedAddress.
+    SourceOffset(address);
+    EmitInstr(address, code, LookupOpcode(code));
+  }
+  inlined_calls_.push_back({call_address, target_address, end_address});
+  return true;
+}
+
+bool PPCHIRBuilder::EmitExportIntrinsic(uint32_t call_address,
+                                        uint32_t target_address) {
+  if (!cvars::inline_export_intrinsics) {
+    return false;
+  }
+  auto callee = LookupFunction(target_address);
+  if (!callee || callee->behavior() != Function::Behavior::kExtern) {
+    return false;
+  }
+  auto export_data = static_cast<GuestFunction*>(callee)->export_data();
+  if (!export_data || !export_data->intrinsic) {
+    return false;
   }
 
-  return Finalize();
+  if (with_debug_info_) {
+    CommentFormat("intrinsic {}", export_data->name);
+  }
+  // LR is set by the bl on both paths.
+  Value* return_address = LoadConstantUint64(uint64_t(call_address) + 4);
+  StoreLR(return_address);
+  auto slow_path = NewLabel();
+  auto end = NewLabel();
+  export_data->intrinsic(*this, slow_path);
+  Branch(end);
+  MarkLabel(slow_path);
+  SetReturnAddress(return_address);
+  Call(callee);
+  MarkLabel(end);
+  return true;
+}
+
+bool PPCHIRBuilder::EmitSaveRestoreCall(uint32_t call_address,
+                                        uint32_t target_address, bool lk) {
+  if (!cvars::inline_save_restore_helpers ||
+      (target_address >= function_->address() &&
+       target_address <= function_->end_address())) {
+    return false;
+  }
+  auto callee = LookupFunction(target_address);
+  if (!callee || !callee->IsSaverest()) {
+    return false;
+  }
+  uint32_t first = callee->SaverestIndex();
+  bool is_restore = callee->IsRestore();
+  // __restgprlr is branched to and returns to the caller of the function, the
+  // others are called with bl.
+  bool is_tail = callee->SaverestType() == SaveRestoreType::GPR && is_restore;
+  if (lk == is_tail) {
+    return false;
+  }
+  // The VMX helpers are runs of two instructions per register up to a shared
+  // blr, without end addresses of their own.
+  uint32_t end_address =
+      callee->SaverestType() == SaveRestoreType::VMX
+          ? target_address + 8 * ((first < 64 ? 32 : 128) - first)
+          : callee->end_address();
+  if (end_address < target_address) {
+    return false;
+  }
+  // The lowering stands for the helper's code, so writes to it must
+  // invalidate this function like those to inlined leaf calls.
+  frontend_->processor()->WatchGuestCode(target_address, end_address);
+
+  if (with_debug_info_) {
+    CommentFormat("saverest {}", callee->name().c_str());
+  }
+  switch (callee->SaverestType()) {
+    case SaveRestoreType::GPR: {
+      // rN to r31 at r1 - 8 * (32 - N) - 8, LR in r12 at r1 - 8.
+      Value* sp = LoadGPR(1);
+      for (uint32_t n = first; n <= 31; ++n) {
+        Value* offset = LoadConstantInt64(-int64_t(8 * (32 - n) + 8));
+        if (is_restore) {
+          StoreGPR(n, ByteSwap(LoadOffset(sp, offset, INT64_TYPE)));
+        } else {
+          StoreOffset(sp, offset, ByteSwap(LoadGPR(n)));
+        }
+      }
+      Value* lr_offset = LoadConstantInt64(-8);
+      if (is_restore) {
+        Value* lr = ZeroExtend(
+            ByteSwap(LoadOffset(sp, lr_offset, INT32_TYPE)), INT64_TYPE);
+        StoreGPR(12, lr);
+        StoreLR(lr);
+      } else {
+        StoreOffset(sp, lr_offset,
+                    ByteSwap(Truncate(LoadGPR(12), INT32_TYPE)));
+      }
+      break;
+    }
+    case SaveRestoreType::FPR: {
+      // fN to f31 at r12 - 8 * (32 - N).
+      Value* base = LoadGPR(12);
+      for (uint32_t n = first; n <= 31; ++n) {
+        Value* ea = Add(base, LoadConstantInt64(-int64_t(8 * (32 - n))));
+        if (is_restore) {
+          StoreFPR(n, Cast(ByteSwap(Load(ea, INT64_TYPE)), FLOAT64_TYPE));
+        } else {
+          Store(ea, ByteSwap(Cast(LoadFPR(n), INT64_TYPE)));
+        }
+      }
+      break;
+    }
+    case SaveRestoreType::VMX: {
+      // vN to v31 (or v127) at r12 - 16 * (32 (or 128) - N) through r11,
+      // which is left at -16.
+      uint32_t last = first < 64 ? 31 : 127;
+      Value* base = LoadGPR(12);
+      for (uint32_t n = first; n <= last; ++n) {
+        Value* offset = LoadConstantInt64(-int64_t(16 * (last + 1 - n)));
+        Value* ea = And(Add(base, offset), LoadConstantUint64(~0xFull));
+        if (is_restore) {
+          StoreVR(n, ByteSwap(Load(ea, VEC128_TYPE)));
+        } else {
+          Store(ea, ByteSwap(LoadVR(n)));
+        }
+      }
+      StoreGPR(11, LoadConstantInt64(-16));
+      break;
+    }
+    default:
+      assert_unhandled_case(callee->SaverestType());
+      return false;
+  }
+  if (lk) {
+    // The helper's blr returns here.
+    StoreLR(LoadConstantUint64(uint64_t(call_address) + 4));
+  }
+  inlined_calls_.push_back({call_address, target_address, end_address});
+  return true;
 }
 
 void PPCHIRBuilder::MaybeBreakOnInstruction(uint32_t address) {
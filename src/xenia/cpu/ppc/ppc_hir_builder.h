@@ -10,9 +10,12 @@
 #ifndef XENIA_CPU_PPC_PPC_HIR_BUILDER_H_
 #define XENIA_CPU_PPC_PPC_HIR_BUILDER_H_
 
+#include <vector>
+
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/hir/hir_builder.h"
+#include "xenia/cpu/ppc/ppc_opcode.h"
 
 namespace xe {
 namespace cpu {
@@ -37,12 +40,32 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   enum EmitFlags {
     // Emit comment nodes.
     EMIT_DEBUG_COMMENTS = 1 << 0,
+    // Emit small leaf functions in place of calls to them.
+    EMIT_INLINE_LEAF_CALLS = 1 << 1,
   };
   bool Emit(GuestFunction* function, uint32_t flags);
+  // Calls whose callees the last Emit emitted in place.
+  const std::vector<FunctionDebugInfo::InlinedCall>& inlined_calls() const {
+    return inlined_calls_;
+  }
 
   GuestFunction* function() const { return function_; }
   Function* LookupFunction(uint32_t address);
   Label* LookupLabel(uint32_t address);
+  // Emits the body of the function at target_address for a bl at
+  // call_address, if it's a small leaf function and inlining is enabled.
+  // Returns false if the call must be emitted instead.
+  bool EmitInlinedCall(uint32_t call_address, uint32_t target_address);
+  // Emits the fast path of the kernel export imported through the thunk at
+  // target_address for a bl at call_address, falling back to the call, if the
+  // export has an intrinsic. Returns false if the call must be emitted instead.
+  bool EmitExportIntrinsic(uint32_t call_address, uint32_t target_address);
+  // Emits the register stores or loads of the __savegprlr/__restgprlr,
+  // __savefpr/__restfpr or __savevmx/__restvmx helper at target_address for a
+  // branch at call_address. After a __restgprlr the caller still has to
+  // return through LR. Returns false if the branch must be emitted instead.
+  bool EmitSaveRestoreCall(uint32_t call_address, uint32_t target_address,
+                           bool lk);
 
   Value* LoadLR();
   void StoreLR(Value* value);
@@ -85,6 +108,7 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   void SetReturnAddress(Value* value);
 
  private:
+  void EmitInstr(uint32_t address, uint32_t code, PPCOpcode opcode);
   void MaybeBreakOnInstruction(uint32_t address);
   void AnnotateLabel(uint32_t address, Label* label);
 
@@ -95,6 +119,8 @@ class PPCHIRBuilder : public hir::HIRBuilder {
 
   // Reset each Emit:
   bool with_debug_info_;
+  bool inline_leaf_calls_;
+  std::vector<FunctionDebugInfo::InlinedCall> inlined_calls_;
   GuestFunction* function_;
   uint64_t start_address_;
   uint64_t instr_count_;
@@ -11,7 +11,9 @@
 
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/cvar.h"
+#include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
@@ -41,7 +43,8 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
 
   scanner_.reset(new PPCScanner(frontend));
   builder_.reset(new PPCHIRBuilder(frontend));
-  compiler_.reset(new Compiler(frontend->processor()));
+  compiler_.reset(new Compiler(frontend->processor(), "optimizing"));
+  baseline_compiler_.reset(new Compiler(frontend->processor(), "baseline"));
   assembler_ = backend->CreateAssembler();
   assembler_->Initialize();
 
@@ -55,7 +58,9 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   // Passes are executed in the order they are added. Multiple of the same
   // pass type may be used.
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
+  // Values can only live across blocks with the global register allocator.
+  compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>(
+      cvars::global_register_allocation));
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   // Grouped simplification + constant propagation.
@@ -65,7 +70,24 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
   sap->AddPass(std::make_unique<passes::ConstantPropagationPass>());
   if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
+  sap->AddPass(std::make_unique<passes::ConditionalConstantPropagationPass>());
+  if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::move(sap));
+  // Resolved branches and removed blocks may have left blocks to merge.
+  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+  compiler_->AddPass(std::make_unique<passes::ControlFlowSimplificationPass>());
+  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  if (cvars::global_register_allocation) {
+    // Hoisted values live across blocks.
+    compiler_->AddPass(
+        std::make_unique<passes::LoopInvariantCodeMotionPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+
+  // Runs after constant propagation has made shuffle controls constant.
+  compiler_->AddPass(std::make_unique<passes::PermuteCombinationPass>());
+  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   if (backend->machine_info()->supports_extended_load_store) {
     // Backend supports the advanced LOAD/STORE instructions.
@@ -83,6 +105,13 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
+  // After anything that removes memory accesses, as it looks at the ones left.
+  if (backend->machine_info()->total_store_order) {
+    compiler_->AddPass(std::make_unique<passes::MemoryBarrierRelaxationPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+
   //// Removes all unneeded variables. Try not to add new ones after this.
   // compiler_->AddPass(new passes::ValueReductionPass());
   // if (validate) compiler_->AddPass(new passes::ValidationPass());
@@ -91,12 +120,50 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
   // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      backend->machine_info()));
+  if (cvars::global_register_allocation) {
+    // Spill costs are weighted by loop depth.
+    compiler_->AddPass(std::make_unique<passes::LoopAnalysisPass>());
+    compiler_->AddPass(std::make_unique<passes::GlobalRegisterAllocationPass>(
+        backend->machine_info()));
+  } else {
+    compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+        backend->machine_info()));
+  }
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  // Baseline passes for functions that may never get hot, see
+  // tiered_compilation. Only a single round of constant propagation after
+  // context promotion, so the backend doesn't have to deal with unfolded
+  // constant operations more than it does already.
+  baseline_compiler_->AddPass(
+      std::make_unique<passes::ControlFlowAnalysisPass>());
+  if (validate)
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  baseline_compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
+  if (validate)
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  baseline_compiler_->AddPass(
+      std::make_unique<passes::ConstantPropagationPass>());
+  if (validate)
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  baseline_compiler_->AddPass(
+      std::make_unique<passes::DeadCodeEliminationPass>());
+  if (validate)
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  if (backend->machine_info()->total_store_order) {
+    baseline_compiler_->AddPass(
+        std::make_unique<passes::MemoryBarrierRelaxationPass>());
+    if (validate)
+      baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+      backend->machine_info()));
+  if (validate)
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  baseline_compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
 }
 
 PPCTranslator::~PPCTranslator() = default;
@@ -151,12 +218,19 @@ void PPCTranslator::DumpHIR(GuestFunction* function, PPCHIRBuilder* builder) {
   }
 }
 bool PPCTranslator::Translate(GuestFunction* function,
-                              uint32_t debug_info_flags) {
+                              uint32_t debug_info_flags,
+                              uint32_t code_generation) {
   SCOPE_profile_cpu_f("cpu");
+  bool gather_statistics = compiler::CompilerStatistics::is_enabled();
+  uint64_t start_ticks =
+      gather_statistics ? Clock::QueryHostTickCount() : uint64_t(0);
+  size_t start_arena_chunk_allocations =
+      gather_statistics ? CountArenaChunkAllocations() : size_t(0);
   HirBuilderScope hir_build_scope{builder_.get()};
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
@@ -176,14 +250,36 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (cvars::trace_function_data) {
     debug_info_flags |= DebugInfoFlags::kDebugInfoTraceFunctionData;
   }
+  // Functions are first translated quickly, and retranslated with all the
+  // passes once their baseline code has been called enough. Debug info must
+  // match the code being run, so it always gets the full translation.
+  bool baseline = cvars::tiered_compilation && !debug_info_flags &&
+                  !function->extern_handler() &&
+                  function->tier() != GuestFunction::Tier::kOptimizing;
+
   std::unique_ptr<FunctionDebugInfo> debug_info;
   if (debug_info_flags) {
     debug_info.reset(new FunctionDebugInfo());
   }
 
-  // Scan the function to find its extents and gather debug data.
-  if (!scanner_->Scan(function, debug_info.get())) {
-    return false;
+  // Scan the function to find its extents and gather debug data. Writes must
+  // invalidate the translation from before the code is first read, so scan
+  // again while the extents reach pages that weren't watched yet.
+  Processor* processor = frontend_->processor();
+  uint32_t page_size = uint32_t(xe::memory::page_size());
+  uint32_t watched_end_address =
+      xe::round_up(function->address() + 4, page_size) - 4;
+  processor->WatchGuestCode(function->address(), watched_end_address);
+  while (true) {
+    if (!scanner_->Scan(function, debug_info.get())) {
+      return false;
+    }
+    if (function->end_address() <= watched_end_address) {
+      break;
+    }
+    watched_end_address =
+        xe::round_up(function->end_address() + 4, page_size) - 4;
+    processor->WatchGuestCode(function->address(), watched_end_address);
   }
 
   // Setup trace data, if needed.
@@ -219,9 +315,18 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (debug_info) {
     emit_flags |= PPCHIRBuilder::EMIT_DEBUG_COMMENTS;
   }
+  // Inlined code can't be stepped into, and coverage is counted per
+  // instruction of the function itself.
+  if (!baseline && !cvars::debug &&
+      !(debug_info_flags & DebugInfoFlags::kDebugInfoTraceFunctions)) {
+    emit_flags |= PPCHIRBuilder::EMIT_INLINE_LEAF_CALLS;
+  }
   if (!builder_->Emit(function, emit_flags)) {
     return false;
   }
+  if (debug_info) {
+    debug_info->set_inlined_calls(builder_->inlined_calls());
+  }
 
   // Stash raw HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmRawHir) {
@@ -231,9 +336,15 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  Compiler* compiler = baseline ? baseline_compiler_.get() : compiler_.get();
+  uint64_t compile_start_ticks =
+      gather_statistics ? Clock::QueryHostTickCount() : uint64_t(0);
+  if (!compiler->Compile(builder_.get())) {
     return false;
   }
+  uint64_t compile_ticks =
+      gather_statistics ? Clock::QueryHostTickCount() - compile_start_ticks
+                        : uint64_t(0);
 
   // Stash optimized HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
@@ -245,14 +356,38 @@ bool PPCTranslator::Translate(GuestFunction* function,
   DumpHIR(function, builder_.get());
 
   // Assemble to backend machine code.
+  // The backend instruments baseline code to count calls.
+  if (baseline) {
+    function->set_tier(GuestFunction::Tier::kBaseline);
+  }
   if (!assembler_->Assemble(function, builder_.get(), debug_info_flags,
-                            std::move(debug_info))) {
+                            std::move(debug_info), builder_->inlined_calls(),
+                            code_generation)) {
     return false;
   }
+  // Only now callers may link to the machine code directly.
+  if (!baseline) {
+    function->set_tier(GuestFunction::Tier::kOptimized);
+  }
+
+  if (gather_statistics) {
+    compiler::CompilerStatistics::RecordFunction(
+        function->address(), baseline,
+        Clock::QueryHostTickCount() - start_ticks, compile_ticks,
+        Compiler::CountInstrs(builder_.get()),
+        uint32_t(CountArenaChunkAllocations() -
+                 start_arena_chunk_allocations));
+  }
 
   return true;
 }
 void PPCTranslator::Reset() { builder_->ResetPools(); }
+
+size_t PPCTranslator::CountArenaChunkAllocations() const {
+  return builder_->arena()->chunk_allocation_count() +
+         compiler_->scratch_arena()->chunk_allocation_count() +
+         baseline_compiler_->scratch_arena()->chunk_allocation_count();
+}
 void PPCTranslator::DumpSource(GuestFunction* function,
                                StringBuffer* string_buffer) {
   Memory* memory = frontend_->memory();
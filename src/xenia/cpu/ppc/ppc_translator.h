@@ -30,17 +30,23 @@ class PPCTranslator {
   explicit PPCTranslator(PPCFrontend* frontend);
   ~PPCTranslator();
 
-  bool Translate(GuestFunction* function, uint32_t debug_info_flags);
+  bool Translate(GuestFunction* function, uint32_t debug_info_flags,
+                 uint32_t code_generation);
   void DumpHIR(GuestFunction* function, PPCHIRBuilder* builder);
   void Reset();
 
  private:
   void DumpSource(GuestFunction* function, StringBuffer* string_buffer);
+  // Chunks allocated so far by the arenas used during translation. Other heap
+  // allocations, such as those of containers, aren't counted.
+  size_t CountArenaChunkAllocations() const;
 
   PPCFrontend* frontend_;
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  // Reduced pass list for the first translation with tiered_compilation.
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
@@ -0,0 +1,809 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/console_app_main.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/string_buffer.h"
+#include "xenia/base/utf8.h"
+#include "xenia/cpu/backend/interpreter/interpreter_backend.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/ppc/ppc_opcode_info.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/raw_module.h"
+
+#if XE_ARCH_AMD64
+#include "xenia/cpu/backend/x64/x64_backend.h"
+#endif  // XE_ARCH
+
+DEFINE_uint64(fuzz_seed, 1, "Seed of the generated instruction streams.",
+              "Other");
+DEFINE_int32(fuzz_stream_count, 1000,
+             "Number of instruction streams to generate.", "Other");
+DEFINE_int32(fuzz_stream_length, 32,
+             "Number of random instructions in each stream.", "Other");
+DEFINE_int32(fuzz_stream, -1,
+             "Only run the stream with this index, to reproduce a divergence "
+             "with the same seed, count and length.",
+             "Other");
+DEFINE_string(
+    fuzz_configs, "interpreter,x64",
+    "Comma-separated translation configurations to run every stream with, "
+    "compared against the first one. Each is a backend (interpreter or x64), "
+    "optionally followed by :baseline to use the baseline passes (see "
+    "tiered_compilation), by :-Name to leave out a pass, such as "
+    "\"x64:-LoopInvariantCodeMotion:-MemorySequenceCombination\", or by "
+    ":mask=N to only use the host extensions in x64_extension_mask N.",
+    "Other");
+DEFINE_string(fuzz_opcodes, "",
+              "Comma-separated names of the only opcodes to generate, all "
+              "supported ones if empty.",
+              "Other");
+DEFINE_string(fuzz_skip_opcodes,
+              "fresx,frsqrtex,vexptefp,vexptefp128,vlogefp,vlogefp128,vrefp,"
+              "vrefp128,vrsqrtefp,vrsqrtefp128",
+              "Comma-separated names of opcodes not to generate. Defaults to "
+              "the estimates, which the interpreter computes exactly.",
+              "Other");
+DEFINE_bool(fuzz_nan_equal, true,
+            "Consider all NaNs equal when comparing floating-point registers "
+            "and vector lanes.",
+            "Other");
+DEFINE_int32(fuzz_report_limit, 10,
+             "Number of diverging streams logged in detail per configuration.",
+             "Other");
+DEFINE_int32(fuzz_benchmark_iterations, 0,
+             "If not 0, also run every stream this many times with each "
+             "configuration and report the time per guest instruction.",
+             "Other");
+
+DECLARE_bool(break_on_unimplemented_instructions);
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+using xe::cpu::ppc::PPCContext;
+using xe::cpu::ppc::PPCOpcode;
+using xe::cpu::ppc::PPCOpcodeFormat;
+
+typedef std::mt19937_64 Rng;
+
+// Streams are placed one after another, each ending with a blr.
+const uint32_t kCodeAddress = 0x82000000;
+const uint32_t kReturnAddress = 0xBCBCBCBC;
+// Memory instructions get their base register pointed to the middle of the
+// scratch area, and displacements and indices small enough to stay inside.
+const uint32_t kScratchAddress = 0x10000000;
+const uint32_t kScratchSize = 0x4000;
+const uint32_t kScratchBase = kScratchAddress + kScratchSize / 2;
+const int32_t kScratchMaxOffset = 0x800;
+// Up to three instructions setting up the operands of a memory instruction.
+const uint32_t kMaxInstrsPerRandomInstr = 4;
+
+// Opcodes depending on state outside of the guest context, such as the time
+// base or reservations left by an earlier stream, or accessing memory the
+// scratch area can't contain.
+const char* const kUnsupportedOpcodes[] = {
+    "dcbi",  "icbi",  "lmw",   "stmw",  "lswi",   "lswx",  "stswi",
+    "stswx", "lwarx", "ldarx", "stwcx", "stdcx",  "mfmsr", "mtmsr",
+    "mtmsrd", "mfspr", "mtspr", "mftb",
+};
+
+struct FuzzConfig {
+  std::string name;
+  std::string backend;
+  bool baseline = false;
+  std::string disabled_passes;
+  int64_t extension_mask = -1;
+};
+
+struct FuzzOpcode {
+  PPCOpcode opcode;
+  PPCOpcodeFormat format;
+  uint32_t code;
+  // Bits that can be changed without changing the opcode.
+  uint32_t free_bits;
+  bool is_memory;
+};
+
+struct Stream {
+  uint32_t address;
+  uint32_t instr_count;
+};
+
+// Everything a stream may change.
+struct GuestState {
+  uint64_t r[32];
+  double f[32];
+  vec128_t v[128];
+  vec128_t vscr_vec;
+  uint64_t lr;
+  uint64_t ctr;
+  uint64_t cr;
+  uint32_t fpscr;
+  uint8_t xer_ca;
+  uint8_t xer_ov;
+  uint8_t xer_so;
+  uint8_t vscr_sat;
+  uint8_t scratch[kScratchSize];
+};
+
+bool ContainsName(const std::string_view list, const std::string_view name) {
+  for (auto list_name : xe::utf8::split(list, ", ", true)) {
+    if (list_name == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t RandomInt(Rng& rng) {
+  static const uint64_t kInteresting[] = {
+      0,      1,          2,          31,         32,
+      63,     64,         0x7F,       0x80,       0xFF,
+      0x7FFF, 0x8000,     0xFFFF,     0x7FFFFFFF, 0x80000000,
+      0xFFFFFFFF,         0x100000000ull,         0x7FFFFFFFFFFFFFFFull,
+      0x8000000000000000ull,                      UINT64_MAX,
+  };
+  switch (rng() % 4) {
+    case 0:
+      return kInteresting[rng() % xe::countof(kInteresting)];
+    case 1:
+      return rng() % 64;
+    case 2:
+      return uint64_t(int64_t(int32_t(rng())));
+    default:
+      return rng();
+  }
+}
+
+double RandomDouble(Rng& rng) {
+  static const double kInteresting[] = {
+      0.0,
+      -0.0,
+      1.0,
+      -1.0,
+      0.5,
+      2147483648.0,
+      -9223372036854775808.0,
+      DBL_MAX,
+      DBL_MIN,
+      std::numeric_limits<double>::denorm_min(),
+      std::numeric_limits<double>::infinity(),
+      -std::numeric_limits<double>::infinity(),
+      std::numeric_limits<double>::quiet_NaN(),
+  };
+  switch (rng() % 4) {
+    case 0:
+      return kInteresting[rng() % xe::countof(kInteresting)];
+    case 1: {
+      uint64_t bits = rng();
+      double value;
+      std::memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+    default:
+      return std::uniform_real_distribution<double>(-65536.0, 65536.0)(rng);
+  }
+}
+
+uint32_t RandomVectorLane(Rng& rng) {
+  static const float kInteresting[] = {
+      0.0f,
+      -0.0f,
+      1.0f,
+      -1.0f,
+      0.5f,
+      FLT_MAX,
+      FLT_MIN,
+      std::numeric_limits<float>::denorm_min(),
+      std::numeric_limits<float>::infinity(),
+      -std::numeric_limits<float>::infinity(),
+      std::numeric_limits<float>::quiet_NaN(),
+  };
+  float value;
+  switch (rng() % 4) {
+    case 0:
+      value = kInteresting[rng() % xe::countof(kInteresting)];
+      break;
+    case 1:
+      return uint32_t(RandomInt(rng));
+    case 2:
+      return uint32_t(rng());
+    default:
+      value = std::uniform_real_distribution<float>(-256.0f, 256.0f)(rng);
+      break;
+  }
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+bool IsDoubleNaN(uint64_t bits) {
+  return (bits & 0x7FF0000000000000ull) == 0x7FF0000000000000ull &&
+         (bits & 0x000FFFFFFFFFFFFFull);
+}
+
+bool IsFloatNaN(uint32_t bits) {
+  return (bits & 0x7F800000) == 0x7F800000 && (bits & 0x007FFFFF);
+}
+
+class Fuzzer {
+ public:
+  Fuzzer() {
+    memory_.reset(new Memory());
+    memory_->Initialize();
+  }
+
+  ~Fuzzer() {
+    thread_state_.reset();
+    processor_.reset();
+    memory_.reset();
+  }
+
+  bool Run() {
+    if (cvars::fuzz_stream_count <= 0 || cvars::fuzz_stream_length <= 0) {
+      XELOGE("Stream count and length must be positive");
+      return false;
+    }
+    std::vector<FuzzConfig> configs;
+    if (!ParseConfigs(&configs)) {
+      return false;
+    }
+    // Not fatal, both configurations should skip them the same way.
+    cvars::break_on_unimplemented_instructions = false;
+
+    size_t diverging_total = 0;
+    for (size_t i = 0; i < configs.size(); ++i) {
+      auto& config = configs[i];
+      XELOGI("Configuration {}:", config.name);
+      if (!Setup(config)) {
+        return false;
+      }
+      // Emitters are registered by the first frontend.
+      if (!i && !Generate()) {
+        return false;
+      }
+      if (!Translate(config)) {
+        return false;
+      }
+      if (!i) {
+        Record();
+      } else {
+        diverging_total += Compare(config, configs[0]);
+      }
+      if (cvars::fuzz_benchmark_iterations > 0) {
+        Benchmark();
+      }
+      thread_state_.reset();
+      functions_.clear();
+      processor_.reset();
+    }
+    if (configs.size() > 1) {
+      XELOGI("Diverging streams: {}", diverging_total);
+    }
+    return !diverging_total;
+  }
+
+ private:
+  bool ParseConfigs(std::vector<FuzzConfig>* configs) {
+    for (auto config_name : xe::utf8::split(cvars::fuzz_configs, ", ", true)) {
+      FuzzConfig config;
+      config.name = config_name;
+      auto options = xe::utf8::split(config_name, ":");
+      config.backend = options[0];
+      for (size_t i = 1; i < options.size(); ++i) {
+        auto option = options[i];
+        if (option == "baseline") {
+          config.baseline = true;
+        } else if (option.size() > 1 && option[0] == '-') {
+          if (!config.disabled_passes.empty()) {
+            config.disabled_passes += ',';
+          }
+          config.disabled_passes += option.substr(1);
+        } else if (xe::utf8::starts_with(option, "mask=")) {
+          config.extension_mask =
+              int64_t(std::strtoull(std::string(option.substr(5)).c_str(),
+                                    nullptr, 0));
+        } else {
+          XELOGE("Unknown option {} in configuration {}", option, config_name);
+          return false;
+        }
+      }
+      configs->push_back(std::move(config));
+    }
+    if (configs->empty()) {
+      XELOGE("No configurations to run");
+      return false;
+    }
+    return true;
+  }
+
+  uint32_t stream_stride() const {
+    return (uint32_t(cvars::fuzz_stream_length) * kMaxInstrsPerRandomInstr +
+            1) *
+           4;
+  }
+
+  bool Setup(const FuzzConfig& config) {
+    std::unique_ptr<xe::cpu::backend::Backend> backend;
+    if (config.backend == "interpreter") {
+      backend.reset(new xe::cpu::backend::interpreter::InterpreterBackend());
+    }
+#if XE_ARCH_AMD64
+    if (config.backend == "x64") {
+      backend.reset(new xe::cpu::backend::x64::X64Backend());
+    }
+#endif  // XE_ARCH
+    if (!backend) {
+      XELOGE("Backend {} is not available", config.backend);
+      return false;
+    }
+
+    processor_.reset(new Processor(memory_.get(), nullptr));
+    if (!processor_->Setup(std::move(backend))) {
+      XELOGE("Unable to set up the processor");
+      return false;
+    }
+
+    uint32_t code_size =
+        uint32_t(cvars::fuzz_stream_count) * stream_stride();
+    if (!memory_allocated_) {
+      auto code_heap = memory_->LookupHeap(kCodeAddress);
+      auto scratch_heap = memory_->LookupHeap(kScratchAddress);
+      if (!code_heap ||
+          !code_heap->AllocFixed(
+              kCodeAddress, code_size, 0,
+              kMemoryAllocationReserve | kMemoryAllocationCommit,
+              kMemoryProtectRead | kMemoryProtectWrite) ||
+          !scratch_heap ||
+          !scratch_heap->AllocFixed(
+              kScratchAddress, kScratchSize, 0,
+              kMemoryAllocationReserve | kMemoryAllocationCommit,
+              kMemoryProtectRead | kMemoryProtectWrite)) {
+        XELOGE("Unable to allocate guest memory for the streams");
+        return false;
+      }
+      memory_allocated_ = true;
+    }
+    auto module = std::make_unique<xe::cpu::RawModule>(processor_.get());
+    module->set_name("fuzz");
+    module->SetAddressRange(kCodeAddress, code_size);
+    processor_->AddModule(std::move(module));
+
+    // Simulate a thread.
+    uint32_t stack_size = 64 * 1024;
+    uint32_t stack_address = kCodeAddress - stack_size;
+    uint32_t pcr_address = stack_address - 0x1000;
+    thread_state_.reset(
+        new ThreadState(processor_.get(), 0x100, stack_address, pcr_address));
+    return true;
+  }
+
+  bool GatherOpcodes() {
+    for (uint32_t i = 0; i < uint32_t(PPCOpcode::kInvalid); ++i) {
+      auto opcode = PPCOpcode(i);
+      auto& info = ppc::GetOpcodeInfo(opcode);
+      auto& disasm_info = ppc::GetOpcodeDisasmInfo(opcode);
+      if (!info.emit || info.group == ppc::PPCOpcodeGroup::kB) {
+        continue;
+      }
+      bool unsupported = false;
+      for (auto name : kUnsupportedOpcodes) {
+        if (!std::strcmp(name, disasm_info.name)) {
+          unsupported = true;
+          break;
+        }
+      }
+      if (unsupported ||
+          ContainsName(cvars::fuzz_skip_opcodes, disasm_info.name) ||
+          (!cvars::fuzz_opcodes.empty() &&
+           !ContainsName(cvars::fuzz_opcodes, disasm_info.name))) {
+        continue;
+      }
+      uint32_t code = disasm_info.opcode;
+      if (ppc::LookupOpcode(code) != opcode) {
+        continue;
+      }
+      // The primary opcode is always fixed.
+      uint32_t free_bits = 0;
+      for (uint32_t bit = 0; bit < 26; ++bit) {
+        if (ppc::LookupOpcode(code ^ (1u << bit)) == opcode) {
+          free_bits |= 1u << bit;
+        }
+      }
+      opcodes_.push_back({opcode, disasm_info.format, code, free_bits,
+                          info.group == ppc::PPCOpcodeGroup::kM});
+    }
+    if (opcodes_.empty()) {
+      XELOGE("No opcodes to generate");
+      return false;
+    }
+    XELOGI("Generating {} streams of {} instructions from {} opcodes.",
+           cvars::fuzz_stream_count, cvars::fuzz_stream_length,
+           opcodes_.size());
+    return true;
+  }
+
+  bool Generate() {
+    if (!GatherOpcodes()) {
+      return false;
+    }
+    uint32_t address = kCodeAddress;
+    for (int32_t i = 0; i < cvars::fuzz_stream_count; ++i) {
+      std::seed_seq seed{uint64_t(cvars::fuzz_seed), uint64_t(i), uint64_t(0)};
+      Rng rng(seed);
+      auto p = memory_->TranslateVirtual<uint32_t*>(address);
+      uint32_t instr_count = 0;
+      for (int32_t j = 0; j < cvars::fuzz_stream_length; ++j) {
+        instr_count += GenerateInstr(rng, p + instr_count);
+      }
+      // blr
+      xe::store_and_swap<uint32_t>(p + instr_count++, 0x4E800020);
+      streams_.push_back({address, instr_count});
+      address += stream_stride();
+    }
+    return true;
+  }
+
+  uint32_t GenerateInstr(Rng& rng, uint32_t* p) {
+    auto& fuzz_opcode = opcodes_[rng() % opcodes_.size()];
+    uint32_t code = fuzz_opcode.code;
+    for (uint32_t attempt = 0; attempt < 16; ++attempt) {
+      uint32_t candidate = (fuzz_opcode.code & ~fuzz_opcode.free_bits) |
+                           (uint32_t(rng()) & fuzz_opcode.free_bits);
+      if (ppc::LookupOpcode(candidate) == fuzz_opcode.opcode) {
+        code = candidate;
+        break;
+      }
+    }
+    uint32_t count = 0;
+    if (fuzz_opcode.is_memory) {
+      // Base in rA, which must not be 0 or the loaded register (invalid for
+      // update forms), and either a displacement or an index in rB.
+      uint32_t rd = (code >> 21) & 0x1F;
+      uint32_t ra;
+      do {
+        ra = 3 + uint32_t(rng() % 29);
+      } while (ra == rd);
+      int32_t offset =
+          int32_t(rng() % (kScratchMaxOffset * 2)) - kScratchMaxOffset;
+      // lis rA, base@h; ori rA, rA, base@l
+      xe::store_and_swap<uint32_t>(
+          p + count++, 0x3C000000 | (ra << 21) | (kScratchBase >> 16));
+      xe::store_and_swap<uint32_t>(
+          p + count++,
+          0x60000000 | (ra << 21) | (ra << 16) | (kScratchBase & 0xFFFF));
+      code = (code & ~(0x1Fu << 16)) | (ra << 16);
+      if (fuzz_opcode.format == PPCOpcodeFormat::kD) {
+        code = (code & ~0xFFFFu) | (uint32_t(offset) & 0xFFFF);
+      } else if (fuzz_opcode.format == PPCOpcodeFormat::kDS) {
+        code = (code & ~0xFFFCu) | (uint32_t(offset) & 0xFFFC);
+      } else {
+        uint32_t rb;
+        do {
+          rb = 3 + uint32_t(rng() % 29);
+        } while (rb == ra);
+        // li rB, offset
+        xe::store_and_swap<uint32_t>(
+            p + count++,
+            0x38000000 | (rb << 21) | (uint32_t(offset) & 0xFFFF));
+        code = (code & ~(0x1Fu << 11)) | (rb << 11);
+      }
+    }
+    xe::store_and_swap<uint32_t>(p + count++, code);
+    return count;
+  }
+
+  bool Translate(const FuzzConfig& config) {
+    // Translators are created with the first function, and only read the
+    // pass cvars then.
+    auto disabled_compiler_passes = cvars::disabled_compiler_passes;
+    auto tiered_compilation = cvars::tiered_compilation;
+    auto tiered_compilation_threshold = cvars::tiered_compilation_threshold;
+#if XE_ARCH_AMD64
+    auto x64_extension_mask = cvars::x64_extension_mask;
+#endif  // XE_ARCH_AMD64
+    cvars::disabled_compiler_passes = config.disabled_passes;
+    cvars::tiered_compilation = config.baseline;
+    // Keep the baseline code for the whole run.
+    cvars::tiered_compilation_threshold = UINT32_MAX;
+#if XE_ARCH_AMD64
+    // Further narrows what the emitters detected, to compare the AVX-512 and
+    // AVX2 sequences on one host.
+    cvars::x64_extension_mask &= config.extension_mask;
+#endif  // XE_ARCH_AMD64
+    bool succeeded = true;
+    for (auto& stream : streams_) {
+      auto function = processor_->ResolveFunction(stream.address);
+      if (!function) {
+        XELOGE("Unable to translate the stream at {:08X}", stream.address);
+        succeeded = false;
+        break;
+      }
+      functions_.push_back(function);
+    }
+    cvars::disabled_compiler_passes = disabled_compiler_passes;
+    cvars::tiered_compilation = tiered_compilation;
+    cvars::tiered_compilation_threshold = tiered_compilation_threshold;
+#if XE_ARCH_AMD64
+    cvars::x64_extension_mask = x64_extension_mask;
+#endif  // XE_ARCH_AMD64
+    return succeeded;
+  }
+
+  bool ShouldRun(size_t index) const {
+    return cvars::fuzz_stream < 0 || size_t(cvars::fuzz_stream) == index;
+  }
+
+  void GenerateState(size_t index, GuestState* state) const {
+    std::seed_seq seed{uint64_t(cvars::fuzz_seed), uint64_t(index),
+                       uint64_t(1)};
+    Rng rng(seed);
+    for (auto& r : state->r) {
+      r = RandomInt(rng);
+    }
+    for (auto& f : state->f) {
+      f = RandomDouble(rng);
+    }
+    for (auto& v : state->v) {
+      for (uint32_t i = 0; i < 4; ++i) {
+        v.u32[i] = RandomVectorLane(rng);
+      }
+    }
+    // Non-Java mode, as after reset.
+    state->vscr_vec = vec128i(0, 0, 0, 0x00010000);
+    state->lr = kReturnAddress;
+    state->ctr = RandomInt(rng);
+    state->cr = uint32_t(rng());
+    state->fpscr = 0;
+    state->xer_ca = rng() & 1;
+    state->xer_ov = rng() & 1;
+    state->xer_so = rng() & 1;
+    state->vscr_sat = 0;
+    for (auto& b : state->scratch) {
+      b = uint8_t(rng());
+    }
+  }
+
+  void ApplyState(const GuestState& state) {
+    auto ctx = thread_state_->context();
+    std::memcpy(ctx->r, state.r, sizeof(ctx->r));
+    std::memcpy(ctx->f, state.f, sizeof(ctx->f));
+    std::memcpy(ctx->v, state.v, sizeof(ctx->v));
+    ctx->vscr_vec = state.vscr_vec;
+    ctx->lr = state.lr;
+    ctx->ctr = state.ctr;
+    ctx->set_cr(state.cr);
+    ctx->fpscr.value = state.fpscr;
+    ctx->xer_ca = state.xer_ca;
+    ctx->xer_ov = state.xer_ov;
+    ctx->xer_so = state.xer_so;
+    ctx->vscr_sat = state.vscr_sat;
+    auto backend = processor_->backend();
+    backend->SetGuestRoundingMode(ctx, state.fpscr & 7);
+    backend->SetGuestNonJavaMode(ctx, true);
+    std::memcpy(memory_->TranslateVirtual(kScratchAddress), state.scratch,
+                kScratchSize);
+  }
+
+  void CaptureState(GuestState* state) const {
+    auto ctx = thread_state_->context();
+    std::memcpy(state->r, ctx->r, sizeof(state->r));
+    std::memcpy(state->f, ctx->f, sizeof(state->f));
+    std::memcpy(state->v, ctx->v, sizeof(state->v));
+    state->vscr_vec = ctx->vscr_vec;
+    state->lr = ctx->lr;
+    state->ctr = ctx->ctr;
+    state->cr = ctx->cr();
+    state->fpscr = ctx->fpscr.value;
+    state->xer_ca = ctx->xer_ca;
+    state->xer_ov = ctx->xer_ov;
+    state->xer_so = ctx->xer_so;
+    state->vscr_sat = ctx->vscr_sat;
+    std::memcpy(state->scratch, memory_->TranslateVirtual(kScratchAddress),
+                kScratchSize);
+  }
+
+  void RunStream(size_t index, GuestState* state) {
+    GenerateState(index, state);
+    ApplyState(*state);
+    functions_[index]->Call(thread_state_.get(), kReturnAddress);
+    CaptureState(state);
+  }
+
+  void Record() {
+    references_.resize(streams_.size());
+    for (size_t i = 0; i < streams_.size(); ++i) {
+      if (ShouldRun(i)) {
+        references_[i].reset(new GuestState());
+        RunStream(i, references_[i].get());
+      }
+    }
+  }
+
+  size_t Compare(const FuzzConfig& config, const FuzzConfig& reference) {
+    size_t diverging = 0;
+    auto state = std::make_unique<GuestState>();
+    StringBuffer differences;
+    for (size_t i = 0; i < streams_.size(); ++i) {
+      if (!ShouldRun(i)) {
+        continue;
+      }
+      RunStream(i, state.get());
+      differences.Reset();
+      if (CompareStates(*references_[i], *state, &differences)) {
+        continue;
+      }
+      if (int32_t(diverging++) < cvars::fuzz_report_limit) {
+        XELOGE("Stream {} diverges from {}:", i, reference.name);
+        DumpStream(streams_[i]);
+        XELOGE("{}", differences.to_string());
+      }
+    }
+    XELOGI("  {} of {} streams diverge from {}.", diverging, streams_.size(),
+           reference.name);
+    return diverging;
+  }
+
+  bool CompareStates(const GuestState& expected, const GuestState& actual,
+                     StringBuffer* differences) const {
+    for (uint32_t i = 0; i < 32; ++i) {
+      if (expected.r[i] != actual.r[i]) {
+        differences->AppendFormat("  r{}: {:016X} != {:016X}\n", i,
+                                  expected.r[i], actual.r[i]);
+      }
+    }
+    for (uint32_t i = 0; i < 32; ++i) {
+      uint64_t expected_bits, actual_bits;
+      std::memcpy(&expected_bits, &expected.f[i], sizeof(expected_bits));
+      std::memcpy(&actual_bits, &actual.f[i], sizeof(actual_bits));
+      if (expected_bits != actual_bits &&
+          !(cvars::fuzz_nan_equal && IsDoubleNaN(expected_bits) &&
+            IsDoubleNaN(actual_bits))) {
+        differences->AppendFormat("  f{}: {:016X} != {:016X}\n", i,
+                                  expected_bits, actual_bits);
+      }
+    }
+    for (uint32_t i = 0; i < 128; ++i) {
+      auto& expected_v = expected.v[i];
+      auto& actual_v = actual.v[i];
+      for (uint32_t j = 0; j < 4; ++j) {
+        if (expected_v.u32[j] != actual_v.u32[j] &&
+            !(cvars::fuzz_nan_equal && IsFloatNaN(expected_v.u32[j]) &&
+              IsFloatNaN(actual_v.u32[j]))) {
+          differences->AppendFormat(
+              "  v{}: {:08X} {:08X} {:08X} {:08X} != {:08X} {:08X} {:08X} "
+              "{:08X}\n",
+              i, expected_v.u32[0], expected_v.u32[1], expected_v.u32[2],
+              expected_v.u32[3], actual_v.u32[0], actual_v.u32[1],
+              actual_v.u32[2], actual_v.u32[3]);
+          break;
+        }
+      }
+    }
+    if (expected.vscr_vec != actual.vscr_vec ||
+        expected.vscr_sat != actual.vscr_sat) {
+      differences->AppendFormat("  vscr: {:08X} sat {} != {:08X} sat {}\n",
+                                expected.vscr_vec.u32[3], expected.vscr_sat,
+                                actual.vscr_vec.u32[3], actual.vscr_sat);
+    }
+    if (expected.lr != actual.lr) {
+      differences->AppendFormat("  lr: {:016X} != {:016X}\n", expected.lr,
+                                actual.lr);
+    }
+    if (expected.ctr != actual.ctr) {
+      differences->AppendFormat("  ctr: {:016X} != {:016X}\n", expected.ctr,
+                                actual.ctr);
+    }
+    if (expected.cr != actual.cr) {
+      differences->AppendFormat("  cr: {:08X} != {:08X}\n", expected.cr,
+                                actual.cr);
+    }
+    if (expected.fpscr != actual.fpscr) {
+      differences->AppendFormat("  fpscr: {:08X} != {:08X}\n", expected.fpscr,
+                                actual.fpscr);
+    }
+    if (expected.xer_ca != actual.xer_ca || expected.xer_ov != actual.xer_ov ||
+        expected.xer_so != actual.xer_so) {
+      differences->AppendFormat(
+          "  xer: ca {} ov {} so {} != ca {} ov {} so {}\n", expected.xer_ca,
+          expected.xer_ov, expected.xer_so, actual.xer_ca, actual.xer_ov,
+          actual.xer_so);
+    }
+    for (uint32_t i = 0; i < kScratchSize; ++i) {
+      if (expected.scratch[i] != actual.scratch[i]) {
+        differences->AppendFormat(
+            "  memory {:08X}: {:02X} != {:02X} (first difference)\n",
+            kScratchAddress + i, expected.scratch[i], actual.scratch[i]);
+        break;
+      }
+    }
+    return !differences->length();
+  }
+
+  void DumpStream(const Stream& stream) const {
+    auto p = memory_->TranslateVirtual<const uint32_t*>(stream.address);
+    StringBuffer disasm;
+    for (uint32_t i = 0; i < stream.instr_count; ++i) {
+      uint32_t address = stream.address + i * 4;
+      uint32_t code = xe::load_and_swap<uint32_t>(p + i);
+      disasm.Reset();
+      ppc::DisasmPPC(address, code, &disasm);
+      XELOGE("  {:08X} {:08X} {}", address, code, disasm.to_string());
+    }
+  }
+
+  void Benchmark() {
+    auto state = std::make_unique<GuestState>();
+    uint64_t instr_count = 0;
+    uint64_t ticks = 0;
+    for (size_t i = 0; i < streams_.size(); ++i) {
+      if (!ShouldRun(i)) {
+        continue;
+      }
+      // The results don't matter, but memory accesses must stay in the
+      // scratch area, which the stream itself makes sure of.
+      GenerateState(i, state.get());
+      ApplyState(*state);
+      auto function = functions_[i];
+      uint64_t start_ticks = Clock::QueryHostTickCount();
+      for (int32_t j = 0; j < cvars::fuzz_benchmark_iterations; ++j) {
+        function->Call(thread_state_.get(), kReturnAddress);
+      }
+      ticks += Clock::QueryHostTickCount() - start_ticks;
+      instr_count +=
+          uint64_t(streams_[i].instr_count) * cvars::fuzz_benchmark_iterations;
+    }
+    double nanoseconds =
+        double(ticks) * 1000000000.0 / double(Clock::QueryHostTickFrequency());
+    XELOGI("  {:.3f} ns per guest instruction over {} instructions.",
+           instr_count ? nanoseconds / double(instr_count) : 0.0,
+           instr_count);
+  }
+
+  std::unique_ptr<Memory> memory_;
+  bool memory_allocated_ = false;
+  std::unique_ptr<Processor> processor_;
+  std::unique_ptr<ThreadState> thread_state_;
+
+  std::vector<FuzzOpcode> opcodes_;
+  std::vector<Stream> streams_;
+  // Parallel to streams_, for the current configuration.
+  std::vector<Function*> functions_;
+  // Results of the first configuration, null for streams not run.
+  std::vector<std::unique_ptr<GuestState>> references_;
+};
+
+int main(const std::vector<std::string>& args) {
+  Fuzzer fuzzer;
+  return fuzzer.Run() ? 0 : 1;
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
+
+XE_DEFINE_CONSOLE_APP("xenia-cpu-ppc-fuzzer", xe::cpu::test::main, "");
@@ -16,6 +16,7 @@ project("xenia-cpu")
   })
   local_platform_files()
   local_platform_files("backend")
+  local_platform_files("backend/interpreter")
   local_platform_files("compiler")
   local_platform_files("compiler/passes")
   local_platform_files("hir")
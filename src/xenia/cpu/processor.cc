@@ -23,6 +23,7 @@
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/compiler/compiler_statistics.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/module.h"
@@ -48,6 +49,11 @@ DEFINE_path(trace_function_data_path, "", "File to write trace data to.",
             "CPU");
 DEFINE_bool(break_on_start, false, "Break into the debugger on startup.",
             "CPU");
+DEFINE_bool(invalidate_written_code, true,
+            "Translate guest functions again when their code is written to, "
+            "such as by code patches or plugins. Only code the guest can "
+            "write to is watched, see writable_code_segments.",
+            "CPU");
 
 namespace xe {
 namespace kernel {
@@ -86,8 +92,16 @@ Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
     : memory_(memory), export_resolver_(export_resolver) {}
 
 Processor::~Processor() {
+  if (memory_) {
+    memory_->SetCodeWriteCallback(nullptr, nullptr);
+  }
+  // Background compilation uses everything below.
+  compile_pool_.reset();
+  compiler::CompilerStatistics::DumpIfEnabled();
+
   {
     auto global_lock = global_critical_region_.Acquire();
+    module_index_ = nullptr;
     modules_.clear();
   }
 
@@ -113,6 +127,7 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
   std::unique_ptr<Module> builtin_module(new BuiltinModule(this));
   builtin_module_ = builtin_module.get();
   modules_.push_back(std::move(builtin_module));
+  UpdateModuleIndex();
 
   if (frontend_ || backend_) {
     return false;
@@ -131,6 +146,15 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
   backend_ = std::move(backend);
   frontend_ = std::move(frontend);
 
+  if (cvars::invalidate_written_code) {
+    memory_->SetCodeWriteCallback(CodeWriteCallbackThunk, this);
+  }
+
+  compile_pool_ = std::make_unique<CompilePool>(this);
+  if (!compile_pool_->Initialize()) {
+    return false;
+  }
+
   // Stack walker is used when profiling, debugging, and dumping.
   // Note that creation may fail, in which case we'll have to disable those
   // features.
@@ -172,6 +196,7 @@ void Processor::PreLaunch() {
 bool Processor::AddModule(std::unique_ptr<Module> module) {
   auto global_lock = global_critical_region_.Acquire();
   modules_.push_back(std::move(module));
+  UpdateModuleIndex();
   return true;
 }
 
@@ -189,6 +214,7 @@ void Processor::RemoveModule(const std::string_view name) {
         (*itr)->GetAddressedFunctions();
 
     modules_.erase(itr);
+    UpdateModuleIndex();
 
     for (const uint32_t entry : addressed_functions) {
       RemoveFunctionByAddress(entry);
@@ -247,6 +273,83 @@ std::vector<Function*> Processor::FindFunctionsWithAddress(uint32_t address) {
 
 void Processor::RemoveFunctionByAddress(uint32_t address) {
   entry_table_.Delete(address);
+  backend_->InvalidateGuestFunction(address);
+}
+
+void Processor::CodeWriteCallbackThunk(void* context, uint32_t address,
+                                       uint32_t length) {
+  reinterpret_cast<Processor*>(context)->OnCodeWritten(address, length);
+}
+
+void Processor::OnCodeWritten(uint32_t address, uint32_t length) {
+  // Functions still being defined may have read the old code, wherever it
+  // turns out to end.
+  for (GuestFunction* function : resolving_functions_) {
+    function->InvalidateCode();
+  }
+  for (Function* function :
+       entry_table_.FindWithinRange(address, address + length)) {
+    if (!function->is_guest()) {
+      continue;
+    }
+    XELOGD("Code of {:08X} was written to, translating it again",
+           function->address());
+    InvalidateWrittenFunction(static_cast<GuestFunction*>(function));
+  }
+  // Inlined callees and lowered save/restore helpers are part of the code of
+  // their callers as well. Collected first, as invalidating functions changes
+  // inlining_functions_.
+  std::vector<GuestFunction*> inlining_functions;
+  for (uint32_t page = address >> kInlinedCodePageShift;
+       page <= (address + length - 1) >> kInlinedCodePageShift; ++page) {
+    auto it = inlining_functions_.find(page);
+    if (it == inlining_functions_.end()) {
+      continue;
+    }
+    for (GuestFunction* function : it->second) {
+      // Only functions with ready code, like the ones found above.
+      if (function->InlinesGuestCode(address, address + length) &&
+          QueryFunction(function->address()) == function &&
+          std::find(inlining_functions.cbegin(), inlining_functions.cend(),
+                    function) == inlining_functions.cend()) {
+        inlining_functions.push_back(function);
+      }
+    }
+  }
+  for (GuestFunction* function : inlining_functions) {
+    XELOGD("Code inlined into {:08X} was written to, translating it again",
+           function->address());
+    InvalidateWrittenFunction(function);
+  }
+}
+
+void Processor::AddInliningFunction(GuestFunction* function) {
+  for (const auto& inlined_call : function->inlined_calls()) {
+    for (uint32_t page = inlined_call.callee_address >> kInlinedCodePageShift;
+         page <= inlined_call.callee_end_address >> kInlinedCodePageShift;
+         ++page) {
+      auto& functions = inlining_functions_[page];
+      if (std::find(functions.cbegin(), functions.cend(), function) ==
+          functions.cend()) {
+        functions.push_back(function);
+      }
+    }
+  }
+}
+
+void Processor::InvalidateWrittenFunction(GuestFunction* function) {
+  // Discards the optimized code being translated from the old code, if any.
+  function->InvalidateCode();
+  RemoveFunctionByAddress(function->address());
+  backend_->DiscardGuestFunction(function);
+  // Callers must stop linking to the old code, and the new code starts
+  // counting calls again.
+  function->set_tier(GuestFunction::Tier::kBaseline);
+  // Defined again by DemandFunction when it's resolved next. OptimizeFunction
+  // does so itself when it's done.
+  if (function->status() != Symbol::Status::kDefining) {
+    function->set_status(Symbol::Status::kDeclared);
+  }
 }
 
 Function* Processor::ResolveFunction(uint32_t address) {
@@ -259,28 +362,52 @@ Function* Processor::ResolveFunction(uint32_t address) {
     auto function = LookupFunction(address);
 
     if (!function) {
-      entry->status = Entry::STATUS_FAILED;
+      entry_table_.FinishCompiling(entry, Entry::STATUS_FAILED);
       return nullptr;
     }
 
-    if (!DemandFunction(function)) {
-      entry->status = Entry::STATUS_FAILED;
-      return nullptr;
+    // Writes to its code until the entry is ready are only noticed through
+    // resolving_functions_.
+    GuestFunction* guest_function = nullptr;
+    if (function->is_guest()) {
+      guest_function = static_cast<GuestFunction*>(function);
+      auto global_lock = global_critical_region_.Acquire();
+      resolving_functions_.push_back(guest_function);
     }
-    // only add it to the list of resolved functions if resolving succeeded
-    auto module_for = function->module();
-
-    auto xexmod = dynamic_cast<XexModule*>(module_for);
-    if (xexmod) {
-      auto addr_flags = xexmod->GetInstructionAddressFlags(address);
-      if (addr_flags) {
-        addr_flags->was_resolved = 1;
+    uint32_t code_generation = 0;
+    bool demanded = DemandFunction(function, &code_generation);
+    if (demanded) {
+      // only add it to the list of resolved functions if resolving succeeded
+      auto module_for = function->module();
+
+      auto xexmod = dynamic_cast<XexModule*>(module_for);
+      if (xexmod) {
+        auto addr_flags = xexmod->GetInstructionAddressFlags(address);
+        if (addr_flags) {
+          addr_flags->was_resolved = 1;
+        }
       }
-    }
 
-    entry->function = function;
-    entry->end_address = function->end_address();
-    status = entry->status = Entry::STATUS_READY;
+      entry->function = function;
+      entry->end_address = function->end_address();
+      status = Entry::STATUS_READY;
+    } else {
+      status = Entry::STATUS_FAILED;
+    }
+    entry_table_.FinishCompiling(entry, status);
+
+    if (guest_function) {
+      auto global_lock = global_critical_region_.Acquire();
+      resolving_functions_.erase(std::find(resolving_functions_.begin(),
+                                           resolving_functions_.end(),
+                                           guest_function));
+      if (demanded && guest_function->code_generation() != code_generation) {
+        // Written to after its code was published, before it was ready.
+        InvalidateWrittenFunction(guest_function);
+        global_lock.unlock();
+        return ResolveFunction(address);
+      }
+    }
   }
   if (status == Entry::STATUS_READY) {
     // Ready to use.
@@ -290,16 +417,112 @@ Function* Processor::ResolveFunction(uint32_t address) {
     return nullptr;
   }
 }
+
+bool Processor::OptimizeFunction(GuestFunction* function) {
+  // Holding the symbol like DemandFunction keeps it from being defined again
+  // meanwhile if its code is written to.
+  uint32_t code_generation;
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    if (function->tier() != GuestFunction::Tier::kOptimizing ||
+        function->status() != Symbol::Status::kDefined) {
+      // Written to since it was queued.
+      return false;
+    }
+    function->set_status(Symbol::Status::kDefining);
+    code_generation = function->code_generation();
+    resolving_functions_.push_back(function);
+  }
+  bool optimized = frontend_->OptimizeFunction(function, code_generation);
+  auto global_lock = global_critical_region_.Acquire();
+  resolving_functions_.erase(std::find(resolving_functions_.begin(),
+                                       resolving_functions_.end(), function));
+  if (function->code_generation() != code_generation) {
+    if (function->tier() == GuestFunction::Tier::kOptimizing) {
+      // Only other code, possibly inlined, was written to. The baseline code
+      // is still valid.
+      function->set_status(Symbol::Status::kDefined);
+      function->AbortOptimization();
+      return false;
+    }
+    // Already invalidated by OnCodeWritten.
+    function->set_status(Symbol::Status::kDeclared);
+    return false;
+  }
+  function->set_status(Symbol::Status::kDefined);
+  if (!optimized) {
+    XELOGE("Failed to retranslate function {:08X}, keeping baseline code",
+           function->address());
+    function->AbortOptimization();
+    return false;
+  }
+  return true;
+}
+
+void Processor::WatchGuestCode(uint32_t address, uint32_t end_address) {
+  if (cvars::invalidate_written_code) {
+    memory_->WatchCodePages(address, end_address + 4 - address);
+  }
+}
+
 Module* Processor::LookupModule(uint32_t address) {
+  const ModuleIndex* index = module_index_.load(std::memory_order_acquire);
+  if (!index) {
+    return nullptr;
+  }
+  // Same result as checking modules_ in order: the earliest module whose
+  // range contains the address, unless an earlier unranged module claims it.
+  // Ranges starting at or below the address are checked back from the last
+  // one, until none of the remaining ones reach up to the address.
+  const ModuleIndex::Range* range = nullptr;
+  auto range_it = std::upper_bound(
+      index->ranges.cbegin(), index->ranges.cend(), address,
+      [](uint32_t address, const ModuleIndex::Range& range) {
+        return address < range.low;
+      });
+  while (range_it != index->ranges.cbegin() &&
+         address < (--range_it)->max_high) {
+    if (address < range_it->high &&
+        (!range || range_it->order < range->order)) {
+      range = &*range_it;
+    }
+  }
+  for (const auto& unranged_module : index->unranged_modules) {
+    if (range && unranged_module.first > range->order) {
+      break;
+    }
+    if (unranged_module.second->ContainsAddress(address)) {
+      return unranged_module.second;
+    }
+  }
+  return range ? range->module : nullptr;
+}
+
+void Processor::UpdateModuleIndex() {
   auto global_lock = global_critical_region_.Acquire();
-  // TODO(benvanik): sort by code address (if contiguous) so can bsearch.
-  // TODO(benvanik): cache last module low/high, as likely to be in there.
-  for (const auto& module : modules_) {
-    if (module->ContainsAddress(address)) {
-      return module.get();
+  auto index = std::make_unique<ModuleIndex>();
+  for (size_t i = 0; i < modules_.size(); ++i) {
+    Module* module = modules_[i].get();
+    ModuleIndex::Range range;
+    if (module->GetAddressRange(&range.low, &range.high)) {
+      range.order = i;
+      range.module = module;
+      index->ranges.push_back(range);
+    } else {
+      index->unranged_modules.emplace_back(i, module);
     }
   }
-  return nullptr;
+  std::sort(index->ranges.begin(), index->ranges.end(),
+            [](const ModuleIndex::Range& a, const ModuleIndex::Range& b) {
+              return a.low < b.low;
+            });
+  uint32_t max_high = 0;
+  for (auto& range : index->ranges) {
+    max_high = std::max(max_high, range.high);
+    range.max_high = max_high;
+  }
+  module_index_.store(index.get(), std::memory_order_release);
+  module_indices_.push_back(std::move(index));
 }
 Function* Processor::LookupFunction(uint32_t address) {
   // TODO(benvanik): fast reject invalid addresses/log errors.
@@ -332,7 +555,8 @@ Function* Processor::LookupFunction(Module* module, uint32_t address) {
   return function;
 }
 
-bool Processor::DemandFunction(Function* function) {
+bool Processor::DemandFunction(Function* function,
+                               uint32_t* out_code_generation) {
   // Lock function for generation. If it's already being generated
   // by another thread this will block and return DECLARED.
   auto module = function->module();
@@ -340,17 +564,29 @@ bool Processor::DemandFunction(Function* function) {
   if (symbol_status == Symbol::Status::kNew) {
     // Symbol is undefined, so define now.
     assert_true(function->is_guest());
-    if (!frontend_->DefineFunction(static_cast<GuestFunction*>(function),
-                                   debug_info_flags_)) {
+    auto guest_function = static_cast<GuestFunction*>(function);
+    bool defined;
+    uint32_t code_generation;
+    do {
+      code_generation = guest_function->code_generation();
+      defined = frontend_->DefineFunction(guest_function, debug_info_flags_,
+                                          code_generation);
+      // Translated again if its code was written to meanwhile.
+    } while (!defined && guest_function->code_generation() != code_generation);
+    if (!defined) {
       function->set_status(Symbol::Status::kFailed);
       return false;
     }
+    *out_code_generation = code_generation;
 
     // Before we give the symbol back to the rest, let the debugger know.
     OnFunctionDefined(function);
 
     function->set_status(Symbol::Status::kDefined);
     symbol_status = function->status();
+  } else if (function->is_guest()) {
+    *out_code_generation =
+        static_cast<GuestFunction*>(function)->code_generation();
   }
 
   if (symbol_status == Symbol::Status::kFailed) {
@@ -495,6 +731,9 @@ void Processor::OnThreadExit(uint32_t thread_id) {
   assert_true(it != thread_debug_infos_.end());
   auto thread_info = it->second.get();
   thread_info->state = ThreadDebugInfo::State::kExited;
+  if (thread_info->thread && thread_info->thread->thread_state()) {
+    backend_->OnThreadExit(thread_info->thread->thread_state()->context());
+  }
 }
 
 void Processor::OnThreadDestroyed(uint32_t thread_id) {
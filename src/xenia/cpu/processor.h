@@ -10,15 +10,18 @@
 #ifndef XENIA_CPU_PROCESSOR_H_
 #define XENIA_CPU_PROCESSOR_H_
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/cvar.h"
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/compile_pool.h"
 #include "xenia/cpu/debug_listener.h"
 #include "xenia/cpu/entry_table.h"
 #include "xenia/cpu/export_resolver.h"
@@ -70,6 +73,7 @@ class Processor {
   StackWalker* stack_walker() const { return stack_walker_.get(); }
   ppc::PPCFrontend* frontend() const { return frontend_.get(); }
   backend::Backend* backend() const { return backend_.get(); }
+  CompilePool* compile_pool() const { return compile_pool_.get(); }
   ExportResolver* export_resolver() const { return export_resolver_; }
 
   bool Setup(std::unique_ptr<backend::Backend> backend);
@@ -116,8 +120,20 @@ class Processor {
 
   Function* LookupFunction(uint32_t address);
   Module* LookupModule(uint32_t address);
+  // Must be called when the address range of an added module changes.
+  void UpdateModuleIndex();
   Function* LookupFunction(Module* module, uint32_t address);
   Function* ResolveFunction(uint32_t address);
+  // Retranslates the baseline code of a function that got hot with the full
+  // pass list, see tiered_compilation. Other threads may keep running the
+  // baseline code meanwhile.
+  bool OptimizeFunction(GuestFunction* function);
+  // Protects the pages of guest code about to be translated, so writes to it
+  // from now on invalidate the translation (see invalidate_written_code).
+  void WatchGuestCode(uint32_t address, uint32_t end_address);
+  // Makes OnCodeWritten find the function by the pages of its inlined callees.
+  // Called by GuestFunction::set_inlined_calls with the global lock held.
+  void AddInliningFunction(GuestFunction* function);
 
   bool Execute(ThreadState* thread_state, uint32_t address);
   bool ExecuteRaw(ThreadState* thread_state, uint32_t address);
@@ -247,7 +263,17 @@ class Processor {
   uint32_t CalculateNextGuestInstruction(ThreadDebugInfo* thread_info,
                                          uint32_t current_pc);
 
-  bool DemandFunction(Function* function);
+  // out_code_generation receives the GuestFunction::code_generation the
+  // function was defined in.
+  bool DemandFunction(Function* function, uint32_t* out_code_generation);
+
+  // Invalidates the functions translated from code written to, see
+  // Memory::WatchCodePages.
+  static void CodeWriteCallbackThunk(void* context, uint32_t address,
+                                     uint32_t length);
+  void OnCodeWritten(uint32_t address, uint32_t length);
+  // Must be called with the global lock held.
+  void InvalidateWrittenFunction(GuestFunction* function);
 
   Memory* memory_ = nullptr;
   std::unique_ptr<StackWalker> stack_walker_;
@@ -263,15 +289,50 @@ class Processor {
 
   std::unique_ptr<ppc::PPCFrontend> frontend_;
   std::unique_ptr<backend::Backend> backend_;
+  std::unique_ptr<CompilePool> compile_pool_;
   ExportResolver* export_resolver_ = nullptr;
 
   EntryTable entry_table_;
   xe::global_critical_region global_critical_region_;
   ExecutionState execution_state_ = ExecutionState::kPaused;
   std::vector<std::unique_ptr<Module>> modules_;
+
+  // Read by LookupModule without locking, replaced under the global lock when
+  // modules_ or their ranges change. Previous indices are kept until shutdown
+  // as other threads may still be reading them.
+  struct ModuleIndex {
+    struct Range {
+      uint32_t low;
+      uint32_t high;
+      // Highest high of this and the preceding ranges, as ranges may overlap.
+      uint32_t max_high;
+      // Position in modules_, earlier modules take precedence.
+      size_t order;
+      Module* module;
+    };
+    // Sorted by low address.
+    std::vector<Range> ranges;
+    // Modules without a single range, checked with ContainsAddress, in order.
+    std::vector<std::pair<size_t, Module*>> unranged_modules;
+  };
+  std::atomic<ModuleIndex*> module_index_ = {nullptr};
+  std::vector<std::unique_ptr<ModuleIndex>> module_indices_;
   Module* builtin_module_ = nullptr;
   uint32_t next_builtin_address_ = 0xFFFF0000u;
 
+  // Functions being defined by ResolveFunction, which aren't in entry_table_
+  // yet for OnCodeWritten to find them by their extents, or retranslated by
+  // OptimizeFunction, which may inline code from anywhere. Must be guarded
+  // with the global lock.
+  std::vector<GuestFunction*> resolving_functions_;
+  // Functions that inlined guest code by the page of the code, so writes to it
+  // don't have to check every function. Functions are only added, and checked
+  // with GuestFunction::InlinesGuestCode when found, as they may have been
+  // translated again without the callee since. Must be guarded with the global
+  // lock.
+  static constexpr uint32_t kInlinedCodePageShift = 12;
+  std::unordered_map<uint32_t, std::vector<GuestFunction*>> inlining_functions_;
+
   // Maps thread ID to state. Updated on thread create, and threads are never
   // removed. Must be guarded with the global lock.
   std::map<uint32_t, std::unique_ptr<ThreadDebugInfo>> thread_debug_infos_;
@@ -71,6 +71,15 @@ bool RawModule::ContainsAddress(uint32_t address) {
   return address >= low_address_ && address < high_address_;
 }
 
+bool RawModule::GetAddressRange(uint32_t* out_low, uint32_t* out_high) {
+  if (low_address_ >= high_address_) {
+    return false;
+  }
+  *out_low = low_address_;
+  *out_high = high_address_;
+  return true;
+}
+
 std::unique_ptr<Function> RawModule::CreateFunction(uint32_t address) {
   return std::unique_ptr<Function>(
       processor_->backend()->CreateGuestFunction(this, address));
@@ -244,6 +244,8 @@ class Win32StackWalker : public StackWalker {
             // instruction was executing before the capture (like a call).
             frame.guest_pc =
                 guest_function->MapMachineCodeToGuestAddress(frame.host_pc - 1);
+            // Inlined code is shown as still being at the call.
+            frame.guest_pc = guest_function->MapInlinedAddress(frame.guest_pc);
           }
         } else {
           frame.guest_symbol.function = nullptr;
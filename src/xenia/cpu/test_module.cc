@@ -32,7 +32,7 @@ TestModule::TestModule(Processor* processor, const std::string_view name,
       contains_address_(contains_address),
       generate_(generate) {
   builder_.reset(new HIRBuilder());
-  compiler_.reset(new Compiler(processor));
+  compiler_.reset(new Compiler(processor, "test"));
   assembler_ = processor->backend()->CreateAssembler();
   assembler_->Initialize();
 
@@ -47,6 +47,8 @@ TestModule::TestModule(Processor* processor, const std::string_view name,
   compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   compiler_->AddPass(std::make_unique<passes::ConstantPropagationPass>());
+  compiler_->AddPass(
+      std::make_unique<passes::ConditionalConstantPropagationPass>());
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
@@ -95,7 +97,8 @@ Symbol::Status TestModule::DeclareFunction(uint32_t address,
     compiler_->Compile(builder_.get());
 
     // Assemble the function.
-    assembler_->Assemble(function, builder_.get(), 0, nullptr);
+    assembler_->Assemble(function, builder_.get(), 0, nullptr, {},
+                         function->code_generation());
 
     status = Symbol::Status::kDefined;
     function->set_status(status);
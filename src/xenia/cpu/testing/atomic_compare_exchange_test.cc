@@ -0,0 +1,79 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+// Kernel intrinsics compare and exchange constants, which reach the backend
+// without a register.
+TEST_CASE("ATOMIC_COMPARE_EXCHANGE_I32_CONSTANT", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreGPR(b, 3,
+             b.ZeroExtend(b.AtomicCompareExchange(LoadGPR(b, 4),
+                                                  b.LoadConstantInt32(-1),
+                                                  b.LoadZeroInt32()),
+                          INT64_TYPE));
+    b.Return();
+  });
+  uint32_t address = test.memory->SystemHeapAlloc(4);
+  auto value = test.memory->TranslateVirtual<int32_t*>(address);
+  test.Run(
+      [&](PPCContext* ctx) {
+        *value = -1;
+        ctx->r[4] = address;
+      },
+      [&](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 1);
+        REQUIRE(*value == 0);
+      });
+  test.Run(
+      [&](PPCContext* ctx) {
+        *value = 0;
+        ctx->r[4] = address;
+      },
+      [&](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 0);
+        REQUIRE(*value == 0);
+      });
+}
+
+TEST_CASE("ATOMIC_COMPARE_EXCHANGE_I64_CONSTANT", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreGPR(b, 3,
+             b.ZeroExtend(b.AtomicCompareExchange(
+                              LoadGPR(b, 4), b.LoadZeroInt64(),
+                              b.LoadConstantInt64(0x0123456789ABCDEFull)),
+                          INT64_TYPE));
+    b.Return();
+  });
+  uint32_t address = test.memory->SystemHeapAlloc(8, 8);
+  auto value = test.memory->TranslateVirtual<uint64_t*>(address);
+  test.Run(
+      [&](PPCContext* ctx) {
+        *value = 0;
+        ctx->r[4] = address;
+      },
+      [&](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 1);
+        REQUIRE(*value == 0x0123456789ABCDEFull);
+      });
+  test.Run(
+      [&](PPCContext* ctx) {
+        *value = 1;
+        ctx->r[4] = address;
+      },
+      [&](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 0);
+        REQUIRE(*value == 1);
+      });
+}
@@ -0,0 +1,58 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <vector>
+
+#include "xenia/memory.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+using xe::BaseHeap;
+using xe::Memory;
+
+namespace {
+
+constexpr uint32_t kCodeAddress = 0x82000000;
+constexpr uint32_t kCodeSize = 0x10000;
+
+void RecordCodeWrite(void* context, uint32_t virtual_address,
+                     uint32_t length) {
+  static_cast<std::vector<uint32_t>*>(context)->push_back(virtual_address);
+}
+
+}  // namespace
+
+// The guest protecting a watched page again replaces its host protection, so
+// the heap must keep the page watched for the write after it to be reported.
+TEST_CASE("CODE_WATCH_REPROTECT", "[memory]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  std::vector<uint32_t> writes;
+  memory.SetCodeWriteCallback(RecordCodeWrite, &writes);
+
+  BaseHeap* heap = memory.LookupHeap(kCodeAddress);
+  REQUIRE(heap->AllocFixed(
+      kCodeAddress, kCodeSize, kCodeSize,
+      xe::kMemoryAllocationReserve | xe::kMemoryAllocationCommit,
+      xe::kMemoryProtectRead | xe::kMemoryProtectWrite));
+  memory.WatchCodePages(kCodeAddress, kCodeSize);
+
+  REQUIRE(heap->Protect(kCodeAddress, kCodeSize,
+                        xe::kMemoryProtectRead | xe::kMemoryProtectWrite));
+  *memory.TranslateVirtual<uint32_t*>(kCodeAddress) = 0x4E800020;
+  REQUIRE(writes.size() == 1);
+  REQUIRE(writes[0] == kCodeAddress);
+  REQUIRE(*memory.TranslateVirtual<uint32_t*>(kCodeAddress) == 0x4E800020);
+
+  // Released pages stop being watched, reporting their code as gone.
+  memory.WatchCodePages(kCodeAddress, kCodeSize);
+  writes.clear();
+  REQUIRE(heap->Release(kCodeAddress));
+  REQUIRE(!writes.empty());
+}
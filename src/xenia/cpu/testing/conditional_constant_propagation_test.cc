@@ -0,0 +1,146 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2022 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/passes/conditional_constant_propagation_pass.h"
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+// Runs only the pass on the HIR, returning whether it changed anything.
+bool RunConditionalConstantPropagation(HIRBuilder& b) {
+  compiler::Compiler compiler(nullptr, "Test");
+  compiler::passes::ConditionalConstantPropagationPass pass;
+  pass.Initialize(&compiler);
+  REQUIRE(b.Finalize());
+  bool changed = false;
+  REQUIRE(pass.Run(&b, changed));
+  return changed;
+}
+
+// Values stored to the GPR, in block order.
+std::vector<Value*> FindGPRStores(HIRBuilder& b, int reg) {
+  std::vector<Value*> values;
+  for (auto block = b.first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_STORE_CONTEXT_info &&
+          i->src1.offset == offsetof(PPCContext, r) + reg * 8) {
+        values.push_back(i->src2.value);
+      }
+    }
+  }
+  return values;
+}
+
+uint32_t CountBlocks(HIRBuilder& b) {
+  uint32_t count = 0;
+  for (auto block = b.first_block(); block; block = block->next) {
+    ++count;
+  }
+  return count;
+}
+}  // namespace
+
+// The context stored before a conditional branch reaches the join of both
+// paths.
+TEST_CASE("CONDITIONAL_CONSTANT_PROPAGATION_JOIN", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    auto taken = b.NewLabel();
+    auto join = b.NewLabel();
+    StoreGPR(b, 5, b.LoadConstantInt64(7));
+    b.BranchTrue(b.CompareNE(LoadGPR(b, 4), b.LoadZeroInt64()), taken);
+    StoreGPR(b, 3, b.LoadConstantInt64(1));
+    b.Branch(join);
+    b.MarkLabel(taken);
+    StoreGPR(b, 3, b.LoadConstantInt64(2));
+    b.MarkLabel(join);
+    StoreGPR(b, 6, b.Add(LoadGPR(b, 5), b.LoadConstantInt64(1)));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 0; },
+           [](PPCContext* ctx) {
+             REQUIRE(ctx->r[3] == 1);
+             REQUIRE(ctx->r[6] == 8);
+           });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 1; },
+           [](PPCContext* ctx) {
+             REQUIRE(ctx->r[3] == 2);
+             REQUIRE(ctx->r[6] == 8);
+           });
+}
+
+TEST_CASE("CONDITIONAL_CONSTANT_PROPAGATION_JOIN_DIFFERENT", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    auto taken = b.NewLabel();
+    auto join = b.NewLabel();
+    StoreGPR(b, 5, b.LoadConstantInt64(7));
+    b.BranchTrue(b.CompareNE(LoadGPR(b, 4), b.LoadZeroInt64()), taken);
+    b.Branch(join);
+    b.MarkLabel(taken);
+    StoreGPR(b, 5, b.LoadConstantInt64(9));
+    b.MarkLabel(join);
+    StoreGPR(b, 6, b.Add(LoadGPR(b, 5), b.LoadConstantInt64(1)));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 0; },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[6] == 8); });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 1; },
+           [](PPCContext* ctx) { REQUIRE(ctx->r[6] == 10); });
+}
+
+TEST_CASE("CONDITIONAL_CONSTANT_PROPAGATION_JOIN_HIR", "[instr]") {
+  HIRBuilder b;
+  auto taken = b.NewLabel();
+  auto join = b.NewLabel();
+  StoreGPR(b, 5, b.LoadConstantInt64(7));
+  b.BranchTrue(b.CompareNE(LoadGPR(b, 4), b.LoadZeroInt64()), taken);
+  StoreGPR(b, 3, b.LoadConstantInt64(1));
+  b.Branch(join);
+  b.MarkLabel(taken);
+  StoreGPR(b, 3, b.LoadConstantInt64(2));
+  b.MarkLabel(join);
+  StoreGPR(b, 6, b.Add(LoadGPR(b, 5), b.LoadConstantInt64(1)));
+  b.Return();
+  REQUIRE(RunConditionalConstantPropagation(b));
+
+  // The add after the join is folded, as r5 is the same on both paths.
+  auto stores = FindGPRStores(b, 6);
+  REQUIRE(stores.size() == 1);
+  REQUIRE(stores[0]->IsConstant());
+  REQUIRE(stores[0]->constant.i64 == 8);
+  // Both paths are still there.
+  REQUIRE(FindGPRStores(b, 3).size() == 2);
+}
+
+TEST_CASE("CONDITIONAL_CONSTANT_PROPAGATION_CONSTANT_BRANCH_HIR", "[instr]") {
+  HIRBuilder b;
+  auto taken = b.NewLabel();
+  auto join = b.NewLabel();
+  StoreGPR(b, 5, b.LoadConstantInt64(7));
+  b.BranchTrue(b.CompareNE(LoadGPR(b, 5), b.LoadZeroInt64()), taken);
+  StoreGPR(b, 3, b.LoadConstantInt64(1));
+  b.Branch(join);
+  b.MarkLabel(taken);
+  StoreGPR(b, 3, b.LoadConstantInt64(2));
+  b.MarkLabel(join);
+  b.Return();
+  uint32_t block_count = CountBlocks(b);
+  REQUIRE(RunConditionalConstantPropagation(b));
+
+  // The branch is always taken, so the block falling through is removed.
+  REQUIRE(CountBlocks(b) == block_count - 1);
+  auto stores = FindGPRStores(b, 3);
+  REQUIRE(stores.size() == 1);
+  REQUIRE(stores[0]->IsConstant());
+  REQUIRE(stores[0]->constant.i64 == 2);
+}
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "xenia/base/platform.h"
+#include "xenia/cpu/backend/interpreter/interpreter_backend.h"
 #include "xenia/cpu/backend/x64/x64_backend.h"
 #include "xenia/cpu/hir/hir_builder.h"
 #include "xenia/cpu/ppc/ppc_context.h"
@@ -46,6 +47,13 @@ class TestFunction {
         processors.emplace_back(std::move(processor));
       }
     }
+    {
+      // Every test also runs interpreted, as a reference for the JIT.
+      auto processor = std::make_unique<Processor>(memory.get(), nullptr);
+      processor->Setup(std::make_unique<
+                       xe::cpu::backend::interpreter::InterpreterBackend>());
+      processors.emplace_back(std::move(processor));
+    }
 
     for (auto& processor : processors) {
       auto module = std::make_unique<xe::cpu::TestModule>(
@@ -15,9 +15,12 @@
 
 #include "xenia/base/byte_order.h"
 #include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/threading.h"
+#include "xenia/base/xxhash.h"
 
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
@@ -1023,6 +1026,8 @@ bool XexModule::LoadContinue() {
 
   // Notify backend that we have an executable range.
   processor_->backend()->CommitExecutableRange(low_address_, high_address_);
+  // The module was added before its range was known.
+  processor_->UpdateModuleIndex();
 
   // Add all imports (variables/functions).
   xex2_opt_import_libraries* opt_import_libraries = nullptr;
@@ -1126,12 +1131,28 @@ void XexModule::Precompile() {
   }
 
   // Find __savegprlr_* and __restgprlr_* and the others.
-  // We can flag these for special handling (inlining/etc).
+  // Branches to these are lowered in place, see
+  // PPCHIRBuilder::EmitSaveRestoreCall.
   if (!FindSaveRest()) {
     return;
   }
 
   info_cache_.Init(this);
+
+  // Pick up code translated for this image by previous sessions. Patches may
+  // also have changed guest memory outside of the image.
+  std::filesystem::path code_storage_root =
+      kernel_state_->emulator()->cache_root() / "modules" / image_sha_str_;
+  processor_->backend()->InitializeCodeStorage(
+      code_storage_root,
+      XXH3_64bits_withSeed(
+          image_sha_bytes_, sizeof(image_sha_bytes_),
+          kernel_state_->emulator()->patcher()->applied_patches_hash()),
+      low_address_, high_address_);
+
+  // Functions resolved in previous sessions are the most likely to be needed
+  // soon, so they go first.
+  PrecompileKnownFunctions();
   PrecompileDiscoveredFunctions();
 }
 bool XexModule::Unload() {
@@ -1336,6 +1357,15 @@ bool XexModule::ContainsAddress(uint32_t address) {
   return address >= low_address_ && address < high_address_;
 }
 
+bool XexModule::GetAddressRange(uint32_t* out_low, uint32_t* out_high) {
+  if (low_address_ >= high_address_) {
+    return false;
+  }
+  *out_low = low_address_;
+  *out_high = high_address_;
+  return true;
+}
+
 std::unique_ptr<Function> XexModule::CreateFunction(uint32_t address) {
   return std::unique_ptr<Function>(
       processor_->backend()->CreateGuestFunction(this, address));
@@ -1353,6 +1383,7 @@ void XexInfoCache::Init(XexModule* xexmod) {
   infocache_path.append(xexmod->image_sha_str_);
 
   std::filesystem::create_directories(infocache_path);
+  function_starts_path_ = infocache_path / "function_starts.bin";
   infocache_path.append("executable_addr_flags.bin");
 
   unsigned num_codebytes = xexmod->high_address_ - xexmod->low_address_;
@@ -1390,6 +1421,67 @@ void XexInfoCache::Init(XexModule* xexmod) {
     }
   }
 }
+bool XexInfoCache::LoadFunctionStarts(uint64_t patch_hash,
+                                      uint32_t low_address,
+                                      uint32_t high_address,
+                                      std::vector<uint32_t>& starts_out) {
+  if (function_starts_path_.empty() || high_address < low_address) {
+    return false;
+  }
+  std::error_code ec;
+  uintmax_t file_size = std::filesystem::file_size(function_starts_path_, ec);
+  if (ec || file_size < sizeof(FunctionStartsHeader)) {
+    return false;
+  }
+  FILE* file = xe::filesystem::OpenFile(function_starts_path_, "rb");
+  if (!file) {
+    return false;
+  }
+  // The count must fit both the file and the image before anything is
+  // allocated for it.
+  FunctionStartsHeader header;
+  bool loaded = false;
+  if (fread(&header, sizeof(header), 1, file) &&
+      header.version == FunctionStartsHeader::kVersion &&
+      header.patch_hash == patch_hash &&
+      header.count <= (file_size - sizeof(header)) / sizeof(uint32_t) &&
+      header.count <= (high_address - low_address) / 4 + 1) {
+    starts_out.resize(header.count);
+    loaded = fread(starts_out.data(), sizeof(uint32_t), header.count, file) ==
+             header.count;
+  }
+  fclose(file);
+  if (loaded && !starts_out.empty()) {
+    loaded = std::is_sorted(starts_out.cbegin(), starts_out.cend()) &&
+             starts_out.front() >= low_address &&
+             starts_out.back() <= high_address;
+  }
+  if (!loaded) {
+    starts_out.clear();
+  }
+  return loaded;
+}
+
+void XexInfoCache::SaveFunctionStarts(uint64_t patch_hash,
+                                      const std::vector<uint32_t>& starts) {
+  if (function_starts_path_.empty()) {
+    return;
+  }
+  FILE* file = xe::filesystem::OpenFile(function_starts_path_, "wb");
+  if (!file) {
+    XELOGW("Failed to open {} for writing",
+           xe::path_to_utf8(function_starts_path_));
+    return;
+  }
+  FunctionStartsHeader header;
+  header.version = FunctionStartsHeader::kVersion;
+  header.count = uint32_t(starts.size());
+  header.patch_hash = patch_hash;
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(starts.data(), sizeof(uint32_t), starts.size(), file);
+  fclose(file);
+}
+
 InfoCacheFlags* XexModule::GetInstructionAddressFlags(uint32_t guest_addr) {
   if (guest_addr < low_address_ || guest_addr > high_address_) {
     return nullptr;
@@ -1405,6 +1497,8 @@ void XexModule::PrecompileDiscoveredFunctions() {
   }
   auto others = PreanalyzeCode();
 
+  std::vector<uint32_t> addresses;
+  addresses.reserve(others.size());
   for (auto&& other : others) {
     if (other < low_address_ || other >= high_address_) {
       continue;
@@ -1412,9 +1506,12 @@ void XexModule::PrecompileDiscoveredFunctions() {
     auto sym = processor_->LookupFunction(other);
 
     if (!sym || sym->status() != Symbol::Status::kDefined) {
-      processor_->ResolveFunction(other);
+      addresses.push_back(other);
     }
   }
+  // Translated in the background if enabled, so the title can start while
+  // this is going on.
+  processor_->compile_pool()->QueueFunctions(addresses);
 }
 void XexModule::PrecompileKnownFunctions() {
   if (!cvars::enable_early_precompilation) {
@@ -1426,6 +1523,7 @@ void XexModule::PrecompileKnownFunctions() {
   if (!flags) {
     return;
   }
+  std::vector<uint32_t> addresses;
   // maybe should pre-acquire global crit?
   for (uint32_t i = 0; i < end; i++) {
     if (flags[i].was_resolved) {
@@ -1433,10 +1531,11 @@ void XexModule::PrecompileKnownFunctions() {
       auto sym = processor_->LookupFunction(addr);
 
       if (!sym || sym->status() != Symbol::Status::kDefined) {
-        processor_->ResolveFunction(addr);
+        addresses.push_back(addr);
       }
     }
   }
+  processor_->compile_pool()->QueueFunctions(addresses);
 }
 
 static uint32_t GetBLCalledFunction(XexModule* xexmod, uint32_t current_base,
@@ -1453,7 +1552,127 @@ static bool IsOpcodeBL(unsigned w) {
   return (w >> (32 - 6)) == 18 && ppc::PPCOpcodeBits{w}.I.LK;
 }
 
+// Code words as they are in memory, loaded in host (little-endian) order.
+// mfspr r12, LR.
+constexpr uint32_t kPreanalyzeMfsprR12LR = 0xA602887D;
+constexpr uint32_t kPreanalyzeBlr = 0x2000804E;
+// The primary opcode (18) and the LK bit of bl.
+constexpr uint32_t kPreanalyzeBLMask = 0x010000FC;
+constexpr uint32_t kPreanalyzeBLBits = 0x01000048;
+
+// Scans words [begin, end) of the code at words (guest address base), with
+// begin and end even, appending possible function starts to starts_out.
+static void ScanFunctionStarts(XexModule* xexmod, const uint32_t* words,
+                               uint32_t base, size_t begin, size_t end,
+                               std::vector<uint32_t>& starts_out) {
+  uint32_t low_address, high_address;
+  xexmod->GetAddressRange(&low_address, &high_address);
+
+  // All functions seem to start on 8 byte boundaries, except for obvious ones
+  // like the save/rest funcs, either saving the link register or following
+  // the blr of the previous function and its padding.
+  // Originally this checked for a blr followed by 0, but some functions are
+  // actually aligned to greater boundaries. Something that appears to be
+  // longjmp (it occurs in most games, so standard library, and loads ctx, so
+  // longjmp) is aligned to 16 bytes in most games.
+  auto check_padded = [&](size_t i) {
+    size_t check = i - 2;
+    while (check && !words[check]) {
+      --check;
+    }
+    XE_LIKELY_IF(words[check] == kPreanalyzeBlr) {
+      starts_out.push_back(base + uint32_t(i) * 4);
+    }
+  };
+  // If there's a bl to an address, that address is the start of a function.
+  auto check_call = [&](size_t i) {
+    uint32_t call = xe::byte_swap(words[i]);
+    uint32_t call_address = base + uint32_t(i) * 4;
+    uint32_t called_function = GetBLCalledFunction(
+        xexmod, call_address, ppc::PPCOpcodeBits{call});
+    // Must be 8 byte aligned and in range.
+    if ((called_function & (8 - 1)) == 0 && called_function >= low_address &&
+        called_function < high_address) {
+      starts_out.push_back(called_function);
+    }
+  };
+  auto scan_scalar = [&](size_t i) {
+    if (!(i & 1)) {
+      if (words[i] == kPreanalyzeMfsprR12LR) {
+        starts_out.push_back(base + uint32_t(i) * 4);
+      } else if (i && !words[i - 1] && words[i]) {
+        check_padded(i);
+      }
+    }
+    if (IsOpcodeBL(xe::byte_swap(words[i]))) {
+      check_call(i);
+    }
+  };
+
+  size_t i = begin;
+#if XE_ARCH_AMD64
+  if (amd64::GetFeatureFlags() & amd64::kX64EmitAVX2) {
+    // The previous word is loaded for the padding check.
+    if (!i) {
+      for (; i < std::min(end, size_t(8)); ++i) {
+        scan_scalar(i);
+      }
+    }
+    const __m256i mfspr_r12_lr =
+        _mm256_set1_epi32(int32_t(kPreanalyzeMfsprR12LR));
+    const __m256i bl_mask = _mm256_set1_epi32(int32_t(kPreanalyzeBLMask));
+    const __m256i bl_bits = _mm256_set1_epi32(int32_t(kPreanalyzeBLBits));
+    const __m256i zero = _mm256_setzero_si256();
+    // Each bit of a mask is a word, only even words can start functions.
+    const uint32_t even_words = 0x55;
+    for (; i + 8 <= end; i += 8) {
+      __m256i code =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&words[i]));
+      __m256i previous =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&words[i - 1]));
+      uint32_t saves = uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(
+                           _mm256_cmpeq_epi32(code, mfspr_r12_lr)))) &
+                       even_words;
+      uint32_t zeros = uint32_t(_mm256_movemask_ps(
+          _mm256_castsi256_ps(_mm256_cmpeq_epi32(code, zero))));
+      uint32_t previous_zeros = uint32_t(_mm256_movemask_ps(
+          _mm256_castsi256_ps(_mm256_cmpeq_epi32(previous, zero))));
+      uint32_t padded = previous_zeros & ~zeros & ~saves & even_words;
+      uint32_t calls = uint32_t(_mm256_movemask_ps(
+          _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+              _mm256_and_si256(code, bl_mask), bl_bits))));
+      // Almost all vectors have nothing.
+      if (!(saves | padded | calls)) {
+        continue;
+      }
+      for (uint32_t bit = 0; bit < 8; ++bit) {
+        if (saves & (1 << bit)) {
+          starts_out.push_back(base + uint32_t(i + bit) * 4);
+        } else if (padded & (1 << bit)) {
+          check_padded(i + bit);
+        }
+        if (calls & (1 << bit)) {
+          check_call(i + bit);
+        }
+      }
+    }
+  }
+#endif  // XE_ARCH_AMD64
+  for (; i < end; ++i) {
+    scan_scalar(i);
+  }
+}
+
 std::vector<uint32_t> XexModule::PreanalyzeCode() {
+  // Patches may have added or removed code since the image was loaded.
+  uint64_t patch_hash =
+      kernel_state_->emulator()->patcher()->applied_patches_hash();
+  std::vector<uint32_t> result;
+  if (info_cache_.LoadFunctionStarts(patch_hash, low_address_, high_address_,
+                                     result)) {
+    return result;
+  }
+
   uint32_t low_8_aligned = xe::align<uint32_t>(low_address_, 8);
 
   uint32_t highest_exec_addr = 0;
@@ -1465,144 +1684,87 @@ std::vector<uint32_t> XexModule::PreanalyzeCode() {
     }
   }
   uint32_t high_8_aligned = highest_exec_addr & ~(8U - 1);
-  uint32_t n_possible_8byte_addresses = (high_8_aligned - low_8_aligned) / 8;
-  uint32_t* funcstart_candidate_stack =
-      new uint32_t[n_possible_8byte_addresses];
-  uint32_t* funcstart_candstack2 = new uint32_t[n_possible_8byte_addresses];
-
-  uint32_t stack_pos = 0;
-  {
-    // all functions seem to start on 8 byte boundaries, except for obvious ones
-    // like the save/rest funcs
-    uint32_t* range_start =
-        (uint32_t*)memory()->TranslateVirtual(low_8_aligned);
-    uint32_t* range_end = (uint32_t*)memory()->TranslateVirtual(
-        high_8_aligned);  // align down to multiple of 8
-
-    const uint8_t mfspr_r12_lr[4] = {0x7D, 0x88, 0x02, 0xA6};
-
-    // a blr instruction, with 4 zero bytes afterwards to pad the next address
-    // to 8 byte alignment
-    // if we see this prior to our address, we can assume we are a function
-    // start
-    const uint8_t blr[4] = {0x4E, 0x80, 0x0, 0x20};
-
-    uint32_t blr32 = *reinterpret_cast<const uint32_t*>(&blr[0]);
-
-    uint32_t mfspr_r12_lr32 =
-        *reinterpret_cast<const uint32_t*>(&mfspr_r12_lr[0]);
-
-    auto add_new_func = [funcstart_candidate_stack, &stack_pos](uint32_t addr) {
-      funcstart_candidate_stack[stack_pos++] = addr;
-    };
-    /*
-                First pass: detect save of the link register at an eight byte
-       aligned address
-        */
-    for (uint32_t* first_pass = range_start; first_pass < range_end;
-         first_pass += 2) {
-      if (*first_pass == mfspr_r12_lr32) {
-        // Push our newly discovered function start into our list
-        // All addresses in the list are sorted until the second pass
-        add_new_func(
-            static_cast<uint32_t>(reinterpret_cast<uintptr_t>(first_pass) -
-                                  reinterpret_cast<uintptr_t>(range_start)) +
-            low_8_aligned);
-      } else if (first_pass[-1] == 0 && *first_pass != 0) {
-        // originally i checked for blr followed by 0, but some functions are
-        // actually aligned to greater boundaries. something that appears to be
-        // longjmp (it occurs in most games, so standard library, and loads ctx,
-        // so longjmp) is aligned to 16 bytes in most games
-        uint32_t* check_iter = &first_pass[-2];
-
-        while (!*check_iter) {
-          --check_iter;
-        }
-
-        XE_LIKELY_IF(*check_iter == blr32) {
-          add_new_func(
-              static_cast<uint32_t>(reinterpret_cast<uintptr_t>(first_pass) -
-                                    reinterpret_cast<uintptr_t>(range_start)) +
-              low_8_aligned);
-        }
-      }
-    }
-    uint32_t current_guestaddr = low_8_aligned;
-    // Second pass: detect branch with link instructions and decode the target
-    // address. We can safely assume that if bl is to address, that address is
-    // the start of the function
-    for (uint32_t* second_pass = range_start; second_pass < range_end;
-         second_pass++, current_guestaddr += 4) {
-      uint32_t current_call = xe::byte_swap(*second_pass);
-
-      if (IsOpcodeBL(current_call)) {
-        uint32_t called_function = GetBLCalledFunction(
-            this, current_guestaddr, ppc::PPCOpcodeBits{current_call});
-        // must be 8 byte aligned and in range
-        if ((called_function & (8 - 1)) == 0 &&
-            called_function >= low_address_ &&
-            called_function < high_address_) {
-          add_new_func(called_function);
-        }
-      }
+  if (high_8_aligned <= low_8_aligned) {
+    return result;
+  }
+  auto words = reinterpret_cast<const uint32_t*>(
+      memory()->TranslateVirtual(low_8_aligned));
+  size_t word_count = (high_8_aligned - low_8_aligned) / 4;
+
+  // Split into chunks of whole vectors, scanned in parallel, but not so small
+  // that starting the threads costs more than the scan.
+  constexpr size_t kMinChunkWords = 256 * 1024;
+  size_t thread_count =
+      std::max(size_t(xe::threading::logical_processor_count()), size_t(1));
+  size_t chunk_count =
+      std::min(std::max(word_count / kMinChunkWords, size_t(1)), thread_count);
+  size_t chunk_words =
+      xe::align((word_count + chunk_count - 1) / chunk_count, size_t(8));
+  std::vector<std::vector<uint32_t>> chunk_starts(chunk_count);
+  auto scan_chunk = [&](size_t chunk) {
+    size_t begin = std::min(chunk * chunk_words, word_count);
+    size_t end = std::min(begin + chunk_words, word_count);
+    ScanFunctionStarts(this, words, low_8_aligned, begin, end,
+                       chunk_starts[chunk]);
+  };
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads;
+  for (size_t chunk = 1; chunk < chunk_count; ++chunk) {
+    auto thread = xe::threading::Thread::Create(
+        {}, [&scan_chunk, chunk]() { scan_chunk(chunk); });
+    if (thread) {
+      thread->set_name("Code Preanalysis");
+      threads.push_back(std::move(thread));
+    } else {
+      scan_chunk(chunk);
     }
+  }
+  scan_chunk(0);
+  for (auto& thread : threads) {
+    xe::threading::Wait(thread.get(), false);
+  }
 
-    auto pdata = this->GetPESection(".pdata");
-
-    if (pdata) {
-      uint32_t* pdata_base =
-          (uint32_t*)this->memory()->TranslateVirtual(pdata->address);
-
-      uint32_t n_pdata_entries = pdata->raw_size / 8;
-
-      for (uint32_t i = 0; i < n_pdata_entries; ++i) {
-        uint32_t funcaddr = xe::load_and_swap<uint32_t>(&pdata_base[i * 2]);
-        if (funcaddr >= low_address_ && funcaddr <= highest_exec_addr) {
-          add_new_func(funcaddr);
-        } else {
-          // we hit 0 for func addr, that means we're done
-          break;
-        }
-      }
-    }
+  size_t start_count = 0;
+  for (auto& starts : chunk_starts) {
+    start_count += starts.size();
+  }
+  result.reserve(start_count);
+  for (auto& starts : chunk_starts) {
+    result.insert(result.end(), starts.begin(), starts.end());
   }
 
-  // Sort the list of function starts and then ensure that all addresses are
-  // unique
-  uint32_t n_known_funcaddrs = 0;
-  {
-    // make addresses unique
+  auto pdata = this->GetPESection(".pdata");
 
-    std::sort(funcstart_candidate_stack, funcstart_candidate_stack + stack_pos);
+  if (pdata) {
+    uint32_t* pdata_base =
+        (uint32_t*)this->memory()->TranslateVirtual(pdata->address);
 
-    uint32_t read_pos = 0;
-    uint32_t write_pos = 0;
-    uint32_t previous_addr = ~0u;
-    while (read_pos < stack_pos) {
-      uint32_t current_addr = funcstart_candidate_stack[read_pos++];
+    uint32_t n_pdata_entries = pdata->raw_size / 8;
 
-      if (current_addr != previous_addr) {
-        previous_addr = current_addr;
-        funcstart_candstack2[write_pos++] = current_addr;
+    for (uint32_t i = 0; i < n_pdata_entries; ++i) {
+      uint32_t funcaddr = xe::load_and_swap<uint32_t>(&pdata_base[i * 2]);
+      if (funcaddr >= low_address_ && funcaddr <= highest_exec_addr) {
+        result.push_back(funcaddr);
+      } else {
+        // we hit 0 for func addr, that means we're done
+        break;
       }
     }
-    n_known_funcaddrs = write_pos;
   }
 
-  delete[] funcstart_candidate_stack;
+  // Sort the list of function starts and then ensure that all addresses are
+  // unique
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  result.shrink_to_fit();
 
-  std::vector<uint32_t> result;
-  result.resize(n_known_funcaddrs);
-  memcpy(&result[0], funcstart_candstack2,
-         sizeof(uint32_t) * n_known_funcaddrs);
-  delete[] funcstart_candstack2;
+  info_cache_.SaveFunctionStarts(patch_hash, result);
   return result;
 }
+
 bool XexModule::FindSaveRest() {
   // Special stack save/restore functions.
   // http://research.microsoft.com/en-us/um/redmond/projects/invisible/src/crt/md/ppc/xxx.s.htm
-  // It'd be nice to stash these away and mark them as such to allow for
-  // special codegen.
+  // These are marked with Function::SetSaverest for special codegen.
   // __savegprlr_14 to __savegprlr_31
   // __restgprlr_14 to __restgprlr_31
   static const uint32_t gprlr_code_values[] = {
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_XEX_MODULE_H_
 #define XENIA_CPU_XEX_MODULE_H_
 
+#include <filesystem>
 #include <string>
 #include <vector>
 #include "xenia/base/mapped_memory.h"
@@ -55,12 +56,32 @@ struct XexInfoCache {
       return &reinterpret_cast<InfoCacheFlags*>(&this[1])[offset];
     }
   };
+  struct FunctionStartsHeader {
+    // Increment when the heuristics of XexModule::PreanalyzeCode change.
+    static constexpr uint32_t kVersion = 2;
+
+    uint32_t version;
+    uint32_t count;
+    // Of the patches applied to the code when it was scanned, see
+    // patcher::Patcher::applied_patches_hash.
+    uint64_t patch_hash;
+  };
   /*
         for every 4-byte aligned address, records a 4 byte set of flags.
   */
   std::unique_ptr<MappedMemory> executable_addr_flags_;
+  // Sorted function starts found by XexModule::PreanalyzeCode, so the code
+  // doesn't have to be scanned again on later boots. Empty if disabled.
+  std::filesystem::path function_starts_path_;
 
   void Init(class XexModule*);
+  // Only loads starts within [low_address, high_address] found with the same
+  // patches applied.
+  bool LoadFunctionStarts(uint64_t patch_hash, uint32_t low_address,
+                          uint32_t high_address,
+                          std::vector<uint32_t>& starts_out);
+  void SaveFunctionStarts(uint64_t patch_hash,
+                          const std::vector<uint32_t>& starts);
   InfoCacheFlagsHeader* GetHeader() {
     if (!executable_addr_flags_) {
       return nullptr;
@@ -205,6 +226,7 @@ class XexModule : public xe::cpu::Module {
   bool Unload();
 
   bool ContainsAddress(uint32_t address) override;
+  bool GetAddressRange(uint32_t* out_low, uint32_t* out_high) override;
 
   const std::string& name() const override { return name_; }
   bool is_executable() const override {
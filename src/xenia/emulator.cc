@@ -32,6 +32,7 @@
 #include "xenia/base/string.h"
 #include "xenia/base/system.h"
 #include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/backend/interpreter/interpreter_backend.h"
 #include "xenia/cpu/backend/null_backend.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/thread_state.h"
@@ -213,10 +214,15 @@ X_STATUS Emulator::Setup(
     backend.reset(new xe::cpu::backend::x64::X64Backend());
   }
 #endif  // XE_ARCH
+  if (cvars::cpu == "interpreter") {
+    backend.reset(new xe::cpu::backend::interpreter::InterpreterBackend());
+  }
   if (cvars::cpu == "any") {
     if (!backend) {
 #if XE_ARCH_AMD64
       backend.reset(new xe::cpu::backend::x64::X64Backend());
+#else
+      backend.reset(new xe::cpu::backend::interpreter::InterpreterBackend());
 #endif  // XE_ARCH
     }
   }
@@ -938,8 +944,6 @@ bool Emulator::ExceptionCallbackThunk(Exception* ex, void* data) {
 bool Emulator::ExceptionCallback(Exception* ex) {
   // Check to see if the exception occurred in guest code.
   auto code_cache = processor()->backend()->code_cache();
-  auto code_base = code_cache->execute_base_address();
-  auto code_end = code_base + code_cache->total_size();
 
   if (!processor()->is_debugger_attached() && debugging::IsDebuggerAttached()) {
     // If Xenia's debugger isn't attached but another one is, pass it to that
@@ -951,6 +955,12 @@ bool Emulator::ExceptionCallback(Exception* ex) {
     return processor()->OnUnhandledException(ex);
   }
 
+  // The interpreter runs guest code without a code cache.
+  if (!code_cache) {
+    return false;
+  }
+  auto code_base = code_cache->execute_base_address();
+  auto code_end = code_base + code_cache->total_size();
   if (!(ex->pc() >= code_base && ex->pc() < code_end)) {
     // Didn't occur in guest code. Let it pass.
     return false;
@@ -18,6 +18,7 @@
 #include "xenia/base/logging.h"
 #include "xenia/base/string.h"
 #include "xenia/base/threading.h"
+#include "xenia/cpu/ppc/ppc_hir_builder.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/user_module.h"
 #include "xenia/kernel/util/shim_utils.h"
@@ -683,6 +684,69 @@ void RtlLeaveCriticalSection_entry(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
 DECLARE_XBOXKRNL_EXPORT2(RtlLeaveCriticalSection, kNone, kImplemented,
                          kHighFrequency);
 
+static cpu::hir::Value* CriticalSectionFieldAddress(cpu::ppc::PPCHIRBuilder& f,
+                                                    size_t offset) {
+  return f.Add(LoadIntrinsicAddressGPR(f, 3), f.LoadConstantUint64(offset));
+}
+
+// A big-endian 1 for the recursion count, as stored.
+static constexpr int32_t kCriticalSectionRecursionOne = 0x01000000;
+
+// Takes a critical section nobody holds. Recursion, spinning and waiting are
+// left to the shim.
+static void RtlEnterCriticalSection_intrinsic(cpu::ppc::PPCHIRBuilder& f,
+                                              cpu::hir::Label* slow_path) {
+  f.BranchFalse(f.Truncate(f.LoadGPR(3), cpu::hir::INT32_TYPE), slow_path);
+  auto acquired = f.AtomicCompareExchange(
+      CriticalSectionFieldAddress(f,
+                                  offsetof(X_RTL_CRITICAL_SECTION, lock_count)),
+      f.LoadConstantInt32(-1), f.LoadZeroInt32());
+  f.BranchFalse(acquired, slow_path);
+  f.Store(CriticalSectionFieldAddress(
+              f, offsetof(X_RTL_CRITICAL_SECTION, owning_thread)),
+          LoadIntrinsicCurrentThread(f));
+  f.Store(CriticalSectionFieldAddress(
+              f, offsetof(X_RTL_CRITICAL_SECTION, recursion_count)),
+          f.LoadConstantInt32(kCriticalSectionRecursionOne));
+}
+
+// Releases the last recursion of a critical section nobody waits for. Waking
+// a waiter is left to the shim.
+static void RtlLeaveCriticalSection_intrinsic(cpu::ppc::PPCHIRBuilder& f,
+                                              cpu::hir::Label* slow_path) {
+  f.BranchFalse(f.Truncate(f.LoadGPR(3), cpu::hir::INT32_TYPE), slow_path);
+  auto recursion_count =
+      f.Load(CriticalSectionFieldAddress(
+                 f, offsetof(X_RTL_CRITICAL_SECTION, recursion_count)),
+             cpu::hir::INT32_TYPE);
+  f.BranchFalse(
+      f.CompareEQ(recursion_count,
+                  f.LoadConstantInt32(kCriticalSectionRecursionOne)),
+      slow_path);
+  f.Store(CriticalSectionFieldAddress(
+              f, offsetof(X_RTL_CRITICAL_SECTION, owning_thread)),
+          f.LoadZeroInt32());
+  f.Store(CriticalSectionFieldAddress(
+              f, offsetof(X_RTL_CRITICAL_SECTION, recursion_count)),
+          f.LoadZeroInt32());
+  auto released = f.AtomicCompareExchange(
+      CriticalSectionFieldAddress(f,
+                                  offsetof(X_RTL_CRITICAL_SECTION, lock_count)),
+      f.LoadZeroInt32(), f.LoadConstantInt32(-1));
+  auto end = f.NewLabel();
+  f.BranchTrue(released, end);
+  // There are waiters, so nobody else can have taken the lock, and it can be
+  // given back for the shim to release.
+  f.Store(CriticalSectionFieldAddress(
+              f, offsetof(X_RTL_CRITICAL_SECTION, owning_thread)),
+          LoadIntrinsicCurrentThread(f));
+  f.Store(CriticalSectionFieldAddress(
+              f, offsetof(X_RTL_CRITICAL_SECTION, recursion_count)),
+          f.LoadConstantInt32(kCriticalSectionRecursionOne));
+  f.Branch(slow_path);
+  f.MarkLabel(end);
+}
+
 struct X_TIME_FIELDS {
   xe::be<uint16_t> year;
   xe::be<uint16_t> month;
@@ -855,8 +919,16 @@ void RtlGetStackLimits_entry(lpdword_t out_end, lpdword_t out_base,
 }
 DECLARE_XBOXKRNL_EXPORT1(RtlGetStackLimits, kNone, kImplemented);
 
+void RegisterRtlExports(xe::cpu::ExportResolver* export_resolver,
+                        KernelState* kernel_state) {
+  export_resolver->SetFunctionIntrinsic("xboxkrnl.exe",
+                                        ordinals::RtlEnterCriticalSection,
+                                        RtlEnterCriticalSection_intrinsic);
+  export_resolver->SetFunctionIntrinsic("xboxkrnl.exe",
+                                        ordinals::RtlLeaveCriticalSection,
+                                        RtlLeaveCriticalSection_intrinsic);
+}
+
 }  // namespace xboxkrnl
 }  // namespace kernel
 }  // namespace xe
-
-DECLARE_XBOXKRNL_EMPTY_REGISTER_EXPORTS(Rtl);
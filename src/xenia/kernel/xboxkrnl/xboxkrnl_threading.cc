@@ -14,6 +14,7 @@
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/mutex.h"
+#include "xenia/cpu/ppc/ppc_hir_builder.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/user_module.h"
@@ -390,6 +391,37 @@ dword_result_t KeGetCurrentProcessType_entry(const ppc_context_t& context) {
 DECLARE_XBOXKRNL_EXPORT2(KeGetCurrentProcessType, kThreading, kImplemented,
                          kHighFrequency);
 
+cpu::hir::Value* LoadIntrinsicAddressGPR(cpu::ppc::PPCHIRBuilder& f,
+                                         uint32_t reg) {
+  return f.ZeroExtend(f.Truncate(f.LoadGPR(reg), cpu::hir::INT32_TYPE),
+                      cpu::hir::INT64_TYPE);
+}
+
+cpu::hir::Value* LoadIntrinsicCurrentThread(cpu::ppc::PPCHIRBuilder& f) {
+  auto pcr = LoadIntrinsicAddressGPR(f, 13);
+  return f.Load(f.Add(pcr, f.LoadConstantUint64(
+                               offsetof(X_KPCR, prcb_data) +
+                               offsetof(X_KPRCB, current_thread))),
+                cpu::hir::INT32_TYPE);
+}
+
+// The thread's own process type, outside of DPCs.
+static void KeGetCurrentProcessType_intrinsic(cpu::ppc::PPCHIRBuilder& f,
+                                              cpu::hir::Label* slow_path) {
+  auto pcr = LoadIntrinsicAddressGPR(f, 13);
+  auto dpc_active = f.Load(
+      f.Add(pcr, f.LoadConstantUint64(offsetof(X_KPCR, prcb_data) +
+                                      offsetof(X_KPRCB, dpc_active))),
+      cpu::hir::INT32_TYPE);
+  f.BranchTrue(dpc_active, slow_path);
+  auto thread = f.ZeroExtend(f.ByteSwap(LoadIntrinsicCurrentThread(f)),
+                             cpu::hir::INT64_TYPE);
+  auto process_type = f.Load(
+      f.Add(thread, f.LoadConstantUint64(offsetof(X_KTHREAD, process_type))),
+      cpu::hir::INT8_TYPE);
+  f.StoreGPR(3, f.ZeroExtend(process_type, cpu::hir::INT64_TYPE));
+}
+
 void KeSetCurrentProcessType_entry(dword_t type, const ppc_context_t& context) {
   xeKeSetCurrentProcessType(type, context);
 }
@@ -507,6 +539,67 @@ dword_result_t KeTlsSetValue_entry(dword_t tls_index, dword_t tls_value) {
 }
 DECLARE_XBOXKRNL_EXPORT1(KeTlsSetValue, kThreading, kImplemented);
 
+// The dynamic slots follow the extended TLS data of the executable, see
+// XThread::Create. Returns false if the layout isn't known yet.
+static bool GetTlsSlotLayout(uint32_t* out_slot_count,
+                             uint32_t* out_extended_size) {
+  auto module = kernel_state()->GetExecutableModule();
+  if (!module) {
+    return false;
+  }
+  xex2_opt_tls_info* tls_header = nullptr;
+  module->GetOptHeader(XEX_HEADER_TLS_INFO, &tls_header);
+  *out_slot_count = 1024;
+  *out_extended_size = 0;
+  if (tls_header && tls_header->slot_count) {
+    *out_slot_count = tls_header->slot_count;
+    *out_extended_size = tls_header->data_size;
+  }
+  return true;
+}
+
+// Address of the slot in r3, or a branch to slow_path if it's out of range.
+static cpu::hir::Value* EmitTlsSlotAddress(cpu::ppc::PPCHIRBuilder& f,
+                                           cpu::hir::Label* slow_path) {
+  uint32_t slot_count, extended_size;
+  if (!GetTlsSlotLayout(&slot_count, &extended_size)) {
+    f.Branch(slow_path);
+    return nullptr;
+  }
+  f.BranchFalse(f.CompareULT(f.Truncate(f.LoadGPR(3), cpu::hir::INT32_TYPE),
+                             f.LoadConstantUint32(slot_count)),
+                slow_path);
+  auto pcr = LoadIntrinsicAddressGPR(f, 13);
+  auto tls = f.ZeroExtend(
+      f.ByteSwap(f.Load(
+          f.Add(pcr, f.LoadConstantUint64(offsetof(X_KPCR, tls_ptr))),
+          cpu::hir::INT32_TYPE)),
+      cpu::hir::INT64_TYPE);
+  auto slot_offset = f.Shl(LoadIntrinsicAddressGPR(f, 3), int8_t(2));
+  return f.Add(f.Add(tls, f.LoadConstantUint64(extended_size)), slot_offset);
+}
+
+static void KeTlsGetValue_intrinsic(cpu::ppc::PPCHIRBuilder& f,
+                                    cpu::hir::Label* slow_path) {
+  auto address = EmitTlsSlotAddress(f, slow_path);
+  if (!address) {
+    return;
+  }
+  f.StoreGPR(3, f.ZeroExtend(f.ByteSwap(f.Load(address, cpu::hir::INT32_TYPE)),
+                             cpu::hir::INT64_TYPE));
+}
+
+static void KeTlsSetValue_intrinsic(cpu::ppc::PPCHIRBuilder& f,
+                                    cpu::hir::Label* slow_path) {
+  auto address = EmitTlsSlotAddress(f, slow_path);
+  if (!address) {
+    return;
+  }
+  f.Store(address,
+          f.ByteSwap(f.Truncate(f.LoadGPR(4), cpu::hir::INT32_TYPE)));
+  f.StoreGPR(3, f.LoadConstantUint64(1));
+}
+
 void KeInitializeEvent_entry(pointer_t<X_KEVENT> event_ptr, dword_t event_type,
                              dword_t initial_state) {
   event_ptr.Zero();
@@ -1736,6 +1829,36 @@ pointer_result_t InterlockedPushEntrySList_entry(
 DECLARE_XBOXKRNL_EXPORT2(InterlockedPushEntrySList, kThreading, kImplemented,
                          kHighFrequency);
 
+// One attempt at the compare exchange, the shim retries if the list changed.
+static void InterlockedPushEntrySList_intrinsic(cpu::ppc::PPCHIRBuilder& f,
+                                                cpu::hir::Label* slow_path) {
+  using cpu::hir::INT32_TYPE;
+  using cpu::hir::INT64_TYPE;
+  auto plist = LoadIntrinsicAddressGPR(f, 3);
+  auto entry = LoadIntrinsicAddressGPR(f, 4);
+  // Swapped, the header is next << 32 | depth << 16 | sequence.
+  auto old_raw = f.Load(plist, INT64_TYPE);
+  auto old_header = f.ByteSwap(old_raw);
+  auto old_head = f.Truncate(f.Shr(old_header, int8_t(32)), INT32_TYPE);
+  f.Store(f.Add(entry, f.LoadConstantUint64(offsetof(X_SINGLE_LIST_ENTRY,
+                                                      next))),
+          f.ByteSwap(old_head));
+  auto old_depth_sequence = f.Truncate(old_header, INT32_TYPE);
+  auto depth_sequence = f.Or(
+      f.And(f.Add(old_depth_sequence, f.LoadConstantUint32(0x10000)),
+            f.LoadConstantUint32(0xFFFF0000)),
+      f.And(f.Add(old_depth_sequence, f.LoadConstantUint32(1)),
+            f.LoadConstantUint32(0xFFFF)));
+  auto new_header =
+      f.Or(f.Shl(entry, int8_t(32)), f.ZeroExtend(depth_sequence, INT64_TYPE));
+  auto pushed =
+      f.AtomicCompareExchange(plist, old_raw, f.ByteSwap(new_header));
+  // r3 is still the argument for the shim if the list changed.
+  f.StoreGPR(3, f.Select(pushed, f.ZeroExtend(old_head, INT64_TYPE),
+                         f.LoadGPR(3)));
+  f.BranchFalse(pushed, slow_path);
+}
+
 pointer_result_t InterlockedPopEntrySList_entry(
     pointer_t<X_SLIST_HEADER> plist_ptr) {
   assert_not_null(plist_ptr);
@@ -1785,8 +1908,20 @@ pointer_result_t InterlockedFlushSList_entry(
 }
 DECLARE_XBOXKRNL_EXPORT1(InterlockedFlushSList, kThreading, kImplemented);
 
+void RegisterThreadingExports(xe::cpu::ExportResolver* export_resolver,
+                              KernelState* kernel_state) {
+  export_resolver->SetFunctionIntrinsic("xboxkrnl.exe",
+                                        ordinals::KeGetCurrentProcessType,
+                                        KeGetCurrentProcessType_intrinsic);
+  export_resolver->SetFunctionIntrinsic(
+      "xboxkrnl.exe", ordinals::KeTlsGetValue, KeTlsGetValue_intrinsic);
+  export_resolver->SetFunctionIntrinsic(
+      "xboxkrnl.exe", ordinals::KeTlsSetValue, KeTlsSetValue_intrinsic);
+  export_resolver->SetFunctionIntrinsic("xboxkrnl.exe",
+                                        ordinals::InterlockedPushEntrySList,
+                                        InterlockedPushEntrySList_intrinsic);
+}
+
 }  // namespace xboxkrnl
 }  // namespace kernel
 }  // namespace xe
-
-DECLARE_XBOXKRNL_EMPTY_REGISTER_EXPORTS(Threading);
@@ -13,6 +13,17 @@
 #include "xenia/kernel/util/shim_utils.h"
 #include "xenia/xbox.h"
 
+namespace xe {
+namespace cpu {
+namespace hir {
+class Value;
+}  // namespace hir
+namespace ppc {
+class PPCHIRBuilder;
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
+
 namespace xe {
 namespace kernel {
 struct X_KEVENT;
@@ -73,6 +84,13 @@ X_STATUS xeProcessUserApcs(PPCContext* ctx);
 void xeRundownApcs(PPCContext* ctx);
 uint32_t xeKeGetCurrentProcessType(PPCContext* context);
 void xeKeSetCurrentProcessType(uint32_t type, PPCContext* context);
+
+// For export intrinsics, see cpu::ExportIntrinsic.
+// Guest address in the low 32 bits of a GPR, as a 64-bit value.
+cpu::hir::Value* LoadIntrinsicAddressGPR(cpu::ppc::PPCHIRBuilder& f,
+                                         uint32_t reg);
+// Address of the current X_KTHREAD from the PCR in r13, still big-endian.
+cpu::hir::Value* LoadIntrinsicCurrentThread(cpu::ppc::PPCHIRBuilder& f);
 }  // namespace xboxkrnl
 }  // namespace kernel
 }  // namespace xe
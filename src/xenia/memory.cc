@@ -316,6 +316,8 @@ void Memory::Reset() {
   heaps_.v80000000.Reset();
   heaps_.v90000000.Reset();
   heaps_.physical.Reset();
+  // Protection of the heaps is reset.
+  code_watch_bits_.clear();
 }
 // clang does not like non-standard layout offsetof
 #if XE_COMPILER_MSVC == 1 && XE_COMPILER_CLANG_CL == 0
@@ -519,6 +521,9 @@ bool Memory::AccessViolationCallback(
     return false;
   }
   uint32_t virtual_address = HostToGuestVirtual(host_address);
+  if (is_write && virtual_address - kCodeWatchBase < kCodeWatchSize) {
+    return TriggerCodeWriteCallback(virtual_address);
+  }
   BaseHeap* heap = LookupHeap(virtual_address);
   if (heap->heap_type() != HeapType::kGuestPhysical) {
     return false;
@@ -541,6 +546,110 @@ bool Memory::AccessViolationCallbackThunk(
       std::move(global_lock_locked_once), host_address, is_write);
 }
 
+void Memory::SetCodeWriteCallback(CodeWriteCallback callback,
+                                  void* context) {
+  auto global_lock = global_critical_region_.Acquire();
+  code_write_callback_ = callback;
+  code_write_callback_context_ = context;
+}
+
+void Memory::WatchCodePages(uint32_t virtual_address, uint32_t length) {
+  if (!length || virtual_address - kCodeWatchBase >= kCodeWatchSize) {
+    return;
+  }
+  length = std::min(length, kCodeWatchBase + kCodeWatchSize - virtual_address);
+  uint32_t page_shift = xe::log2_floor(system_page_size_);
+  uint32_t first_page = (virtual_address - kCodeWatchBase) >> page_shift;
+  uint32_t last_page =
+      (virtual_address + length - 1 - kCodeWatchBase) >> page_shift;
+
+  auto global_lock = global_critical_region_.Acquire();
+  if (!code_write_callback_) {
+    return;
+  }
+  if (code_watch_bits_.empty()) {
+    code_watch_bits_.resize(((kCodeWatchSize >> page_shift) + 63) / 64);
+  }
+  for (uint32_t page = first_page; page <= last_page; ++page) {
+    uint64_t& bits = code_watch_bits_[page >> 6];
+    uint64_t bit = uint64_t(1) << (page & 63);
+    if (bits & bit) {
+      continue;
+    }
+    uint32_t page_address = kCodeWatchBase + (page << page_shift);
+    uint32_t page_end = page_address + system_page_size_ - 1;
+    BaseHeap* heap = LookupHeap(page_address);
+    if (!heap || heap->QueryRangeAccess(page_address, page_end) !=
+                     xe::memory::PageAccess::kReadWrite) {
+      // Writes already fault for the guest.
+      continue;
+    }
+    if (xe::memory::Protect(TranslateVirtual(page_address), system_page_size_,
+                            xe::memory::PageAccess::kReadOnly, nullptr)) {
+      bits |= bit;
+    }
+  }
+}
+
+bool Memory::TriggerCodeWriteCallback(uint32_t virtual_address) {
+  uint32_t page_shift = xe::log2_floor(system_page_size_);
+  uint32_t page = (virtual_address - kCodeWatchBase) >> page_shift;
+  if (code_watch_bits_.empty() ||
+      !(code_watch_bits_[page >> 6] & (uint64_t(1) << (page & 63)))) {
+    return false;
+  }
+  code_watch_bits_[page >> 6] &= ~(uint64_t(1) << (page & 63));
+  uint32_t page_address = kCodeWatchBase + (page << page_shift);
+  uint32_t page_end = page_address + system_page_size_ - 1;
+  xe::memory::Protect(
+      TranslateVirtual(page_address), system_page_size_,
+      LookupHeap(page_address)->QueryRangeAccess(page_address, page_end),
+      nullptr);
+  if (code_write_callback_) {
+    code_write_callback_(code_write_callback_context_, page_address,
+                         system_page_size_);
+  }
+  return true;
+}
+
+void Memory::UpdateCodeWatches(uint32_t virtual_address, uint32_t length,
+                               bool freed) {
+  if (code_watch_bits_.empty() || !length ||
+      virtual_address - kCodeWatchBase >= kCodeWatchSize) {
+    return;
+  }
+  length = std::min(length, kCodeWatchBase + kCodeWatchSize - virtual_address);
+  uint32_t page_shift = xe::log2_floor(system_page_size_);
+  uint32_t first_page = (virtual_address - kCodeWatchBase) >> page_shift;
+  uint32_t last_page =
+      (virtual_address + length - 1 - kCodeWatchBase) >> page_shift;
+  for (uint32_t page = first_page; page <= last_page; ++page) {
+    uint64_t& bits = code_watch_bits_[page >> 6];
+    uint64_t bit = uint64_t(1) << (page & 63);
+    if (!(bits & bit)) {
+      continue;
+    }
+    uint32_t page_address = kCodeWatchBase + (page << page_shift);
+    uint32_t page_end = page_address + system_page_size_ - 1;
+    xe::memory::PageAccess access =
+        LookupHeap(page_address)->QueryRangeAccess(page_address, page_end);
+    if (freed) {
+      bits &= ~bit;
+      xe::memory::Protect(TranslateVirtual(page_address), system_page_size_,
+                          access, nullptr);
+      if (code_write_callback_) {
+        code_write_callback_(code_write_callback_context_, page_address,
+                             system_page_size_);
+      }
+    } else if (access == xe::memory::PageAccess::kReadWrite) {
+      // Pages the guest can't write to keep its protection and stay watched,
+      // so they're protected again once it can.
+      xe::memory::Protect(TranslateVirtual(page_address), system_page_size_,
+                          xe::memory::PageAccess::kReadOnly, nullptr);
+    }
+  }
+}
+
 bool Memory::TriggerPhysicalMemoryCallbacks(
     global_unique_lock_type global_lock_locked_once, uint32_t virtual_address,
     uint32_t length, bool is_write, bool unwatch_exact_range, bool unprotect) {
@@ -941,6 +1050,11 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     auto alloc_type = (allocation_type & kMemoryAllocationCommit)
                           ? xe::memory::AllocationType::kCommit
                           : xe::memory::AllocationType::kReserve;
+    bool scribble = cvars::scribble_heap && (protect & kMemoryProtectWrite);
+    if (scribble) {
+      // Overwrites committed code without faulting.
+      memory_->UpdateCodeWatches(base_address, page_count * page_size_, true);
+    }
     void* result = xe::memory::AllocFixed(
         TranslateRelative(start_page_number * page_size_),
         page_count * page_size_, alloc_type, ToPageAccess(protect));
@@ -949,7 +1063,7 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
       return false;
     }
 
-    if (cvars::scribble_heap && protect & kMemoryProtectWrite) {
+    if (scribble) {
       std::memset(result, 0xCD, page_count * page_size_);
     }
   }
@@ -970,6 +1084,8 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     }
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  // Committing pages again gives them the guest's protection on the host.
+  memory_->UpdateCodeWatches(base_address, page_count * page_size_, false);
 
   return true;
 }
@@ -1160,6 +1276,10 @@ bool BaseHeap::Decommit(uint32_t address, uint32_t size) {
 
   auto global_lock = global_critical_region_.Acquire();
 
+  memory_->UpdateCodeWatches(
+      heap_base_ + start_page_number * page_size_,
+      (end_page_number - start_page_number + 1) * page_size_, true);
+
   // Release from host.
   // TODO(benvanik): find a way to actually decommit memory;
   //     mapped memory cannot be decommitted.
@@ -1201,6 +1321,10 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     *out_region_size = (base_page_entry.region_page_count * page_size_);
   }
 
+  memory_->UpdateCodeWatches(heap_base_ + base_page_number * page_size_,
+                             base_page_entry.region_page_count * page_size_,
+                             true);
+
   // Release from host not needed as mapping reserves the range for us.
   // TODO(benvanik): protect with NOACCESS?
   /*BOOL result = VirtualFree(
@@ -1326,6 +1450,9 @@ bool BaseHeap::Protect(uint32_t address, uint32_t size, uint32_t protect,
     auto& page_entry = page_table_[page_number];
     page_entry.current_protect = protect;
   }
+  memory_->UpdateCodeWatches(
+      heap_base_ + (start_page_number << page_size_shift_),
+      page_count << page_size_shift_, false);
 
   return true;
 }
@@ -503,6 +503,18 @@ class Memory {
       uint32_t length, bool is_write, bool unwatch_exact_range,
       bool unprotect = true);
 
+  // Code write watches: host pages of guest-writable code in the XEX heaps
+  // (0x80000000-0x9FFFFFFF) can be protected, so the first write to each
+  // makes it writable again and is reported to the code write callback, with
+  // the global critical region locked, for invalidating code translated from
+  // it. Pages that the guest can't write to are not watched.
+  typedef void (*CodeWriteCallback)(void* context, uint32_t virtual_address,
+                                    uint32_t length);
+  void SetCodeWriteCallback(CodeWriteCallback callback, void* context);
+  // Watches the host pages of [virtual_address, virtual_address + length)
+  // until they're written to.
+  void WatchCodePages(uint32_t virtual_address, uint32_t length);
+
   // Allocates virtual memory from the 'system' heap.
   // System memory is kept separate from game memory but is still accessible
   // using normal guest virtual addresses. Kernel structures and other internal
@@ -554,6 +566,19 @@ class Memory {
   static bool AccessViolationCallbackThunk(
       global_unique_lock_type global_lock_locked_once, void* context,
       void* host_address, bool is_write);
+  // Must be called with the global critical region locked.
+  bool TriggerCodeWriteCallback(uint32_t virtual_address);
+  // Called by the heaps with the global critical region locked when the guest
+  // changes pages within the range, as the host protection of watched pages
+  // is replaced. Without freed, after the change, watched pages the guest can
+  // still write to are protected again. With freed, before pages are released
+  // or decommitted, watched pages stop being watched and are reported to the
+  // code write callback, as their code is gone.
+  void UpdateCodeWatches(uint32_t virtual_address, uint32_t length,
+                         bool freed);
+
+  static constexpr uint32_t kCodeWatchBase = 0x80000000;
+  static constexpr uint32_t kCodeWatchSize = 0x20000000;
 
   std::filesystem::path file_name_;
   uint32_t system_page_size_ = 0;
@@ -599,6 +624,13 @@ class Memory {
   xe::global_critical_region global_critical_region_;
   std::vector<std::pair<PhysicalMemoryInvalidationCallback, void*>*>
       physical_memory_invalidation_callbacks_;
+
+  // Protected with global_critical_region_.
+  CodeWriteCallback code_write_callback_ = nullptr;
+  void* code_write_callback_context_ = nullptr;
+  // One bit per watched host page from kCodeWatchBase, allocated on the first
+  // watch.
+  std::vector<uint64_t> code_watch_bits_;
 };
 
 }  // namespace xe
@@ -9,6 +9,7 @@
 #include <cstring>
 
 #include "xenia/base/logging.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/patcher/patcher.h"
 
 namespace xe {
@@ -58,6 +59,12 @@ void Patcher::ApplyPatch(Memory* memory, const PatchInfoEntry* patch) {
                   (uint32_t)patch_data_entry.data.alloc_size,
                   old_address_protect);
 
+    applied_patches_hash_ = XXH3_64bits_withSeed(
+        &patch_data_entry.address, sizeof(patch_data_entry.address),
+        applied_patches_hash_);
+    applied_patches_hash_ = XXH3_64bits_withSeed(
+        patch_data_entry.data.patch_data.data(),
+        patch_data_entry.data.alloc_size, applied_patches_hash_);
     is_any_patch_applied_ = true;
   }
 }
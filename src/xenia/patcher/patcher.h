@@ -25,10 +25,14 @@ class Patcher {
                             const std::optional<uint64_t> hash);
 
   bool IsAnyPatchApplied() { return is_any_patch_applied_; }
+  // Of the addresses and data of all patches applied so far, for caches of
+  // anything derived from guest memory.
+  uint64_t applied_patches_hash() const { return applied_patches_hash_; }
 
  private:
   PatchDB* patch_db_;
   bool is_any_patch_applied_;
+  uint64_t applied_patches_hash_ = 0;
 };
 
 }  // namespace patcher